@@ -33,6 +33,8 @@
 #include "settings.h"
 #include "url.h"
 #include "checkmedia.h"
+#include "netlink.h"
+#include "console.h"
 
 static int driver_is_active(hd_t *hd);
 static void auto2_progress(char *pos, char *msg);
@@ -329,6 +331,9 @@ void auto2_scan_hardware()
   if(!storage_loaded) load_drivers(hd_data, hw_storage_ctrl);
   load_drivers(hd_data, hw_network_ctrl);
 
+  /* watch link state while we go on */
+  nl_link_watch();
+
   hd_free_hd_data(hd_data);
   free(hd_data);
 
@@ -604,12 +609,16 @@ int auto2_find_repo()
   if(!err) auto2_read_repo_files(config.url.install);
 
   if(err) {
+    url_prefetch_clear();
     log_info("no %s repository found\n", config.product);
     return 0;
   }
 
   auto2_driverupdate(config.url.install);
 
+  /* drop prefetched files nobody asked for */
+  url_prefetch_clear();
+
   util_do_driver_updates();
 
   return config.sig_failed ? 0: 1;
@@ -740,6 +749,8 @@ void load_network_mods()
 
   load_drivers(hd_data, hw_network_ctrl);
 
+  nl_link_watch();
+
   hd_free_hd_data(hd_data);
   free(hd_data);
 }
@@ -807,9 +818,7 @@ void load_drivers(hd_data_t *hd_data, hd_hw_item_t hw_item)
  */
 void auto2_progress(char *pos, char *msg)
 {
-  printf("\r%64s\r", "");
-  printf("> %s: %s", pos, msg);
-  fflush(stdout);
+  con_progress(stdout, "\r%64s\r> %s: %s", "", pos, msg);
 }
 
 
@@ -0,0 +1,189 @@
+/*
+ * Known answer tests for the signature checks in pgp.c.
+ *
+ * Ed25519: test vectors 1 - 3 from RFC 8032, section 7.1.
+ * RSA: a PKCS#1 v1.5 signature over "abc" with SHA-256 (2048 bit key,
+ * made with openssl).
+ *
+ * Each good signature must verify; a tampered signature or message must not.
+ */
+
+#include "../pgp.c"
+
+static struct {
+  char *pk, *msg, *sig;
+} ed25519_tests[] = {
+  {
+    "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+    "",
+    "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+    "5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b"
+  },
+  {
+    "3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+    "72",
+    "92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+    "085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00"
+  },
+  {
+    "fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+    "af82",
+    "6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac"
+    "18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a"
+  },
+};
+
+static struct {
+  char *n, *e, *msg, *sig;
+} rsa_test = {
+  .n =
+    "aa7972d406958a436080486153e2260ba71d622d11f632ff7846fcbe82f169e0"
+    "685830df5da1c1db5ea42c1204caedb60ca9f74a69d5cc60d213ed3277580956"
+    "ddd21d5f42ccfc2ae9701adf21d349a0dd32002a979de5fb47fd46bcecb11f32"
+    "d0fcafab47e736b91c8206b5ef500af97a93230a122737d859ec18a41433774f"
+    "7e99e629e7aaf549ebf708ffcc03232616b2bd112c2f579d760616150e4749b2"
+    "92e1d4f90a909a50607804884c24b2bbe4e1849e27a694fd7df2c0415b10d0d2"
+    "487ff1f0eabaf6505d7b120efe84cb5a75e763405ad6dfbc57ee8ca2067f7706"
+    "b607723a6fb619743a37c977a502d9ecd8f231f43f33b6c8ad632ad3b3c685b9",
+  .e = "010001",
+  .msg = "abc",
+  .sig =
+    "2047e00b16f2cf83b11bbdbb5b0b1287d959a27ae13ea05e359d520dd1e19e9e"
+    "62ee3d99f16a2bcd3b4792a86839fbb76f57f7428162aaa600a13f6f4d806292"
+    "52ddb96284eb732f08ac28b700bbdc4a30e848dce7a5faf0fad1d4b7b6c9d2c6"
+    "4fa54e42d8e8167e79bba54d6dc8cd8dd59fc959067c9cf15811b989175e5dc7"
+    "68865abaa2f65dfae13b87b2e6769eef5fe0908733b62cb0ce04e2d309d952bf"
+    "2cd35c9af0c1b7ab47a2d5a384dc3f5fd7c2f50bf03f3da0ed5cac320283cfba"
+    "fc757cb809a3c17249f22f3633974fccae02fd565dcb7c37083514a9433e1597"
+    "4e9a13b8f46d142d70e5a74defea5abfc867e26c9bdd24f0a57c61ecb570a960"
+};
+
+static unsigned unhex(unsigned char *buf, char *str);
+static int check(char *name, int result, int expected);
+
+
+int main()
+{
+  unsigned char pk[32], msg[64], sig[64], n[512], e[8], s[512], digest[64];
+  unsigned u, msg_len, digest_len;
+  pgp_key_t key = { .algo = PK_RSA, .n = n, .e = e };
+  pgp_hash_t hash;
+  char name[64];
+  int err = 0;
+
+  for(u = 0; u < sizeof ed25519_tests / sizeof *ed25519_tests; u++) {
+    unhex(pk, ed25519_tests[u].pk);
+    msg_len = unhex(msg, ed25519_tests[u].msg);
+    unhex(sig, ed25519_tests[u].sig);
+
+    sprintf(name, "ed25519 #%u", u + 1);
+    err |= check(name, ed25519_verify(pk, sig, msg, msg_len), 1);
+
+    sig[0] ^= 1;
+    sprintf(name, "ed25519 #%u, bad signature", u + 1);
+    err |= check(name, ed25519_verify(pk, sig, msg, msg_len), 0);
+    sig[0] ^= 1;
+
+    if(msg_len) {
+      msg[msg_len - 1] ^= 1;
+      sprintf(name, "ed25519 #%u, bad message", u + 1);
+      err |= check(name, ed25519_verify(pk, sig, msg, msg_len), 0);
+    }
+  }
+
+  key.n_len = unhex(n, rsa_test.n);
+  key.e_len = unhex(e, rsa_test.e);
+  msg_len = strlen(rsa_test.msg);
+
+  hash_init(&hash, PGP_HASH_SHA256);
+  hash_update(&hash, rsa_test.msg, msg_len);
+  digest_len = hash_finish(&hash, digest);
+
+  u = unhex(s, rsa_test.sig);
+  err |= check("rsa", rsa_verify(&key, s, u, PGP_HASH_SHA256, digest, digest_len), 1);
+
+  err |= check("rsa, wrong hash", rsa_verify(&key, s, u, PGP_HASH_SHA512, digest, digest_len), 0);
+
+  s[u - 1] ^= 1;
+  err |= check("rsa, bad signature", rsa_verify(&key, s, u, PGP_HASH_SHA256, digest, digest_len), 0);
+  s[u - 1] ^= 1;
+
+  digest[0] ^= 1;
+  err |= check("rsa, bad message", rsa_verify(&key, s, u, PGP_HASH_SHA256, digest, digest_len), 0);
+
+  return err;
+}
+
+
+/*
+ * Convert hex string to bytes; return number of bytes.
+ */
+unsigned unhex(unsigned char *buf, char *str)
+{
+  unsigned u, c;
+
+  for(u = 0; sscanf(str + 2 * u, "%2x", &c) == 1; u++) buf[u] = c;
+
+  return u;
+}
+
+
+int check(char *name, int result, int expected)
+{
+  printf("%-28s %s\n", name, result == expected ? "ok" : "FAILED");
+
+  return result != expected;
+}
+
+
+/*
+ * What pgp.c needs from util.c.
+ */
+void util_log(unsigned level, char *format, ...)
+{
+}
+
+
+void membuf_add(membuf_t *buf, char *data, size_t len)
+{
+  if(buf->len + len + 1 > buf->size) {
+    buf->size = (buf->len + len + 1) * 2 + 1024;
+    buf->data = realloc(buf->data, buf->size);
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+}
+
+
+void membuf_free(membuf_t *buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof *buf);
+}
+
+
+void str_copy(char **dst, const char *src)
+{
+  free(*dst);
+  *dst = src ? strdup(src) : NULL;
+}
+
+
+void strprintf(char **buf, char *format, ...)
+{
+  va_list args;
+
+  free(*buf);
+
+  va_start(args, format);
+  if(vasprintf(buf, format, args) < 0) *buf = NULL;
+  va_end(args);
+}
+
+
+int util_check_exist(char *file)
+{
+  return 0;
+}
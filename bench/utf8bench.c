@@ -0,0 +1,136 @@
+/*
+ * Compare utf8_strwidth() and utf8_strwcpy() against a plain char by char
+ * version (what utf8.c did before it skipped ASCII a word at a time).
+ *
+ * Results must match; times are printed for both.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../utf8.h"
+
+#define ROUNDS	2000
+
+static unsigned char *texts[] = {
+  "Loading Installation System",
+  "Make sure that CD number 1 is in your drive.\nThen press OK.",
+  "Sélectionnez la langue d'installation : Français (France)",
+  "Выберите язык установки и нажмите «OK».",
+  "インストールする言語を選択してください。",
+  "설치 언어를 선택한 다음 확인을 누르십시오.",
+  "Failed to load the installation system\n\x80\x80 (broken utf8)",
+};
+
+static int ref_strwidth(unsigned char *str);
+static void ref_strwcpy(unsigned char *dst, unsigned char *src, int width);
+static double now(void);
+
+
+int main()
+{
+  static unsigned char buf1[1 << 12], buf2[1 << 12];
+  unsigned char *str;
+  unsigned u, r;
+  int w, err = 0, sum1 = 0, sum2 = 0;
+  double t, t_ref[2], t_cur[2];
+
+  /* identical results first */
+  for(u = 0; u < sizeof texts / sizeof *texts; u++) {
+    str = texts[u];
+    if(ref_strwidth(str) != utf8_strwidth(str)) {
+      printf("strwidth mismatch: \"%s\": %d != %d\n", str, ref_strwidth(str), utf8_strwidth(str));
+      err = 1;
+    }
+    for(w = -1; w <= (int) strlen(str) + 1; w++) {
+      ref_strwcpy(buf1, str, w);
+      utf8_strwcpy(buf2, str, w);
+      if(strcmp(buf1, buf2)) {
+        printf("strwcpy mismatch: \"%s\", %d: \"%s\" != \"%s\"\n", str, w, buf1, buf2);
+        err = 1;
+      }
+    }
+  }
+
+  t = now();
+  for(r = 0; r < ROUNDS; r++) {
+    for(u = 0; u < sizeof texts / sizeof *texts; u++) sum1 += ref_strwidth(texts[u]);
+  }
+  t_ref[0] = now() - t;
+
+  t = now();
+  for(r = 0; r < ROUNDS; r++) {
+    for(u = 0; u < sizeof texts / sizeof *texts; u++) sum2 += utf8_strwidth(texts[u]);
+  }
+  t_cur[0] = now() - t;
+
+  t = now();
+  for(r = 0; r < ROUNDS; r++) {
+    for(u = 0; u < sizeof texts / sizeof *texts; u++) ref_strwcpy(buf1, texts[u], 40);
+  }
+  t_ref[1] = now() - t;
+
+  t = now();
+  for(r = 0; r < ROUNDS; r++) {
+    for(u = 0; u < sizeof texts / sizeof *texts; u++) utf8_strwcpy(buf2, texts[u], 40);
+  }
+  t_cur[1] = now() - t;
+
+  if(sum1 != sum2) err = 1;
+
+  printf("%-14s %10s %10s\n", "", "scalar", "word");
+  printf("%-14s %8.2fms %8.2fms\n", "utf8_strwidth", t_ref[0] * 1e3, t_cur[0] * 1e3);
+  printf("%-14s %8.2fms %8.2fms\n", "utf8_strwcpy", t_ref[1] * 1e3, t_cur[1] * 1e3);
+
+  return err;
+}
+
+
+/*
+ * Char by char versions.
+ */
+int ref_strwidth(unsigned char *str)
+{
+  int c, len, i = 0, width = 0;
+
+  while(*str && (len = utf8_enc_len(*str)) && (c = utf8_decode(str))) {
+    str += len;
+    if(c == '\n') {
+      i = 0;
+    }
+    else {
+      i += utf32_char_width(c);
+      if(i > width) width = i;
+    }
+  }
+
+  return width;
+}
+
+
+void ref_strwcpy(unsigned char *dst, unsigned char *src, int width)
+{
+  int w = 0, c, l = 0;
+
+  while(
+    (c = utf8_decode(src + l)) &&
+    (w += utf32_char_width(c)) <= width
+  ) {
+    l += utf8_enc_len(src[l]);
+  }
+
+  memcpy(dst, src, l);
+  dst[l] = 0;
+}
+
+
+double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -18,6 +18,7 @@
 #include "sha256.h"
 #include "sha512.h"
 #include "keyboard.h"
+#include "io.h"
 
 #define MAX_DIGEST_SIZE SHA512_DIGEST_SIZE
 
@@ -192,13 +193,14 @@ void digest_media_verify(char *device)
  */
 void do_digest(char *file)
 {
-  unsigned char buffer[64 << 10]; /* at least 36k! */
-  int fd, err = 0;
-  unsigned chunks = (iso.size - iso.pad) / (sizeof buffer >> 10);
-  unsigned chunk, u;
-  unsigned last_size = ((iso.size - iso.pad) % (sizeof buffer >> 10)) << 10;
+  static unsigned char zero[2 << 10];
+  unsigned char *buffer, tmp[1 << 10];
+  int fd, len, err = 0;
+  uint64_t pos, size = (uint64_t) (iso.size - iso.pad) << 10;
+  unsigned block, u;
   char msg[256];
   time_t t0 = 0, t1 = 0;
+  io_reader_t *io;
 
   if((fd = open(file, O_RDONLY | O_LARGEFILE)) == -1) return;
 
@@ -208,25 +210,21 @@ void do_digest(char *file)
   digest_media_init(&iso.digest.ctx);
   digest_media_init(&iso.digest.full_ctx);
 
-  for(chunk = 0; chunk < chunks; chunk++) {
-    if((u = read(fd, buffer, sizeof buffer)) != sizeof buffer) {
-      err = 1;
-      if(u > sizeof buffer) u = 0 ;
-      iso.err_ofs = (u >> 10) + chunk * (sizeof buffer >> 10);
-      break;
-    };
+  io = io_read_open(fd, 0, size);
 
-    digest_media_process(&iso.digest.full_ctx, buffer, sizeof buffer);
+  for(pos = 0, block = 0; (len = io_read_next(io, &buffer)) > 0; pos += len, block++) {
+    digest_media_process(&iso.digest.full_ctx, buffer, len);
 
-    if(chunk == 0) {
+    /* blocks are at least 36k */
+    if(pos == 0) {
       memset(buffer, 0, 0x200);
       memset(buffer + 0x8373, ' ', 0x200);
     }
 
-    digest_media_process(&iso.digest.ctx, buffer, sizeof buffer);
+    digest_media_process(&iso.digest.ctx, buffer, len);
 
-    if(!(chunk % 16)) {
-      update_progress((chunk + 1) * (sizeof buffer >> 10));
+    if(!(block % 4)) {
+      update_progress((pos + len) >> 10);
 
       t1 = time(NULL);
 
@@ -240,6 +238,7 @@ void do_digest(char *file)
          iso.digest.ok = 0;
          iso.err_ofs = 0;
          iso.err = 0;
+         io_read_close(io);
          close(fd);
          return;
       }
@@ -248,25 +247,22 @@ void do_digest(char *file)
     }
   }
 
-  if(!err && last_size) {
-    if((u = read(fd, buffer, last_size)) != last_size) {
-      err = 1;
-      if(u > sizeof buffer) u = 0 ;
-      iso.err_ofs = (u >> 10) + chunk * (sizeof buffer >> 10);
-    }
-    else {
-      digest_media_process(&iso.digest.ctx, buffer, last_size);
-      digest_media_process(&iso.digest.full_ctx, buffer, last_size);
+  io_read_close(io);
 
-      update_progress(iso.size - iso.pad);
-    }
+  if(pos != size) {
+    err = 1;
+    /* the failed block is large, find the bad spot */
+    while(pos < size && pread64(fd, tmp, sizeof tmp, pos) == sizeof tmp) pos += sizeof tmp;
+    iso.err_ofs = pos >> 10;
+  }
+  else {
+    update_progress(iso.size - iso.pad);
   }
 
   if(!err) {
-    memset(buffer, 0, 2 << 10);		/* 2k */
     for(u = 0; u < (iso.pad >> 1); u++) {
-      digest_media_process(&iso.digest.ctx, buffer, 2 << 10);
-      digest_media_process(&iso.digest.full_ctx, buffer, 2 << 10);
+      digest_media_process(&iso.digest.ctx, zero, 2 << 10);
+      digest_media_process(&iso.digest.full_ctx, zero, 2 << 10);
 
       update_progress(iso.size - iso.pad + ((u + 1) << 1));
     }
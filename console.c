@@ -0,0 +1,488 @@
+/*
+ *
+ * console.c     Console output
+ *
+ * Writing to a slow (serial) console must not hold up linuxrc. stdout and
+ * log consoles are streams that just append to a queue; a separate thread
+ * writes the queue out, putting everything that piled up meanwhile into a
+ * single write().
+ *
+ * Progress updates (con_progress()) that have not been written yet are
+ * replaced by newer ones. If stdout falls too far behind, the caller waits.
+ * A log console drops whole lines instead (they are still in the log file)
+ * and notes that it did.
+ *
+ */
+
+#define _GNU_SOURCE	/* fopencookie */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "global.h"
+#include "util.h"
+#include "console.h"
+
+#define CON_MAX		4		/* number of queued streams */
+#define CON_QUEUE_MAX	(1 << 20)	/* max. unwritten output per stream */
+
+typedef struct {
+  FILE *f;			/* stream writing to queue; NULL: slot unused */
+  int fd;			/* console */
+  membuf_t queue;		/* unwritten output */
+  size_t frame;			/* start of last progress update in queue */
+  unsigned dropped;		/* bytes dropped and not yet noted */
+  unsigned has_frame:1;		/* queue ends with progress update at frame */
+  unsigned busy:1;		/* writer thread is writing */
+  unsigned log:1;		/* log console: own fd, may drop output */
+  unsigned bol:1;		/* last queued char was '\n' (or nothing queued) */
+  unsigned skip_line:1;		/* drop output up to next '\n' */
+} con_t;
+
+static struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;		/* output queued */
+  pthread_cond_t idle;		/* output written */
+  pid_t pid;			/* process running the writer thread */
+  FILE *stdout_orig;		/* stdout before con_init() */
+  unsigned active:1;
+  unsigned stop:1;
+  unsigned atexit:1;		/* con_exit() registered */
+  con_t con[CON_MAX];
+} con_state = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+  .idle = PTHREAD_COND_INITIALIZER
+};
+
+static int con_active(void);
+static FILE *con_open(int fd, int log);
+static ssize_t con_cookie_write(void *cookie, const char *buf, size_t len);
+static int con_cookie_close(void *cookie);
+static int con_queue(con_t *con, const char *buf, size_t len);
+static void con_note(con_t *con);
+static void *con_writer(void *arg);
+static int con_write(int fd, char *buf, size_t len);
+static void con_exit(void);
+
+
+/*
+ * Start writer thread and route stdout and log consoles through it.
+ */
+void con_init()
+{
+  log_file_t *lf;
+  FILE *f;
+
+  if(con_state.active) return;
+
+  if(pthread_create(&con_state.thread, NULL, con_writer, NULL)) {
+    perror_info("pthread_create");
+    return;
+  }
+
+  con_state.pid = getpid();
+  con_state.active = 1;
+
+  if(!con_state.atexit) {
+    atexit(con_exit);
+    con_state.atexit = 1;
+  }
+
+  fflush(stdout);
+
+  if(!(f = con_open(STDOUT_FILENO, 0))) return;
+
+  con_state.stdout_orig = stdout;
+  stdout = f;
+
+  for(lf = config.log.dest; lf < config.log.dest + sizeof config.log.dest / sizeof *config.log.dest; lf++) {
+    if(lf->f == con_state.stdout_orig) {
+      lf->f = stdout;
+    }
+    else if(lf->f && lf->name && isatty(fileno(lf->f))) {
+      /* reopened via con_fopen() on next use */
+      fclose(lf->f);
+      lf->f = NULL;
+    }
+  }
+}
+
+
+/*
+ * Write out everything and stop writer thread; stdout is restored.
+ */
+void con_done()
+{
+  log_file_t *lf;
+  FILE *f;
+
+  if(!con_active()) return;
+
+  con_sync();
+
+  pthread_mutex_lock(&con_state.lock);
+  con_state.stop = 1;
+  pthread_cond_signal(&con_state.work);
+  pthread_mutex_unlock(&con_state.lock);
+
+  pthread_join(con_state.thread, NULL);
+
+  con_state.active = 0;
+  con_state.stop = 0;
+
+  if(con_state.stdout_orig) {
+    f = stdout;
+    stdout = con_state.stdout_orig;
+    con_state.stdout_orig = NULL;
+
+    for(lf = config.log.dest; lf < config.log.dest + sizeof config.log.dest / sizeof *config.log.dest; lf++) {
+      if(lf->f == f) lf->f = stdout;
+    }
+
+    fclose(f);
+  }
+}
+
+
+/*
+ * Wait until all queued output has been written.
+ */
+void con_sync()
+{
+  con_t *con;
+
+  if(!con_active()) return;
+
+  for(con = con_state.con; con < con_state.con + CON_MAX; con++) {
+    if(con->f) fflush(con->f);
+  }
+
+  pthread_mutex_lock(&con_state.lock);
+  for(con = con_state.con; con < con_state.con + CON_MAX; con++) {
+    while(con->queue.len || con->busy) pthread_cond_wait(&con_state.idle, &con_state.lock);
+  }
+  pthread_mutex_unlock(&con_state.lock);
+}
+
+
+/*
+ * Open log destination; terminals get a queued stream.
+ */
+FILE *con_fopen(char *name)
+{
+  FILE *f = NULL;
+  int fd;
+
+  if(!con_active()) return fopen(name, "a");
+
+  if((fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0) return NULL;
+
+  if(isatty(fd)) f = con_open(fd, 1);
+
+  if(!f && !(f = fdopen(fd, "a"))) close(fd);
+
+  return f;
+}
+
+
+/*
+ * Reopen stdout on console device name, like freopen().
+ */
+void con_reopen(char *name)
+{
+  int fd;
+
+  if(!con_active() || !con_state.stdout_orig) {
+    freopen(name, "a", stdout);
+
+    return;
+  }
+
+  con_sync();
+
+  if((fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0) return;
+
+  if(fd != STDOUT_FILENO) {
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+  }
+}
+
+
+/*
+ * Print progress update.
+ *
+ * If the previous update to f is still queued, it is replaced. So each
+ * update must redraw the whole progress indicator.
+ */
+void con_progress(FILE *f, char *format, ...)
+{
+  va_list args;
+  con_t *con;
+  char *buf;
+  int len;
+
+  va_start(args, format);
+  len = vasprintf(&buf, format, args);
+  va_end(args);
+
+  if(len < 0) return;
+
+  for(con = con_state.con; con < con_state.con + CON_MAX; con++) {
+    if(con->f == f) break;
+  }
+
+  fflush(f);
+
+  if(con < con_state.con + CON_MAX && con_active()) {
+    pthread_mutex_lock(&con_state.lock);
+    if(con->has_frame) con->queue.len = con->frame;
+    con->has_frame = con_queue(con, buf, len);
+    pthread_mutex_unlock(&con_state.lock);
+  }
+  else {
+    fwrite(buf, len, 1, f);
+    fflush(f);
+  }
+
+  free(buf);
+}
+
+
+/*
+ * Writer thread is running and belongs to us (and not to our parent).
+ */
+int con_active()
+{
+  return con_state.active && con_state.pid == getpid();
+}
+
+
+/*
+ * Create queued stream for fd.
+ *
+ * A log console (log = 1) owns fd and may drop output.
+ */
+FILE *con_open(int fd, int log)
+{
+  cookie_io_functions_t io = { .write = con_cookie_write, .close = con_cookie_close };
+  con_t *con;
+  FILE *f;
+
+  for(con = con_state.con; con < con_state.con + CON_MAX; con++) {
+    if(!con->f) break;
+  }
+
+  if(con == con_state.con + CON_MAX) return NULL;
+
+  con->fd = fd;
+  con->log = log;
+  con->bol = 1;
+
+  if(!(f = fopencookie(con, "w", io))) return NULL;
+
+  setvbuf(f, NULL, _IOLBF, BUFSIZ);
+
+  return con->f = f;
+}
+
+
+ssize_t con_cookie_write(void *cookie, const char *buf, size_t len)
+{
+  con_t *con = cookie;
+
+  /* writer stopped or we are a forked child */
+  if(!con_active()) {
+    con_write(con->fd, (char *) buf, len);
+
+    return len;
+  }
+
+  pthread_mutex_lock(&con_state.lock);
+  con_queue(con, buf, len);
+  con->has_frame = 0;
+  pthread_mutex_unlock(&con_state.lock);
+
+  return len;
+}
+
+
+int con_cookie_close(void *cookie)
+{
+  con_t *con = cookie;
+  int active = con_active();
+
+  /* a forked child must not lock: the lock may be held by a thread it doesn't have */
+  if(active) {
+    pthread_mutex_lock(&con_state.lock);
+    while(con->queue.len || con->busy) pthread_cond_wait(&con_state.idle, &con_state.lock);
+  }
+
+  if(con->log) close(con->fd);
+  membuf_free(&con->queue);
+  memset(con, 0, sizeof *con);
+
+  if(active) pthread_mutex_unlock(&con_state.lock);
+
+  return 0;
+}
+
+
+/*
+ * Append to queue; return 1 if queued, 0 if dropped.
+ *
+ * If the queue is full, wait for the writer thread - except for log
+ * consoles: they drop output up to the end of the line. The note about it
+ * goes in before the next line that is queued (or when the writer thread
+ * runs out of work).
+ *
+ * con->frame is set to where buf starts in the queue.
+ *
+ * Must be called with lock held.
+ */
+int con_queue(con_t *con, const char *buf, size_t len)
+{
+  char *s;
+  size_t skip;
+
+  if(con->skip_line) {
+    skip = (s = memchr(buf, '\n', len)) ? s + 1 - buf : len;
+    con->dropped += skip;
+    buf += skip;
+    len -= skip;
+    if(s) con->skip_line = 0;
+  }
+
+  if(!len) return 0;
+
+  if(!con->log) {
+    while(con->queue.len && con->queue.len + len > CON_QUEUE_MAX) {
+      pthread_cond_wait(&con_state.idle, &con_state.lock);
+    }
+  }
+  else if(con->queue.len && con->queue.len + len > CON_QUEUE_MAX) {
+    con->dropped += len;
+    if(buf[len - 1] != '\n') con->skip_line = 1;
+
+    return 0;
+  }
+
+  con_note(con);
+
+  con->frame = con->queue.len;
+  membuf_add(&con->queue, (char *) buf, len);
+  con->bol = buf[len - 1] == '\n';
+  pthread_cond_signal(&con_state.work);
+
+  return 1;
+}
+
+
+/*
+ * Queue note about dropped output; it gets a line of its own.
+ *
+ * Must be called with lock held.
+ */
+void con_note(con_t *con)
+{
+  char note[64];
+  int i;
+
+  if(!con->dropped) return;
+
+  i = snprintf(note, sizeof note, "%s[%u bytes of output dropped]\n", con->bol ? "" : "\n", con->dropped);
+  membuf_add(&con->queue, note, i);
+  con->dropped = 0;
+  con->bol = 1;
+}
+
+
+/*
+ * Writer thread: take a whole queue at a time and write it.
+ */
+void *con_writer(void *arg)
+{
+  membuf_t buf = {}, tmp;
+  con_t *con;
+  unsigned next = 0;
+  int i, fd;
+
+  pthread_mutex_lock(&con_state.lock);
+
+  for(;;) {
+    /* go round robin so a stuck console doesn't block the others for long */
+    for(i = 0; i < CON_MAX; i++) {
+      con = con_state.con + (next + i) % CON_MAX;
+      if(con->queue.len || con->dropped) break;
+    }
+
+    if(i == CON_MAX) {
+      if(con_state.stop) break;
+      pthread_cond_wait(&con_state.work, &con_state.lock);
+      continue;
+    }
+
+    next = con - con_state.con + 1;
+
+    con_note(con);
+
+    tmp = con->queue;
+    con->queue = buf;
+    buf = tmp;
+
+    con->has_frame = 0;
+    con->busy = 1;
+    fd = con->fd;
+
+    pthread_mutex_unlock(&con_state.lock);
+
+    con_write(fd, buf.data, buf.len);
+    buf.len = 0;
+
+    pthread_mutex_lock(&con_state.lock);
+    con->busy = 0;
+    pthread_cond_broadcast(&con_state.idle);
+  }
+
+  pthread_mutex_unlock(&con_state.lock);
+
+  membuf_free(&buf);
+
+  return NULL;
+}
+
+
+/*
+ * Don't lose queued output on exit().
+ */
+void con_exit()
+{
+  con_sync();
+}
+
+
+int con_write(int fd, char *buf, size_t len)
+{
+  ssize_t i;
+
+  while(len) {
+    i = write(fd, buf, len);
+    if(i < 0) {
+      if(errno == EINTR) continue;
+      return -1;
+    }
+    buf += i;
+    len -= i;
+  }
+
+  return 0;
+}
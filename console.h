@@ -0,0 +1,9 @@
+/*
+ * Queued console output, written by a separate thread.
+ */
+void con_init(void);
+void con_done(void);
+void con_sync(void);
+FILE *con_fopen(char *name);
+void con_reopen(char *name);
+void con_progress(FILE *f, char *format, ...) __attribute__ ((format (printf, 2, 3)));
@@ -6,6 +6,8 @@
  *
  */
 
+#define _GNU_SOURCE	/* memmem */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,8 +15,12 @@
 #include <ctype.h>
 #include <readline/readline.h>
 
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "global.h"
 #include "window.h"
@@ -26,10 +32,30 @@
 #include "file.h"
 #include "utf8.h"
 #include "net.h"
+#include "console.h"
 
 
 #define MIN_WIN_SIZE    40
-#define MAX_LINES     1000
+
+/* files up to this size are indexed at once to size the pager window */
+#define DIA_TEXT_SMALL  (64 << 10)
+
+/*
+ * Text for the pager: either an array of lines or a (mapped) file that is
+ * split into lines on demand.
+ */
+typedef struct {
+  char **lines;
+  char *data;
+  size_t size;
+  size_t next;			/* start of first line not yet indexed */
+  size_t *ofs;			/* line start offsets into data */
+  int nr_lines;			/* lines indexed so far */
+  int ofs_max;
+  int max_width;		/* widest indexed line, in columns */
+  unsigned complete:1;		/* all lines indexed */
+  unsigned mapped:1;		/* data is mmap'ed */
+} dia_text_t;
 
 struct {
   dia_item_t item;
@@ -134,6 +160,17 @@ static char *readline_input(char *prompt, char *val);
 
 static int dia_input(char *txt_tv, char *input_tr, int len_iv, int fieldlen_iv, int pw_mode);
 
+static int dia_text_index(dia_text_t *text, int line);
+static int dia_text_lines(dia_text_t *text);
+static void dia_text_line(dia_text_t *text, int line, char **start, char **end);
+static int dia_text_char(char *s, char *end, int *c);
+static int dia_text_width(char *s, char *end);
+static void dia_text_render(dia_text_t *text, int line, int h_offset, char *buf, size_t buf_size, int width);
+static int dia_text_search(dia_text_t *text, int line, char *str);
+static int dia_show_text(char *head_tv, dia_text_t *text, int width_iv, int eof_iv);
+static void dia_log(char *type, char *txt);
+static void dia_headless_leave(char *type, char *txt);
+
 /*
  *
  * exported functions
@@ -265,6 +302,8 @@ int dia_binary(char *txt, char *button0_txt, char *button1_txt, int def)
   int width, answer;
   int len0, len1, len_max;
 
+  if(config.headless) dia_headless_leave("binary", txt);
+
   if (config.linemode)
     {
       int current_ii;
@@ -335,6 +374,12 @@ int dia_message (char *txt_tv, int msgtype_iv)
     int       key_ii;
     char *s;
 
+    if (config.headless)
+      {
+        dia_log (msgtype_iv == MSGTYPE_ERROR || msgtype_iv == MSGTYPE_REBOOT ? "error" : "message", txt_tv);
+        return (0);
+      }
+
     if(!config.win) util_disp_init();
 
     if (config.linemode)
@@ -439,6 +484,9 @@ int dia_menu (char *head_tv,     item_t  items_arv [],
     int dir, cur_new, ofs_new;
 
 
+    if (config.headless)
+        dia_headless_leave ("menu", head_tv);
+
     if (config.linemode)
       {
 	int i, j, cnt;
@@ -824,6 +872,11 @@ void dia_status_on (window_t *win_prr, char *txt_tv)
     window_t  tmp_win_ri;
     char      tmp_txt_ti [STATUS_SIZE * 6 + 1];
 
+    if(config.headless) {
+      memset(win_prr, 0, sizeof *win_prr);
+      return;
+    }
+
     if(!config.win || config.linemode) {
       printf("%s", txt_tv);
       fflush(stdout);
@@ -885,10 +938,12 @@ void dia_status (window_t *win, int p)
   char buf[STATUS_SIZE + 1];
   int i;
 
+  if(config.headless) return;
+
   if(p > 100) p = 100;
 
   if(!config.win || config.linemode) {
-    printf("\x08\x08\x08\x08%3d%%", p);
+    con_progress(stdout, "\x08\x08\x08\x08%3d%%", p);
   }
   else {
     for(i = 0; i < p * STATUS_SIZE / 100; i++) buf[i] = ' ';
@@ -904,6 +959,8 @@ void dia_status (window_t *win, int p)
 
 void dia_status_off (window_t *win_prv)
 {
+    if(config.headless) return;
+
     if(!config.win || config.linemode) {
       printf("\n");
       fflush(stdout);
@@ -918,6 +975,8 @@ int dia_input(char *txt_tv, char *input_tr, int len_iv, int fieldlen_iv, int pw_
   window_t tmp_win_ri;
   int rc_ii = 0;
 
+  if(config.headless) dia_headless_leave("input", txt_tv);
+
   if(config.linemode) {
     int i;
     char *buf = NULL;
@@ -1035,6 +1094,355 @@ ctrlc:
 int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                      int   width_iv, int eof_iv)
     {
+    dia_text_t text_ri;
+
+    if (!nr_lines_iv)
+        return (-1);
+
+    memset (&text_ri, 0, sizeof text_ri);
+    text_ri.lines = lines_atv;
+    text_ri.nr_lines = nr_lines_iv;
+    text_ri.complete = TRUE;
+
+    return (dia_show_text (head_tv, &text_ri, width_iv, eof_iv));
+    }
+
+
+/*
+ * Show file in a pager.
+ *
+ * The file is mapped and split into lines only as far as needed, so there
+ * is no limit on its size.
+ */
+int dia_show_file (char *head_tv, char *file_tv, int eof_iv)
+    {
+    dia_text_t text_ri;
+    struct stat sbuf;
+    membuf_t buf = {};
+    char tmp[4096];
+    int fd, len, width, rc = -1;
+
+    if (config.headless)
+        {
+        dia_log ("file", file_tv);
+        return (0);
+        }
+
+    memset (&text_ri, 0, sizeof text_ri);
+
+    if ((fd = open (file_tv, O_RDONLY)) < 0)
+        return (-1);
+
+    if (!fstat (fd, &sbuf) && S_ISREG (sbuf.st_mode) && sbuf.st_size > 0)
+        {
+        text_ri.data = mmap (NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text_ri.data == MAP_FAILED)
+            text_ri.data = NULL;
+        else
+            {
+            text_ri.size = sbuf.st_size;
+            text_ri.mapped = TRUE;
+            madvise (text_ri.data, text_ri.size, MADV_SEQUENTIAL);
+            }
+        }
+
+    /* /proc files & co. */
+    if (!text_ri.mapped)
+        {
+        while ((len = read (fd, tmp, sizeof tmp)) > 0)
+            membuf_add (&buf, tmp, len);
+        text_ri.data = buf.data;
+        text_ri.size = buf.len;
+        }
+
+    close (fd);
+
+    /* small files get a window that fits */
+    if (text_ri.size <= DIA_TEXT_SMALL)
+        {
+        dia_text_index (&text_ri, INT_MAX);
+        width = text_ri.max_width + 6;
+        }
+    else
+        {
+        width = max_x_ig;
+        }
+
+    if (dia_text_index (&text_ri, 1))
+        rc = dia_show_text (head_tv, &text_ri, width, eof_iv);
+
+    if (text_ri.mapped)
+        munmap (text_ri.data, text_ri.size);
+    else
+        membuf_free (&buf);
+
+    free (text_ri.ofs);
+
+    return (rc);
+    }
+
+
+void dia_info (window_t *win_prr, char *txt_tv, int type)
+    {
+    int        width_ii;
+    window_t   tmp_win_ri;
+    unsigned char *lines_ati [MAX_Y];
+    int        nr_lines_ii;
+    int        i_ii;
+
+
+    if (config.headless)
+      {
+        dia_log ("info", txt_tv);
+        memset (win_prr, 0, sizeof *win_prr);
+        return;
+      }
+
+    if (config.linemode)
+      {
+	dia_printformatted(txt_tv, 0, max_x_ig - 1, 1);
+	memset(win_prr, 0, sizeof *win_prr);
+	return;
+      }
+
+    disp_toggle_output (DISP_OFF);
+    width_ii = utf8_strwidth (txt_tv) + 6;
+    if (width_ii < MIN_WIN_SIZE)
+        width_ii = MIN_WIN_SIZE;
+
+    if (width_ii > max_x_ig - 16)
+        width_ii = max_x_ig - 16;
+
+    nr_lines_ii = util_format_txt (txt_tv, lines_ati, width_ii - 4);
+
+    memset (win_prr, 0, sizeof (window_t));
+    win_prr->x_left = max_x_ig / 2 - width_ii / 2;
+    win_prr->y_left = max_y_ig / 2 - nr_lines_ii / 2 - 1;
+    win_prr->x_right = max_x_ig / 2 + width_ii / 2;
+    win_prr->y_right = max_y_ig / 2 + (nr_lines_ii + 1) / 2 + 2;
+    win_prr->shadow = TRUE;
+    win_prr->style = STYLE_RAISED;
+    win_prr->save_bg = TRUE;
+    if(type == MSGTYPE_ERROR) {
+      win_prr->bg_color = colors_prg->error_win;
+      win_prr->fg_color = colors_prg->error_fg;
+    }
+    else {
+      win_prr->bg_color = colors_prg->msg_win;
+      win_prr->fg_color = colors_prg->msg_fg;
+    }
+    win_open (win_prr);
+    win_clear (win_prr);
+
+    memset (&tmp_win_ri, 0, sizeof (window_t));
+    tmp_win_ri.x_left = win_prr->x_left + 1;
+    tmp_win_ri.y_left = win_prr->y_left + 1;
+    tmp_win_ri.x_right = win_prr->x_right - 1;
+    tmp_win_ri.y_right = win_prr->y_right - 1;
+    tmp_win_ri.style = STYLE_SUNKEN;
+    tmp_win_ri.bg_color = win_prr->bg_color;
+    tmp_win_ri.fg_color = win_prr->fg_color;
+    win_open (&tmp_win_ri);
+    win_clear (&tmp_win_ri);
+
+    for (i_ii = 1; i_ii <= nr_lines_ii; i_ii++)
+        {
+        win_print (&tmp_win_ri, 2, i_ii, lines_ati [i_ii - 1]);
+        free (lines_ati [i_ii - 1]);
+        }
+
+    disp_flush_area (win_prr);
+    }
+
+/*
+ *
+ *  local functions
+ *
+ */
+
+/*
+ * Index lines up to (at least) line; return number of lines indexed.
+ */
+static int dia_text_index(dia_text_t *text, int line)
+{
+  char *s;
+  size_t len;
+  int width;
+
+  while(text->nr_lines < line && !text->complete) {
+    if(text->next >= text->size) {
+      text->complete = 1;
+      break;
+    }
+
+    if(text->nr_lines >= text->ofs_max) {
+      text->ofs_max = text->ofs_max * 2 + 1024;
+      text->ofs = realloc(text->ofs, text->ofs_max * sizeof *text->ofs);
+    }
+    text->ofs[text->nr_lines++] = text->next;
+
+    s = memchr(text->data + text->next, '\n', text->size - text->next);
+    len = s ? (size_t) (s - text->data) - text->next : text->size - text->next;
+    width = dia_text_width(text->data + text->next, text->data + text->next + len);
+    if(width > text->max_width) text->max_width = width;
+    text->next += len + 1;
+  }
+
+  return text->nr_lines;
+}
+
+
+/*
+ * Total number of lines; estimated as long as the index is incomplete.
+ */
+static int dia_text_lines(dia_text_t *text)
+{
+  if(text->complete || !text->next) return text->nr_lines;
+
+  return (double) text->nr_lines * text->size / text->next;
+}
+
+
+/*
+ * Get start and end of line (line must be indexed).
+ */
+static void dia_text_line(dia_text_t *text, int line, char **start, char **end)
+{
+  char *s;
+
+  if(text->lines) {
+    *start = text->lines[line];
+    *end = *start + strlen(*start);
+
+    return;
+  }
+
+  *start = text->data + text->ofs[line];
+  s = memchr(*start, '\n', text->size - text->ofs[line]);
+  *end = s ?: text->data + text->size;
+}
+
+
+/*
+ * Get next char of line; return its length in bytes.
+ *
+ * *c is the char, 0 for control chars (tabs & co., shown as ' '), or -1 if
+ * it's not valid utf8 (shown as '?'). Valid chars are at most 4 bytes long.
+ */
+static int dia_text_char(char *s, char *end, int *c)
+{
+  int len;
+
+  len = utf8_enc_len(*(unsigned char *) s);
+
+  if(len < 1 || len > 4 || s + len > end || !(*c = utf8_decode((unsigned char *) s))) {
+    *c = -1;
+
+    return 1;
+  }
+
+  if(*c < 0x20 || *c == 0x7f) *c = 0;
+
+  return len;
+}
+
+
+/*
+ * Display width of line as dia_text_render() draws it.
+ */
+static int dia_text_width(char *s, char *end)
+{
+  int c, width = 0;
+
+  for(; s < end; s += dia_text_char(s, end, &c)) {
+    width += c <= 0 ? 1 : utf32_char_width(c) ?: 1;
+  }
+
+  return width;
+}
+
+
+/*
+ * Render width columns of line, starting at column h_offset, into buf.
+ *
+ * buf needs 4 * width + 1 bytes; width is reduced to fit buf_size. buf is
+ * padded with spaces.
+ */
+static void dia_text_render(dia_text_t *text, int line, int h_offset, char *buf, size_t buf_size, int width)
+{
+  char *s, *end;
+  int c, len, w;
+
+  if(width > (int) (buf_size - 1) / 4) width = (buf_size - 1) / 4;
+
+  dia_text_line(text, line, &s, &end);
+
+  for(; s < end && width > 0; s += len) {
+    len = dia_text_char(s, end, &c);
+    if(c <= 0) {
+      w = 1;
+      if(h_offset-- <= 0) *buf++ = c < 0 ? '?' : ' ';
+    }
+    else {
+      w = utf32_char_width(c) ?: 1;
+      if(h_offset-- <= 0) {
+        if(w > width) break;
+        memcpy(buf, s, len);
+        buf += len;
+      }
+    }
+    if(h_offset < 0) width -= w;
+  }
+
+  while(width-- > 0) *buf++ = ' ';
+  *buf = 0;
+}
+
+
+/*
+ * Find next line at or after line containing str; return -1 if there's none.
+ */
+static int dia_text_search(dia_text_t *text, int line, char *str)
+{
+  char *s;
+  size_t len = strlen(str);
+  int i;
+
+  if(!len) return -1;
+
+  if(text->lines) {
+    for(i = line; i < text->nr_lines; i++) {
+      if(strstr(text->lines[i], str)) return i;
+    }
+
+    return -1;
+  }
+
+  if(line >= dia_text_index(text, line + 1)) return -1;
+
+  s = memmem(text->data + text->ofs[line], text->size - text->ofs[line], str, len);
+  if(!s) return -1;
+
+  /* extend index up to the match, then look it up */
+  while(!text->complete && text->next <= (size_t) (s - text->data)) {
+    dia_text_index(text, text->nr_lines + 1024);
+  }
+
+  for(i = line; i < text->nr_lines - 1; i++) {
+    if(text->ofs[i + 1] > (size_t) (s - text->data)) break;
+  }
+
+  return i;
+}
+
+
+/*
+ * Pager for dia_show_lines() and dia_show_file().
+ *
+ * Keys: cursor keys, Home/End, PgUp/PgDown; '/' to search, 'n' to search again.
+ */
+static int dia_show_text(char *head_tv, dia_text_t *text, int width_iv, int eof_iv)
+    {
     window_t  file_win_ri;
     window_t  tmp_win_ri;
     button_t  button_ri;
@@ -1046,27 +1454,33 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
     unsigned char *lines_ati [MAX_Y];
     int       line_length_ii;
     int       h_offset_ii;
-    char      tmp_ti [MAX_X];
+    char      tmp_ti [MAX_X * 4 + 1];
     int       visible_lines_ii;
+    int       nr_lines_ii;
     int       sb_len_ii;
     int       sb_start_ii;
     int       needflush_ii;
-    char *s;
+    char *s, *end;
+    char *search = NULL;
 
 
-    if (!nr_lines_iv || width_iv < 8)
+    if (config.headless)
+        {
+        dia_log ("text", head_tv);
+        return (0);
+        }
+
+    if (width_iv < 8)
         return (-1);
     if (config.linemode)
       {
-	int l;
-
 	printf("\n%s\n\n", head_tv);
-        for (i_ii = 0; i_ii < nr_lines_iv; i_ii++)
+        for (i_ii = 0; i_ii < dia_text_index (text, i_ii + 1); i_ii++)
 	  {
-	    l = strlen(lines_atv[i_ii]);
-	    while (l && lines_atv[i_ii][l - 1] == ' ')
-	      l--;
-	    printf("%.*s\n", l, lines_atv[i_ii]);
+	    dia_text_line (text, i_ii, &s, &end);
+	    while (end > s && end[-1] == ' ')
+	      end--;
+	    printf("%.*s\n", (int) (end - s), s);
 	  }
         return 0;
       }
@@ -1075,10 +1489,11 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
     line_length_ii = width_iv;
     if (width_iv > max_x_ig - 6)
         width_iv = max_x_ig - 6;
-    if (nr_lines_iv > max_y_ig - 14)
+    nr_lines_ii = dia_text_index (text, max_y_ig);
+    if (nr_lines_ii > max_y_ig - 14)
         visible_lines_ii = max_y_ig - 14;
     else
-        visible_lines_ii = nr_lines_iv;
+        visible_lines_ii = nr_lines_ii;
 
     textlines_ii = util_format_txt (head_tv, lines_ati, width_iv - 4);
 
@@ -1152,12 +1567,14 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                 need_redraw_ii = TRUE;
                 break;
             case KEY_END:
-                if (visible_lines_ii < nr_lines_iv)
-                    offset_ii = nr_lines_iv - visible_lines_ii;
+                nr_lines_ii = dia_text_index (text, INT_MAX);
+                if (visible_lines_ii < nr_lines_ii)
+                    offset_ii = nr_lines_ii - visible_lines_ii;
                 need_redraw_ii = TRUE;
                 break;
             case KEY_DOWN:
-                if (offset_ii + visible_lines_ii < nr_lines_iv)
+                nr_lines_ii = dia_text_index (text, offset_ii + visible_lines_ii + 1);
+                if (offset_ii + visible_lines_ii < nr_lines_ii)
                     {
                     offset_ii++;
                     need_redraw_ii = TRUE;
@@ -1171,16 +1588,17 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                     }
                 break;
             case KEY_PGDOWN:
-                if (visible_lines_ii < nr_lines_iv)
+                nr_lines_ii = dia_text_index (text, offset_ii + 2 * visible_lines_ii);
+                if (visible_lines_ii < nr_lines_ii)
                     {
                     offset_ii += visible_lines_ii;
-                    if (offset_ii + visible_lines_ii >= nr_lines_iv)
-                        offset_ii = nr_lines_iv - visible_lines_ii;
+                    if (offset_ii + visible_lines_ii >= nr_lines_ii)
+                        offset_ii = nr_lines_ii - visible_lines_ii;
                     need_redraw_ii = TRUE;
                     }
                 break;
             case KEY_PGUP:
-                if (visible_lines_ii < nr_lines_iv)
+                if (visible_lines_ii < nr_lines_ii)
                     {
                     offset_ii -= visible_lines_ii;
                     if (offset_ii < 0)
@@ -1189,6 +1607,8 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                     }
                 break;
             case KEY_RIGHT:
+                if (!text->lines && text->max_width + 6 > line_length_ii)
+                    line_length_ii = text->max_width + 6;
                 if (h_offset_ii + width_iv < line_length_ii)
                     {
                     h_offset_ii++;
@@ -1202,30 +1622,50 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
                     need_redraw_ii = TRUE;
                     }
                 break;
+            case '/':
+                if (dia_input2 ("Search for", &search, 30, 0) || !search)
+                    break;
+                /* fall through */
+            case 'n':
+                if (!search)
+                    break;
+                i_ii = dia_text_search (text, offset_ii + 1, search);
+                if (i_ii < 0)
+                    {
+                    dia_message ("Text not found.", MSGTYPE_INFO);
+                    break;
+                    }
+                offset_ii = i_ii;
+                nr_lines_ii = dia_text_index (text, offset_ii + visible_lines_ii);
+                if (offset_ii + visible_lines_ii > nr_lines_ii)
+                    offset_ii = nr_lines_ii > visible_lines_ii ? nr_lines_ii - visible_lines_ii : 0;
+                need_redraw_ii = TRUE;
+                break;
             default:
                 break;
             }
 
         if (need_redraw_ii)
             {
+            nr_lines_ii = dia_text_index (text, offset_ii + visible_lines_ii);
             disp_set_color (tmp_win_ri.fg_color, tmp_win_ri.bg_color);
             for (i_ii = 0; i_ii < visible_lines_ii; i_ii++)
-                if (i_ii + offset_ii < nr_lines_iv)
+                if (i_ii + offset_ii < nr_lines_ii)
                     {
-                    strncpy (tmp_ti, &lines_atv [offset_ii + i_ii][h_offset_ii],
-                             width_iv - 4);
-                    tmp_ti [width_iv - 5] = 0;
+                    dia_text_render (text, offset_ii + i_ii, h_offset_ii, tmp_ti, sizeof tmp_ti, width_iv - 5);
                     win_print (&tmp_win_ri, 2, i_ii + 1, tmp_ti);
                     }
 
-            if (visible_lines_ii < nr_lines_iv)
+            /* scrollbar */
+            i_ii = dia_text_lines (text);
+            if (visible_lines_ii < i_ii)
                 {
                 disp_graph_on ();
-                sb_len_ii = (visible_lines_ii * visible_lines_ii + 1) / nr_lines_iv;
+                sb_len_ii = (visible_lines_ii * visible_lines_ii + 1) / i_ii;
                 if (sb_len_ii >= visible_lines_ii - 1)
                     sb_len_ii--;
-                sb_start_ii = (offset_ii * visible_lines_ii) / nr_lines_iv;
-                if (offset_ii + visible_lines_ii < nr_lines_iv &&
+                sb_start_ii = (offset_ii * visible_lines_ii) / i_ii;
+                if (offset_ii + visible_lines_ii < i_ii &&
                     sb_start_ii + sb_len_ii == visible_lines_ii - 1)
                     sb_start_ii--;
                 if (offset_ii && !sb_start_ii)
@@ -1263,126 +1703,14 @@ int dia_show_lines (char *head_tv, char *lines_atv [], int nr_lines_iv,
         }
     while (key_ii != KEY_ENTER && key_ii != KEY_ESC);
 
+    free (search);
+
     win_button_pressed (&button_ri, FALSE);
     win_close (&file_win_ri);
     return (0);
     }
 
 
-int dia_show_file (char *head_tv, char *file_tv, int eof_iv)
-    {
-    FILE     *fd_pri;
-    char     *lines_ati [MAX_LINES];
-    int       nr_lines_ii;
-    int       i_ii;
-    char      buffer_ti [MAX_X];
-    int       width_ii;
-    int       rc_ii = 0;
-
-    fd_pri = fopen (file_tv, "r");
-    if (!fd_pri)
-        return (-1);
-
-    nr_lines_ii = 0;
-    width_ii = 0;
-    while (fgets (buffer_ti, MAX_X - 1, fd_pri) &&
-           nr_lines_ii < MAX_LINES)
-        {
-        lines_ati [nr_lines_ii] = malloc (MAX_X);
-        if (strrchr (buffer_ti, '\n'))
-            *strrchr (buffer_ti, '\n') = 0;
-        for (i_ii = 0; buffer_ti [i_ii]; i_ii++)
-            if (buffer_ti [i_ii] == '\t' || buffer_ti [i_ii] == 0x0d)
-                buffer_ti [i_ii] = ' ';
-        strncpy (lines_ati [nr_lines_ii], buffer_ti, MAX_X - 1);
-        lines_ati [nr_lines_ii][MAX_X - 1] = 0;
-        if ((ssize_t) utf8_strwidth (lines_ati [nr_lines_ii]) + 6 > width_ii)
-            width_ii = utf8_strwidth (lines_ati [nr_lines_ii]) + 6;
-        util_fill_string (lines_ati [nr_lines_ii], MAX_X);
-        nr_lines_ii++;
-        }
-    fclose (fd_pri);
-
-    rc_ii = dia_show_lines (head_tv, lines_ati, nr_lines_ii, width_ii, eof_iv);
-
-    for (i_ii = 0; i_ii < nr_lines_ii; i_ii++)
-        free (lines_ati [i_ii]);
-
-    return (rc_ii);
-    }
-
-
-void dia_info (window_t *win_prr, char *txt_tv, int type)
-    {
-    int        width_ii;
-    window_t   tmp_win_ri;
-    unsigned char *lines_ati [MAX_Y];
-    int        nr_lines_ii;
-    int        i_ii;
-
-
-    if (config.linemode)
-      {
-	dia_printformatted(txt_tv, 0, max_x_ig - 1, 1);
-	memset(win_prr, 0, sizeof *win_prr);
-	return;
-      }
-
-    disp_toggle_output (DISP_OFF);
-    width_ii = utf8_strwidth (txt_tv) + 6;
-    if (width_ii < MIN_WIN_SIZE)
-        width_ii = MIN_WIN_SIZE;
-
-    if (width_ii > max_x_ig - 16)
-        width_ii = max_x_ig - 16;
-
-    nr_lines_ii = util_format_txt (txt_tv, lines_ati, width_ii - 4);
-
-    memset (win_prr, 0, sizeof (window_t));
-    win_prr->x_left = max_x_ig / 2 - width_ii / 2;
-    win_prr->y_left = max_y_ig / 2 - nr_lines_ii / 2 - 1;
-    win_prr->x_right = max_x_ig / 2 + width_ii / 2;
-    win_prr->y_right = max_y_ig / 2 + (nr_lines_ii + 1) / 2 + 2;
-    win_prr->shadow = TRUE;
-    win_prr->style = STYLE_RAISED;
-    win_prr->save_bg = TRUE;
-    if(type == MSGTYPE_ERROR) {
-      win_prr->bg_color = colors_prg->error_win;
-      win_prr->fg_color = colors_prg->error_fg;
-    }
-    else {
-      win_prr->bg_color = colors_prg->msg_win;
-      win_prr->fg_color = colors_prg->msg_fg;
-    }
-    win_open (win_prr);
-    win_clear (win_prr);
-
-    memset (&tmp_win_ri, 0, sizeof (window_t));
-    tmp_win_ri.x_left = win_prr->x_left + 1;
-    tmp_win_ri.y_left = win_prr->y_left + 1;
-    tmp_win_ri.x_right = win_prr->x_right - 1;
-    tmp_win_ri.y_right = win_prr->y_right - 1;
-    tmp_win_ri.style = STYLE_SUNKEN;
-    tmp_win_ri.bg_color = win_prr->bg_color;
-    tmp_win_ri.fg_color = win_prr->fg_color;
-    win_open (&tmp_win_ri);
-    win_clear (&tmp_win_ri);
-
-    for (i_ii = 1; i_ii <= nr_lines_ii; i_ii++)
-        {
-        win_print (&tmp_win_ri, 2, i_ii, lines_ati [i_ii - 1]);
-        free (lines_ati [i_ii - 1]);
-        }
-
-    disp_flush_area (win_prr);
-    }
-
-/*
- *
- *  local functions
- *
- */
-
 static int dia_win_open (window_t *win_prr, char *txt_tv, int min_width)
     {
     int        width_ii;
@@ -1436,6 +1764,50 @@ static int dia_win_open (window_t *win_prr, char *txt_tv, int min_width)
     }
 
 
+/*
+ * Headless mode: log dialog as a single line instead of showing it.
+ *
+ * type: dialog type, txt: dialog text
+ */
+static void dia_log(char *type, char *txt)
+{
+  membuf_t buf = {};
+  char *s;
+
+  for(s = txt ?: ""; *s; s++) {
+    if(*s == '\n') {
+      membuf_add(&buf, "\\n", 2);
+    }
+    else if(*s == '"' || *s == '\\') {
+      membuf_printf(&buf, "\\%c", *s);
+    }
+    else {
+      membuf_add(&buf, s, 1);
+    }
+  }
+
+  log_info("dialog: type=%s text=\"%s\"\n", type, buf.data ?: "");
+
+  membuf_free(&buf);
+}
+
+
+/*
+ * Headless mode: dialog needs a decision.
+ *
+ * Guessing could reboot or loop forever; log the dialog and switch to the
+ * console so someone can take over.
+ */
+static void dia_headless_leave(char *type, char *txt)
+{
+  dia_log(type, txt);
+  log_show("headless: %s dialog needs an answer, switching to console\n", type);
+
+  config.headless = 0;
+  util_disp_init();
+}
+
+
 void dia_handle_ctrlc (void)
 {
     int i, j;
@@ -1482,10 +1854,13 @@ void dia_handle_ctrlc (void)
 	    t = config.run_command + 5;
 	    while(isspace(*t)) t++;
 	    kbd_end(0);	/* restore terminal settings */
+	    con_done();
 	    j = execlp(t, t, NULL);
+	    con_init();
 	    kbd_init(0);
 	  }
 	  else {
+	    con_sync();
 	    j = system(config.run_command);
 	  }
 	  if(j) log_info("  exit code: %d\n", WIFEXITED(j) ? WEXITSTATUS(j) : -1);
@@ -6,8 +6,11 @@
  *
  */
 
+#define _GNU_SOURCE	/* vasprintf */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -15,6 +18,7 @@
 #include "display.h"
 #include "util.h"
 #include "utf8.h"
+#include "console.h"
 
 /*
  *
@@ -32,7 +36,38 @@ static int  disp_x_im;
 static int  disp_y_im;
 static int  disp_state_im = DISP_ON;
 
+/*
+ * disp_screen_aprm holds what the screen should look like, disp_front_aprm
+ * what we last sent to the terminal. Rows touched while output was off or
+ * by a restore are recorded in disp_damage_arm and redrawn by disp_frame().
+ */
 static character_t **disp_screen_aprm;
+static character_t **disp_front_aprm;
+
+static struct {
+  int x_min, x_max;
+} *disp_damage_arm;
+
+// unchanged cells shorter than this are rewritten instead of moving the cursor
+#define DISP_GAP         6
+
+#define DISP_SAME(a, b)  ((a).c == (b).c && (a).attr == (b).attr)
+
+static struct {
+  unsigned active:1;
+  membuf_t buf;
+} disp_out;
+
+/*
+ * Window save areas are taken from here; windows nest, so this is used as
+ * a stack. Areas that don't fit are malloc'ed.
+ */
+#define DISP_POOL_SCREENS  4
+
+static struct {
+  character_t *buf;
+  unsigned size, used, count;
+} disp_pool;
 
 colorset_t  disp_vgacolors_rm;
 static colorset_t  disp_mono_rm;
@@ -46,6 +81,12 @@ graphics_t graphics_sg;
  *
  */
 
+static void disp_printf(char *format, ...) __attribute__ ((format (printf, 1, 2)));
+static void disp_put(int c, int width);
+static void disp_damage(int x, int y, int len);
+static void disp_invalidate(void);
+static int disp_area(window_t *win, int *x_len, int *y_len);
+static void disp_frame(void);
 
 /*
  *
@@ -155,9 +196,16 @@ void disp_init (void)
 
     colors_prg = &disp_vgacolors_rm;
 
-    disp_screen_aprm = malloc (sizeof (character_t *) * max_y_ig);
-    for (i_ii = 0; i_ii < max_y_ig; i_ii++)
-        disp_screen_aprm [i_ii] = malloc (sizeof (character_t) * max_x_ig);
+    /* screen buffer and terminal copy share one block; rows point into it */
+    disp_screen_aprm = malloc (sizeof (character_t *) * max_y_ig * 2);
+    disp_front_aprm = disp_screen_aprm + max_y_ig;
+    disp_screen_aprm [0] = calloc (max_x_ig * max_y_ig * 2, sizeof (character_t));
+    for (i_ii = 0; i_ii < max_y_ig * 2; i_ii++)
+        disp_screen_aprm [i_ii] = disp_screen_aprm [0] + i_ii * max_x_ig;
+    disp_damage_arm = calloc (max_y_ig, sizeof *disp_damage_arm);
+
+    disp_pool.size = max_x_ig * max_y_ig * DISP_POOL_SCREENS;
+    disp_pool.buf = malloc (sizeof (character_t) * disp_pool.size);
     }
 
 
@@ -167,6 +215,9 @@ void disp_end (void)
     FILE *fd_pri;
     char  tty_ti [20];
 
+    if (config.headless)
+        return;
+
     if (config.linemode)
       {
 	printf("\n\n");
@@ -182,12 +233,17 @@ void disp_end (void)
 
     if (disp_screen_aprm)
       {
-        for (i_ii = 0; i_ii < max_y_ig; i_ii++)
-            free (disp_screen_aprm [i_ii]);
-
+        free (disp_screen_aprm [0]);
         free (disp_screen_aprm);
+        free (disp_damage_arm);
+        disp_screen_aprm = NULL;
       }
 
+    free (disp_pool.buf);
+    memset (&disp_pool, 0, sizeof disp_pool);
+
+    membuf_free (&disp_out.buf);
+
     if(!config.test)
         {
         for (i_ii = 2; i_ii <= 6; i_ii++)
@@ -215,7 +271,7 @@ void disp_gotoxy(int x, int y)
     x > 0 && x <= max_x_ig &&
     y > 0 && y <= max_y_ig
   ) {
-    printf("\033[%d;%df", y, x);
+    disp_printf("\033[%d;%df", y, x);
     disp_x_im = x;
     disp_y_im = y;
   }
@@ -239,7 +295,7 @@ void disp_set_color(char fg, char bg)
     }
 
     if(!config.linemode) {
-      printf("\033[%d;%d;%dm", (int) attr, (int) (fg & 0x07) + 30, (int) bg + 40);
+      disp_printf("\033[%d;%d;%dm", (int) attr, (int) (fg & 0x07) + 30, (int) bg + 40);
     }
   }
 }
@@ -270,7 +326,7 @@ void disp_cursor_off()
 
 void disp_cursor_on()
 {
-  if(config.linemode) return;
+  if(config.linemode || config.headless) return;
 
   printf("\033[?25h");
 }
@@ -282,10 +338,10 @@ void disp_graph_on()
 
   if(!IS_ALTERNATE(disp_attr_cm)) {
     if(config.serial || config.test) {
-      printf("%c", 14);
+      disp_printf("%c", 14);
     }
     else {
-      printf("\033[11m");
+      disp_printf("\033[11m");
     }
     disp_attr_cm |= 0x80;
   }
@@ -298,10 +354,10 @@ void disp_graph_off()
 
   if(IS_ALTERNATE(disp_attr_cm)) {
     if(config.serial || config.test) {
-      printf("%c", 15);
+      disp_printf("%c", 15);
     }
     else {
-      printf("\033[10m");
+      disp_printf("\033[10m");
     }
     disp_attr_cm &= 0x7f;
   }
@@ -316,86 +372,91 @@ void disp_toggle_output(int state)
 
 void disp_save_area(window_t *win)
 {
-  int i, x_len, y_len;
+  int y, x_len, y_len;
+  unsigned len;
 
-  x_len = win->x_right - win->x_left + 1;
-  y_len = win->y_right - win->y_left + 1;
-
-  if(win->shadow) {
-    x_len += 2;
-    y_len++;
-  }
-
-  if(x_len < 1 || y_len < 1) return;
-
-  if(x_len + win->x_left > max_x_ig) x_len = max_x_ig - win->x_left + 1;
-
-  if(y_len + win->y_left > max_y_ig) y_len = max_y_ig - win->y_left + 1;
+  if(!disp_area(win, &x_len, &y_len)) return;
 
 //  log_info("save area at %d x %d (size %d x %d)\n", win->x_left, win->y_left, x_len, y_len);
 
-//  dump_screen("save area, start");
+  len = x_len * y_len;
 
-  win->save_area = malloc(sizeof (character_t *) * y_len);
+  if(disp_pool.used + len > disp_pool.size && !disp_pool.count) {
+    disp_pool.size = len;
+    disp_pool.buf = realloc(disp_pool.buf, sizeof (character_t) * disp_pool.size);
+  }
 
-  for(i = 0; i < y_len; i++) {
-    win->save_area[i] = malloc(sizeof (character_t) * x_len);
+  if(disp_pool.used + len <= disp_pool.size) {
+    win->save_area = disp_pool.buf + disp_pool.used;
+    disp_pool.used += len;
+    disp_pool.count++;
+  }
+  else {
+    win->save_area = malloc(sizeof (character_t) * len);
+  }
+
+  for(y = 0; y < y_len; y++) {
     memcpy(
-      win->save_area[i],
-      &disp_screen_aprm[win->y_left + i - 1][win->x_left - 1],
+      win->save_area + y * x_len,
+      &disp_screen_aprm[win->y_left + y - 1][win->x_left - 1],
       sizeof (character_t) * x_len
     );
   }
-
-//  dump_screen("save area, end");
 }
 
 
+/*
+ * Put saved area back into the screen buffer and redraw what changed.
+ */
 void disp_restore_area(window_t *win)
 {
-  int x, x_len;
-  int y, y_len;
-  char save_attr;
+  int y, x_len, y_len;
+  unsigned len;
 
   disp_toggle_output(DISP_ON);
-  save_attr = disp_attr_cm;
 
-  x_len = win->x_right - win->x_left + 1;
-  y_len = win->y_right - win->y_left + 1;
+  if(!disp_area(win, &x_len, &y_len)) return;
 
-  if(win->shadow) {
-    x_len += 2;
-    y_len++;
+  for(y = 0; y < y_len; y++) {
+    memcpy(
+      &disp_screen_aprm[win->y_left + y - 1][win->x_left - 1],
+      win->save_area + y * x_len,
+      sizeof (character_t) * x_len
+    );
+    disp_damage(win->x_left, win->y_left + y, x_len);
   }
 
-  if(x_len < 1 || y_len < 1) return;
+  disp_frame();
 
-  if(x_len + win->x_left > max_x_ig) x_len = max_x_ig - win->x_left + 1;
-  if(y_len + win->y_left > max_y_ig) y_len = max_y_ig - win->y_left + 1;
+  len = x_len * y_len;
 
-  for(y = 0; y < y_len; y++) {
-    disp_gotoxy(win->x_left, win->y_left + y);
-    for(x = 0; x < x_len;) {
-      disp_set_attr(win->save_area[y][x].attr);
-      x += disp_write_char(win->save_area[y][x].c);
-    }
+  if(win->save_area >= disp_pool.buf && win->save_area < disp_pool.buf + disp_pool.size) {
+    // areas closed out of order are reclaimed once all windows are gone
+    if(win->save_area + len == disp_pool.buf + disp_pool.used) disp_pool.used -= len;
+    if(!--disp_pool.count) disp_pool.used = 0;
+  }
+  else {
+    free(win->save_area);
   }
-  fflush(stdout);
-
-  for(y = 0; y < y_len; y++) free(win->save_area[y]);
-  free(win->save_area);
 
-  disp_set_attr(save_attr);
+  win->save_area = NULL;
 }
 
 
+/*
+ * Show window drawn while output was off.
+ */
 void disp_flush_area(window_t *win)
 {
-  window_t tmp_win;
+  int y, x_len, y_len;
 
-  tmp_win = *win;
-  disp_save_area(&tmp_win);
-  disp_restore_area(&tmp_win);
+  disp_toggle_output(DISP_ON);
+
+  if(!disp_area(win, &x_len, &y_len)) return;
+
+  for(y = 0; y < y_len; y++) disp_damage(win->x_left, win->y_left + y, x_len);
+
+  disp_frame();
 }
 
 
@@ -442,27 +503,24 @@ void disp_set_display()
 
 void disp_restore_screen()
 {
-  int x, y;
+  int y;
 
   log_info("restore screen\n");
 
-  disp_x_im = 0;
+  // someone else wrote to the terminal; we can't trust it anymore
+  disp_invalidate();
 
-  for(y = 0; y < max_y_ig; y++) {
-    disp_gotoxy(1, y + 1);
-    for(x = 0; x < max_x_ig; x++) {
-      disp_set_attr(disp_screen_aprm[y][x].attr);
-      disp_write_char(disp_screen_aprm[y][x].c);
-    }
-  }
+  for(y = 0; y < max_y_ig; y++) disp_damage(1, y + 1, max_x_ig);
 
-  fflush(stdout);
+  disp_frame();
 }
 
 
 void disp_clear_screen()
 {
   printf("\033[H\033[J");
+
+  if(disp_screen_aprm) disp_invalidate();
 }
 
 
@@ -471,8 +529,8 @@ void disp_clear_screen()
  */
 void disp_write_utf32string(int *str)
 {
-  int i, j, len, buf_len, width;
-  unsigned char *buf;
+  int i, len, buf_len, width;
+  unsigned char tmp[4 * MAX_X + 1], *buf;
 
   if(
     disp_x_im > 0 &&
@@ -483,27 +541,18 @@ void disp_write_utf32string(int *str)
     len = utf32_len(str);
 
     if(disp_state_im == DISP_ON) {
-      buf = malloc(buf_len = len * 6 + 1);
+      buf_len = len * 6 + 1;
+      buf = buf_len > (int) sizeof tmp ? malloc(buf_len) : tmp;
       utf32_to_utf8(buf, buf_len, str);
-      printf("%s", buf);
-      free(buf);
+      disp_printf("%s", buf);
+      if(buf != tmp) free(buf);
     }
 
     for(i = 0; i < len; i++) {
-
-      width = 1;
-
       width = utf32_char_width(str[i]);
       if(!width) width = 1;
 
-      if(disp_x_im <= max_x_ig) {
-        disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].attr = disp_attr_cm;
-        disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].c = str[i];
-        for(j = 1; j < width; j++) {
-          disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + j].attr = disp_attr_cm;
-          disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + j].c = 0;
-        }
-      }
+      if(disp_x_im <= max_x_ig) disp_put(str[i], width);
 
       disp_x_im += width;
     }
@@ -518,20 +567,21 @@ void disp_write_utf32string(int *str)
  */
 void disp_write_string(char *str)
 {
-  int len, *buf;
+  int len, tmp[MAX_X + 1], *buf;
 
 //  log_info("[* <%s>", str);
 //  getchar();
 
   len = strlen(str) + 1;
 
-  buf = malloc(len * sizeof *buf);
+  /* short strings (the usual case) don't need a buffer */
+  buf = len > (int) (sizeof tmp / sizeof *tmp) ? malloc(len * sizeof *buf) : tmp;
   utf8_to_utf32(buf, len, str);
   disp_write_utf32string(buf);
 
 //  log_info("#]\n");
 
-  free(buf);
+  if(buf != tmp) free(buf);
 }
 
 
@@ -540,7 +590,7 @@ void disp_write_string(char *str)
  */
 int disp_write_char(int c)
 {
-  int i, width = 1;
+  int width = 1;
 
   if(
     disp_x_im > 0 &&
@@ -548,21 +598,192 @@ int disp_write_char(int c)
     disp_y_im > 0 &&
     disp_y_im <= max_y_ig
   ) {
-    if(disp_state_im == DISP_ON && c) printf("%s", utf8_encode(c));
+    if(disp_state_im == DISP_ON && c) disp_printf("%s", utf8_encode(c));
 
     width = utf32_char_width(c);
     if(!width) width = 1;
 
-    disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].attr = disp_attr_cm;
-    disp_screen_aprm[disp_y_im - 1][disp_x_im - 1].c = c;
-
-    for(i = 1; i < width; i++) {
-      disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + i].attr = disp_attr_cm;
-      disp_screen_aprm[disp_y_im - 1][disp_x_im - 1 + i].c = 0;
-    }
+    disp_put(c, width);
 
     disp_x_im += width;
   }
 
   return width;
 }
+
+
+/*
+ * Output escape sequences and text; collected into a single write() while
+ * disp_frame() is running.
+ */
+void disp_printf(char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  if(disp_out.active) {
+    char *s = NULL;
+    int len = vasprintf(&s, format, args);
+
+    if(len > 0) membuf_add(&disp_out.buf, s, len);
+    free(s);
+  }
+  else {
+    vprintf(format, args);
+  }
+  va_end(args);
+}
+
+
+/*
+ * Store char at cursor position.
+ *
+ * If output is on, the terminal now shows it as well; else remember to
+ * redraw the cells later.
+ */
+void disp_put(int c, int width)
+{
+  int i, x = disp_x_im - 1, y = disp_y_im - 1;
+
+  if(x + width > max_x_ig) width = max_x_ig - x;
+
+  for(i = 0; i < width; i++) {
+    disp_screen_aprm[y][x + i].attr = disp_attr_cm;
+    disp_screen_aprm[y][x + i].c = i ? 0 : c;
+    if(disp_state_im == DISP_ON) disp_front_aprm[y][x + i] = disp_screen_aprm[y][x + i];
+  }
+
+  if(disp_state_im != DISP_ON) disp_damage(x + 1, y + 1, width);
+}
+
+
+/*
+ * Mark len cells starting at x, y (1-based) as needing a redraw.
+ */
+void disp_damage(int x, int y, int len)
+{
+  if(y < 1 || y > max_y_ig || len < 1) return;
+
+  x--;
+  y--;
+
+  if(!disp_damage_arm[y].x_max) {
+    disp_damage_arm[y].x_min = x;
+    disp_damage_arm[y].x_max = x + len;
+  }
+  else {
+    if(x < disp_damage_arm[y].x_min) disp_damage_arm[y].x_min = x;
+    if(x + len > disp_damage_arm[y].x_max) disp_damage_arm[y].x_max = x + len;
+  }
+
+  if(disp_damage_arm[y].x_max > max_x_ig) disp_damage_arm[y].x_max = max_x_ig;
+}
+
+
+/*
+ * Forget what is on the terminal; damaged cells are then always redrawn.
+ */
+void disp_invalidate()
+{
+  int y;
+
+  for(y = 0; y < max_y_ig; y++) {
+    memset(disp_front_aprm[y], 0xff, sizeof (character_t) * max_x_ig);
+  }
+}
+
+
+/*
+ * Window area including shadow, clipped to the screen.
+ *
+ * Return 0 if there's nothing left.
+ */
+int disp_area(window_t *win, int *x_len, int *y_len)
+{
+  *x_len = win->x_right - win->x_left + 1;
+  *y_len = win->y_right - win->y_left + 1;
+
+  if(win->shadow) {
+    *x_len += 2;
+    (*y_len)++;
+  }
+
+  if(*x_len < 1 || *y_len < 1) return 0;
+
+  if(*x_len + win->x_left > max_x_ig) *x_len = max_x_ig - win->x_left + 1;
+  if(*y_len + win->y_left > max_y_ig) *y_len = max_y_ig - win->y_left + 1;
+
+  return 1;
+}
+
+
+/*
+ * Bring the terminal in sync with the screen buffer.
+ *
+ * Only damaged cells that differ from what the terminal shows are sent;
+ * short unchanged gaps are rewritten rather than moving the cursor, and
+ * the whole update goes out in one write().
+ */
+void disp_frame()
+{
+  int x, y, x_end, n, cells = 0;
+  int save_state;
+  char save_attr;
+  character_t *back, *front;
+
+  if(!disp_screen_aprm) return;
+
+  fflush(stdout);
+
+  disp_out.active = 1;
+  disp_out.buf.len = 0;
+
+  save_attr = disp_attr_cm;
+  save_state = disp_state_im;
+  disp_state_im = DISP_ON;
+  disp_x_im = 0;
+
+  for(y = 0; y < max_y_ig; y++) {
+    if(!disp_damage_arm[y].x_max) continue;
+
+    back = disp_screen_aprm[y];
+    front = disp_front_aprm[y];
+    x = disp_damage_arm[y].x_min;
+    x_end = disp_damage_arm[y].x_max;
+    disp_damage_arm[y].x_min = disp_damage_arm[y].x_max = 0;
+
+    while(x < x_end) {
+      if(DISP_SAME(back[x], front[x])) {
+        x++;
+        continue;
+      }
+
+      // start at the first column of a wide char
+      if(x > 0 && !back[x].c) x--;
+
+      disp_gotoxy(x + 1, y + 1);
+
+      for(;;) {
+        disp_set_attr(back[x].attr);
+        x += disp_write_char(back[x].c);
+        cells++;
+
+        // continue if the next change is close enough
+        for(n = x; n < x_end && n < x + DISP_GAP && DISP_SAME(back[n], front[n]); n++);
+        if(n >= x_end || n == x + DISP_GAP) break;
+      }
+    }
+  }
+
+  disp_set_attr(save_attr);
+
+  disp_state_im = save_state;
+  disp_out.active = 0;
+
+  if(disp_out.buf.len) {
+    log_debug("redraw: %d cells, %d bytes\n", cells, (int) disp_out.buf.len);
+    /* keep it in order with the queued console output */
+    fwrite(disp_out.buf.data, disp_out.buf.len, 1, stdout);
+    fflush(stdout);
+  }
+}
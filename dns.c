@@ -0,0 +1,636 @@
+/*
+ *
+ * dns.c         Name resolver
+ *
+ * A and AAAA queries are sent in parallel to all name servers listed in
+ * /etc/resolv.conf; lost packets are resent with exponential backoff.
+ * Answers are kept in a hashed cache until their TTL expires.
+ *
+ * /etc/hosts is checked first. If no name server answers, the system
+ * resolver (getaddrinfo()) is tried as last resort.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+
+#include "global.h"
+#include "util.h"
+#include "dns.h"
+
+#define DNS_HASH_SIZE		64	/* must be a power of 2 */
+#define DNS_MAX_SERVERS		4
+#define DNS_MAX_SEARCH		6
+#define DNS_RETRY_MS		250	/* first retransmit, doubled each time */
+#define DNS_TRIES		5	/* 250 + 500 + ... + 4000 ms */
+#define DNS_DEFAULT_TTL		300	/* for /etc/hosts & getaddrinfo() */
+#define DNS_MIN_TTL		10
+
+#define DNS_TYPE_A		1
+#define DNS_TYPE_CNAME		5
+#define DNS_TYPE_AAAA		28
+
+#define DNS_RCODE_NXDOMAIN	3
+
+typedef struct dns_entry_s {
+  struct dns_entry_s *next;
+  char *name;
+  unsigned families;		/* DNS_IPV4/DNS_IPV6 looked up */
+  unsigned found;		/* DNS_IPV4/DNS_IPV6 found */
+  struct in_addr ip4;
+  struct in6_addr ip6;
+  long expires;			/* monotonic time in s */
+} dns_entry_t;
+
+/* one A or AAAA query */
+typedef struct {
+  unsigned type;
+  unsigned id;
+  unsigned done:1;
+  unsigned errors;		/* servers that failed */
+  unsigned len;
+  unsigned char pkt[300];
+} dns_query_t;
+
+typedef struct {
+  unsigned servers;
+  struct sockaddr_storage server[DNS_MAX_SERVERS];
+  unsigned searches;
+  char *search[DNS_MAX_SEARCH];
+} dns_conf_t;
+
+static unsigned dns_hash(char *name);
+static long dns_now(void);
+static dns_entry_t *dns_cache_get(char *name, unsigned families);
+static void dns_cache_put(dns_entry_t *res, unsigned ttl);
+static int dns_hosts(char *name, dns_entry_t *res);
+static void dns_read_conf(dns_conf_t *conf);
+static void dns_free_conf(dns_conf_t *conf);
+static int dns_query(dns_conf_t *conf, char *name, dns_entry_t *res, unsigned *ttl);
+static int dns_build_query(dns_query_t *q, char *name);
+static int dns_parse(dns_query_t *q, unsigned char *buf, int len, dns_entry_t *res, unsigned *ttl);
+static int dns_skip_name(unsigned char *buf, int len, int pos);
+static int dns_getaddrinfo(char *name, dns_entry_t *res);
+
+static dns_entry_t *dns_cache[DNS_HASH_SIZE];
+
+
+/*
+ * Look up name.
+ *
+ * families: DNS_IPV4 and/or DNS_IPV6; ip4/ip6 get the first address found.
+ *
+ * Return families found.
+ */
+int dns_lookup(char *name, unsigned families, struct in_addr *ip4, struct in6_addr *ip6)
+{
+  dns_entry_t *de, res = { };
+  dns_conf_t conf = { };
+  slist_t *sl, *names = NULL;
+  unsigned ttl = 0, u;
+  char *fqdn = NULL, buf[INET6_ADDRSTRLEN];
+  int i, dots, err = -1, absolute;
+
+  if(!name || !*name || !families) return 0;
+
+  if((de = dns_cache_get(name, families))) {
+    if(ip4) *ip4 = de->ip4;
+    if(ip6) *ip6 = de->ip6;
+
+    return de->found & families;
+  }
+
+  res.name = name;
+  res.families = families;
+
+  if(dns_hosts(name, &res)) {
+    ttl = DNS_DEFAULT_TTL;
+  }
+  else {
+    dns_read_conf(&conf);
+
+    for(dots = 0, i = 0; name[i]; i++) if(name[i] == '.') dots++;
+    absolute = i && name[i - 1] == '.';
+
+    /* like glibc with 'ndots:1': names without dot try the search list first */
+    if(absolute || dots) slist_append_str(&names, name);
+    for(u = 0; u < conf.searches && !absolute; u++) {
+      strprintf(&fqdn, "%s.%s", name, conf.search[u]);
+      slist_append_str(&names, fqdn);
+    }
+    if(!absolute && !dots) slist_append_str(&names, name);
+
+    for(sl = names; sl && conf.servers; sl = sl->next) {
+      err = dns_query(&conf, sl->key, &res, &ttl);
+      if(err || res.found) break;
+    }
+
+    slist_free(names);
+    str_copy(&fqdn, NULL);
+    dns_free_conf(&conf);
+
+    if(err && !res.found && dns_getaddrinfo(name, &res)) ttl = DNS_DEFAULT_TTL;
+  }
+
+  if(config.run_as_linuxrc) {
+    if((families & DNS_IPV6)) {
+      if((res.found & DNS_IPV6) && inet_ntop(AF_INET6, &res.ip6, buf, sizeof buf)) {
+        log_info("dns6: %s is %s\n", name, buf);
+      }
+      else {
+        log_info("dns6: what is \"%s\"?\n", name);
+      }
+    }
+    if((families & DNS_IPV4)) {
+      if((res.found & DNS_IPV4) && inet_ntop(AF_INET, &res.ip4, buf, sizeof buf)) {
+        log_info("dns: %s is %s\n", name, buf);
+      }
+      else {
+        log_info("dns: what is \"%s\"?\n", name);
+      }
+    }
+  }
+
+  // failed lookups are not cached; network may just not be ready
+  if(res.found) dns_cache_put(&res, ttl);
+
+  if(ip4) *ip4 = res.ip4;
+  if(ip6) *ip6 = res.ip6;
+
+  return res.found;
+}
+
+
+/*
+ * Add name resolution for host to list of curl resolve entries
+ * ('host:port:addr'), so curl doesn't resolve again.
+ *
+ * Return new list.
+ */
+struct curl_slist *dns_curl_resolve(struct curl_slist *list, char *host, unsigned port)
+{
+  struct in_addr ip4;
+  struct in6_addr ip6;
+  unsigned families = 0, found;
+  char *buf = NULL, addr4[INET_ADDRSTRLEN], addr6[INET6_ADDRSTRLEN];
+
+  if(!host || !port || strchr(host, ':') || inet_pton(AF_INET, host, &ip4) > 0) return list;
+
+  if(config.net.ipv4) families |= DNS_IPV4;
+  if(config.net.ipv6) families |= DNS_IPV6;
+
+  if(!(found = dns_lookup(host, families, &ip4, &ip6))) return list;
+
+  if(!inet_ntop(AF_INET, &ip4, addr4, sizeof addr4)) found &= ~DNS_IPV4;
+  if(!inet_ntop(AF_INET6, &ip6, addr6, sizeof addr6)) found &= ~DNS_IPV6;
+
+  if(found == (DNS_IPV4 | DNS_IPV6)) {
+    strprintf(&buf, "%s:%u:[%s],%s", host, port, addr6, addr4);
+  }
+  else if(found == DNS_IPV6) {
+    strprintf(&buf, "%s:%u:[%s]", host, port, addr6);
+  }
+  else if(found == DNS_IPV4) {
+    strprintf(&buf, "%s:%u:%s", host, port, addr4);
+  }
+
+  if(buf) {
+    if(config.debug >= 2) log_debug("curl resolve: %s\n", buf);
+    list = curl_slist_append(list, buf);
+    str_copy(&buf, NULL);
+  }
+
+  return list;
+}
+
+
+/*
+ * Forget all cached answers.
+ */
+void dns_cache_clear()
+{
+  dns_entry_t *de, *next;
+  unsigned u;
+
+  for(u = 0; u < DNS_HASH_SIZE; u++) {
+    for(de = dns_cache[u]; de; de = next) {
+      next = de->next;
+      free(de->name);
+      free(de);
+    }
+    dns_cache[u] = NULL;
+  }
+}
+
+
+unsigned dns_hash(char *name)
+{
+  unsigned hash = 2166136261u;
+
+  for(; *name; name++) {
+    hash = (hash ^ tolower(*(unsigned char *) name)) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+long dns_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec;
+}
+
+
+/*
+ * Find unexpired cache entry for name that covers families.
+ *
+ * Expired entries are removed.
+ */
+dns_entry_t *dns_cache_get(char *name, unsigned families)
+{
+  dns_entry_t *de, **p;
+  long now = dns_now();
+
+  for(p = &dns_cache[dns_hash(name) & (DNS_HASH_SIZE - 1)]; (de = *p);) {
+    if(de->expires <= now) {
+      *p = de->next;
+      free(de->name);
+      free(de);
+      continue;
+    }
+    if(!strcasecmp(de->name, name) && (de->families & families) == families) return de;
+    p = &de->next;
+  }
+
+  return NULL;
+}
+
+
+void dns_cache_put(dns_entry_t *res, unsigned ttl)
+{
+  dns_entry_t *de;
+  unsigned hash;
+
+  if(ttl < DNS_MIN_TTL) ttl = DNS_MIN_TTL;
+
+  hash = dns_hash(res->name) & (DNS_HASH_SIZE - 1);
+
+  de = malloc(sizeof *de);
+  *de = *res;
+  de->name = strdup(res->name);
+  de->expires = dns_now() + ttl;
+  de->next = dns_cache[hash];
+  dns_cache[hash] = de;
+}
+
+
+/*
+ * Look up name in /etc/hosts.
+ *
+ * Return 1 if found.
+ */
+int dns_hosts(char *name, dns_entry_t *res)
+{
+  FILE *f;
+  char buf[1024], *s, *addr, *save;
+  struct in_addr ip4;
+  struct in6_addr ip6;
+
+  if(!(f = fopen("/etc/hosts", "r"))) return 0;
+
+  while(fgets(buf, sizeof buf, f)) {
+    if((s = strchr(buf, '#'))) *s = 0;
+    if(!(addr = strtok_r(buf, " \t\n", &save))) continue;
+    while((s = strtok_r(NULL, " \t\n", &save))) {
+      if(strcasecmp(s, name)) continue;
+      if((res->families & DNS_IPV6) && !(res->found & DNS_IPV6) && inet_pton(AF_INET6, addr, &ip6) > 0) {
+        res->ip6 = ip6;
+        res->found |= DNS_IPV6;
+      }
+      if((res->families & DNS_IPV4) && !(res->found & DNS_IPV4) && inet_pton(AF_INET, addr, &ip4) > 0) {
+        res->ip4 = ip4;
+        res->found |= DNS_IPV4;
+      }
+      break;
+    }
+  }
+
+  fclose(f);
+
+  return res->found ? 1 : 0;
+}
+
+
+/*
+ * Get name servers and search list.
+ *
+ * Name servers are taken from /etc/resolv.conf, plus our own config if
+ * resolv.conf has not been written yet.
+ */
+void dns_read_conf(dns_conf_t *conf)
+{
+  FILE *f;
+  char buf[1024], *key, *s, *save;
+  struct sockaddr_in *sa4;
+  struct sockaddr_in6 *sa6;
+  unsigned u;
+
+  if((f = fopen("/etc/resolv.conf", "r"))) {
+    while(fgets(buf, sizeof buf, f)) {
+      if(!(key = strtok_r(buf, " \t\n", &save))) continue;
+      if(!strcmp(key, "nameserver") && (s = strtok_r(NULL, " \t\n", &save))) {
+        if(conf->servers >= DNS_MAX_SERVERS) continue;
+        sa4 = (struct sockaddr_in *) &conf->server[conf->servers];
+        sa6 = (struct sockaddr_in6 *) &conf->server[conf->servers];
+        if(inet_pton(AF_INET, s, &sa4->sin_addr) > 0) {
+          sa4->sin_family = AF_INET;
+          sa4->sin_port = htons(53);
+          conf->servers++;
+        }
+        else if(inet_pton(AF_INET6, s, &sa6->sin6_addr) > 0) {
+          sa6->sin6_family = AF_INET6;
+          sa6->sin6_port = htons(53);
+          conf->servers++;
+        }
+      }
+      else if(!strcmp(key, "search") || !strcmp(key, "domain")) {
+        // the last entry wins
+        for(u = 0; u < conf->searches; u++) free(conf->search[u]);
+        conf->searches = 0;
+        while((s = strtok_r(NULL, " \t\n", &save)) && conf->searches < DNS_MAX_SEARCH) {
+          conf->search[conf->searches++] = strdup(s);
+        }
+      }
+    }
+    fclose(f);
+  }
+
+  if(!conf->servers) {
+    for(u = 0; u < config.net.nameservers && u < DNS_MAX_SERVERS; u++) {
+      if(!config.net.nameserver[u].ok) continue;
+      sa4 = (struct sockaddr_in *) &conf->server[conf->servers];
+      sa6 = (struct sockaddr_in6 *) &conf->server[conf->servers];
+      if(config.net.nameserver[u].ipv4) {
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons(53);
+        sa4->sin_addr = config.net.nameserver[u].ip;
+        conf->servers++;
+      }
+      else if(config.net.nameserver[u].ipv6) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(53);
+        sa6->sin6_addr = config.net.nameserver[u].ip6;
+        conf->servers++;
+      }
+    }
+  }
+}
+
+
+void dns_free_conf(dns_conf_t *conf)
+{
+  unsigned u;
+
+  for(u = 0; u < conf->searches; u++) free(conf->search[u]);
+  conf->searches = 0;
+}
+
+
+/*
+ * Send A and AAAA queries for name to all servers and wait for answers.
+ *
+ * Return:
+ *   0: got answers (res->found may still be 0: name does not exist)
+ *  -1: no answer
+ */
+int dns_query(dns_conf_t *conf, char *name, dns_entry_t *res, unsigned *ttl)
+{
+  dns_query_t query[2];
+  struct pollfd fds[DNS_MAX_SERVERS];
+  unsigned char buf[1500];
+  unsigned queries = 0, u, v, sockets = 0, pending;
+  int i, len, try, timeout;
+  long end;
+  struct timespec ts;
+
+  memset(query, 0, sizeof query);
+
+  if((res->families & DNS_IPV6)) query[queries++].type = DNS_TYPE_AAAA;
+  if((res->families & DNS_IPV4)) query[queries++].type = DNS_TYPE_A;
+
+  for(u = 0; u < queries; u++) {
+    if(dns_build_query(&query[u], name)) return -1;
+  }
+
+  for(u = 0; u < conf->servers; u++) {
+    i = socket(conf->server[u].ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(i == -1) continue;
+    if(connect(i, (struct sockaddr *) &conf->server[u], sizeof conf->server[u])) {
+      close(i);
+      continue;
+    }
+    fds[sockets].fd = i;
+    fds[sockets++].events = POLLIN;
+  }
+
+  for(pending = queries, try = 0; pending && try < DNS_TRIES && sockets; try++) {
+    for(u = 0; u < queries; u++) {
+      if(query[u].done) continue;
+      for(v = 0; v < sockets; v++) send(fds[v].fd, query[u].pkt, query[u].len, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    end = ts.tv_sec * 1000L + ts.tv_nsec / 1000000 + (DNS_RETRY_MS << try);
+
+    while(pending) {
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      timeout = end - (ts.tv_sec * 1000L + ts.tv_nsec / 1000000);
+      if(timeout <= 0 || poll(fds, sockets, timeout) <= 0) break;
+
+      for(v = 0; v < sockets; v++) {
+        if(!(fds[v].revents & (POLLIN | POLLERR))) continue;
+        while((len = recv(fds[v].fd, buf, sizeof buf, 0)) > 0) {
+          for(u = 0; u < queries; u++) {
+            if(query[u].done) continue;
+            i = dns_parse(&query[u], buf, len, res, ttl);
+            // server error: give up if all servers failed
+            if(i == 2 && ++query[u].errors < sockets) i = -1;
+            if(i >= 0) {
+              query[u].done = 1;
+              pending--;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  for(v = 0; v < sockets; v++) close(fds[v].fd);
+
+  return pending == queries ? -1 : 0;
+}
+
+
+/*
+ * Build query packet.
+ *
+ * Return 0 if ok.
+ */
+int dns_build_query(dns_query_t *q, char *name)
+{
+  unsigned char *p = q->pkt;
+  unsigned short id;
+  char *s;
+  int len;
+
+  if(getrandom(&id, sizeof id, 0) != sizeof id) id = random();
+
+  q->id = id;
+
+  *p++ = id >> 8;
+  *p++ = id;
+  *p++ = 0x01;		// RD
+  *p++ = 0;
+  *p++ = 0; *p++ = 1;	// 1 question
+  memset(p, 0, 6);
+  p += 6;
+
+  while(*name) {
+    len = (s = strchr(name, '.')) ? s - name : (int) strlen(name);
+    if(len == 0 || len > 63 || p + len + 6 > q->pkt + 256 + 12) return 1;
+    *p++ = len;
+    memcpy(p, name, len);
+    p += len;
+    name += len;
+    if(*name) name++;
+  }
+
+  *p++ = 0;
+  *p++ = q->type >> 8;
+  *p++ = q->type;
+  *p++ = 0;
+  *p++ = 1;		// class IN
+
+  q->len = p - q->pkt;
+
+  return 0;
+}
+
+
+/*
+ * Parse answer.
+ *
+ * Return:
+ *  -1: not an answer to query q
+ *   0: done, no data
+ *   1: done, got address
+ *   2: server error
+ */
+int dns_parse(dns_query_t *q, unsigned char *buf, int len, dns_entry_t *res, unsigned *ttl)
+{
+  int pos, rcode, answers, type, rlen, found = 0;
+  unsigned rttl;
+
+  if(len < 12 || (unsigned) ((buf[0] << 8) + buf[1]) != q->id || !(buf[2] & 0x80)) return -1;
+
+  // must be the same question
+  if((unsigned) len < q->len || memcmp(buf + 12, q->pkt + 12, q->len - 12)) return -1;
+
+  rcode = buf[3] & 0x0f;
+  if(rcode == DNS_RCODE_NXDOMAIN) return 0;
+  if(rcode) return 2;
+
+  answers = (buf[6] << 8) + buf[7];
+  pos = q->len;
+
+  for(; answers-- > 0; pos += rlen) {
+    if((pos = dns_skip_name(buf, len, pos)) < 0 || pos + 10 > len) break;
+    type = (buf[pos] << 8) + buf[pos + 1];
+    rttl = (buf[pos + 4] << 24) + (buf[pos + 5] << 16) + (buf[pos + 6] << 8) + buf[pos + 7];
+    rlen = (buf[pos + 8] << 8) + buf[pos + 9];
+    pos += 10;
+    if(pos + rlen > len) break;
+
+    if(type != q->type && type != DNS_TYPE_CNAME) continue;
+
+    if(!*ttl || rttl < *ttl) *ttl = rttl;
+
+    if(found) continue;
+
+    if(type == DNS_TYPE_A && rlen == 4) {
+      memcpy(&res->ip4, buf + pos, 4);
+      res->found |= DNS_IPV4;
+      found = 1;
+    }
+    else if(type == DNS_TYPE_AAAA && rlen == 16) {
+      memcpy(&res->ip6, buf + pos, 16);
+      res->found |= DNS_IPV6;
+      found = 1;
+    }
+  }
+
+  return found;
+}
+
+
+/*
+ * Return position after name or -1.
+ */
+int dns_skip_name(unsigned char *buf, int len, int pos)
+{
+  while(pos < len) {
+    if(!buf[pos]) return pos + 1;
+    if((buf[pos] & 0xc0) == 0xc0) return pos + 2 <= len ? pos + 2 : -1;
+    pos += buf[pos] + 1;
+  }
+
+  return -1;
+}
+
+
+/*
+ * Ask system resolver.
+ *
+ * Return 1 if found.
+ */
+int dns_getaddrinfo(char *name, dns_entry_t *res)
+{
+  struct addrinfo hints = { .ai_socktype = SOCK_STREAM }, *ai0, *ai;
+
+  if(getaddrinfo(name, NULL, &hints, &ai0)) return 0;
+
+  for(ai = ai0; ai; ai = ai->ai_next) {
+    if(ai->ai_family == AF_INET6 && (res->families & DNS_IPV6) && !(res->found & DNS_IPV6)) {
+      res->ip6 = ((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr;
+      res->found |= DNS_IPV6;
+    }
+    if(ai->ai_family == AF_INET && (res->families & DNS_IPV4) && !(res->found & DNS_IPV4)) {
+      res->ip4 = ((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+      res->found |= DNS_IPV4;
+    }
+  }
+
+  freeaddrinfo(ai0);
+
+  return res->found ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#define DNS_IPV4	(1 << 0)
+#define DNS_IPV6	(1 << 1)
+
+struct curl_slist;
+
+int dns_lookup(char *name, unsigned families, struct in_addr *ip4, struct in6_addr *ip6);
+struct curl_slist *dns_curl_resolve(struct curl_slist *list, char *host, unsigned port);
+void dns_cache_clear(void);
@@ -34,6 +34,7 @@
 #include "display.h"
 #include "keyboard.h"
 #include "url.h"
+#include "console.h"
 
 #define YAST_INF_FILE		"/etc/yast.inf"
 #define INSTALL_INF_FILE	"/etc/install.inf"
@@ -282,6 +283,8 @@ static struct {
   { key_devbyid,        "devbyid",        kf_cfg + kf_cmd_early          },
   { key_braille,        "braille",        kf_cfg + kf_cmd_early          },
   { key_nfsopts,        "nfs.opts",       kf_cfg + kf_cmd                },
+  { key_nfsperf,        "nfs.perf",       kf_cfg + kf_cmd                },
+  { key_headless,       "Headless",       kf_cfg + kf_cmd + kf_cmd_early },
   { key_ipv4,           "ipv4",           kf_cfg + kf_cmd + kf_cmd_early },
   { key_ipv4only,       "ipv4only",       kf_cfg + kf_cmd + kf_cmd_early },
   { key_ipv6,           "ipv6",           kf_cfg + kf_cmd + kf_cmd_early },
@@ -310,6 +313,7 @@ static struct {
   { key_debugshell,     "DebugShell",     kf_cfg + kf_cmd + kf_cmd_early },
   { key_self_update,    "SelfUpdate",     kf_cfg + kf_cmd                },
   { key_ibft_devices,   "IBFTDevices",    kf_cfg + kf_cmd                },
+  { key_downloadcache,  "DownloadCache",  kf_cfg + kf_cmd                },
 };
 
 static struct {
@@ -977,7 +981,7 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
           if(!config.console || strcmp(config.console, f->value)) {
             str_copy(&config.console, f->value);
             freopen(config.console, "r", stdin);
-            freopen(config.console, "a", stdout);
+            con_reopen(config.console);
           }
         }
         break;
@@ -1039,6 +1043,10 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         config.utf8 = config.linemode ? 0 : 1;
         break;
 
+      case key_headless:
+        if(f->is.numeric) config.headless = f->nvalue;
+        break;
+
       case key_moduledelay:
         if(f->is.numeric) config.module.delay = f->nvalue;
         break;
@@ -1079,6 +1087,7 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
               else if(!strcmp(s, "trace")) config.error_trace = i;
               else if(!strcmp(s, "bash")) config.early_bash = i;
               else if(!strcmp(s, "devtmpfs")) config.devtmpfs = i;
+              else if(!strcmp(s, "overlay")) config.parts_overlay = i;
             }
           }
         }
@@ -1430,6 +1439,7 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
               FD_ZERO(&fds);
               FD_SET(0, &fds);
 
+              con_sync();
               write(1, "\xff\xfb\03\xff\xfb\x01", 6);
               if(select(1, &fds, NULL, NULL, &timeout)) {
                 read(0, buf, 10);
@@ -1515,11 +1525,7 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         if(*f->value) {
           sl0 = slist_split(' ', f->value);
           if(sl0->key && sl0->next && sl0->next->next) {
-            sl = slist_append_str(&config.digests.list, sl0->key);
-            strprintf(&sl->key, "%s %s", sl->key, sl0->next->key);
-            sl->value = strdup(sl0->next->next->key);
-            // key = 'SHAXXX <shaxxx_sum>'
-            // value = '<file name>'
+            url_digest_add(sl0->key, sl0->next->key, sl0->next->next->key);
           }
           slist_free(sl0);
         }
@@ -1628,6 +1634,10 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         }
         break;
 
+      case key_nfsperf:
+        if(f->is.numeric) config.net.nfs.perf = f->nvalue;
+        break;
+
       case key_ipv4:
         if(f->is.numeric) config.net.ipv4 = f->nvalue;
         break;
@@ -1773,6 +1783,27 @@ void file_do_info(file_t *f0, file_key_flag_t flags)
         slist_assign_values(&config.ifcfg.ibft, f->value);
         break;
 
+      case key_downloadcache:
+        /*
+         * 0: no cache, 1: cache in memory, else: device or directory
+         * (cache survives reboots)
+         */
+        config.download.cache_ready = 0;
+        config.download.cache_on_disk = 0;
+        if(f->is.numeric) {
+          if(f->nvalue) {
+            strprintf(&config.download.cache, "%s/cache", config.download.base);
+          }
+          else {
+            str_copy(&config.download.cache, NULL);
+          }
+        }
+        else if(*f->value) {
+          str_copy(&config.download.cache, f->value);
+          config.download.cache_on_disk = 1;
+        }
+        break;
+
       default:
         break;
     }
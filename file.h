@@ -55,7 +55,8 @@ typedef enum {
   key_plymouth, key_sslcerts, key_restart, key_restarted, key_autoyast2,
   key_withipoib, key_upgrade, key_ifcfg, key_defaultinstall, key_nanny, key_vlanid,
   key_sshkey, key_systemboot, key_sethostname, key_debugshell, key_self_update,
-  key_ibft_devices
+  key_ibft_devices, key_downloadcache, key_nfsperf,
+  key_headless
 } file_key_t;
 
 typedef enum {
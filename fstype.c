@@ -33,6 +33,7 @@
 #define _GNU_SOURCE	/* stat64 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -44,6 +45,7 @@
 #include "util.h"
 #include "linux_fs.h"
 #include "fstype.h"
+#include "io.h"
 
 /*
  * Most file system types can be recognized by a `magic' number
@@ -116,6 +118,30 @@ static int may_be_swap(const char *s)
 }
 
 
+/*
+ * All probes below look at the first 68k of the device; it is read once.
+ *
+ * If that read fails, each probe reads its part itself.
+ */
+#define PROBE_SIZE	0x11000
+
+typedef struct {
+  int fd;
+  unsigned char *data;
+  unsigned len;
+} probe_t;
+
+static int probe_read(probe_t *head, unsigned ofs, void *buf, unsigned len)
+{
+  if(ofs + len > head->len) {
+    return pread64(head->fd, buf, len, ofs) == (ssize_t) len;
+  }
+
+  memcpy(buf, head->data + ofs, len);
+
+  return 1;
+}
+
 static int is_reiserfs_magic_string(struct reiserfs_super_block * rs)
 {
   return
@@ -126,9 +152,12 @@ static int is_reiserfs_magic_string(struct reiserfs_super_block * rs)
 
 char *fstype(const char *device)
 {
-  int fd;
+  int fd, i;
   char *type = NULL;
   struct stat64 statbuf;
+  probe_t head = { };
+  io_reader_t *io;
+  unsigned char *data;
 
   /*
    * opening and reading an arbitrary unknown path can have
@@ -151,9 +180,14 @@ char *fstype(const char *device)
   }
 
   /*
-   * do seeks and reads in disk order, otherwise a very short
-   * partition may cause a failure because of read error
+   * read everything at once; if that fails (a very short partition may
+   * cause a read error), probe_read() falls back to single reads
    */
+  head.fd = fd;
+  head.data = malloc(PROBE_SIZE);
+  io = io_read_open(fd, 0, PROBE_SIZE);
+  if((i = io_read_next(io, &data)) > 0) memcpy(head.data, data, head.len = i);
+  io_read_close(io);
 
   if(!type) {
     union {
@@ -170,8 +204,7 @@ char *fstype(const char *device)
 
     /* block 0 */
     if(
-      lseek(fd, 0, SEEK_SET) == 0 &&
-      read(fd, &xsb, sizeof xsb) == sizeof xsb
+      probe_read(&head, 0, &xsb, sizeof xsb)
     ) {
       if(xiafsmagic(xsb.xiasb) == _XIAFS_SUPER_MAGIC) {
         type = "xiafs";
@@ -223,8 +256,7 @@ char *fstype(const char *device)
     char buf[6];
 
     if(
-      lseek(fd, 0, SEEK_SET) == 0 &&
-      read(fd, buf, sizeof buf) == sizeof buf
+      probe_read(&head, 0, buf, sizeof buf)
     ) {
       if(!memcmp(buf, "070701", 6) || !memcmp(buf, "\xc7\x71", 2)) type = "cpio";
       else if(!memcmp(buf, "hsqs", 4) || !memcmp(buf, "sqsh", 4)) type = "squashfs";
@@ -236,8 +268,7 @@ char *fstype(const char *device)
     struct sysv_super_block svsb;
 
     if(
-      lseek(fd, 512 , SEEK_SET) == 512 &&
-      read(fd, &svsb, sizeof svsb) == sizeof svsb &&
+      probe_read(&head, 512, &svsb, sizeof svsb) &&
       sysvmagic(svsb) == SYSV_SUPER_MAGIC
     ) {
       type = "sysv";
@@ -253,8 +284,7 @@ char *fstype(const char *device)
     } sb;
 
     if(
-      lseek(fd, 1024, SEEK_SET) == 1024 &&
-      read(fd, &sb, sizeof sb) == sizeof sb
+      probe_read(&head, 1024, &sb, sizeof sb)
     ) {
       /*
        * ext2 has magic in little-endian on disk, so "swapped" is
@@ -306,8 +336,7 @@ char *fstype(const char *device)
      * more accurate (sb magic is only a short int)
      */
     if(
-      lseek(fd, 0x400, SEEK_SET) == 0x400 &&
-      read(fd, &hfssb, sizeof hfssb) == sizeof hfssb &&
+      probe_read(&head, 0x400, &hfssb, sizeof hfssb) &&
       (
         (hfsmagic(hfssb) == HFS_SUPER_MAGIC && hfsblksize(hfssb) == 0x20000) ||
         (swapped(hfsmagic(hfssb)) == HFS_SUPER_MAGIC && hfsblksize(hfssb) == 0x200)
@@ -321,8 +350,7 @@ char *fstype(const char *device)
     struct ufs_super_block ufssb;
 
     if(
-      lseek(fd, 8192, SEEK_SET) == 8192 &&
-      read(fd, &ufssb, sizeof ufssb) == sizeof ufssb &&
+      probe_read(&head, 8192, &ufssb, sizeof ufssb) &&
       ufsmagic(ufssb) == UFS_SUPER_MAGIC	/* also test swapped version? */
     ) {
       type = "ufs";
@@ -333,8 +361,7 @@ char *fstype(const char *device)
     struct reiserfs_super_block reiserfssb;
 
     if(
-      lseek(fd, REISERFS_OLD_DISK_OFFSET_IN_BYTES, SEEK_SET) == REISERFS_OLD_DISK_OFFSET_IN_BYTES &&
-      read(fd, &reiserfssb, sizeof(reiserfssb)) == sizeof(reiserfssb) &&
+      probe_read(&head, REISERFS_OLD_DISK_OFFSET_IN_BYTES, &reiserfssb, sizeof(reiserfssb)) &&
       is_reiserfs_magic_string(&reiserfssb)
     ) {
       type = "reiserfs";
@@ -345,8 +372,7 @@ char *fstype(const char *device)
     struct hpfs_super_block hpfssb;
 
     if(
-      lseek(fd, 0x2000, SEEK_SET) == 0x2000 &&
-      read(fd, &hpfssb, sizeof hpfssb) == sizeof hpfssb &&
+      probe_read(&head, 0x2000, &hpfssb, sizeof hpfssb) &&
       hpfsmagic(hpfssb) == HPFS_SUPER_MAGIC
     ) {
       type = "hpfs";
@@ -357,8 +383,7 @@ char *fstype(const char *device)
     struct jfs_super_block jfssb;
 
     if(
-      lseek(fd, JFS_SUPER1_OFF, SEEK_SET) == JFS_SUPER1_OFF &&
-      read(fd, &jfssb, sizeof jfssb) == sizeof jfssb &&
+      probe_read(&head, JFS_SUPER1_OFF, &jfssb, sizeof jfssb) &&
       !strncmp(jfssb.s_magic, JFS_MAGIC, 4)
     ) {
       type = "jfs";
@@ -372,8 +397,7 @@ char *fstype(const char *device)
     } isosb;
 
     if(
-      lseek(fd, 0x8000, SEEK_SET) == 0x8000 &&
-      read(fd, &isosb, sizeof isosb) == sizeof isosb
+      probe_read(&head, 0x8000, &isosb, sizeof isosb)
     ) {
       if(
         !strncmp(isosb.iso.id, ISO_STANDARD_ID, sizeof(isosb.iso.id)) ||
@@ -391,8 +415,7 @@ char *fstype(const char *device)
     struct reiserfs_super_block reiserfssb;
 
     if(
-      lseek(fd, REISERFS_DISK_OFFSET_IN_BYTES, SEEK_SET) == REISERFS_DISK_OFFSET_IN_BYTES &&
-      read(fd, &reiserfssb, sizeof reiserfssb) == sizeof reiserfssb &&
+      probe_read(&head, REISERFS_DISK_OFFSET_IN_BYTES, &reiserfssb, sizeof reiserfssb) &&
       is_reiserfs_magic_string(&reiserfssb)
     ) {
       type = "reiserfs";
@@ -403,8 +426,7 @@ char *fstype(const char *device)
     char buf[8];
 
     if(
-      lseek(fd, 0x10040, SEEK_SET) == 0x10040 &&
-      read(fd, buf, sizeof buf) == sizeof buf &&
+      probe_read(&head, 0x10040, buf, sizeof buf) &&
       !memcmp(buf, "_BHRfS_M", sizeof buf)
     ) {
       type = "btrfs";
@@ -415,8 +437,7 @@ char *fstype(const char *device)
     char buf[6];
 
     if(
-      lseek(fd, 0x101, SEEK_SET) == 0x101 &&
-      read(fd, buf, sizeof buf) == sizeof buf &&
+      probe_read(&head, 0x101, buf, sizeof buf) &&
       !memcmp(buf, "ustar", 6 /* with \0 */)
     ) {
       type = "tar";
@@ -436,8 +457,7 @@ char *fstype(const char *device)
     if(rd < 8192) rd = 8192;
     if(rd > sizeof buf) rd = sizeof buf;
     if(
-      lseek(fd, 0, SEEK_SET) == 0 &&
-      read(fd, buf, rd) == rd &&
+      probe_read(&head, 0, buf, rd) &&
       (
         may_be_swap(buf + pagesize) ||
         may_be_swap(buf + 4096) ||
@@ -448,6 +468,8 @@ char *fstype(const char *device)
     }
   }
 
+  free(head.data);
+
   close(fd);
 
   return type;
@@ -11,6 +11,8 @@
 #include <netinet/in.h>
 #include <netinet/ip6.h>
 #include <inttypes.h>
+#include <time.h>
+#include <sys/types.h>
 
 #include <blkid/blkid.h>
 
@@ -151,7 +153,7 @@ typedef struct {
                char          style;
                char          shadow;
                char          save_bg;
-               character_t **save_area;
+               character_t  *save_area;
                }
         window_t;
 
@@ -208,6 +210,39 @@ typedef struct slist_s {
 } slist_t;
 
 
+/*
+ * Growable memory buffer; see membuf_*() functions.
+ */
+typedef struct {
+  char *data;
+  size_t len, size;
+} membuf_t;
+
+
+/*
+ * External command; see util_run_start(), util_run_wait().
+ *
+ * Set either cmd or argv. cmd is run directly if it doesn't use any shell
+ * syntax, else via /bin/sh.
+ */
+typedef struct {
+  char *cmd;			/* command line */
+  char **argv;			/* or: argument list, argv[0] is looked up in $PATH */
+  unsigned log_stdout:1;	/* capture stdout, too (default: stderr only) */
+  unsigned shell:1;		/* force running cmd via /bin/sh */
+  unsigned timeout;		/* in ms, 0: no timeout */
+  int status;			/* exit code (128 + signal number if killed) */
+  unsigned status_unknown:1;	/* reaped elsewhere, exit code unknown (status is 0) */
+  membuf_t output;		/* captured output */
+  /* internal */
+  pid_t pid;
+  int fd, pid_fd;
+  slist_t *args;
+  char **arg_list;
+  struct timespec start;
+} run_t;
+
+
 typedef struct {
   unsigned ok:1;		/* at least ip or ip6 is valid */
   unsigned ipv4:1;		/* 1: valid ipv4 */
@@ -375,6 +410,7 @@ typedef struct {
   unsigned win:1;		/* set if we are drawing windows */
   unsigned forceinsmod:1;	/* use 'insmod -f' if set */
   unsigned tmpfs:1;		/* we're using tmpfs for / */
+  unsigned parts_overlay:1;	/* stack initrd parts via overlayfs */
   unsigned run_as_linuxrc:1;	/* set if we really are linuxrc */
   unsigned test:1;		/* we are in test mode */
   unsigned rescue:1;		/* start rescue system */
@@ -384,6 +420,7 @@ typedef struct {
   unsigned debugwait:1;		/* pop up dialogs at some critical points */
   unsigned debugwait_off:1;	/* force debugwait off */
   unsigned linemode:2;		/* line mode */
+  unsigned headless:1;		/* no user interface, dialogs are only logged */
   unsigned ask_language:1;	/* let use choose language  */
   unsigned ask_keytable:1;	/* let user choose keytable */
   unsigned use_ramdisk:1;	/* used internally */
@@ -605,6 +642,7 @@ typedef struct {
   struct {			/* mountpoints */
     unsigned cnt;		/* mp counter */
     unsigned initrd_parts;	/* initrd parts counter */
+    slist_t *initrd_stacked;	/* top-level dirs with initrd parts stacked via overlayfs */
     char *instdata;
     char *instsys;
     char *update;
@@ -617,6 +655,9 @@ typedef struct {
     unsigned instsys:1;		/* download instsys */
     unsigned instsys_set:1;	/* the above was explicitly set */
     char *base;			/* base dir for downloads */
+    char *cache;		/* download cache dir (NULL: no cache) */
+    unsigned cache_on_disk:1;	/* cache is not in memory */
+    unsigned cache_ready:1;	/* cache has been set up */
   } download;
 
   struct {
@@ -633,7 +674,6 @@ typedef struct {
     unsigned setup;		/* bitmask: do these network setup things */
     char *device;		/* currently used device */
     slist_t *devices;		/* list of active network devs */
-    slist_t *dns_cache;		/* cache dns lookups here */
     int file_length;		/* length of currently retrieved file */
     char *nisdomain;		/* NIS domain name */
     int dhcp_timeout;
@@ -645,6 +685,7 @@ typedef struct {
       unsigned wsize;		/* nfs wsize mount option */
       unsigned udp:1;		/* udp instead of tcp */
       unsigned vers;		/* nfs version (2 or 3) */
+      unsigned perf:1;		/* use performance profile (nconnect, rsize, readahead) */
     } nfs;
     int retry;			/* max retry count for network connections */
     inet_t netmask;
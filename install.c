@@ -45,6 +45,7 @@
 #include "settings.h"
 #include "auto2.h"
 #include "url.h"
+#include "console.h"
 
 #ifndef MNT_DETACH
 #define MNT_DETACH	(1 << 1)
@@ -1348,6 +1349,7 @@ int inst_execute_yast()
   LXRC_WAIT
 
   kbd_end(1);
+  con_sync();
   if(!config.test) util_notty();
 
   if(config.test) {
@@ -1399,7 +1401,7 @@ int inst_execute_yast()
 
   if(!config.test && !config.listen) {
     freopen(config.console, "r", stdin);
-    freopen(config.console, "a", stdout);
+    con_reopen(config.console);
     freopen(config.console, "a", stderr);
   }
   else {
@@ -1484,7 +1486,7 @@ int inst_commit_install()
         break;
       }
 
-      reboot(RB_AUTOBOOT);
+      util_reboot(RB_AUTOBOOT);
       break;
 
     case 2:	/* power off */
@@ -1493,7 +1495,7 @@ int inst_commit_install()
         break;
       }
 
-      reboot(RB_POWER_OFF);
+      util_reboot(RB_POWER_OFF);
       break;
 
     case 3:	/* kexec */
@@ -0,0 +1,536 @@
+/*
+ *
+ * io.c          Bulk reads from local media
+ *
+ * Files are read sequentially in large blocks with several reads in
+ * flight, using io_uring with registered buffers if the kernel supports it
+ * and plain pread() otherwise.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(SYS_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define IO_URING
+#endif
+#endif
+
+#include "global.h"
+#include "util.h"
+#include "io.h"
+
+#define IO_BLOCK_SIZE	(256 << 10)
+#define IO_DEPTH	8
+
+struct io_reader_s {
+  int fd;
+  uint64_t ofs;			/* next offset to queue */
+  uint64_t end;			/* end offset */
+  int err;			/* errno of failed read */
+  int last;			/* slot passed to caller (-1: none) */
+  unsigned next;		/* slot with next block */
+  unsigned eof:1;
+  unsigned ring:1;		/* use io_uring */
+  unsigned char *buf;		/* buffer for pread() */
+  struct {
+    uint64_t ofs;
+    unsigned len;
+    int res;
+    unsigned queued:1;
+    unsigned done:1;
+  } slot[IO_DEPTH];
+};
+
+#ifdef IO_URING
+static int io_ring_setup(void);
+static void io_ring_queue(io_reader_t *io, unsigned slot);
+static int io_ring_wait(io_reader_t *io, unsigned slot);
+static int io_ring_enter(unsigned submit, unsigned wait);
+#endif
+static int io_pread(int fd, unsigned char *buf, unsigned len, uint64_t ofs);
+
+#ifdef IO_URING
+/*
+ * There's just one ring; it is set up on first use and kept.
+ */
+static struct {
+  int fd;			/* -1: not set up, -2: not available */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+  unsigned char *buf;		/* IO_DEPTH buffers of IO_BLOCK_SIZE */
+  struct iovec iov[IO_DEPTH];
+  unsigned to_submit;
+  unsigned fixed:1;		/* buffers registered */
+  unsigned busy:1;		/* in use by a reader */
+} io_ring = { .fd = -1 };
+#endif
+
+/*
+ * pread() buffer, kept for the next reader (do_cp() copies many small files).
+ */
+static struct {
+  unsigned char *buf;
+  unsigned busy:1;
+} io_buf;
+
+
+/*
+ * Start reading 'len' bytes at offset 'ofs' from 'fd'.
+ *
+ * len = 0: read until end of file (no read-ahead).
+ */
+io_reader_t *io_read_open(int fd, uint64_t ofs, uint64_t len)
+{
+  io_reader_t *io;
+#ifdef IO_URING
+  unsigned u;
+#endif
+
+  if(fd < 0) return NULL;
+
+  io = calloc(1, sizeof *io);
+
+  io->fd = fd;
+  io->ofs = ofs;
+  io->end = len ? ofs + len : UINT64_MAX;
+  io->last = -1;
+
+#ifdef IO_URING
+  // small reads aren't worth it
+  if(len > IO_BLOCK_SIZE && !io_ring.busy && !io_ring_setup()) {
+    io->ring = 1;
+    io_ring.busy = 1;
+    for(u = 0; u < IO_DEPTH; u++) io_ring_queue(io, u);
+    io_ring_enter(io_ring.to_submit, 0);
+  }
+#endif
+
+  if(!io->ring) {
+    if(!io_buf.busy) {
+      if(!io_buf.buf) io_buf.buf = malloc(IO_BLOCK_SIZE);
+      io_buf.busy = 1;
+      io->buf = io_buf.buf;
+    }
+    else {
+      io->buf = malloc(IO_BLOCK_SIZE);
+    }
+  }
+
+  return io;
+}
+
+
+/*
+ * Get next block.
+ *
+ * *buf is valid until the next call.
+ *
+ * Return block size, 0 at end, -1 on error (see io_read_error()).
+ */
+int io_read_next(io_reader_t *io, unsigned char **buf)
+{
+  unsigned len;
+  int res;
+
+  if(!io || io->err) return -1;
+
+  if(io->eof || io->ofs >= io->end) {
+    if(!io->ring) return 0;
+  }
+
+  if(!io->ring) {
+    len = io->end - io->ofs > IO_BLOCK_SIZE ? IO_BLOCK_SIZE : io->end - io->ofs;
+    res = io_pread(io->fd, io->buf, len, io->ofs);
+    if(res < 0) {
+      io->err = errno;
+      return -1;
+    }
+    if(res < len) io->eof = 1;
+    io->ofs += res;
+    *buf = io->buf;
+
+    return res;
+  }
+
+#ifdef IO_URING
+  // buffer we handed out last time is free again
+  if(io->last >= 0) {
+    io_ring_queue(io, io->last);
+    io->last = -1;
+  }
+
+  if(io->eof || !io->slot[io->next].queued) return 0;
+
+  if(io_ring_wait(io, io->next)) {
+    io->err = errno;
+    return -1;
+  }
+
+  res = io->slot[io->next].res;
+
+  if(res < 0) {
+    io->err = -res;
+    return -1;
+  }
+
+  *buf = io_ring.buf + io->next * IO_BLOCK_SIZE;
+
+  // finish short reads the simple way
+  if(res < io->slot[io->next].len) {
+    len = io->slot[io->next].len - res;
+    len = io_pread(io->fd, *buf + res, len, io->slot[io->next].ofs + res) == len ? len : 0;
+    if(!len) io->eof = 1;
+    res += len;
+  }
+
+  io->slot[io->next].queued = io->slot[io->next].done = 0;
+  io->last = io->next;
+  io->next = (io->next + 1) % IO_DEPTH;
+
+  return res;
+#else
+  return 0;
+#endif
+}
+
+
+/*
+ * errno of failed read.
+ */
+int io_read_error(io_reader_t *io)
+{
+  return io ? io->err : EBADF;
+}
+
+
+/*
+ * Wait for outstanding reads and free reader.
+ */
+void io_read_close(io_reader_t *io)
+{
+#ifdef IO_URING
+  unsigned u;
+#endif
+
+  if(!io) return;
+
+#ifdef IO_URING
+  if(io->ring) {
+    io_ring_enter(io_ring.to_submit, 0);
+    for(u = 0; u < IO_DEPTH; u++) {
+      if(io->slot[u].queued) io_ring_wait(io, u);
+    }
+    io_ring.busy = 0;
+  }
+#endif
+
+  if(io->buf && io->buf == io_buf.buf) {
+    io_buf.busy = 0;
+  }
+  else {
+    free(io->buf);
+  }
+
+  free(io);
+}
+
+
+/*
+ * Copy file from fd_in to fd_out.
+ *
+ * 'len' is the expected file size; anything beyond is copied, too.
+ *
+ * Return 0 if ok, 1 on read error, 2 on write error (errno is set).
+ */
+int io_copy(int fd_in, int fd_out, uint64_t len)
+{
+  io_reader_t *io;
+  unsigned char *buf;
+  uint64_t ofs = 0;
+  int i, j, k, pass, err = 0;
+
+  for(pass = 0; pass < (len ? 2 : 1) && !err; pass++) {
+    if(!(io = io_read_open(fd_in, ofs, pass ? 0 : len))) return 1;
+
+    while((i = io_read_next(io, &buf)) > 0) {
+      for(j = 0; j < i; j += k) {
+        if((k = write(fd_out, buf + j, i - j)) <= 0) {
+          if(k < 0 && errno == EINTR) {
+            k = 0;
+            continue;
+          }
+          err = 2;
+          break;
+        }
+      }
+      if(err) break;
+      ofs += i;
+    }
+
+    if(i < 0) err = 1;
+    k = err == 1 ? io_read_error(io) : errno;
+
+    io_read_close(io);
+
+    errno = k;
+  }
+
+  return err;
+}
+
+
+/*
+ * Free io_uring resources and buffers.
+ */
+void io_done()
+{
+  if(!io_buf.busy) {
+    free(io_buf.buf);
+    io_buf.buf = NULL;
+  }
+
+#ifdef IO_URING
+  if(io_ring.fd < 0 || io_ring.busy) return;
+
+  munmap(io_ring.sqes, io_ring.sqes_size);
+  if(io_ring.cq_ptr != io_ring.sq_ptr) munmap(io_ring.cq_ptr, io_ring.cq_size);
+  munmap(io_ring.sq_ptr, io_ring.sq_size);
+  close(io_ring.fd);
+  free(io_ring.buf);
+
+  memset(&io_ring, 0, sizeof io_ring);
+  io_ring.fd = -1;
+#endif
+}
+
+
+int io_pread(int fd, unsigned char *buf, unsigned len, uint64_t ofs)
+{
+  unsigned pos = 0;
+  ssize_t i;
+
+  while(pos < len) {
+    i = pread64(fd, buf + pos, len - pos, ofs + pos);
+    if(i < 0 && errno == EINTR) continue;
+    if(i < 0) return -1;
+    if(i == 0) break;
+    pos += i;
+  }
+
+  return pos;
+}
+
+
+#ifdef IO_URING
+
+/*
+ * Set up ring and buffers.
+ *
+ * Return 0 if ok.
+ */
+int io_ring_setup()
+{
+  struct io_uring_params p;
+  unsigned u;
+  int fd;
+
+  if(io_ring.fd >= 0) return 0;
+  if(io_ring.fd == -2) return 1;
+
+  io_ring.fd = -2;
+
+  memset(&p, 0, sizeof p);
+
+  if((fd = syscall(SYS_io_uring_setup, IO_DEPTH, &p)) < 0) {
+    log_debug("io_uring: not available (%s)\n", strerror(errno));
+    return 1;
+  }
+
+  io_ring.sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  io_ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  io_ring.sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+
+  if((p.features & IORING_FEAT_SINGLE_MMAP)) {
+    if(io_ring.cq_size > io_ring.sq_size) io_ring.sq_size = io_ring.cq_size;
+    io_ring.cq_size = io_ring.sq_size;
+  }
+
+  io_ring.sq_ptr = mmap(NULL, io_ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if(io_ring.sq_ptr == MAP_FAILED) {
+    close(fd);
+    return 1;
+  }
+
+  if((p.features & IORING_FEAT_SINGLE_MMAP)) {
+    io_ring.cq_ptr = io_ring.sq_ptr;
+  }
+  else {
+    io_ring.cq_ptr = mmap(NULL, io_ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if(io_ring.cq_ptr == MAP_FAILED) {
+      munmap(io_ring.sq_ptr, io_ring.sq_size);
+      close(fd);
+      return 1;
+    }
+  }
+
+  io_ring.sqes = mmap(NULL, io_ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if(io_ring.sqes == MAP_FAILED) {
+    if(io_ring.cq_ptr != io_ring.sq_ptr) munmap(io_ring.cq_ptr, io_ring.cq_size);
+    munmap(io_ring.sq_ptr, io_ring.sq_size);
+    close(fd);
+    return 1;
+  }
+
+  io_ring.sq_head = io_ring.sq_ptr + p.sq_off.head;
+  io_ring.sq_tail = io_ring.sq_ptr + p.sq_off.tail;
+  io_ring.sq_mask = io_ring.sq_ptr + p.sq_off.ring_mask;
+  io_ring.sq_array = io_ring.sq_ptr + p.sq_off.array;
+  io_ring.cq_head = io_ring.cq_ptr + p.cq_off.head;
+  io_ring.cq_tail = io_ring.cq_ptr + p.cq_off.tail;
+  io_ring.cq_mask = io_ring.cq_ptr + p.cq_off.ring_mask;
+  io_ring.cqes = io_ring.cq_ptr + p.cq_off.cqes;
+
+  if(posix_memalign((void **) &io_ring.buf, 4096, IO_DEPTH * IO_BLOCK_SIZE)) io_ring.buf = NULL;
+  if(!io_ring.buf) {
+    munmap(io_ring.sqes, io_ring.sqes_size);
+    if(io_ring.cq_ptr != io_ring.sq_ptr) munmap(io_ring.cq_ptr, io_ring.cq_size);
+    munmap(io_ring.sq_ptr, io_ring.sq_size);
+    close(fd);
+    return 1;
+  }
+
+  for(u = 0; u < IO_DEPTH; u++) {
+    io_ring.iov[u].iov_base = io_ring.buf + u * IO_BLOCK_SIZE;
+    io_ring.iov[u].iov_len = IO_BLOCK_SIZE;
+  }
+
+  // may fail due to RLIMIT_MEMLOCK; then we just don't use fixed buffers
+  io_ring.fixed = syscall(SYS_io_uring_register, fd, IORING_REGISTER_BUFFERS, io_ring.iov, IO_DEPTH) ? 0 : 1;
+
+  io_ring.fd = fd;
+
+  log_debug("io_uring: depth %u, %u kB blocks%s\n", IO_DEPTH, IO_BLOCK_SIZE >> 10, io_ring.fixed ? ", fixed buffers" : "");
+
+  return 0;
+}
+
+
+/*
+ * Queue read of next block into slot.
+ */
+void io_ring_queue(io_reader_t *io, unsigned slot)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx, len;
+
+  if(io->eof || io->ofs >= io->end) return;
+
+  len = io->end - io->ofs > IO_BLOCK_SIZE ? IO_BLOCK_SIZE : io->end - io->ofs;
+
+  io->slot[slot].ofs = io->ofs;
+  io->slot[slot].len = len;
+  io->slot[slot].queued = 1;
+  io->slot[slot].done = 0;
+  io->ofs += len;
+
+  tail = *io_ring.sq_tail;
+  idx = tail & *io_ring.sq_mask;
+  sqe = io_ring.sqes + idx;
+
+  memset(sqe, 0, sizeof *sqe);
+  sqe->fd = io->fd;
+  sqe->off = io->slot[slot].ofs;
+  sqe->user_data = slot;
+
+  if(io_ring.fixed) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (unsigned long) io_ring.iov[slot].iov_base;
+    sqe->len = len;
+    sqe->buf_index = slot;
+  }
+  else {
+    io_ring.iov[slot].iov_len = len;
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (unsigned long) (io_ring.iov + slot);
+    sqe->len = 1;
+  }
+
+  io_ring.sq_array[idx] = idx;
+  __atomic_store_n(io_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  io_ring.to_submit++;
+}
+
+
+/*
+ * Wait until read in slot has finished.
+ *
+ * Return 0 if ok.
+ */
+int io_ring_wait(io_reader_t *io, unsigned slot)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  while(!io->slot[slot].done) {
+    head = *io_ring.cq_head;
+    if(head == __atomic_load_n(io_ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      if(io_ring_enter(io_ring.to_submit, 1)) return 1;
+      continue;
+    }
+    cqe = io_ring.cqes + (head & *io_ring.cq_mask);
+    if(cqe->user_data < IO_DEPTH) {
+      io->slot[cqe->user_data].res = cqe->res;
+      io->slot[cqe->user_data].done = 1;
+    }
+    __atomic_store_n(io_ring.cq_head, head + 1, __ATOMIC_RELEASE);
+  }
+
+  return 0;
+}
+
+
+/*
+ * Submit queued requests and wait for 'wait' completions.
+ *
+ * Return 0 if ok.
+ */
+int io_ring_enter(unsigned submit, unsigned wait)
+{
+  int i;
+
+  if(!submit && !wait) return 0;
+
+  do {
+    i = syscall(SYS_io_uring_enter, io_ring.fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  }
+  while(i < 0 && errno == EINTR);
+
+  if(i < 0) {
+    perror_debug("io_uring_enter");
+    return 1;
+  }
+
+  io_ring.to_submit -= i;
+
+  return 0;
+}
+
+#endif
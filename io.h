@@ -0,0 +1,11 @@
+/*
+ * Sequential reader with read-ahead.
+ */
+typedef struct io_reader_s io_reader_t;
+
+io_reader_t *io_read_open(int fd, uint64_t ofs, uint64_t len);
+int io_read_next(io_reader_t *io, unsigned char **buf);
+int io_read_error(io_reader_t *io);
+void io_read_close(io_reader_t *io);
+int io_copy(int fd_in, int fd_out, uint64_t len);
+void io_done(void);
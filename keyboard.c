@@ -15,7 +15,8 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <termios.h>
-#include <signal.h>
+#include <poll.h>
+#include <sys/timerfd.h>
 #include <string.h>
 #include <linux/vt.h>
 #include <linux/kd.h>
@@ -24,6 +25,7 @@
 #include "global.h"
 #include "keyboard.h"
 #include "util.h"
+#include "console.h"
 #include "utf8.h"
 
 /*
@@ -32,14 +34,14 @@
  *
  */
 
-#define KBD_TIMEOUT       10000
+#define KBD_TIMEOUT       10		/* ms */
 
 static struct termios   kbd_norm_tio_rm;
 static struct termios   kbd_tio_rm;
-static int              kbd_timeout_im;
+static int              kbd_timer_fd = -1;
 
 typedef struct {
-  unsigned char buffer[16];
+  unsigned char buffer[256];
   unsigned pos;
   int key;
 } kbd_buffer_t;
@@ -72,6 +74,17 @@ struct {
   { "\x1bOS" , KEY_F4     },
 };
 
+/*
+ * key_list as trie; node 0 is the root, 0 as child/next means none.
+ */
+static struct {
+  unsigned char byte;
+  unsigned char child, next;
+  int key;
+} kbd_trie[128];
+
+static unsigned kbd_trie_len;
+
 
 /*
  *
@@ -79,9 +92,11 @@ struct {
  *
  */
 
-static void kbd_del_timeout (void);
-static void kbd_set_timeout (long timeout_lv);
-static void kbd_timeout     (int signal_iv);
+static void kbd_set_timeout (int sec);
+static int  kbd_read        (int timeout);
+static int  kbd_read_char   (char *c, int timeout);
+static void kbd_trie_init   (void);
+static int  kbd_trie_match  (unsigned char *buf, unsigned len, int *key);
 
 static void get_screen_size(int fd);
 
@@ -181,6 +196,8 @@ void kbd_end(int close_fd)
   if(close_fd) {
     close(config.kbd_fd);
     config.kbd_fd = -1;
+    if(kbd_timer_fd >= 0) close(kbd_timer_fd);
+    kbd_timer_fd = -1;
   }
 }
 
@@ -250,7 +267,8 @@ void del_keys(unsigned n)
  */
 void check_for_key(int del_garbage)
 {
-  unsigned u, len;
+  unsigned u;
+  int len;
 
   kbd.key = 0;
 
@@ -265,15 +283,11 @@ void check_for_key(int del_garbage)
   }
 
   /* look for esc sequences */
-  for(u = 0; u < sizeof key_list / sizeof *key_list; u++) {
-    len = strlen(key_list[u].bytes);
-    if(len && len <= kbd.pos && !memcmp(kbd.buffer, key_list[u].bytes, len)) {
-      kbd.key = key_list[u].key;
-      del_keys(len);
-//      log_debug("-> key = 0x%02x\n", kbd.key);
+  if((len = kbd_trie_match(kbd.buffer, kbd.pos, &kbd.key)) > 0) {
+    del_keys(len);
+//    log_debug("-> key = 0x%02x\n", kbd.key);
 
-      return;
-    }
+    return;
   }
 
   /* kill unknown esc sequences */
@@ -312,53 +326,43 @@ void check_for_key(int del_garbage)
 /*
  * Read keyboard input until some key sequence has been recognized.
  */
-int kbd_getch_raw(do_wait)
+int kbd_getch_raw(int do_wait)
 {
-  unsigned char key;
-  int i, esc_delay, time_to_wait, esc_count, delay;
+  int len, esc_delay;
+
+  esc_delay = config.escdelay ?: 25;
 
-  esc_delay = config.escdelay ? config.escdelay * 1000 : 25000;
+  check_for_key(0);
 
-  time_to_wait = config.kbdtimeout * 1000000;
+  /* the rest of a buffered esc or utf8 sequence may still be on its way */
+  while(!kbd.key && kbd.pos && kbd_read(esc_delay) > 0) check_for_key(0);
 
-  check_for_key(1);
+  if(!kbd.key) check_for_key(1);
 
   if(kbd.key || !do_wait) return kbd.key;
 
-  esc_count = 0;
+  kbd_set_timeout(config.kbdtimeout);
 
   for(;;) {
-    delay = esc_count ? esc_delay : KBD_TIMEOUT;
-    if(esc_count) esc_count--;
-
-    kbd_set_timeout(delay);
-    key = 0;
-    read(config.kbd_fd, &key, 1);
-    kbd_del_timeout();
-    if(do_wait && config.kbdtimeout && (time_to_wait -= delay) <= 0) {
+    /* wait for the rest of an esc or utf8 sequence only briefly */
+    len = kbd_read(kbd.pos ? esc_delay : -1);
+
+    if(len < 0) {
       /* fake 'Enter' */
       kbd.pos = 0;
       kbd.key = KEY_ENTER;
 
-      return kbd.key;
+      break;
     }
 
-    /* next 3 keys might be part of an esc sequence */
-    if(key == '\x1b') esc_count = 3;
-
-    if((i = utf8_enc_len(key)) > 1) esc_count = i - 1;
+    check_for_key(len ? 0 : 1);
 
-    if(key) {
-      if(kbd.pos < sizeof kbd.buffer) kbd.buffer[kbd.pos++] = key;
+    if(kbd.key) break;
+  }
 
-      check_for_key(0);
-    }
-    else {
-      check_for_key(1);
-    }
+  kbd_set_timeout(0);
 
-    if(kbd.key || !do_wait) return kbd.key;
-  }
+  return kbd.key;
 }
 
 
@@ -377,7 +381,7 @@ void kbd_echo_off (void)
 
 int kbd_getch_old (int wait_iv)
     {
-#define KBD_ESC_DELAY     25000
+#define KBD_ESC_DELAY     25		/* ms */
 #define KEY_FUNC         0x0800
     char  keypress_ci;
     char  tmp_ci;
@@ -387,9 +391,7 @@ int kbd_getch_old (int wait_iv)
     keypress_ci = 0;
     do
         {
-        kbd_set_timeout (KBD_TIMEOUT);
-        read (config.kbd_fd, &keypress_ci, 1);
-        kbd_del_timeout ();
+        kbd_read_char (&keypress_ci, wait_iv ? -1 : KBD_TIMEOUT);
         }
     while (!keypress_ci && wait_iv);
 
@@ -399,36 +401,27 @@ int kbd_getch_old (int wait_iv)
     if (keypress_ci != KEY_ESC)
         return ((int) keypress_ci);
 
-    kbd_set_timeout (KBD_ESC_DELAY);
-
-    read (config.kbd_fd, &keypress_ci, 1);
-    if (kbd_timeout_im)
+    if (!kbd_read_char (&keypress_ci, KBD_ESC_DELAY))
         return ((int) KEY_ESC);
-    else
-        kbd_del_timeout ();
 
     if (keypress_ci != 91)
         return (0);
 
-    read (config.kbd_fd, &keypress_ci, 1);
+    kbd_read_char (&keypress_ci, -1);
     if (keypress_ci == (KEY_UP    & 0xff)  ||
         keypress_ci == (KEY_DOWN  & 0xff)  ||
         keypress_ci == (KEY_RIGHT & 0xff)  ||
         keypress_ci == (KEY_LEFT  & 0xff))
         return (((int) keypress_ci) | KEY_SPECIAL);
-    
+
     i_ii = 0;
-    kbd_set_timeout (KBD_ESC_DELAY);
 
     do
         {
         tmp_ci = keypress_ci;
-        read (config.kbd_fd, &keypress_ci, 1);
         i_ii++;
         }
-    while (!kbd_timeout_im && keypress_ci != 126);
-
-    kbd_del_timeout ();
+    while (kbd_read_char (&keypress_ci, KBD_ESC_DELAY) && keypress_ci != 126);
 
     if (keypress_ci != 126)
         return (0);
@@ -446,34 +439,138 @@ int kbd_getch_old (int wait_iv)
  *
  */
 
-static void kbd_del_timeout (void)
-    {
-    struct itimerval timer_ri;
+/*
+ * Arm keyboard timeout (in s); 0 disarms it.
+ */
+void kbd_set_timeout(int sec)
+{
+  struct itimerspec its = { .it_value.tv_sec = sec };
 
-    kbd_timeout_im = FALSE;
-    memset (&timer_ri, 0, sizeof (timer_ri));
-    setitimer (ITIMER_REAL, &timer_ri, 0);
-    signal (SIGALRM, SIG_IGN);
+  if(kbd_timer_fd < 0) {
+    if(!sec) return;
+    kbd_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if(kbd_timer_fd < 0) {
+      perror_info("timerfd_create");
+      return;
     }
+  }
 
+  timerfd_settime(kbd_timer_fd, 0, &its, NULL);
+}
 
-static void kbd_set_timeout (long timeout_lv)
-    {
-    struct itimerval timer_ri;
 
-    kbd_timeout_im = FALSE;
+/*
+ * Wait up to timeout ms (-1: forever) for keyboard input and append what
+ * fits to the keyboard buffer.
+ *
+ * Return number of bytes read or -1 if the keyboard timeout expired.
+ */
+int kbd_read(int timeout)
+{
+  struct pollfd fds[2] = {
+    { .fd = config.kbd_fd, .events = POLLIN },
+    { .fd = kbd_timer_fd, .events = POLLIN }
+  };
+  uint64_t expired;
+  int len;
+
+  /* buffer full: let check_for_key() clean up first */
+  if(kbd.pos >= sizeof kbd.buffer) return 0;
+
+  if(poll(fds, kbd_timer_fd >= 0 ? 2 : 1, timeout) <= 0) return 0;
+
+  if(fds[1].revents & POLLIN) {
+    read(kbd_timer_fd, &expired, sizeof expired);
+
+    return -1;
+  }
+
+  if(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    /* don't spin on a broken console */
+    usleep(KBD_TIMEOUT * 1000);
 
-    memset (&timer_ri, 0, sizeof (timer_ri));
-    signal (SIGALRM, kbd_timeout);
-    timer_ri.it_value.tv_usec = timeout_lv;
-    setitimer (ITIMER_REAL, &timer_ri, 0);
+    return 0;
+  }
+
+  /* anything that doesn't fit stays for the next call */
+  len = read(config.kbd_fd, kbd.buffer + kbd.pos, sizeof kbd.buffer - kbd.pos);
+  if(len <= 0) return 0;
+
+  kbd.pos += len;
+
+  return len;
+}
+
+
+/*
+ * Read single byte, waiting up to timeout ms (-1: forever).
+ *
+ * Return 1 if we got one.
+ */
+int kbd_read_char(char *c, int timeout)
+{
+  struct pollfd fds = { .fd = config.kbd_fd, .events = POLLIN };
+
+  if(poll(&fds, 1, timeout) <= 0 || !(fds.revents & POLLIN)) return 0;
+
+  return read(config.kbd_fd, c, 1) == 1;
+}
+
+
+/*
+ * Build trie from key_list.
+ */
+void kbd_trie_init()
+{
+  unsigned u, node, child;
+  unsigned char *s;
+
+  kbd_trie_len = 1;
+
+  for(u = 0; u < sizeof key_list / sizeof *key_list; u++) {
+    for(node = 0, s = key_list[u].bytes; *s; s++, node = child) {
+      for(child = kbd_trie[node].child; child; child = kbd_trie[child].next) {
+        if(kbd_trie[child].byte == *s) break;
+      }
+      if(!child) {
+        if(kbd_trie_len >= sizeof kbd_trie / sizeof *kbd_trie) return;
+        child = kbd_trie_len++;
+        kbd_trie[child].byte = *s;
+        kbd_trie[child].next = kbd_trie[node].child;
+        kbd_trie[node].child = child;
+      }
     }
+    kbd_trie[node].key = key_list[u].key;
+  }
+}
 
 
-static void kbd_timeout (int signal_iv)
-    {
-    kbd_timeout_im = TRUE;
+/*
+ * Match start of buf against key_list.
+ *
+ * Return length of matched sequence and set key, 0 if buf might still
+ * become a known sequence, or -1 if it won't.
+ */
+int kbd_trie_match(unsigned char *buf, unsigned len, int *key)
+{
+  unsigned u, node, child;
+
+  if(!kbd_trie_len) kbd_trie_init();
+
+  for(node = 0, u = 0; u < len; u++, node = child) {
+    for(child = kbd_trie[node].child; child; child = kbd_trie[child].next) {
+      if(kbd_trie[child].byte == buf[u]) break;
     }
+    if(!child) return -1;
+    if(kbd_trie[child].key) {
+      *key = kbd_trie[child].key;
+
+      return u + 1;
+    }
+  }
+
+  return 0;
+}
 
 
 void get_screen_size(int fd)
@@ -487,6 +584,9 @@ void get_screen_size(int fd)
 
   if(fd < 0) return;
 
+  /* anything still queued would end up in the middle of the reply */
+  con_sync();
+
   write(fd, term_init, strlen(term_init));
   fsync(fd);
 
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/statvfs.h>
 #include <sys/reboot.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
@@ -45,6 +46,8 @@
 #include "scsi_rename.h"
 #include "checkmedia.h"
 #include "url.h"
+#include "io.h"
+#include "console.h"
 #include <sys/utsname.h>
 
 #if defined(__alpha__) || defined(__ia64__)
@@ -81,6 +84,10 @@ static void lxrc_movetotmpfs(void);
 static int cmp_entry(slist_t *sl0, slist_t *sl1);
 static int cmp_entry_s(const void *p0, const void *p1);
 static void lxrc_add_parts(void);
+static void lxrc_stack_parts(void);
+static void lxrc_unstack_parts(int relink);
+static int64_t lxrc_inodes(void);
+static void lxrc_parts_log(char *label, struct timespec *start, int64_t inodes);
 #if SWISS_ARMY_KNIFE 
 static void lxrc_makelinks(char *name);
 #endif
@@ -129,6 +136,7 @@ int main(int argc, char **argv, char **env)
 
   config.run_as_linuxrc = 1;
   config.tmpfs = 1;
+  config.parts_overlay = 1;
 
   str_copy(&config.console, "/dev/console");
 
@@ -265,7 +273,7 @@ void lxrc_reboot()
   }
 
   if(dia_yesno("Reboot the system now?", 1) == YES) {
-    reboot(RB_AUTOBOOT);
+    util_reboot(RB_AUTOBOOT);
   }
 }
 
@@ -277,7 +285,7 @@ void lxrc_halt()
   }
 
   if(dia_yesno("Do you want to halt the system now?", 1) == YES) {
-    reboot(RB_POWER_OFF);
+    util_reboot(RB_POWER_OFF);
   }
 }
 
@@ -469,6 +477,9 @@ void lxrc_end()
 
   util_plymouth_off();
 
+  url_cleanup();
+  io_done();
+
   if(netstop || config.restarting) {
     LXRC_WAIT
 
@@ -486,7 +497,7 @@ void lxrc_end()
   log_info("all done\n");
 
   /* screen saver on */
-  if(!config.linemode) printf("\033[9;15]");
+  if(!(config.linemode || config.headless)) printf("\033[9;15]");
 
   lxrc_set_bdflush(40);
 
@@ -507,6 +518,10 @@ void lxrc_end()
   disp_cursor_on();
   kbd_end(1);
   disp_end();
+  con_done();
+
+  // overlay mounts must not outlive us; the rescue system moves 'parts' and needs the links
+  lxrc_unstack_parts(config.rescue);
 
   if(!config.restarting) lxrc_change_root();
 }
@@ -748,6 +763,7 @@ void lxrc_init()
 
   config.download.base = strdup(config.test ? "/tmp/download" : "/download");
   mkdir(config.download.base, 0755);
+  strprintf(&config.download.cache, "%s/cache", config.download.base);
 
   /* must end with '/' */
   config.mountpoint.base = strdup(config.test ? "/tmp/mounts/" : "/mounts/");
@@ -774,6 +790,7 @@ void lxrc_init()
   config.net.tftp_timeout = 10;
   config.net.ifconfig = 1;
   config.net.ipv4 = 1;
+  config.net.nfs.perf = 1;
   config.net.ipv6 = 1;
   config.net.setup = NS_DHCP;	/* unless we are told otherwise just go for dhcp */
   config.net.nameservers = 1;
@@ -991,6 +1008,7 @@ void lxrc_init()
     freopen(config.console, "r", stdin);
     freopen(config.console, "a", stdout);
   }
+  con_init();
 
   util_get_splash_status();
 
@@ -1012,7 +1030,7 @@ void lxrc_init()
 
   // auto2_chk_expert();
 
-  if (!config.linemode)
+  if (!(config.linemode || config.headless))
     printf("\033[9;0]");		/* screen saver off */
   fflush(stdout);
 
@@ -1157,7 +1175,7 @@ void lxrc_init()
           log_info("*** reboot ***\n");
         }
         else {
-          reboot(RB_AUTOBOOT);
+          util_reboot(RB_AUTOBOOT);
         }
       }
     }
@@ -1571,8 +1589,11 @@ void lxrc_add_parts()
   struct dirent *de;
   DIR *d;
   slist_t *sl0 = NULL, *sl;
-  char *mp = NULL, *argv[3] = { };
+  char *mp = NULL;
   int insmod_done = 0;
+  struct timespec start;
+  int64_t inodes;
+  unsigned u;
 
   if((d = opendir("/parts"))) {
     while((de = readdir(d))) {
@@ -1590,21 +1611,44 @@ void lxrc_add_parts()
     log_info("Integrating %s\n", sl->key);
     if(!config.test) {
       if(!insmod_done) {
-        insmod_done = 1;
-        lxrc_run("/sbin/insmod /modules/loop.ko max_loop=64");
+        run_t insmod[3] = {
+          { .cmd = "/sbin/insmod /modules/loop.ko max_loop=64", .log_stdout = 1 },
+        };
+        unsigned insmods = 1;
+
         if(util_check_exist("/modules/lz4_decompress.ko")) {
-          lxrc_run("/sbin/insmod /modules/lz4_decompress.ko");
+          insmod[insmods++] = (run_t) { .cmd = "/sbin/insmod /modules/lz4_decompress.ko", .log_stdout = 1 };
+        }
+        if(config.parts_overlay && util_check_exist("/modules/overlay.ko")) {
+          insmod[insmods++] = (run_t) { .cmd = "/sbin/insmod /modules/overlay.ko", .log_stdout = 1 };
         }
+
+        insmod_done = 1;
+        /* independent of each other, so load them in parallel */
+        for(u = 0; u < insmods; u++) util_run_start(insmod + u);
+        util_run_wait(insmod, insmods);
       }
       strprintf(&mp, "/parts/mp_%04u", config.mountpoint.initrd_parts++);
       mkdir(mp, 0755);
       util_mount_ro(sl->key, mp, NULL);
-      argv[1] = mp;
-      argv[2] = "/";
-      util_lndir_main(3, argv);
     }
   }
 
+  if(config.mountpoint.initrd_parts) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    inodes = lxrc_inodes();
+
+    if(config.parts_overlay) lxrc_stack_parts();
+
+    // link whatever could not be stacked
+    for(u = 0; u < config.mountpoint.initrd_parts; u++) {
+      strprintf(&mp, "/parts/mp_%04u", u);
+      util_lndir(mp, "/", config.mountpoint.initrd_stacked);
+    }
+
+    lxrc_parts_log(config.mountpoint.initrd_stacked ? "parts added (overlayfs)" : "parts added (lndir)", &start, inodes);
+  }
+
   slist_free(sl0);
   free(mp);
 }
@@ -1612,22 +1656,180 @@ void lxrc_add_parts()
 
 void lxrc_readd_parts()
 {
-  char *mp = NULL, *argv[3] = { };
+  char *mp = NULL;
+  struct timespec start;
+  int64_t inodes;
   unsigned u;
 
   if(config.test) return;
 
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  inodes = lxrc_inodes();
+
+  // stacked directories are still in place
   for(u = 0; u < config.mountpoint.initrd_parts; u++) {
     strprintf(&mp, "/parts/mp_%04u", u);
-    argv[1] = mp;
-    argv[2] = "/";
-    util_lndir_main(3, argv);
+    util_lndir(mp, "/", config.mountpoint.initrd_stacked);
   }
 
+  if(u) lxrc_parts_log("parts re-added", &start, inodes);
+
   free(mp);
 }
 
 
+/*
+ * Stack initrd parts using overlayfs.
+ *
+ * Every top-level directory of the parts gets an overlay mount with the
+ * parts as lower layers (later parts on top) and the directory in / as
+ * upper layer. So, as with lndir, existing files win and new files end up
+ * in /.
+ *
+ * Stacked directories are put into config.mountpoint.initrd_stacked;
+ * everything else is left for lndir (files, links, directories that are
+ * links or mount points in /).
+ */
+void lxrc_stack_parts()
+{
+  struct dirent *de;
+  struct stat sbuf;
+  dev_t root_dev;
+  DIR *d;
+  slist_t *names = NULL, *sl;
+  char *mp = NULL, *dir = NULL, *lower = NULL, *opts = NULL;
+  mode_t mode = 0755;
+  int i, ok;
+
+  for(i = 0; i < (int) config.mountpoint.initrd_parts; i++) {
+    strprintf(&mp, "/parts/mp_%04u", i);
+    if(!(d = opendir(mp))) continue;
+    while((de = readdir(d))) {
+      if(
+        strcmp(de->d_name, ".") &&
+        strcmp(de->d_name, "..") &&
+        !slist_getentry(names, de->d_name)
+      ) {
+        slist_append_str(&names, de->d_name);
+      }
+    }
+    closedir(d);
+  }
+
+  root_dev = stat("/", &sbuf) ? 0 : sbuf.st_dev;
+
+  // the upper layers are covered by the overlay mounts, so reach them via a bind mount of /
+  mkdir("/parts/root", 0755);
+  mkdir("/parts/work", 0755);
+  if(mount("/", "/parts/root", NULL, MS_BIND, NULL)) {
+    perror_info("/parts/root");
+    names = slist_free(names);
+  }
+
+  for(sl = names; sl; sl = sl->next) {
+    strprintf(&dir, "/%s", sl->key);
+    // mount points (/dev, /proc, ...) are hidden in the (non-recursive) bind mount
+    ok = lstat(dir, &sbuf) ? errno == ENOENT : S_ISDIR(sbuf.st_mode) && sbuf.st_dev == root_dev;
+    if(strpbrk(sl->key, ":,\\")) ok = 0;
+
+    str_copy(&lower, NULL);
+    for(i = config.mountpoint.initrd_parts - 1; ok && i >= 0; i--) {
+      strprintf(&mp, "/parts/mp_%04u/%s", i, sl->key);
+      if(lstat(mp, &sbuf)) continue;
+      if(S_ISDIR(sbuf.st_mode)) {
+        strprintf(&lower, "%s%s%s", lower ?: "", lower ? ":" : "", mp);
+        mode = sbuf.st_mode & 07777;
+      }
+      else {
+        ok = 0;
+      }
+    }
+
+    if(!ok || !lower) continue;
+
+    mkdir(dir, mode);
+    strprintf(&mp, "/parts/work/%s", sl->key);
+    mkdir(mp, 0755);
+
+    strprintf(&opts, "lowerdir=%s,upperdir=/parts/root/%s,workdir=/parts/root%s", lower, sl->key, mp);
+    if(mount("overlay", dir, "overlay", 0, opts)) {
+      if(errno == ENODEV) {
+        log_info("overlayfs not supported, linking parts\n");
+        break;
+      }
+      perror_info(dir);
+      continue;
+    }
+
+    log_debug("%s: stacked %s\n", dir, lower);
+    slist_append_str(&config.mountpoint.initrd_stacked, sl->key);
+  }
+
+  umount2("/parts/root", MNT_DETACH);
+
+  slist_free(names);
+  free(mp);
+  free(dir);
+  free(lower);
+  free(opts);
+}
+
+
+/*
+ * Undo lxrc_stack_parts(): remove the overlay mounts and, if relink is
+ * set, link the parts instead.
+ */
+void lxrc_unstack_parts(int relink)
+{
+  slist_t *sl;
+  char *buf = NULL;
+
+  if(!config.mountpoint.initrd_stacked) return;
+
+  for(sl = config.mountpoint.initrd_stacked; sl; sl = sl->next) {
+    strprintf(&buf, "/%s", sl->key);
+    if(umount2(buf, MNT_DETACH)) perror_info(buf);
+  }
+
+  config.mountpoint.initrd_stacked = slist_free(config.mountpoint.initrd_stacked);
+
+  if(relink) lxrc_readd_parts();
+
+  free(buf);
+}
+
+
+/*
+ * Number of inodes in use on /.
+ */
+int64_t lxrc_inodes()
+{
+  struct statvfs sbuf;
+
+  if(statvfs("/", &sbuf)) return 0;
+
+  return (int64_t) sbuf.f_files - sbuf.f_ffree;
+}
+
+
+/*
+ * Log time and inodes it took to integrate the initrd parts.
+ */
+void lxrc_parts_log(char *label, struct timespec *start, int64_t inodes)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  log_info("%s: %u parts, %ld ms, %"PRId64" inodes\n",
+    label,
+    config.mountpoint.initrd_parts,
+    (long) ((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000),
+    lxrc_inodes() - inodes
+  );
+}
+
+
 /*
  * Offer the user a list of URLs to choose from based in the current install
  * URL and the default repo setting.
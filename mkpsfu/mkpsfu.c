@@ -51,6 +51,7 @@ typedef struct {
   unsigned height;
   int yofs;
   int height2;
+  int *uni_index;		/* glyph index by char, built from unimap */
   unsigned used:1;		/* font actually used */
 } font_t;
 
@@ -87,6 +88,12 @@ int fonts;
 
 char_data_t *char_list;
 
+/* char_list, hashed by char */
+struct {
+  char_data_t **list;
+  unsigned size, used;
+} char_hash;
+
 unsigned char gfx_char[0x10000];
 
 char *pref_font = NULL;
@@ -95,6 +102,8 @@ int orig_char = -1;
 static int load_font(font_t *font);
 static char_data_t *add_char(int c);
 static char_data_t *find_char(int c);
+static void hash_char(char_data_t *cd);
+static unsigned bitmap_hash(unsigned char *bitmap, int height);
 static void dump_char(char_data_t *cd);
 static void dump_char_list(void);
 static void sort_char_list(void);
@@ -113,7 +122,8 @@ int main(int argc, char **argv)
 {
   int i, j, k, font_height, char_count, max_chars;
   char *str, *str1, *t, *t2;
-  char_data_t *cd;
+  char_data_t *cd, **glyphs, **by_index;
+  int start[512 + 1];
   iconv_t ic = (iconv_t) -1, ic2;
   char obuf[4], ibuf[6];
   char obuf2[4*0x100], ibuf2[0x100];
@@ -277,6 +287,7 @@ int main(int argc, char **argv)
 
         free(tmp_font.bitmap);
         free(tmp_font.unimap);
+        free(tmp_font.uni_index);
         break;
 
       case 'v':
@@ -418,32 +429,50 @@ int main(int argc, char **argv)
     }
   }
 
-  for(i = 0; i < max_chars; i++) {
-    for(cd = char_list; cd; cd = cd->next) {
-      if(cd->ok && !cd->dup && cd->new_index == i) break;
+  /* sort chars by font position (counting sort, keeps list order) */
+  memset(start, 0, sizeof start);
+  for(k = 0, cd = char_list; cd; cd = cd->next) {
+    if(cd->ok && cd->new_index >= 0 && cd->new_index < max_chars) {
+      start[cd->new_index + 1]++;
+      k++;
     }
-    add_data(&font, cd ? cd->bitmap : dummy_bitmap, font_height);
   }
+  for(i = 0; i < max_chars; i++) start[i + 1] += start[i];
 
-  uc[2] = uc[3] = 0xff;
-  
-  for(i = 0; i < max_chars; i++) {
-    for(j = 0, cd = char_list; cd; cd = cd->next) {
-      if(cd->ok && cd->new_index == i) {
-        uc[0] = cd->c;
-        uc[1] = cd->c >> 8;
-        add_data(&font, uc, 2);
-        j = 1;
-      }
+  glyphs = calloc(max_chars, sizeof *glyphs);
+  by_index = calloc(k + 1, sizeof *by_index);
+
+  for(cd = char_list; cd; cd = cd->next) {
+    if(cd->ok && cd->new_index >= 0 && cd->new_index < max_chars) {
+      by_index[start[cd->new_index]++] = cd;
+      if(!cd->dup && !glyphs[cd->new_index]) glyphs[cd->new_index] = cd;
     }
-    if(!j) {
+  }
+
+  for(i = 0; i < max_chars; i++) {
+    add_data(&font, glyphs[i] ? glyphs[i]->bitmap : dummy_bitmap, font_height);
+  }
+
+  uc[2] = uc[3] = 0xff;
+
+  /* start[i] now points to the end of entries for position i */
+  for(i = j = 0; i < max_chars; i++) {
+    if(j == start[i]) {
       uc[0] = 0xfd;
       uc[1] = 0xff;
       add_data(&font, uc, 2);
     }
+    for(; j < start[i]; j++) {
+      uc[0] = by_index[j]->c;
+      uc[1] = by_index[j]->c >> 8;
+      add_data(&font, uc, 2);
+    }
     add_data(&font, uc + 2, 2);
   }
 
+  free(glyphs);
+  free(by_index);
+
   if(opt_verbose) dump_char_list();
 
   write_data(opt_file);
@@ -460,7 +489,8 @@ int load_font(font_t *font)
   FILE *f;
   char *cmd = NULL;
   unsigned char head[4];
-  int ok = 0;
+  int i, c, ok = 0;
+  unsigned u;
 
   if(!font->name) return 0;
 
@@ -499,6 +529,20 @@ int load_font(font_t *font)
     }
   }
 
+  /* index unimap; first entry for a char wins */
+  if(ok) {
+    font->uni_index = malloc(0x10000 * sizeof *font->uni_index);
+    for(i = 0; i < 0x10000; i++) font->uni_index[i] = -1;
+    for(i = u = 0; u < font->unimap_len; u += 2) {
+      c = font->unimap[u] + (font->unimap[u + 1] << 8);
+      if(c == 0xffff) {
+        i++;
+        continue;
+      }
+      if(font->uni_index[c] < 0) font->uni_index[c] = i;
+    }
+  }
+
   pclose(f);
 
   return ok;
@@ -519,22 +563,67 @@ char_data_t *add_char(int c)
 
   cd->orig_c = orig_char >= 0 ? orig_char : cd->c;
 
+  hash_char(cd);
+
   return char_list = cd;
 }
 
 
 char_data_t *find_char(int c)
 {
-  char_data_t *cd;
+  unsigned u;
 
-  for(cd = char_list; cd; cd = cd->next) {
-    if(cd->c == c) return cd;
+  if(!char_hash.size) return NULL;
+
+  for(u = c * 0x9e3779b1u; char_hash.list[u &= char_hash.size - 1]; u++) {
+    if(char_hash.list[u]->c == c) return char_hash.list[u];
   }
 
   return NULL;
 }
 
 
+/*
+ * Add char to hash; grow hash if it gets too full.
+ */
+void hash_char(char_data_t *cd)
+{
+  unsigned u;
+  char_data_t *cd2;
+
+  if(2 * (char_hash.used + 1) > char_hash.size) {
+    free(char_hash.list);
+    char_hash.size = char_hash.size ? char_hash.size * 2 : 0x400;
+    char_hash.list = calloc(char_hash.size, sizeof *char_hash.list);
+    char_hash.used = 0;
+    for(cd2 = char_list; cd2; cd2 = cd2->next) {
+      if(cd2 != cd) hash_char(cd2);
+    }
+  }
+
+  for(u = cd->c * 0x9e3779b1u; char_hash.list[u &= char_hash.size - 1]; u++);
+
+  char_hash.list[u] = cd;
+  char_hash.used++;
+}
+
+
+/*
+ * FNV-1a hash of bitmap.
+ */
+unsigned bitmap_hash(unsigned char *bitmap, int height)
+{
+  unsigned h = 2166136261u;
+
+  while(height-- > 0) {
+    h ^= *bitmap++;
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+
 void dump_char(char_data_t *cd)
 {
   int j;
@@ -650,21 +739,9 @@ void locate_char(char_data_t *cd)
 
 int char_index(font_t *font, int c)
 {
-  int i;
-  unsigned u, u1;
-
-  if(!font || !font->unimap || c < 0 || c >= 0xffff) return -1;
-
-  for(i = u = 0; u < font->unimap_len; u += 2) {
-    u1 = font->unimap[u] + (font->unimap[u + 1] << 8);
-    if(u1 == 0xffff) {
-      i++;
-      continue;
-    }
-    if(u1 == c) return i;
-  }
+  if(!font || !font->uni_index || c < 0 || c >= 0xffff) return -1;
 
-  return -1;
+  return font->uni_index[c];
 }
 
 
@@ -756,26 +833,39 @@ int is_special_nongfx(char_data_t *cd)
 int assign_char_pos()
 {
   int char_count, char_index, i;
-  char_data_t *cd, *cd2;
+  unsigned u, size;
+  char_data_t *cd, **bitmaps;
   char_data_t *used[512] = { };
   int max_chars;
 
-  for(cd = char_list; cd; cd = cd->next) {
+  for(i = 0, size = 0x400, cd = char_list; cd; cd = cd->next) {
     cd->new_index = -1;
+    if(cd->ok && 2 * ++i > size) size *= 2;
   }
 
   /* first, find identical bitmaps */
+  bitmaps = calloc(size, sizeof *bitmaps);
+
   for(cd = char_list; cd; cd = cd->next) {
     if(!cd->ok || cd->dup) continue;
 
-    for(cd2 = cd->next; cd2; cd2 = cd2->next) {
-      if(!cd2->ok || cd2->dup) continue;
-      if(!memcmp(cd->bitmap, cd2->bitmap, cd->height)) {
-        cd2->dup = cd;
-      }
+    for(u = bitmap_hash(cd->bitmap, cd->height); bitmaps[u &= size - 1]; u++) {
+      if(
+        bitmaps[u]->height == cd->height &&
+        !memcmp(bitmaps[u]->bitmap, cd->bitmap, cd->height)
+      ) break;
+    }
+
+    if(bitmaps[u]) {
+      cd->dup = bitmaps[u];
+    }
+    else {
+      bitmaps[u] = cd;
     }
   }
 
+  free(bitmaps);
+
   char_count = 0;
   for(cd = char_list; cd; cd = cd->next) {
     if(cd->ok && !cd->dup) char_count++;
@@ -26,6 +26,8 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
@@ -35,6 +37,9 @@
 #include <netinet/in.h>
 #include <netinet/ether.h>
 #include <sys/wait.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <limits.h>
 
 #include <hd.h>
 
@@ -47,6 +52,8 @@
 #include "module.h"
 #include "url.h"
 #include "auto2.h"
+#include "netlink.h"
+#include "dns.h"
 
 
 #if defined(__s390__) || defined(__s390x__)
@@ -59,6 +66,35 @@
 int net_activate_s390_devs_ex(hd_t* hd, char** device);
 #endif
 
+// max. time (in ms) to wait for interfaces after 'wicked ifup/ifdown'
+#define NET_SETTLE_TIMEOUT	3000
+#define NET_DOWN_TIMEOUT	1000
+
+// nfs performance profile
+#define NFS_NCONNECT_MAX	4
+#define NFS_RWSIZE		(1 << 20)
+#define NFS_READAHEAD_KB	4096
+
+// new mount api (older glibc doesn't have it)
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC		0x00000001
+#define FSMOUNT_CLOEXEC		0x00000001
+#define FSCONFIG_SET_FLAG	0
+#define FSCONFIG_SET_STRING	1
+#define FSCONFIG_CMD_CREATE	6
+#define MOVE_MOUNT_F_EMPTY_PATH	0x00000004
+#define MOUNT_ATTR_RDONLY	0x00000001
+#define MOUNT_ATTR_NOSUID	0x00000002
+#define MOUNT_ATTR_NODEV	0x00000004
+#define MOUNT_ATTR_NOEXEC	0x00000008
+#define MOUNT_ATTR_NOATIME	0x00000010
+#endif
+
+// wicked puts dhcp leases here
+#define NET_LEASE_DIR		"/run/wicked"
+#define NET_LEASE4		(1 << 0)
+#define NET_LEASE6		(1 << 1)
+
 static int net_choose_device(void);
 static int net_input_data(void);
 static int net_input_vlanid(void);
@@ -68,6 +104,13 @@ static int wlan_auth_cb(dia_item_t di);
 static dia_item_t di_wlan_auth_last = di_none;
 static void parse_leaseinfo(char *file);
 static void net_wicked_dhcp(void);
+static void net_wicked_dhcp_up(char *ifname);
+static unsigned net_lease_event(char *ifname, char *name, unsigned leases);
+static void net_wicked_reap(void);
+static char *nfs_perf_options(void);
+static int nfs_mount_api(char *mountpoint, char *server, char *path, char *perf_options, char *options);
+static int nfs_mount_cmd(char *mountpoint, char *path, char *options);
+static void nfs_set_readahead(char *mountpoint);
 
 static void net_cifs_build_options(char **options, char *user, char *password, char *workgroup);
 static int ifcfg_write(char *device, ifcfg_t *ifcfg, int flags);
@@ -77,6 +120,13 @@ static int net_get_ip(char *text, char **ip, int with_prefix);
 static int net_check_ip(char *buf, int multi, int with_prefix);
 static int compare_subnet(char *ip1, char *ip2, unsigned prefix);
 static void get_and_copy_ifcfg_flags(ifcfg_t *ifcfg, char *device);
+static int net_settled(void *data);
+static int net_if_configured(nl_if_t *nif);
+static int net_down(void *data);
+static void net_wait_state(char *ifname, int up);
+
+// 'wicked ifup' still running in background after dhcp
+static run_t dhcp_run;
 
 
 /*
@@ -280,10 +330,8 @@ int net_static()
  */
 int net_check_address(inet_t *inet, int do_dns)
 {
-  struct hostent *he = NULL;
-  slist_t *sl;
   char *s, buf[INET6_ADDRSTRLEN];
-  int net_bits = 0;
+  int i, net_bits = 0;
 
   if(!inet) return 1;
 
@@ -351,78 +399,14 @@ int net_check_address(inet_t *inet, int do_dns)
     return inet->ok ? 0 : 1;
   }
 
-  if(!inet->ipv6 && !inet->ipv4) {
-    for(sl = config.net.dns_cache; sl; sl = sl->next) {
-      if(sl->key && sl->value && !strcasecmp(sl->key, inet->name)) {
-        if(!inet->ipv6 && config.net.ipv6 && strchr(sl->value, ':')) {
-          if(inet_pton(AF_INET6, sl->value, &inet->ip6) > 0) {
-            inet->ipv6 = 1;
-          }
-        }
-
-        if(!inet->ipv4 && config.net.ipv4 && !strchr(sl->value, ':')) {
-          if(inet_pton(AF_INET, sl->value, &inet->ip) > 0) {
-            inet->ipv4 = 1;
-          }
-        }
-      }
-    }
-  }
-
-  if(inet->ipv6 || inet->ipv4) inet->ok = 1;
-
   if(!inet->ok) {
-    if(config.net.ipv6) {
-      he = gethostbyname2(inet->name, AF_INET6);
-      if(!he) { sleep(1); he = gethostbyname2(inet->name, AF_INET6); }
-      if(!he) {
-        if(config.run_as_linuxrc) {
-          log_info("dns6: what is \"%s\"?\n", inet->name);
-        }
-      }
-      else {
-        inet->ok = 1;
-        inet->ipv6 = 1;
-        memcpy(&inet->ip6, *he->h_addr_list, he->h_length);
-
-        s = (char *) inet_ntop(AF_INET6, &inet->ip6, buf, sizeof buf);
-        if(s) {
-          sl = slist_add(&config.net.dns_cache, slist_new());
-          str_copy(&sl->key, inet->name);
-          str_copy(&sl->value, s);
-
-          if(config.run_as_linuxrc) {
-            log_info("dns6: %s is %s\n", inet->name, s);
-          }
-        }
-      }
-    }
-
-    if(config.net.ipv4) {
-      he = gethostbyname2(inet->name, AF_INET);
-      if(!he) { sleep(1); gethostbyname2(inet->name, AF_INET); }
-      if(!he) {
-        if(config.run_as_linuxrc) {
-          log_info("dns: what is \"%s\"?\n", inet->name);
-        }
-      }
-      else {
-        inet->ok = 1;
-        inet->ipv4 = 1;
-        memcpy(&inet->ip, *he->h_addr_list, he->h_length);
-
-        s = (char *) inet_ntop(AF_INET, &inet->ip, buf, sizeof buf);
-        if(s) {
-          sl = slist_add(&config.net.dns_cache, slist_new());
-          str_copy(&sl->key, inet->name);
-          str_copy(&sl->value, s);
-
-          if(config.run_as_linuxrc) {
-            log_info("dns: %s is %s\n", inet->name, s);
-          }
-        }
-      }
-    }
+    i = dns_lookup(inet->name,
+      (config.net.ipv4 ? DNS_IPV4 : 0) | (config.net.ipv6 ? DNS_IPV6 : 0),
+      &inet->ip, &inet->ip6
+    );
+    if((i & DNS_IPV4)) inet->ipv4 = 1;
+    if((i & DNS_IPV6)) inet->ipv6 = 1;
+    if(i) inet->ok = 1;
   }
 
   inet->ok = inet->ok && ((config.net.ipv6 && inet->ipv6) || (config.net.ipv4 && inet->ipv4));
@@ -531,28 +515,14 @@ int net_mount_cifs(char *mountpoint, char *server, char *share, char *user, char
 int net_mount_nfs(char *mountpoint, char *server, char *hostdir, unsigned port, char *options)
 {
   char *path = NULL;
-  char *real_options = NULL;
-  pid_t mount_pid;
+  char *real_options = NULL, *perf_options = NULL;
+  int err = -1;
 
   if(!server) return -EDESTADDRREQ;	// -89
 
   if(!hostdir) hostdir = "/";
   if(!mountpoint || !*mountpoint) mountpoint = "/";
 
-  mount_pid = fork();
-  if(mount_pid < 0) {
-    perror_info("fork");
-
-    return mount_pid;
-  }
-  else if(mount_pid > 0) {
-    int err;
-    pid_t pid;
-    while((pid = waitpid(-1, &err, 0)) && pid != mount_pid);
-
-    return WEXITSTATUS(err);
-  }
-
   if(strchr(server, ':')) {
     strprintf(&path, "[%s]:%s", server, hostdir);
   }
@@ -573,9 +543,209 @@ int net_mount_nfs(char *mountpoint, char *server, char *hostdir, unsigned port,
     }
   }
 
-  log_debug("mount -o '%s' '%s' '%s'\n", real_options, path, mountpoint);
+  /*
+   * Try the performance profile via the new mount api. Fall back to the
+   * mount command (without our tuning) only if the api or some option is
+   * not supported - not if the server is just unreachable.
+   */
+  if((perf_options = nfs_perf_options())) {
+    err = nfs_mount_api(mountpoint, server, path, perf_options, real_options);
+    if(err == EINVAL || err == ENOSYS || err == EOPNOTSUPP) {
+      log_info("nfs: falling back to mount, without %s\n", perf_options);
+      err = -1;
+    }
+    else if(!err) {
+      nfs_set_readahead(mountpoint);
+    }
+  }
+
+  if(err == -1) err = nfs_mount_cmd(mountpoint, path, real_options);
+
+  str_copy(&path, NULL);
+  str_copy(&real_options, NULL);
+  str_copy(&perf_options, NULL);
+
+  return err;
+}
+
+
+/*
+ * Options for the nfs performance profile.
+ *
+ * Use several tcp connections (nconnect) and large rsize/wsize unless
+ * the user has set them.
+ *
+ * Return NULL if the profile is not used.
+ */
+char *nfs_perf_options()
+{
+  char *buf = NULL;
+  long cpus;
+
+  if(!config.net.nfs.perf || config.net.nfs.udp) return NULL;
+
+  if(!config.net.nfs.opts || !strstr(config.net.nfs.opts, "nconnect=")) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus > NFS_NCONNECT_MAX) cpus = NFS_NCONNECT_MAX;
+    if(cpus > 1) strprintf(&buf, "nconnect=%ld", cpus);
+  }
+
+  if(!config.net.nfs.rsize) strprintf(&buf, "%s%srsize=%u", buf ?: "", buf ? "," : "", NFS_RWSIZE);
+  if(!config.net.nfs.wsize) strprintf(&buf, "%s%swsize=%u", buf ?: "", buf ? "," : "", NFS_RWSIZE);
+
+  return buf;
+}
+
+
+/*
+ * Mount nfs directly via fsopen() & co.
+ *
+ * The kernel needs the server address (no name) and doesn't try other nfs
+ * versions, so we try v4 and v3 unless a version has been given.
+ *
+ * perf_options are our tuning (see nfs_perf_options()) and are dropped if
+ * the kernel doesn't know them; options are the regular ones and must all
+ * be accepted. Explicit options go last so they win.
+ *
+ * Return 0 if ok, else errno value (ENOSYS if the api can't be used).
+ */
+int nfs_mount_api(char *mountpoint, char *server, char *path, char *perf_options, char *options)
+{
+#if defined(SYS_fsopen) && defined(SYS_fsconfig) && defined(SYS_fsmount) && defined(SYS_move_mount)
+  inet_t inet = {};
+  slist_t *sl, *sl0;
+  char *s, *addr = NULL, *all_options = NULL, *vers[] = { NULL, "4", "3" };
+  char buf[INET6_ADDRSTRLEN];
+  unsigned attr = 0, u, n, perf_cnt, has_vers;
+  int fs_fd, mnt_fd = -1, err = 0;
+  struct timespec t0, t1;
+
+  str_copy(&inet.name, server);
+  if(!net_check_address(&inet, 1)) {
+    if(inet.ipv6) s = (char *) inet_ntop(AF_INET6, &inet.ip6, buf, sizeof buf);
+    else s = (char *) inet_ntop(AF_INET, &inet.ip, buf, sizeof buf);
+    str_copy(&addr, s);
+  }
+  str_copy(&inet.name, NULL);
+
+  if(!addr) return ENOSYS;
+
+  // our options come first
+  sl0 = slist_split(',', perf_options);
+  for(perf_cnt = 0, sl = sl0; sl; sl = sl->next) perf_cnt++;
+  slist_free(sl0);
+
+  strprintf(&all_options, "%s%s%s", perf_options, *options ? "," : "", options);
+  sl0 = slist_split(',', all_options);
+  str_copy(&all_options, NULL);
+
+  for(has_vers = 0, sl = sl0; sl; sl = sl->next) {
+    if(!strncmp(sl->key, "vers=", 5) || !strncmp(sl->key, "nfsvers=", 8)) has_vers = 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(u = has_vers ? 0 : 1; u < (has_vers ? 1 : sizeof vers / sizeof *vers); u++) {
+    if((fs_fd = syscall(SYS_fsopen, "nfs", FSOPEN_CLOEXEC)) == -1) {
+      err = errno;
+      break;
+    }
+
+    syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "source", path, 0);
+    syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "addr", addr, 0);
+    if(vers[u]) syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, "vers", vers[u], 0);
+
+    for(err = 0, n = 0, sl = sl0; sl && !err; sl = sl->next, n++) {
+      if(!strcmp(sl->key, "noatime")) { attr |= MOUNT_ATTR_NOATIME; continue; }
+      if(!strcmp(sl->key, "nodev")) { attr |= MOUNT_ATTR_NODEV; continue; }
+      if(!strcmp(sl->key, "nosuid")) { attr |= MOUNT_ATTR_NOSUID; continue; }
+      if(!strcmp(sl->key, "noexec")) { attr |= MOUNT_ATTR_NOEXEC; continue; }
+      if(!strcmp(sl->key, "defaults")) continue;
+      if(!*sl->key) continue;
+      if((s = strchr(sl->key, '='))) {
+        *s = 0;
+        err = syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_STRING, sl->key, s + 1, 0);
+        *s = '=';
+      }
+      else {
+        err = syscall(SYS_fsconfig, fs_fd, FSCONFIG_SET_FLAG, sl->key, NULL, 0);
+      }
+      if(err) {
+        err = errno;
+        log_info("nfs: option %s not supported%s\n", sl->key, n < perf_cnt ? ", dropped" : "");
+        if(n < perf_cnt) err = 0;
+      }
+    }
+
+    if(!err) err = syscall(SYS_fsconfig, fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) ? errno : 0;
+
+    if(!err) {
+      mnt_fd = syscall(SYS_fsmount, fs_fd, FSMOUNT_CLOEXEC, attr);
+      if(mnt_fd == -1) err = errno;
+    }
+
+    close(fs_fd);
+
+    // try next version
+    if(err != EPROTONOSUPPORT) break;
+  }
+
+  slist_free(sl0);
+
+  if(mnt_fd != -1) {
+    err = syscall(SYS_move_mount, mnt_fd, "", AT_FDCWD, mountpoint, MOVE_MOUNT_F_EMPTY_PATH) ? errno : 0;
+    close(mnt_fd);
+  }
 
-  char *args[6] = { "mount", "-o", real_options, path, mountpoint /*, NULL */ };
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if(err) {
+    log_info("nfs: %s: %s\n", path, strerror(err));
+  }
+  else {
+    log_info("nfs: %s mounted at %s (%s, vers=%s, %ld ms)\n",
+      path, mountpoint, addr, vers[u] ?: "default",
+      (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000
+    );
+  }
+
+  str_copy(&addr, NULL);
+
+  return err;
+#else
+  return ENOSYS;
+#endif
+}
+
+
+/*
+ * Mount nfs via mount command.
+ *
+ * Return 0 if ok.
+ */
+int nfs_mount_cmd(char *mountpoint, char *path, char *options)
+{
+  pid_t mount_pid;
+
+  mount_pid = fork();
+  if(mount_pid < 0) {
+    perror_info("fork");
+
+    return mount_pid;
+  }
+  else if(mount_pid > 0) {
+    int err;
+
+    while(waitpid(mount_pid, &err, 0) == -1) {
+      if(errno != EINTR) return -1;
+    }
+
+    return WEXITSTATUS(err);
+  }
+
+  log_debug("mount -o '%s' '%s' '%s'\n", options, path, mountpoint);
+
+  char *args[6] = { "mount", "-o", options, path, mountpoint /*, NULL */ };
 
   signal(SIGUSR1, SIG_IGN);
   execvp("mount", args);
@@ -584,6 +754,31 @@ int net_mount_nfs(char *mountpoint, char *server, char *hostdir, unsigned port,
 }
 
 
+/*
+ * Increase readahead of nfs mount.
+ *
+ * The setting is in /sys/class/bdi/<major:minor> of the mount.
+ */
+void nfs_set_readahead(char *mountpoint)
+{
+  struct stat sbuf;
+  char *buf = NULL;
+  FILE *f;
+
+  if(stat(mountpoint, &sbuf)) return;
+
+  strprintf(&buf, "/sys/class/bdi/%u:%u/read_ahead_kb", major(sbuf.st_dev), minor(sbuf.st_dev));
+
+  if((f = fopen(buf, "w"))) {
+    fprintf(f, "%u\n", NFS_READAHEAD_KB);
+    fclose(f);
+    log_debug("%s: read_ahead_kb = %u\n", buf, NFS_READAHEAD_KB);
+  }
+
+  str_copy(&buf, NULL);
+}
+
+
 /*
  * Let user select a network interface.
  *
@@ -1155,7 +1350,7 @@ int net_dhcp()
  */
 void net_wicked_dhcp()
 {
-  char file[256], *buf = NULL;
+  char *buf = NULL;
   window_t win;
   int got_ip = 0, cfg_ok;
   ifcfg_t *ifcfg = NULL;
@@ -1205,17 +1400,7 @@ void net_wicked_dhcp()
 
   net_apply_ethtool(config.ifcfg.manual->device, NULL);
 
-  net_wicked_up(ifname);
-
-  if(config.net.ipv4) {
-    snprintf(file, sizeof file, "/run/wicked/leaseinfo.%s.dhcp.ipv4", ifname);
-    parse_leaseinfo(file);
-  }
-
-  if(!got_ip && config.net.ipv6) {
-    snprintf(file, sizeof file, "/run/wicked/leaseinfo.%s.dhcp.ipv6", ifname);
-    parse_leaseinfo(file);
-  }
+  net_wicked_dhcp_up(ifname);
 
   if(slist_getentry(config.ifcfg.if_up, ifname)) got_ip = 1;
 
@@ -1257,6 +1442,157 @@ void net_wicked_dhcp()
 }
 
 
+/*
+ * Set up interface via dhcp and read leases as they are written.
+ *
+ * With both ipv4 and ipv6 enabled, wicked runs dhcp4 and dhcp6 in
+ * parallel. We go on as soon as one protocol has given us an address and a
+ * default route; 'wicked ifup' keeps running in the background for the
+ * other (see net_wicked_reap()).
+ */
+void net_wicked_dhcp_up(char *ifname)
+{
+  char buf[sizeof (struct inotify_event) + NAME_MAX + 1] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  char file[256];
+  struct inotify_event *ev;
+  struct pollfd pfd;
+  int fd, i, len, done = 0;
+  unsigned leases = 0;
+  nl_if_t *nif;
+
+  net_wicked_reap();
+
+  if((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) != -1) {
+    mkdir(NET_LEASE_DIR, 0755);
+    if(inotify_add_watch(fd, NET_LEASE_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+      perror_debug(NET_LEASE_DIR);
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  if(fd == -1) {
+    net_wicked_up(ifname);
+  }
+  else {
+    log_debug("wicked ifup %s\n", ifname);
+
+    if(config.net.dhcp_timeout_set) {
+      strprintf(&dhcp_run.cmd, "wicked ifup --timeout %d %s", config.net.dhcp_timeout, ifname);
+    }
+    else {
+      strprintf(&dhcp_run.cmd, "wicked ifup %s", ifname);
+    }
+
+    if(config.test || util_run_start(&dhcp_run)) done = 1;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    do {
+      if(util_run_poll(&dhcp_run)) done = 1;
+
+      if(done || poll(&pfd, 1, 100) > 0) {
+        while((len = read(fd, buf, sizeof buf)) > 0) {
+          for(i = 0; i < len; i += sizeof *ev + ev->len) {
+            ev = (struct inotify_event *) (buf + i);
+            if(ev->len) leases |= net_lease_event(ifname, ev->name, leases);
+          }
+        }
+      }
+
+      if(!done && !nl_update() && (nif = nl_if_get(ifname))) {
+        if(
+          ((leases & NET_LEASE4) && nif->addr4 && nif->gw4) ||
+          ((leases & NET_LEASE6) && nif->addr6 && nif->gw6)
+        ) {
+          log_info("%s: dhcp%s ok, not waiting for wicked\n", ifname, leases & NET_LEASE4 ? "4" : "6");
+          done = 1;
+        }
+      }
+    } while(!done);
+
+    close(fd);
+
+    if(config.net.ifup_wait) sleep(config.net.ifup_wait);
+
+    LXRC_WAIT
+
+    net_update_state();
+  }
+
+  // nothing seen: look at what is there
+  if(!leases) {
+    if(config.net.ipv4) {
+      snprintf(file, sizeof file, NET_LEASE_DIR "/leaseinfo.%s.dhcp.ipv4", ifname);
+      parse_leaseinfo(file);
+    }
+
+    if(config.net.ipv6) {
+      snprintf(file, sizeof file, NET_LEASE_DIR "/leaseinfo.%s.dhcp.ipv6", ifname);
+      parse_leaseinfo(file);
+    }
+  }
+}
+
+
+/*
+ * Handle new file in NET_LEASE_DIR.
+ *
+ * If the ipv6 lease has already been read, an ipv4 lease does not override
+ * it (keeps the order we used to read them).
+ *
+ * Return NET_LEASE4 or NET_LEASE6 if it's a lease for ifname.
+ */
+unsigned net_lease_event(char *ifname, char *name, unsigned leases)
+{
+  char file[256];
+  unsigned lease;
+  int len = strlen(ifname);
+
+  if(strncmp(name, "leaseinfo.", sizeof "leaseinfo." - 1)) return 0;
+  name += sizeof "leaseinfo." - 1;
+  if(strncmp(name, ifname, len)) return 0;
+  name += len;
+
+  if(!strcmp(name, ".dhcp.ipv4") && config.net.ipv4) {
+    lease = NET_LEASE4;
+  }
+  else if(!strcmp(name, ".dhcp.ipv6") && config.net.ipv6) {
+    lease = NET_LEASE6;
+  }
+  else {
+    return 0;
+  }
+
+  log_debug("%s: dhcp%s lease\n", ifname, lease == NET_LEASE4 ? "4" : "6");
+
+  if(lease == NET_LEASE6 || !(leases & NET_LEASE6)) {
+    snprintf(file, sizeof file, NET_LEASE_DIR "/leaseinfo.%s%s", ifname, name);
+    parse_leaseinfo(file);
+  }
+
+  return lease;
+}
+
+
+/*
+ * Wait for 'wicked ifup' left running by net_wicked_dhcp_up().
+ *
+ * Note: the waitpid(-1) loops that reap orphaned processes (we may be
+ * init) might have reaped it already; util_run_wait() copes with that.
+ */
+void net_wicked_reap()
+{
+  if(dhcp_run.pid) {
+    log_debug("waiting for: %s\n", dhcp_run.cmd);
+    util_run_wait(&dhcp_run, 1);
+  }
+
+  str_copy(&dhcp_run.cmd, NULL);
+}
+
+
 /*
  * Return current network config state as bitmask.
  */
@@ -2497,7 +2833,10 @@ char *ifcfg_print(ifcfg_t *ifcfg)
 
 
 /*
- * Run wicked to collect all interface states.
+ * Collect all interface states.
+ *
+ * The state is taken from the netlink interface list; if that's not
+ * available, run wicked.
  *
  * config.ifcfg.if_state
  */
@@ -2506,10 +2845,19 @@ void net_update_state()
   FILE *f;
   char buf[256], *s1, *s2,*s3;
   slist_t *sl;
+  nl_if_t *nif;
 
   config.ifcfg.if_state = slist_free(config.ifcfg.if_state);
 
-  if((f = popen("wicked show all 2>/dev/null", "r"))) {
+  if(!nl_update()) {
+    for(nif = nl_if_list(); nif; nif = nif->next) {
+      if(!nif->name) continue;
+      sl = slist_append(&config.ifcfg.if_state, slist_new());
+      str_copy(&sl->key, nif->name);
+      str_copy(&sl->value, nl_if_state(nif));
+    }
+  }
+  else if((f = popen("wicked show all 2>/dev/null", "r"))) {
     while(fgets(buf, sizeof buf, f)) {
       if(!isspace(*buf)) {
         for(s1 = buf; *s1 && !isspace(*s1); s1++);
@@ -2549,6 +2897,8 @@ void net_wicked_up(char *ifname)
 
   if(!ifname) return;
 
+  net_wicked_reap();
+
   log_debug("wicked ifup %s\n", ifname);
 
   if(config.net.dhcp_timeout_set) {
@@ -2560,7 +2910,9 @@ void net_wicked_up(char *ifname)
 
   if(!config.test) lxrc_run(buf);
 
-  sleep(config.net.ifup_wait + 1);
+  net_wait_state(ifname, 1);
+
+  if(config.net.ifup_wait) sleep(config.net.ifup_wait);
 
   LXRC_WAIT
 
@@ -2579,13 +2931,21 @@ void net_wicked_down(char *ifname)
 
   if(!ifname) return;
 
+  net_wicked_reap();
+
   log_debug("wicked ifdown %s\n", ifname);
 
   strprintf(&buf, "wicked ifdown %s", ifname);
 
   if(!config.test) lxrc_run(buf);
 
-  sleep(1);
+  net_wait_state(ifname, 0);
+
+  // name servers may differ on the next network
+  dns_cache_clear();
+
+  // and open connections went with the interface
+  url_close_connections();
 
   LXRC_WAIT
 
@@ -2609,6 +2969,87 @@ void net_wicked_down(char *ifname)
 }
 
 
+/*
+ * Check if interface (or all interfaces for 'all') has settled after
+ * 'wicked ifup', i.e. it has a usable address of a family we use and no
+ * address is still doing duplicate address detection.
+ *
+ * For 'all', at least one interface != lo must have an address.
+ */
+int net_settled(void *data)
+{
+  char *ifname = data;
+  nl_if_t *nif;
+  int configured = 0;
+
+  if(strcmp(ifname, "all")) {
+    nif = nl_if_get(ifname);
+
+    return nif && net_if_configured(nif);
+  }
+
+  for(nif = nl_if_list(); nif; nif = nif->next) {
+    if(nif->tentative) return 0;
+    if(nif->name && strcmp(nif->name, "lo") && net_if_configured(nif)) configured = 1;
+  }
+
+  return configured;
+}
+
+
+/*
+ * Interface has a usable (not tentative) address of a family we use.
+ */
+int net_if_configured(nl_if_t *nif)
+{
+  if(nif->tentative) return 0;
+
+  return (config.net.ipv4 && nif->addr4) || (config.net.ipv6 && nif->addr6);
+}
+
+
+/*
+ * Check if interface (or all interfaces != lo for 'all') is down.
+ */
+int net_down(void *data)
+{
+  char *ifname = data;
+  nl_if_t *nif;
+
+  if(strcmp(ifname, "all")) {
+    nif = nl_if_get(ifname);
+
+    return !nif || strcmp(nl_if_state(nif), "up");
+  }
+
+  for(nif = nl_if_list(); nif; nif = nif->next) {
+    if(nif->name && strcmp(nif->name, "lo") && !strcmp(nl_if_state(nif), "up")) return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Wait for interface to finish going up or down.
+ *
+ * Without netlink, just wait a second.
+ */
+void net_wait_state(char *ifname, int up)
+{
+  int ok;
+
+  ok = nl_wait(up ? net_settled : net_down, ifname, up ? NET_SETTLE_TIMEOUT : NET_DOWN_TIMEOUT);
+
+  if(ok < 0) {
+    sleep(1);
+  }
+  else {
+    log_debug("%s: %s%s\n", ifname, up ? "settled" : "down", ok ? "" : " (timeout)");
+  }
+}
+
+
 /*
  * Convert netmask string to network prefix bits.
  * Both ipv4 and ipv6 forms are allowed.
@@ -0,0 +1,600 @@
+/*
+ *
+ * netlink.c     Network interface state tracking via rtnetlink
+ *
+ * Link, address and route changes are read from a NETLINK_ROUTE socket and
+ * kept in a list of interfaces. This replaces parsing 'wicked show all' and
+ * fixed sleeps while waiting for interfaces to come up or go down.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <linux/if_arp.h>
+
+#include "global.h"
+#include "util.h"
+#include "netlink.h"
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP	0x10000
+#endif
+
+static int nl_dump(int type, int family);
+static int nl_read(int timeout);
+static void nl_parse(struct nlmsghdr *nh);
+static void nl_parse_link(struct nlmsghdr *nh);
+static void nl_parse_addr(struct nlmsghdr *nh);
+static void nl_parse_route(struct nlmsghdr *nh);
+static nl_if_t *nl_if_by_index(int index, int create);
+static void nl_if_free(nl_if_t *nif);
+static void nl_update_counts(nl_if_t *nif);
+static void nl_resync(void);
+static long nl_ms(void);
+
+static int nl_fd = -1;
+static unsigned nl_seq;
+static nl_if_t *nl_list;
+static int nl_lost;
+
+
+/*
+ * Open rtnetlink socket and read current state.
+ *
+ * Return 0 on success.
+ */
+int nl_init()
+{
+  struct sockaddr_nl sa = {
+    .nl_family = AF_NETLINK,
+    .nl_groups =
+      RTMGRP_LINK |
+      RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+      RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE
+  };
+  int size = 1 << 20;
+
+  if(nl_fd >= 0) return 0;
+
+  if((nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE)) == -1) {
+    perror_debug("netlink socket");
+    return 1;
+  }
+
+  setsockopt(nl_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+
+  if(bind(nl_fd, (struct sockaddr *) &sa, sizeof sa)) {
+    perror_debug("netlink bind");
+    close(nl_fd);
+    nl_fd = -1;
+    return 1;
+  }
+
+  nl_resync();
+
+  return 0;
+}
+
+
+/*
+ * Read all pending events.
+ *
+ * Return 0 if the state is available.
+ */
+int nl_update()
+{
+  if(nl_init()) return 1;
+
+  while(nl_read(0) >= 0);
+
+  if(nl_lost) nl_resync();
+
+  return 0;
+}
+
+
+/*
+ * Interface list (call nl_update() first).
+ */
+nl_if_t *nl_if_list()
+{
+  return nl_list;
+}
+
+
+nl_if_t *nl_if_get(char *name)
+{
+  nl_if_t *nif;
+
+  if(!name) return NULL;
+
+  for(nif = nl_list; nif; nif = nif->next) {
+    if(nif->name && !strcmp(nif->name, name)) return nif;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Interface state in wicked terms.
+ *
+ * 'up': interface is up and has a usable address.
+ */
+char *nl_if_state(nl_if_t *nif)
+{
+  if(!nif || !(nif->flags & IFF_UP)) return "device-down";
+
+  if(nif->addr4 || nif->addr6) return "up";
+
+  if(nif->tentative) return "setup-in-progress";
+
+  return "device-up";
+}
+
+
+/*
+ * Start watching link state of all ethernet interfaces.
+ *
+ * This only observes: interfaces are left as they are (setting them up is
+ * up to wicked). The time until carrier is seen gets logged. Call again
+ * after loading more network drivers.
+ */
+void nl_link_watch()
+{
+  nl_if_t *nif;
+
+  if(nl_update()) return;
+
+  for(nif = nl_list; nif; nif = nif->next) {
+    if(nif->watch_time || nif->type != ARPHRD_ETHER) continue;
+
+    nif->watch_time = nl_ms();
+
+    if(nif->carrier) log_info("link: %s has carrier\n", nif->name);
+  }
+}
+
+
+/*
+ * Time between starting to watch and carrier detection (in ms).
+ *
+ * Interfaces that already had link when we started get 0.
+ */
+long nl_link_delay(nl_if_t *nif)
+{
+  long delay;
+
+  if(!nif || !nif->carrier || !nif->watch_time) return 0;
+
+  delay = nif->carrier_time - nif->watch_time;
+
+  return delay > 0 ? delay : 0;
+}
+
+
+/*
+ * Process events until check(data) returns non-zero or timeout (in ms) is
+ * reached.
+ *
+ * Return check() result (0: timed out) or -1 if no netlink socket.
+ */
+int nl_wait(int (*check)(void *), void *data, int timeout)
+{
+  long end;
+  int ok, left;
+
+  if(nl_update()) return -1;
+
+  end = nl_ms() + timeout;
+
+  while(!(ok = check(data)) && (left = end - nl_ms()) > 0) {
+    if(nl_read(left) < 0) break;
+    while(nl_read(0) >= 0);
+    if(nl_lost) nl_resync();
+  }
+
+  if(!ok) ok = check(data);
+
+  return ok;
+}
+
+
+/*
+ * Request a dump of all objects of a type.
+ */
+int nl_dump(int type, int family)
+{
+  struct {
+    struct nlmsghdr nh;
+    struct rtgenmsg g;
+  } req = {
+    .nh = {
+      .nlmsg_len = NLMSG_LENGTH(sizeof (struct rtgenmsg)),
+      .nlmsg_type = type,
+      .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+      .nlmsg_seq = ++nl_seq
+    },
+    .g = { .rtgen_family = family }
+  };
+  int done;
+
+  if(send(nl_fd, &req, req.nh.nlmsg_len, 0) == -1) {
+    perror_debug("netlink send");
+    return 1;
+  }
+
+  // nl_read() returns 0 on NLMSG_DONE
+  while((done = nl_read(1000)) > 0);
+
+  return done < 0 ? 1 : 0;
+}
+
+
+/*
+ * Read one batch of messages, waiting up to timeout ms.
+ *
+ * Return:
+ *   -1: error or timeout
+ *    0: end of dump seen
+ *   >0: messages read
+ */
+int nl_read(int timeout)
+{
+  static char buf[1 << 15];
+  struct pollfd p = { .fd = nl_fd, .events = POLLIN };
+  struct nlmsghdr *nh;
+  ssize_t len;
+  int cnt = 0, done = 0;
+
+  if(timeout && poll(&p, 1, timeout) <= 0) return -1;
+
+  len = recv(nl_fd, buf, sizeof buf, 0);
+
+  if(len == -1) {
+    if(errno == ENOBUFS) {
+      // we lost events - have to start over
+      log_debug("netlink: overflow\n");
+      nl_lost = 1;
+      return 1;
+    }
+    return -1;
+  }
+
+  for(nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+    if(nh->nlmsg_type == NLMSG_DONE) {
+      done = 1;
+      continue;
+    }
+    if(nh->nlmsg_type == NLMSG_ERROR) {
+      if(nh->nlmsg_seq == nl_seq) done = 1;
+      continue;
+    }
+    nl_parse(nh);
+    cnt++;
+  }
+
+  return done ? 0 : cnt ? cnt : 1;
+}
+
+
+void nl_parse(struct nlmsghdr *nh)
+{
+  switch(nh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+      nl_parse_link(nh);
+      break;
+
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+      nl_parse_addr(nh);
+      break;
+
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+      nl_parse_route(nh);
+      break;
+  }
+}
+
+
+void nl_parse_link(struct nlmsghdr *nh)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(nh);
+  struct rtattr *rta;
+  int len = IFLA_PAYLOAD(nh);
+  nl_if_t *nif, **p;
+  unsigned carrier;
+
+  if(nh->nlmsg_type == RTM_DELLINK) {
+    for(p = &nl_list; (nif = *p); p = &nif->next) {
+      if(nif->index == ifi->ifi_index) {
+        *p = nif->next;
+        log_debug("netlink: %s removed\n", nif->name);
+        nl_if_free(nif);
+        break;
+      }
+    }
+    return;
+  }
+
+  nif = nl_if_by_index(ifi->ifi_index, 1);
+
+  for(rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if(rta->rta_type == IFLA_IFNAME) {
+      str_copy(&nif->name, RTA_DATA(rta));
+    }
+  }
+
+  carrier = ifi->ifi_flags & IFF_LOWER_UP ? 1 : 0;
+  if(carrier && !nif->carrier) {
+    nif->carrier_time = nl_ms();
+    if(nif->watch_time) {
+      log_info("link: %s has carrier after %ld ms\n", nif->name, nif->carrier_time - nif->watch_time);
+    }
+  }
+  nif->carrier = carrier;
+  nif->flags = ifi->ifi_flags;
+  nif->type = ifi->ifi_type;
+}
+
+
+void nl_parse_addr(struct nlmsghdr *nh)
+{
+  struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+  struct rtattr *rta;
+  int len = IFA_PAYLOAD(nh);
+  nl_if_t *nif;
+  nl_addr_t *a, **p;
+  unsigned char *addr = NULL, *local = NULL;
+  unsigned flags = ifa->ifa_flags, addr_len;
+
+  if(ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6) return;
+
+  addr_len = ifa->ifa_family == AF_INET ? 4 : 16;
+
+  for(rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    switch(rta->rta_type) {
+      case IFA_ADDRESS:
+        if(RTA_PAYLOAD(rta) >= addr_len) addr = RTA_DATA(rta);
+        break;
+      case IFA_LOCAL:
+        if(RTA_PAYLOAD(rta) >= addr_len) local = RTA_DATA(rta);
+        break;
+#ifdef IFA_FLAGS
+      case IFA_FLAGS:
+        if(RTA_PAYLOAD(rta) >= sizeof flags) flags = *(unsigned *) RTA_DATA(rta);
+        break;
+#endif
+    }
+  }
+
+  // for ptp links IFA_LOCAL is our address
+  if(local) addr = local;
+
+  if(!addr || !(nif = nl_if_by_index(ifa->ifa_index, 0))) return;
+
+  for(p = &nif->addr; (a = *p); p = &a->next) {
+    if(
+      a->family == ifa->ifa_family &&
+      a->prefix == ifa->ifa_prefixlen &&
+      !memcmp(a->addr, addr, addr_len)
+    ) break;
+  }
+
+  if(nh->nlmsg_type == RTM_DELADDR) {
+    if(a) {
+      *p = a->next;
+      free(a);
+    }
+  }
+  else {
+    if(!a) {
+      a = *p = calloc(1, sizeof *a);
+      a->family = ifa->ifa_family;
+      a->prefix = ifa->ifa_prefixlen;
+      memcpy(a->addr, addr, addr_len);
+    }
+    a->flags = flags;
+    a->scope = ifa->ifa_scope;
+  }
+
+  nl_update_counts(nif);
+}
+
+
+/*
+ * Keep track of default routes.
+ *
+ * There may be several per interface (e.g. more than one ipv6 router), so
+ * remember each of them and not just a flag.
+ */
+void nl_parse_route(struct nlmsghdr *nh)
+{
+  struct rtmsg *rtm = NLMSG_DATA(nh);
+  struct rtattr *rta;
+  int len = RTM_PAYLOAD(nh), oif = 0;
+  unsigned char gw[16] = {};
+  unsigned metric = 0, addr_len;
+  nl_if_t *nif;
+  nl_route_t *r, **p;
+
+  // only default routes in main table matter here
+  if(rtm->rtm_table != RT_TABLE_MAIN || rtm->rtm_dst_len) return;
+  if(rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6) return;
+
+  addr_len = rtm->rtm_family == AF_INET ? 4 : 16;
+
+  for(rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    switch(rta->rta_type) {
+      case RTA_OIF:
+        oif = *(int *) RTA_DATA(rta);
+        break;
+      case RTA_PRIORITY:
+        metric = *(unsigned *) RTA_DATA(rta);
+        break;
+      case RTA_GATEWAY:
+        if(RTA_PAYLOAD(rta) >= addr_len) memcpy(gw, RTA_DATA(rta), addr_len);
+        break;
+    }
+  }
+
+  if(!(nif = nl_if_by_index(oif, 0))) return;
+
+  for(p = &nif->route; (r = *p); p = &r->next) {
+    if(
+      r->family == rtm->rtm_family &&
+      r->metric == metric &&
+      !memcmp(r->gw, gw, sizeof gw)
+    ) break;
+  }
+
+  if(nh->nlmsg_type == RTM_DELROUTE) {
+    if(r) {
+      *p = r->next;
+      free(r);
+    }
+  }
+  else if(!r) {
+    r = *p = calloc(1, sizeof *r);
+    r->family = rtm->rtm_family;
+    r->metric = metric;
+    memcpy(r->gw, gw, sizeof gw);
+  }
+
+  nif->gw4 = nif->gw6 = 0;
+  for(r = nif->route; r; r = r->next) {
+    if(r->family == AF_INET) {
+      nif->gw4 = 1;
+    }
+    else {
+      nif->gw6 = 1;
+    }
+  }
+}
+
+
+nl_if_t *nl_if_by_index(int index, int create)
+{
+  nl_if_t *nif, **p;
+
+  if(index <= 0) return NULL;
+
+  for(p = &nl_list; (nif = *p); p = &nif->next) {
+    if(nif->index == index) return nif;
+  }
+
+  if(create) {
+    nif = *p = calloc(1, sizeof *nif);
+    nif->index = index;
+  }
+
+  return nif;
+}
+
+
+void nl_if_free(nl_if_t *nif)
+{
+  nl_addr_t *a, *next;
+  nl_route_t *r, *r_next;
+
+  for(a = nif->addr; a; a = next) {
+    next = a->next;
+    free(a);
+  }
+
+  for(r = nif->route; r; r = r_next) {
+    r_next = r->next;
+    free(r);
+  }
+
+  free(nif->name);
+  free(nif);
+}
+
+
+/*
+ * Count usable addresses.
+ *
+ * Link-local IPv6 addresses don't count; addresses still doing duplicate
+ * address detection are 'tentative'.
+ */
+void nl_update_counts(nl_if_t *nif)
+{
+  nl_addr_t *a;
+
+  nif->addr4 = nif->addr6 = nif->tentative = 0;
+
+  for(a = nif->addr; a; a = a->next) {
+    if(a->flags & (IFA_F_TENTATIVE | IFA_F_OPTIMISTIC)) {
+      nif->tentative++;
+    }
+    else if(a->flags & IFA_F_DADFAILED) {
+      continue;
+    }
+    else if(a->family == AF_INET) {
+      nif->addr4++;
+    }
+    else if(a->scope == RT_SCOPE_UNIVERSE) {
+      nif->addr6++;
+    }
+  }
+}
+
+
+/*
+ * Re-read complete state.
+ *
+ * Link timestamps are kept for interfaces that didn't lose carrier.
+ */
+void nl_resync()
+{
+  nl_if_t *nif, *old, *old_list, *next;
+
+  nl_lost = 0;
+
+  old_list = nl_list;
+  nl_list = NULL;
+
+  nl_dump(RTM_GETLINK, AF_UNSPEC);
+  nl_dump(RTM_GETADDR, AF_UNSPEC);
+  nl_dump(RTM_GETROUTE, AF_UNSPEC);
+
+  for(old = old_list; old; old = next) {
+    next = old->next;
+    if((nif = nl_if_by_index(old->index, 0))) {
+      nif->watch_time = old->watch_time;
+      if(nif->carrier && old->carrier) nif->carrier_time = old->carrier_time;
+    }
+    nl_if_free(old);
+  }
+}
+
+
+/*
+ * Monotonic time in ms.
+ */
+long nl_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,51 @@
+/*
+ * Address of a network interface.
+ */
+typedef struct nl_addr_s {
+  struct nl_addr_s *next;
+  unsigned family;		/* AF_INET, AF_INET6 */
+  unsigned prefix;
+  unsigned flags;		/* IFA_F_* */
+  unsigned scope;		/* RT_SCOPE_* */
+  unsigned char addr[16];
+} nl_addr_t;
+
+/*
+ * Default route via a network interface.
+ */
+typedef struct nl_route_s {
+  struct nl_route_s *next;
+  unsigned family;		/* AF_INET, AF_INET6 */
+  unsigned metric;
+  unsigned char gw[16];		/* gateway (all 0: none) */
+} nl_route_t;
+
+/*
+ * Network interface state.
+ */
+typedef struct nl_if_s {
+  struct nl_if_s *next;
+  int index;
+  char *name;
+  unsigned flags;		/* IFF_* */
+  unsigned addr4;		/* usable ipv4 addresses */
+  unsigned addr6;		/* usable global ipv6 addresses */
+  unsigned tentative;		/* addresses still doing DAD */
+  unsigned carrier:1;		/* link detected */
+  unsigned gw4:1;		/* has ipv4 default route */
+  unsigned gw6:1;		/* has ipv6 default route */
+  unsigned type;		/* ARPHRD_* */
+  long carrier_time;		/* when link was detected (ms, monotonic) */
+  long watch_time;		/* when link watching started (ms, monotonic), see nl_link_watch() */
+  nl_addr_t *addr;
+  nl_route_t *route;		/* default routes */
+} nl_if_t;
+
+int nl_init(void);
+int nl_update(void);
+nl_if_t *nl_if_list(void);
+nl_if_t *nl_if_get(char *name);
+char *nl_if_state(nl_if_t *nif);
+void nl_link_watch(void);
+long nl_link_delay(nl_if_t *nif);
+int nl_wait(int (*check)(void *), void *data, int timeout);
@@ -0,0 +1,2517 @@
+/*
+ *
+ * pgp.c         OpenPGP signature verification
+ *
+ * Verifies signed files against the keys in PGP_KEYRING and PGP_KEYRING_DIR
+ * without running gpg or rpmkeys.
+ *
+ * Supported:
+ *   - detached signatures (binary or armored)
+ *   - signed messages (binary or armored, optionally compressed)
+ *   - cleartext signed messages
+ *   - signed rpms (header signature + payload digest)
+ *   - RSA and EdDSA (Ed25519) keys, SHA1 and SHA2 hashes
+ *
+ * Data are processed as a stream, so verification can be done while a file
+ * is being downloaded.
+ *
+ * Note: the keyrings are trusted as a whole; key binding signatures and
+ * expiration dates are not checked (we used to run gpg with
+ * --ignore-valid-from --ignore-time-conflict anyway).
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "global.h"
+#include "util.h"
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "sha512.h"
+#include "pgp.h"
+
+/* OpenPGP packet tags */
+#define TAG_SIG			2
+#define TAG_ONEPASS		4
+#define TAG_KEY			6
+#define TAG_COMPRESSED		8
+#define TAG_LITERAL		11
+#define TAG_SUBKEY		14
+
+/* public key algorithms */
+#define PK_RSA			1
+#define PK_RSA_SIGN		3
+#define PK_EDDSA		22
+#define PK_ED25519		27
+
+/* input types */
+#define PV_UNKNOWN		0
+#define PV_NONE			1	/* not signed, just pass through */
+#define PV_BINARY		2
+#define PV_ARMOR		3
+#define PV_CLEAR		4
+#define PV_RPM			5
+#define PV_DETACHED		6
+#define PV_KEYS			7	/* read keyring */
+
+/* line states for armored input */
+#define A_START			0
+#define A_HEADERS		1
+#define A_BODY			2
+#define A_TAIL			3
+#define A_DONE			4
+#define C_HEADERS		5
+#define C_TEXT			6
+
+/* packet parser states */
+#define PKT_HDR			0
+#define PKT_LEN			1
+#define PKT_BODY		2
+
+/* rpm parser states */
+#define R_LEAD			0
+#define R_SIGPRE		1
+#define R_SIG			2
+#define R_HDRPRE		3
+#define R_HDR			4
+#define R_PAYLOAD		5
+
+#define RPM_LEAD_SIZE		96
+
+/* rpm tags */
+#define RPMSIGTAG_DSA		267
+#define RPMSIGTAG_RSA		268
+#define RPMSIGTAG_PGP		1002
+#define RPMSIGTAG_MD5		1004
+#define RPMSIGTAG_GPG		1005
+#define RPMTAG_PAYLOADDIGEST	5092
+#define RPMTAG_PAYLOADDIGESTALGO 5093
+
+/* max size of a packet we keep in memory */
+#define MAX_PACKET		(1 << 20)
+
+typedef struct {
+  int algo;
+  union {
+    struct md5_ctx md5;
+    struct sha1_ctx sha1;
+    struct sha256_ctx sha256;
+    struct sha512_ctx sha512;
+  } ctx;
+} pgp_hash_t;
+
+typedef struct pgp_key_s {
+  struct pgp_key_s *next;
+  int algo;
+  unsigned char keyid[8];
+  unsigned char fpr[20];
+  unsigned char *n, *e;		/* RSA */
+  unsigned n_len, e_len;
+  unsigned char ed[32];		/* EdDSA */
+} pgp_key_t;
+
+typedef struct {
+  int version, type, pk_algo, hash_algo;
+  unsigned char *keyid;		/* issuer, if known */
+  unsigned char *fpr;		/* issuer fingerprint, if known */
+  unsigned char *hashed;	/* part of the packet included in hash */
+  unsigned hashed_len;
+  unsigned char *left16;
+  unsigned char *mpi[2];
+  unsigned mpi_len[2];
+} pgp_sig_t;
+
+typedef struct {
+  int state;
+  unsigned char hdr[6];
+  unsigned hdr_len;
+  int tag;
+  uint64_t left;
+  unsigned partial:1;
+  unsigned indeterminate:1;
+  uint64_t pos;			/* body bytes seen so far */
+  membuf_t body;		/* packet body, if we need it */
+} pgp_layer_t;
+
+struct pgp_verify_s {
+  int type;
+  int result;
+  unsigned failed:1;		/* malformed input or unsupported feature */
+  unsigned hash_started:1;
+  unsigned text:1;		/* canonical text signature */
+  unsigned last_cr:1;
+  unsigned first_line:1;
+  unsigned keys_started:1;
+  unsigned keys_binary:1;
+  unsigned lit_text:1;		/* literal data in text mode */
+  unsigned lit_cr:1;
+  pgp_write_func_t write;
+  void *write_data;
+  membuf_t head;		/* data collected until type is known */
+  membuf_t line;		/* current line (armored input) */
+  int line_state;
+  unsigned b64_val;
+  int b64_bits;
+  pgp_layer_t layer[2];		/* [1]: inside compressed packet */
+  z_stream z;
+  int z_algo;
+  unsigned z_active:1;
+  unsigned lit_hdr_len;
+  pgp_hash_t hash;
+  membuf_t sig;			/* signature packet to check */
+  struct {
+    int state;
+    uint64_t need;
+    membuf_t buf;
+    membuf_t hdr_sig, pkg_sig;
+    unsigned char md5[16];
+    unsigned has_md5:1;
+    unsigned hdr_ok:1;
+    pgp_hash_t hdr_hash, pkg_hash, md5_hash, payload_hash;
+    char *payload_digest;
+  } rpm;
+};
+
+static pgp_key_t *pgp_keys;
+static time_t pgp_keys_mtime[2];
+
+static int hash_init(pgp_hash_t *hash, int algo);
+static void hash_update(pgp_hash_t *hash, const void *buf, size_t len);
+static unsigned hash_finish(pgp_hash_t *hash, unsigned char *digest);
+static int hash_by_name(char *name);
+
+static int bn_cmp(const uint32_t *a, const uint32_t *b, unsigned len);
+static void bn_sub(uint32_t *a, const uint32_t *b, unsigned len);
+static void bn_from_bytes(uint32_t *a, unsigned len, const unsigned char *buf, unsigned buf_len);
+static void mont_mul(uint32_t *r, const uint32_t *a, const uint32_t *b, const uint32_t *n, uint32_t n0inv, unsigned len, uint32_t *t);
+static int rsa_verify(pgp_key_t *key, unsigned char *s, unsigned s_len, int hash_algo, unsigned char *digest, unsigned digest_len);
+
+static int ed25519_verify(const unsigned char *pk, const unsigned char *sig, const unsigned char *msg, size_t msg_len);
+
+static unsigned char *get_mpi(unsigned char **buf, unsigned char *end, unsigned *len);
+static int parse_sig(unsigned char *buf, unsigned len, pgp_sig_t *sig);
+static void parse_key(unsigned char *buf, unsigned len);
+static int check_sig(pgp_sig_t *sig, unsigned char *digest, unsigned digest_len);
+static int verify_sig(pgp_hash_t *hash, unsigned char *buf, unsigned len);
+static void decode_sig(void *buf, size_t len, membuf_t *sig);
+static void free_keys(void);
+static void load_keyring(char *file);
+
+static void start_hash(pgp_verify_t *pv, int algo, int text);
+static void hash_text(pgp_verify_t *pv, unsigned char *buf, size_t len);
+static void write_text(pgp_verify_t *pv, unsigned char *buf, size_t len);
+static void detect_type(pgp_verify_t *pv);
+static void input_data(pgp_verify_t *pv, unsigned char *buf, size_t len);
+static void input_lines(pgp_verify_t *pv, unsigned char *buf, size_t len);
+static void line_handler(pgp_verify_t *pv, char *line, size_t len);
+static void b64_decode(pgp_verify_t *pv, char *line);
+static int new_len(unsigned char *buf, unsigned len, uint64_t *pkt_len, unsigned *partial);
+static void layer_process(pgp_verify_t *pv, int level, unsigned char *buf, size_t len);
+static void layer_finish(pgp_verify_t *pv, int level);
+static void packet_start(pgp_verify_t *pv, int level);
+static void packet_data(pgp_verify_t *pv, int level, unsigned char *buf, size_t len);
+static void packet_end(pgp_verify_t *pv, int level);
+static void inflate_data(pgp_verify_t *pv, unsigned char *buf, size_t len, int flush);
+static void rpm_process(pgp_verify_t *pv, unsigned char *buf, size_t len);
+static void rpm_section_done(pgp_verify_t *pv);
+static unsigned char *sig_packet(unsigned char *buf, unsigned *len);
+static unsigned char *rpm_tag(membuf_t *hdr, unsigned tag, unsigned *type, unsigned *count, unsigned *len);
+static int rpm_result(pgp_verify_t *pv);
+
+static inline unsigned get_be16(unsigned char *p)
+{
+  return (p[0] << 8) + p[1];
+}
+
+static inline unsigned get_be32(unsigned char *p)
+{
+  return ((unsigned) p[0] << 24) + (p[1] << 16) + (p[2] << 8) + p[3];
+}
+
+
+/*
+ * Hash functions.
+ *
+ * hash_init() returns digest size or 0 if algorithm is not supported.
+ */
+int hash_init(pgp_hash_t *hash, int algo)
+{
+  hash->algo = algo;
+
+  switch(algo) {
+    case PGP_HASH_MD5:
+      md5_init_ctx(&hash->ctx.md5);
+      return MD5_DIGEST_SIZE;
+
+    case PGP_HASH_SHA1:
+      sha1_init_ctx(&hash->ctx.sha1);
+      return SHA1_DIGEST_SIZE;
+
+    case PGP_HASH_SHA224:
+      sha224_init_ctx(&hash->ctx.sha256);
+      return SHA224_DIGEST_SIZE;
+
+    case PGP_HASH_SHA256:
+      sha256_init_ctx(&hash->ctx.sha256);
+      return SHA256_DIGEST_SIZE;
+
+    case PGP_HASH_SHA384:
+      sha384_init_ctx(&hash->ctx.sha512);
+      return SHA384_DIGEST_SIZE;
+
+    case PGP_HASH_SHA512:
+      sha512_init_ctx(&hash->ctx.sha512);
+      return SHA512_DIGEST_SIZE;
+  }
+
+  hash->algo = 0;
+
+  return 0;
+}
+
+
+void hash_update(pgp_hash_t *hash, const void *buf, size_t len)
+{
+  if(!len) return;
+
+  switch(hash->algo) {
+    case PGP_HASH_MD5:
+      md5_process_bytes(buf, len, &hash->ctx.md5);
+      break;
+
+    case PGP_HASH_SHA1:
+      sha1_process_bytes(buf, len, &hash->ctx.sha1);
+      break;
+
+    case PGP_HASH_SHA224:
+    case PGP_HASH_SHA256:
+      sha256_process_bytes(buf, len, &hash->ctx.sha256);
+      break;
+
+    case PGP_HASH_SHA384:
+    case PGP_HASH_SHA512:
+      sha512_process_bytes(buf, len, &hash->ctx.sha512);
+      break;
+  }
+}
+
+
+unsigned hash_finish(pgp_hash_t *hash, unsigned char *digest)
+{
+  switch(hash->algo) {
+    case PGP_HASH_MD5:
+      md5_finish_ctx(&hash->ctx.md5, digest);
+      return MD5_DIGEST_SIZE;
+
+    case PGP_HASH_SHA1:
+      sha1_finish_ctx(&hash->ctx.sha1, digest);
+      return SHA1_DIGEST_SIZE;
+
+    case PGP_HASH_SHA224:
+      sha224_finish_ctx(&hash->ctx.sha256, digest);
+      return SHA224_DIGEST_SIZE;
+
+    case PGP_HASH_SHA256:
+      sha256_finish_ctx(&hash->ctx.sha256, digest);
+      return SHA256_DIGEST_SIZE;
+
+    case PGP_HASH_SHA384:
+      sha384_finish_ctx(&hash->ctx.sha512, digest);
+      return SHA384_DIGEST_SIZE;
+
+    case PGP_HASH_SHA512:
+      sha512_finish_ctx(&hash->ctx.sha512, digest);
+      return SHA512_DIGEST_SIZE;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Hash algorithm from name as used in 'Hash:' armor header.
+ */
+int hash_by_name(char *name)
+{
+  static struct {
+    char *name;
+    int algo;
+  } hashes[] = {
+    { "SHA1",   PGP_HASH_SHA1   },
+    { "SHA224", PGP_HASH_SHA224 },
+    { "SHA256", PGP_HASH_SHA256 },
+    { "SHA384", PGP_HASH_SHA384 },
+    { "SHA512", PGP_HASH_SHA512 },
+  };
+  unsigned u;
+
+  for(u = 0; u < sizeof hashes / sizeof *hashes; u++) {
+    if(!strcasecmp(name, hashes[u].name)) return hashes[u].algo;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Big numbers (for RSA).
+ *
+ * Numbers are arrays of 32 bit words, least significant word first.
+ */
+int bn_cmp(const uint32_t *a, const uint32_t *b, unsigned len)
+{
+  while(len--) {
+    if(a[len] != b[len]) return a[len] > b[len] ? 1 : -1;
+  }
+
+  return 0;
+}
+
+
+void bn_sub(uint32_t *a, const uint32_t *b, unsigned len)
+{
+  uint64_t borrow = 0, d;
+  unsigned u;
+
+  for(u = 0; u < len; u++) {
+    d = (uint64_t) a[u] - b[u] - borrow;
+    a[u] = d;
+    borrow = (d >> 32) & 1;
+  }
+}
+
+
+void bn_from_bytes(uint32_t *a, unsigned len, const unsigned char *buf, unsigned buf_len)
+{
+  unsigned u;
+
+  memset(a, 0, len * sizeof *a);
+
+  for(u = 0; u < buf_len && u < len * 4; u++) {
+    a[u / 4] |= (uint32_t) buf[buf_len - 1 - u] << (8 * (u % 4));
+  }
+}
+
+
+/*
+ * Montgomery multiplication: r = a * b / R mod n (R = 2^(32 * len)).
+ *
+ * t must have space for len + 2 words.
+ */
+void mont_mul(uint32_t *r, const uint32_t *a, const uint32_t *b, const uint32_t *n, uint32_t n0inv, unsigned len, uint32_t *t)
+{
+  unsigned i, j;
+  uint64_t c;
+  uint32_t m;
+
+  memset(t, 0, (len + 2) * sizeof *t);
+
+  for(i = 0; i < len; i++) {
+    for(c = j = 0; j < len; j++) {
+      c += (uint64_t) a[j] * b[i] + t[j];
+      t[j] = c;
+      c >>= 32;
+    }
+    c += t[len];
+    t[len] = c;
+    t[len + 1] = c >> 32;
+
+    m = t[0] * n0inv;
+    c = ((uint64_t) m * n[0] + t[0]) >> 32;
+    for(j = 1; j < len; j++) {
+      c += (uint64_t) m * n[j] + t[j];
+      t[j - 1] = c;
+      c >>= 32;
+    }
+    c += t[len];
+    t[len - 1] = c;
+    t[len] = t[len + 1] + (c >> 32);
+  }
+
+  if(t[len] || bn_cmp(t, n, len) >= 0) bn_sub(t, n, len);
+
+  memcpy(r, t, len * sizeof *r);
+}
+
+
+/*
+ * Verify RSA PKCS#1 v1.5 signature.
+ *
+ * Return 1 if ok.
+ */
+int rsa_verify(pgp_key_t *key, unsigned char *s, unsigned s_len, int hash_algo, unsigned char *digest, unsigned digest_len)
+{
+  static const unsigned char prefix_sha1[] = {
+    0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04, 0x14
+  };
+  static const unsigned char prefix_sha224[] = {
+    0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x04, 0x05, 0x00, 0x04, 0x1c
+  };
+  static const unsigned char prefix_sha256[] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+  };
+  static const unsigned char prefix_sha384[] = {
+    0x30, 0x41, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x02, 0x05, 0x00, 0x04, 0x30
+  };
+  static const unsigned char prefix_sha512[] = {
+    0x30, 0x51, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x03, 0x05, 0x00, 0x04, 0x40
+  };
+  const unsigned char *prefix;
+  unsigned prefix_len, len, k, u, bits, ok = 0;
+  uint32_t *n, *x, *acc, *r2, *t, n0inv, inv;
+  unsigned char *em;
+  int i;
+
+  switch(hash_algo) {
+    case PGP_HASH_SHA1:
+      prefix = prefix_sha1;
+      prefix_len = sizeof prefix_sha1;
+      break;
+
+    case PGP_HASH_SHA224:
+      prefix = prefix_sha224;
+      prefix_len = sizeof prefix_sha224;
+      break;
+
+    case PGP_HASH_SHA256:
+      prefix = prefix_sha256;
+      prefix_len = sizeof prefix_sha256;
+      break;
+
+    case PGP_HASH_SHA384:
+      prefix = prefix_sha384;
+      prefix_len = sizeof prefix_sha384;
+      break;
+
+    case PGP_HASH_SHA512:
+      prefix = prefix_sha512;
+      prefix_len = sizeof prefix_sha512;
+      break;
+
+    default:
+      return 0;
+  }
+
+  k = key->n_len;
+  if(!k || !(key->n[k - 1] & 1) || s_len > k || k < prefix_len + digest_len + 11) return 0;
+
+  len = (k + 3) / 4;
+
+  n = calloc(6 * len + 2, sizeof *n);
+  x = n + len;
+  acc = x + len;
+  r2 = acc + len;
+  t = r2 + len;
+
+  bn_from_bytes(n, len, key->n, k);
+  bn_from_bytes(x, len, s, s_len);
+
+  if(bn_cmp(x, n, len) >= 0) {
+    free(n);
+    return 0;
+  }
+
+  /* n0inv = -1 / n[0] mod 2^32 */
+  for(inv = n[0], u = 0; u < 5; u++) inv *= 2 - n[0] * inv;
+  n0inv = -inv;
+
+  /* r2 = R^2 mod n */
+  memset(r2, 0, len * sizeof *r2);
+  r2[0] = 1;
+  for(u = 0; u < 64 * len; u++) {
+    uint32_t carry = r2[len - 1] >> 31;
+    for(i = len - 1; i > 0; i--) r2[i] = (r2[i] << 1) | (r2[i - 1] >> 31);
+    r2[0] <<= 1;
+    if(carry || bn_cmp(r2, n, len) >= 0) bn_sub(r2, n, len);
+  }
+
+  /* acc = x ^ e mod n */
+  mont_mul(x, x, r2, n, n0inv, len, t);
+  memcpy(acc, x, len * sizeof *acc);
+
+  for(bits = 0, u = 0; u < key->e_len; u++) {
+    for(i = 7; i >= 0; i--) {
+      if(bits) {
+        mont_mul(acc, acc, acc, n, n0inv, len, t);
+        if((key->e[u] >> i) & 1) mont_mul(acc, acc, x, n, n0inv, len, t);
+      }
+      else {
+        bits = (key->e[u] >> i) & 1;
+      }
+    }
+  }
+
+  memset(r2, 0, len * sizeof *r2);
+  r2[0] = 1;
+  mont_mul(acc, acc, r2, n, n0inv, len, t);
+
+  /* compare with EMSA-PKCS1-v1_5 encoding */
+  em = (unsigned char *) t;
+  for(u = 0; u < k; u++) em[k - 1 - u] = acc[u / 4] >> (8 * (u % 4));
+
+  if(bits && em[0] == 0 && em[1] == 1) {
+    u = k - prefix_len - digest_len - 1;
+    for(ok = 1, i = 2; i < (int) u; i++) if(em[i] != 0xff) ok = 0;
+    if(
+      em[u] != 0 ||
+      memcmp(em + u + 1, prefix, prefix_len) ||
+      memcmp(em + u + 1 + prefix_len, digest, digest_len)
+    ) ok = 0;
+  }
+
+  free(n);
+
+  return ok;
+}
+
+
+/*
+ * Ed25519 signature verification (RFC 8032).
+ *
+ * Field and group arithmetic follows the public domain TweetNaCl code.
+ */
+
+typedef int64_t gf[16];
+
+static const gf gf0;
+static const gf gf1 = { 1 };
+static const gf ed_d = {
+  0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070,
+  0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203
+};
+static const gf ed_d2 = {
+  0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0,
+  0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406
+};
+static const gf ed_x = {
+  0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c,
+  0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169
+};
+static const gf ed_y = {
+  0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666,
+  0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666
+};
+static const gf ed_i = {
+  0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43,
+  0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83
+};
+static const int64_t ed_l[32] = {
+  0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+};
+
+static void gf_set(gf r, const gf a)
+{
+  memcpy(r, a, sizeof (gf));
+}
+
+static void gf_carry(gf o)
+{
+  int i;
+  int64_t c;
+
+  for(i = 0; i < 16; i++) {
+    o[i] += 1 << 16;
+    c = o[i] >> 16;
+    o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+    o[i] -= c * 65536;
+  }
+}
+
+static void gf_sel(gf p, gf q, int b)
+{
+  int64_t t, c = ~(b - 1);
+  int i;
+
+  for(i = 0; i < 16; i++) {
+    t = c & (p[i] ^ q[i]);
+    p[i] ^= t;
+    q[i] ^= t;
+  }
+}
+
+static void gf_pack(unsigned char *o, const gf n)
+{
+  int i, j, b;
+  gf m, t;
+
+  gf_set(t, n);
+  gf_carry(t);
+  gf_carry(t);
+  gf_carry(t);
+
+  for(j = 0; j < 2; j++) {
+    m[0] = t[0] - 0xffed;
+    for(i = 1; i < 15; i++) {
+      m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+      m[i - 1] &= 0xffff;
+    }
+    m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+    b = (m[15] >> 16) & 1;
+    m[14] &= 0xffff;
+    gf_sel(t, m, 1 - b);
+  }
+
+  for(i = 0; i < 16; i++) {
+    o[2 * i] = t[i] & 0xff;
+    o[2 * i + 1] = t[i] >> 8;
+  }
+}
+
+static int gf_neq(const gf a, const gf b)
+{
+  unsigned char c[32], d[32];
+
+  gf_pack(c, a);
+  gf_pack(d, b);
+
+  return memcmp(c, d, 32) != 0;
+}
+
+static int gf_parity(const gf a)
+{
+  unsigned char d[32];
+
+  gf_pack(d, a);
+
+  return d[0] & 1;
+}
+
+static void gf_unpack(gf o, const unsigned char *n)
+{
+  int i;
+
+  for(i = 0; i < 16; i++) o[i] = n[2 * i] + ((int64_t) n[2 * i + 1] << 8);
+  o[15] &= 0x7fff;
+}
+
+static void gf_add(gf o, const gf a, const gf b)
+{
+  int i;
+
+  for(i = 0; i < 16; i++) o[i] = a[i] + b[i];
+}
+
+static void gf_sub(gf o, const gf a, const gf b)
+{
+  int i;
+
+  for(i = 0; i < 16; i++) o[i] = a[i] - b[i];
+}
+
+static void gf_mul(gf o, const gf a, const gf b)
+{
+  int64_t t[31];
+  int i, j;
+
+  memset(t, 0, sizeof t);
+
+  for(i = 0; i < 16; i++) {
+    for(j = 0; j < 16; j++) t[i + j] += a[i] * b[j];
+  }
+  for(i = 0; i < 15; i++) t[i] += 38 * t[i + 16];
+  for(i = 0; i < 16; i++) o[i] = t[i];
+
+  gf_carry(o);
+  gf_carry(o);
+}
+
+static void gf_inv(gf o, const gf i)
+{
+  gf c;
+  int a;
+
+  gf_set(c, i);
+  for(a = 253; a >= 0; a--) {
+    gf_mul(c, c, c);
+    if(a != 2 && a != 4) gf_mul(c, c, i);
+  }
+  gf_set(o, c);
+}
+
+static void gf_pow2523(gf o, const gf i)
+{
+  gf c;
+  int a;
+
+  gf_set(c, i);
+  for(a = 250; a >= 0; a--) {
+    gf_mul(c, c, c);
+    if(a != 1) gf_mul(c, c, i);
+  }
+  gf_set(o, c);
+}
+
+static void ed_add(gf p[4], gf q[4])
+{
+  gf a, b, c, d, t, e, f, g, h;
+
+  gf_sub(a, p[1], p[0]);
+  gf_sub(t, q[1], q[0]);
+  gf_mul(a, a, t);
+  gf_add(b, p[0], p[1]);
+  gf_add(t, q[0], q[1]);
+  gf_mul(b, b, t);
+  gf_mul(c, p[3], q[3]);
+  gf_mul(c, c, ed_d2);
+  gf_mul(d, p[2], q[2]);
+  gf_add(d, d, d);
+  gf_sub(e, b, a);
+  gf_sub(f, d, c);
+  gf_add(g, d, c);
+  gf_add(h, b, a);
+
+  gf_mul(p[0], e, f);
+  gf_mul(p[1], h, g);
+  gf_mul(p[2], g, f);
+  gf_mul(p[3], e, h);
+}
+
+static void ed_cswap(gf p[4], gf q[4], int b)
+{
+  int i;
+
+  for(i = 0; i < 4; i++) gf_sel(p[i], q[i], b);
+}
+
+static void ed_pack(unsigned char *r, gf p[4])
+{
+  gf tx, ty, zi;
+
+  gf_inv(zi, p[2]);
+  gf_mul(tx, p[0], zi);
+  gf_mul(ty, p[1], zi);
+  gf_pack(r, ty);
+  r[31] ^= gf_parity(tx) << 7;
+}
+
+static void ed_scalarmult(gf p[4], gf q[4], const unsigned char *s)
+{
+  int i, b;
+
+  gf_set(p[0], gf0);
+  gf_set(p[1], gf1);
+  gf_set(p[2], gf1);
+  gf_set(p[3], gf0);
+
+  for(i = 255; i >= 0; i--) {
+    b = (s[i / 8] >> (i & 7)) & 1;
+    ed_cswap(p, q, b);
+    ed_add(q, p);
+    ed_add(p, p);
+    ed_cswap(p, q, b);
+  }
+}
+
+static void ed_scalarbase(gf p[4], const unsigned char *s)
+{
+  gf q[4];
+
+  gf_set(q[0], ed_x);
+  gf_set(q[1], ed_y);
+  gf_set(q[2], gf1);
+  gf_mul(q[3], ed_x, ed_y);
+  ed_scalarmult(p, q, s);
+}
+
+static void ed_mod_l(unsigned char *r, int64_t x[64])
+{
+  int64_t carry;
+  int i, j;
+
+  for(i = 63; i >= 32; i--) {
+    carry = 0;
+    for(j = i - 32; j < i - 12; j++) {
+      x[j] += carry - 16 * x[i] * ed_l[j - (i - 32)];
+      carry = (x[j] + 128) >> 8;
+      x[j] -= carry * 256;
+    }
+    x[j] += carry;
+    x[i] = 0;
+  }
+
+  carry = 0;
+  for(j = 0; j < 32; j++) {
+    x[j] += carry - (x[31] >> 4) * ed_l[j];
+    carry = x[j] >> 8;
+    x[j] &= 255;
+  }
+  for(j = 0; j < 32; j++) x[j] -= carry * ed_l[j];
+  for(i = 0; i < 32; i++) {
+    x[i + 1] += x[i] >> 8;
+    r[i] = x[i] & 255;
+  }
+}
+
+static int ed_unpackneg(gf r[4], const unsigned char p[32])
+{
+  gf t, chk, num, den, den2, den4, den6;
+
+  gf_set(r[2], gf1);
+  gf_unpack(r[1], p);
+  gf_mul(num, r[1], r[1]);
+  gf_mul(den, num, ed_d);
+  gf_sub(num, num, r[2]);
+  gf_add(den, r[2], den);
+
+  gf_mul(den2, den, den);
+  gf_mul(den4, den2, den2);
+  gf_mul(den6, den4, den2);
+  gf_mul(t, den6, num);
+  gf_mul(t, t, den);
+
+  gf_pow2523(t, t);
+  gf_mul(t, t, num);
+  gf_mul(t, t, den);
+  gf_mul(t, t, den);
+  gf_mul(r[0], t, den);
+
+  gf_mul(chk, r[0], r[0]);
+  gf_mul(chk, chk, den);
+  if(gf_neq(chk, num)) gf_mul(r[0], r[0], ed_i);
+
+  gf_mul(chk, r[0], r[0]);
+  gf_mul(chk, chk, den);
+  if(gf_neq(chk, num)) return -1;
+
+  if(gf_parity(r[0]) == (p[31] >> 7)) gf_sub(r[0], gf0, r[0]);
+
+  gf_mul(r[3], r[0], r[1]);
+
+  return 0;
+}
+
+
+/*
+ * Verify Ed25519 signature (R || S) of msg.
+ *
+ * Return 1 if ok.
+ */
+int ed25519_verify(const unsigned char *pk, const unsigned char *sig, const unsigned char *msg, size_t msg_len)
+{
+  struct sha512_ctx ctx;
+  unsigned char h[64], t[32];
+  int64_t x[64];
+  gf p[4], q[4];
+  int i;
+
+  /* S must be < l */
+  for(i = 31; i >= 0; i--) {
+    if(sig[32 + i] != ed_l[i]) break;
+  }
+  if(i < 0 || sig[32 + i] > ed_l[i]) return 0;
+
+  if(ed_unpackneg(q, pk)) return 0;
+
+  sha512_init_ctx(&ctx);
+  sha512_process_bytes(sig, 32, &ctx);
+  sha512_process_bytes(pk, 32, &ctx);
+  sha512_process_bytes(msg, msg_len, &ctx);
+  sha512_finish_ctx(&ctx, h);
+
+  for(i = 0; i < 64; i++) x[i] = h[i];
+  ed_mod_l(h, x);
+
+  ed_scalarmult(p, q, h);
+  ed_scalarbase(q, sig + 32);
+  ed_add(p, q);
+  ed_pack(t, p);
+
+  return !memcmp(sig, t, 32);
+}
+
+
+/*
+ * Read multiprecision integer; advance *buf.
+ */
+unsigned char *get_mpi(unsigned char **buf, unsigned char *end, unsigned *len)
+{
+  unsigned char *p = *buf;
+
+  if(end - p < 2) return NULL;
+
+  *len = (get_be16(p) + 7) / 8;
+  p += 2;
+
+  if((unsigned) (end - p) < *len) return NULL;
+
+  *buf = p + *len;
+
+  return p;
+}
+
+
+/*
+ * Parse signature packet body.
+ *
+ * The sig fields point into buf.
+ *
+ * Return 1 if ok.
+ */
+int parse_sig(unsigned char *buf, unsigned len, pgp_sig_t *sig)
+{
+  unsigned char *p, *end = buf + len, *area, *area_end;
+  unsigned u, sub_len, area_len, pass;
+
+  memset(sig, 0, sizeof *sig);
+
+  if(len < 1) return 0;
+
+  sig->version = buf[0];
+
+  if(sig->version == 3) {
+    /* 3, 5, type, time[4], keyid[8], pk, hash, left16[2] */
+    if(len < 19 || buf[1] != 5) return 0;
+    sig->type = buf[2];
+    sig->hashed = buf + 2;
+    sig->hashed_len = 5;
+    sig->keyid = buf + 7;
+    sig->pk_algo = buf[15];
+    sig->hash_algo = buf[16];
+    sig->left16 = buf + 17;
+    p = buf + 19;
+  }
+  else if(sig->version == 4) {
+    /* 4, type, pk, hash, hashed_len[2], hashed, unhashed_len[2], unhashed, left16[2] */
+    if(len < 6) return 0;
+    sig->type = buf[1];
+    sig->pk_algo = buf[2];
+    sig->hash_algo = buf[3];
+    area_len = get_be16(buf + 4);
+    if(len < 6 + area_len + 2) return 0;
+    sig->hashed = buf;
+    sig->hashed_len = 6 + area_len;
+
+    area = buf + 6;
+    for(pass = 0; pass < 2; pass++) {
+      area_end = area + area_len;
+      for(p = area; p < area_end; p += sub_len) {
+        if(*p < 192) {
+          sub_len = *p++;
+        }
+        else if(*p < 255) {
+          if(area_end - p < 2) return 0;
+          sub_len = ((p[0] - 192) << 8) + p[1] + 192;
+          p += 2;
+        }
+        else {
+          if(area_end - p < 5) return 0;
+          sub_len = get_be32(p + 1);
+          p += 5;
+        }
+        if(!sub_len || sub_len > (unsigned) (area_end - p)) return 0;
+        /* issuer key id */
+        if((*p & 0x7f) == 16 && sub_len == 9) sig->keyid = p + 1;
+        /* issuer fingerprint */
+        if((*p & 0x7f) == 33 && sub_len == 22 && p[1] == 4) sig->fpr = p + 2;
+      }
+      if(pass == 0) {
+        if(end - area_end < 2) return 0;
+        area_len = get_be16(area_end);
+        area = area_end + 2;
+        if((unsigned) (end - area) < area_len + 2) return 0;
+      }
+      else {
+        p = area_end;
+      }
+    }
+
+    sig->left16 = p;
+    p += 2;
+  }
+  else {
+    return 0;
+  }
+
+  switch(sig->pk_algo) {
+    case PK_RSA:
+    case PK_RSA_SIGN:
+      if(!(sig->mpi[0] = get_mpi(&p, end, &sig->mpi_len[0]))) return 0;
+      break;
+
+    case PK_EDDSA:
+      for(u = 0; u < 2; u++) {
+        if(!(sig->mpi[u] = get_mpi(&p, end, &sig->mpi_len[u])) || sig->mpi_len[u] > 32) return 0;
+      }
+      break;
+
+    case PK_ED25519:
+      if(end - p < 64) return 0;
+      sig->mpi[0] = p;
+      sig->mpi[1] = p + 32;
+      sig->mpi_len[0] = sig->mpi_len[1] = 32;
+      break;
+
+    default:
+      return 0;
+  }
+
+  return 1;
+}
+
+
+/*
+ * Parse public key packet body and add key to key list.
+ */
+void parse_key(unsigned char *buf, unsigned len)
+{
+  static const unsigned char oid_ed25519[] = { 0x09, 0x2b, 0x06, 0x01, 0x04, 0x01, 0xda, 0x47, 0x0f, 0x01 };
+  pgp_key_t key = { };
+  struct sha1_ctx ctx;
+  unsigned char *p, *end = buf + len, *q, hdr[3];
+  unsigned q_len;
+
+  /* only v4 keys */
+  if(len < 6 || buf[0] != 4) return;
+
+  key.algo = buf[5];
+  p = buf + 6;
+
+  switch(key.algo) {
+    case PK_RSA:
+    case PK_RSA_SIGN:
+      if(!(key.n = get_mpi(&p, end, &key.n_len))) return;
+      if(!(key.e = get_mpi(&p, end, &key.e_len))) return;
+      key.n = memcpy(malloc(key.n_len), key.n, key.n_len);
+      key.e = memcpy(malloc(key.e_len), key.e, key.e_len);
+      break;
+
+    case PK_EDDSA:
+      if(end - p < (int) sizeof oid_ed25519 || memcmp(p, oid_ed25519, sizeof oid_ed25519)) return;
+      p += sizeof oid_ed25519;
+      if(!(q = get_mpi(&p, end, &q_len)) || q_len != 33 || q[0] != 0x40) return;
+      memcpy(key.ed, q + 1, 32);
+      break;
+
+    case PK_ED25519:
+      if(end - p < 32) return;
+      memcpy(key.ed, p, 32);
+      break;
+
+    default:
+      return;
+  }
+
+  hdr[0] = 0x99;
+  hdr[1] = len >> 8;
+  hdr[2] = len;
+  sha1_init_ctx(&ctx);
+  sha1_process_bytes(hdr, sizeof hdr, &ctx);
+  sha1_process_bytes(buf, len, &ctx);
+  sha1_finish_ctx(&ctx, key.fpr);
+  memcpy(key.keyid, key.fpr + 12, 8);
+
+  key.next = pgp_keys;
+  pgp_keys = memcpy(malloc(sizeof key), &key, sizeof key);
+
+  log_debug(
+    "pgp: key %02X%02X%02X%02X%02X%02X%02X%02X, algo %d\n",
+    key.keyid[0], key.keyid[1], key.keyid[2], key.keyid[3],
+    key.keyid[4], key.keyid[5], key.keyid[6], key.keyid[7],
+    key.algo
+  );
+}
+
+
+/*
+ * Check signature against all matching keys.
+ *
+ * Return 1 if ok.
+ */
+int check_sig(pgp_sig_t *sig, unsigned char *digest, unsigned digest_len)
+{
+  pgp_key_t *key;
+  unsigned char ed_sig[64];
+  unsigned u;
+
+  if(memcmp(sig->left16, digest, 2)) return 0;
+
+  pgp_load_keys();
+
+  for(key = pgp_keys; key; key = key->next) {
+    if(sig->fpr && memcmp(sig->fpr, key->fpr, 20)) continue;
+    if(sig->keyid && memcmp(sig->keyid, key->keyid, 8)) continue;
+
+    switch(sig->pk_algo) {
+      case PK_RSA:
+      case PK_RSA_SIGN:
+        if(key->algo != PK_RSA && key->algo != PK_RSA_SIGN) continue;
+        if(rsa_verify(key, sig->mpi[0], sig->mpi_len[0], sig->hash_algo, digest, digest_len)) return 1;
+        break;
+
+      case PK_EDDSA:
+      case PK_ED25519:
+        if(key->algo != PK_EDDSA && key->algo != PK_ED25519) continue;
+        /* MPIs have leading zeros stripped */
+        memset(ed_sig, 0, sizeof ed_sig);
+        for(u = 0; u < 2; u++) {
+          memcpy(ed_sig + 32 * (u + 1) - sig->mpi_len[u], sig->mpi[u], sig->mpi_len[u]);
+        }
+        if(ed25519_verify(key->ed, ed_sig, digest, digest_len)) return 1;
+        break;
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+ * Verify signature packet body 'buf' against data hashed in 'hash'.
+ *
+ * Return PGP_SIG_OK or PGP_SIG_BAD.
+ */
+int verify_sig(pgp_hash_t *hash, unsigned char *buf, unsigned len)
+{
+  pgp_sig_t sig;
+  unsigned char digest[SHA512_DIGEST_SIZE], trailer[6];
+  unsigned digest_len;
+
+  if(!parse_sig(buf, len, &sig) || sig.hash_algo != hash->algo) return PGP_SIG_BAD;
+
+  /* only document signatures */
+  if(sig.type != 0 && sig.type != 1) return PGP_SIG_BAD;
+
+  hash_update(hash, sig.hashed, sig.hashed_len);
+
+  if(sig.version == 4) {
+    trailer[0] = 4;
+    trailer[1] = 0xff;
+    trailer[2] = sig.hashed_len >> 24;
+    trailer[3] = sig.hashed_len >> 16;
+    trailer[4] = sig.hashed_len >> 8;
+    trailer[5] = sig.hashed_len;
+    hash_update(hash, trailer, sizeof trailer);
+  }
+
+  digest_len = hash_finish(hash, digest);
+
+  if(!check_sig(&sig, digest, digest_len)) return PGP_SIG_BAD;
+
+  if(sig.keyid) {
+    log_debug(
+      "pgp: good signature from key %02X%02X%02X%02X%02X%02X%02X%02X\n",
+      sig.keyid[0], sig.keyid[1], sig.keyid[2], sig.keyid[3],
+      sig.keyid[4], sig.keyid[5], sig.keyid[6], sig.keyid[7]
+    );
+  }
+
+  return PGP_SIG_OK;
+}
+
+
+void free_keys()
+{
+  pgp_key_t *key, *next;
+
+  for(key = pgp_keys; key; key = next) {
+    next = key->next;
+    free(key->n);
+    free(key->e);
+    free(key);
+  }
+
+  pgp_keys = NULL;
+}
+
+
+/*
+ * Add keys from a keyring file (binary or armored).
+ */
+void load_keyring(char *file)
+{
+  pgp_verify_t *pv;
+  unsigned char buf[4096];
+  int fd, len;
+
+  if((fd = open(file, O_RDONLY)) == -1) return;
+
+  pv = pgp_verify_new(NULL, NULL);
+  pv->type = PV_KEYS;
+
+  while((len = read(fd, buf, sizeof buf)) > 0) {
+    pgp_verify_process(pv, buf, len);
+  }
+
+  close(fd);
+
+  pgp_verify_free(pv);
+}
+
+
+/*
+ * Read public keys from PGP_KEYRING and PGP_KEYRING_DIR.
+ *
+ * Keys are cached; they are re-read if the keyrings have changed.
+ *
+ * Return number of keys.
+ */
+int pgp_load_keys()
+{
+  struct stat sbuf;
+  struct dirent *de;
+  time_t mtime[2] = { };
+  char *file = NULL;
+  pgp_key_t *key;
+  DIR *dir;
+  int keys;
+
+  if(!stat(PGP_KEYRING, &sbuf)) mtime[0] = sbuf.st_mtime;
+  if(!stat(PGP_KEYRING_DIR, &sbuf)) mtime[1] = sbuf.st_mtime;
+
+  if(pgp_keys && !memcmp(mtime, pgp_keys_mtime, sizeof mtime)) {
+    for(keys = 0, key = pgp_keys; key; key = key->next) keys++;
+
+    return keys;
+  }
+
+  memcpy(pgp_keys_mtime, mtime, sizeof mtime);
+
+  free_keys();
+
+  load_keyring(PGP_KEYRING);
+
+  if((dir = opendir(PGP_KEYRING_DIR))) {
+    while((de = readdir(dir))) {
+      if(*de->d_name == '.') continue;
+      strprintf(&file, "%s/%s", PGP_KEYRING_DIR, de->d_name);
+      if(util_check_exist(file) == 'r') load_keyring(file);
+    }
+    closedir(dir);
+  }
+
+  str_copy(&file, NULL);
+
+  for(keys = 0, key = pgp_keys; key; key = key->next) keys++;
+
+  log_debug("pgp: %d keys\n", keys);
+
+  return keys;
+}
+
+
+/*
+ * Create new verification context.
+ *
+ * Data passed to pgp_verify_process() are checked and the signed content
+ * (if it is a signed message) or the unchanged data are passed on to
+ * write_func.
+ */
+pgp_verify_t *pgp_verify_new(pgp_write_func_t write_func, void *write_data)
+{
+  pgp_verify_t *pv = calloc(1, sizeof *pv);
+
+  pv->write = write_func;
+  pv->write_data = write_data;
+  pv->result = PGP_SIG_NONE;
+
+  return pv;
+}
+
+
+/*
+ * Set detached signature (binary or armored).
+ *
+ * Must be called before any data are processed.
+ *
+ * Return 1 if ok, 0 if it's not a usable signature.
+ */
+int pgp_verify_set_sig(pgp_verify_t *pv, void *buf, size_t len)
+{
+  pgp_sig_t sig;
+
+  decode_sig(buf, len, &pv->sig);
+
+  pv->type = PV_DETACHED;
+
+  if(!pv->sig.len || !parse_sig((unsigned char *) pv->sig.data, pv->sig.len, &sig)) {
+    pv->failed = 1;
+
+    return 0;
+  }
+
+  start_hash(pv, sig.hash_algo, sig.type == 1);
+
+  return 1;
+}
+
+
+/*
+ * Get hash algorithm needed to check detached signature.
+ *
+ * Return 0 if the signature is not usable with pgp_verify_hashed()
+ * (broken or text mode signature).
+ */
+int pgp_sig_hash(void *buf, size_t len)
+{
+  membuf_t sig_buf = {};
+  pgp_sig_t sig;
+  int algo = 0;
+
+  decode_sig(buf, len, &sig_buf);
+
+  if(sig_buf.len && parse_sig((unsigned char *) sig_buf.data, sig_buf.len, &sig) && sig.type == 0) {
+    algo = sig.hash_algo;
+  }
+
+  membuf_free(&sig_buf);
+
+  return algo;
+}
+
+
+/*
+ * Check detached signature against already hashed data.
+ *
+ * ctx is the hash state after processing the data (struct sha256_ctx, etc.,
+ * matching pgp_sig_hash()).
+ *
+ * Return PGP_SIG_OK or PGP_SIG_BAD.
+ */
+int pgp_verify_hashed(void *buf, size_t len, void *ctx)
+{
+  membuf_t sig_buf = {};
+  pgp_sig_t sig;
+  pgp_hash_t hash;
+  int err = PGP_SIG_BAD;
+
+  decode_sig(buf, len, &sig_buf);
+
+  if(
+    sig_buf.len &&
+    parse_sig((unsigned char *) sig_buf.data, sig_buf.len, &sig) &&
+    sig.hash_algo != PGP_HASH_MD5 &&
+    hash_init(&hash, sig.hash_algo)
+  ) {
+    switch(hash.algo) {
+      case PGP_HASH_SHA1:
+        hash.ctx.sha1 = *(struct sha1_ctx *) ctx;
+        break;
+
+      case PGP_HASH_SHA224:
+      case PGP_HASH_SHA256:
+        hash.ctx.sha256 = *(struct sha256_ctx *) ctx;
+        break;
+
+      case PGP_HASH_SHA384:
+      case PGP_HASH_SHA512:
+        hash.ctx.sha512 = *(struct sha512_ctx *) ctx;
+        break;
+    }
+    err = verify_sig(&hash, (unsigned char *) sig_buf.data, sig_buf.len);
+  }
+
+  membuf_free(&sig_buf);
+
+  return err;
+}
+
+
+/*
+ * Decode signature (binary or armored); append signature packet to 'sig'.
+ */
+void decode_sig(void *buf, size_t len, membuf_t *sig)
+{
+  pgp_verify_t *pv;
+
+  /* reuse the parser */
+  pv = pgp_verify_new(NULL, NULL);
+  pgp_verify_process(pv, buf, len);
+  pgp_verify_finish(pv);
+
+  membuf_add(sig, pv->sig.data, pv->sig.len);
+
+  pgp_verify_free(pv);
+}
+
+
+void start_hash(pgp_verify_t *pv, int algo, int text)
+{
+  if(pv->hash_started) return;
+
+  /* md5 is not acceptable for signatures */
+  if(algo == PGP_HASH_MD5 || !hash_init(&pv->hash, algo)) {
+    log_debug("pgp: unsupported hash algorithm %d\n", algo);
+    pv->failed = 1;
+  }
+
+  pv->hash_started = 1;
+  pv->text = text;
+}
+
+
+/*
+ * Hash text with canonical line endings (CR LF).
+ */
+void hash_text(pgp_verify_t *pv, unsigned char *buf, size_t len)
+{
+  unsigned char *s;
+  size_t n;
+
+  while(len) {
+    s = memchr(buf, '\n', len);
+    n = s ? s - buf : len;
+    hash_update(&pv->hash, buf, n);
+    if(n) pv->last_cr = buf[n - 1] == '\r';
+    if(!s) break;
+    hash_update(&pv->hash, pv->last_cr ? "\n" : "\r\n", pv->last_cr ? 1 : 2);
+    pv->last_cr = 0;
+    buf += n + 1;
+    len -= n + 1;
+  }
+}
+
+
+/*
+ * Write text with local line endings (LF).
+ */
+void write_text(pgp_verify_t *pv, unsigned char *buf, size_t len)
+{
+  size_t u, start = 0;
+
+  if(pv->lit_cr) {
+    pv->lit_cr = 0;
+    if(len && *buf != '\n') pv->write(pv->write_data, "\r", 1);
+  }
+
+  for(u = 0; u < len; u++) {
+    if(buf[u] != '\r') continue;
+    if(u + 1 == len) {
+      pv->lit_cr = 1;
+    }
+    else if(buf[u + 1] != '\n') {
+      continue;
+    }
+    if(u > start) pv->write(pv->write_data, buf + start, u - start);
+    start = u + 1;
+  }
+
+  if(len > start) pv->write(pv->write_data, buf + start, len - start);
+}
+
+
+/*
+ * Look at the first bytes of input and decide what to do with it.
+ */
+void detect_type(pgp_verify_t *pv)
+{
+  static const unsigned char rpm_magic[4] = { 0xed, 0xab, 0xee, 0xdb };
+  static const unsigned old_len[4] = { 1, 2, 4, 0 };
+  unsigned char *buf = (unsigned char *) pv->head.data, body;
+  unsigned len = pv->head.len, partial;
+  uint64_t pkt_len;
+  int tag, hdr_len;
+
+  if(len >= 4 && !memcmp(buf, rpm_magic, 4)) {
+    pv->type = PV_RPM;
+  }
+  else if(len >= 34 && !memcmp(buf, "-----BEGIN PGP SIGNED MESSAGE-----", 34)) {
+    pv->type = PV_CLEAR;
+  }
+  else if(len >= 15 && !memcmp(buf, "-----BEGIN PGP ", 15)) {
+    pv->type = PV_ARMOR;
+  }
+  else if(len && (buf[0] & 0x80)) {
+    /* look at the first packet to avoid mistaking random binary data */
+    pv->type = PV_NONE;
+    if(buf[0] & 0x40) {
+      tag = buf[0] & 0x3f;
+      hdr_len = len > 1 ? new_len(buf + 1, len - 1, &pkt_len, &partial) : -1;
+      if(hdr_len < 0) return;
+      hdr_len++;
+    }
+    else {
+      tag = (buf[0] >> 2) & 0xf;
+      hdr_len = 1 + old_len[buf[0] & 3];
+    }
+    if((unsigned) hdr_len + 1 > len) return;
+    body = buf[hdr_len];
+    if(
+      (tag == TAG_SIG && (body == 3 || body == 4)) ||
+      (tag == TAG_ONEPASS && body == 3) ||
+      (tag == TAG_COMPRESSED && body <= 2)
+    ) {
+      pv->type = PV_BINARY;
+    }
+  }
+  else {
+    pv->type = PV_NONE;
+  }
+}
+
+
+/*
+ * Process data.
+ */
+void pgp_verify_process(pgp_verify_t *pv, void *buf, size_t len)
+{
+  if(!len) return;
+
+  if(pv->type == PV_UNKNOWN) {
+    membuf_add(&pv->head, buf, len);
+    if(pv->head.len < 64) return;
+    detect_type(pv);
+    input_data(pv, (unsigned char *) pv->head.data, pv->head.len);
+    membuf_free(&pv->head);
+  }
+  else {
+    input_data(pv, buf, len);
+  }
+}
+
+
+void input_data(pgp_verify_t *pv, unsigned char *buf, size_t len)
+{
+  switch(pv->type) {
+    case PV_NONE:
+      if(pv->write) pv->write(pv->write_data, buf, len);
+      break;
+
+    case PV_DETACHED:
+      if(pv->text) {
+        hash_text(pv, buf, len);
+      }
+      else {
+        hash_update(&pv->hash, buf, len);
+      }
+      if(pv->write) pv->write(pv->write_data, buf, len);
+      break;
+
+    case PV_RPM:
+      rpm_process(pv, buf, len);
+      if(pv->write) pv->write(pv->write_data, buf, len);
+      break;
+
+    case PV_BINARY:
+      layer_process(pv, 0, buf, len);
+      break;
+
+    case PV_KEYS:
+      /* keyrings are either armored or binary */
+      if(!pv->keys_started) {
+        pv->keys_started = 1;
+        pv->keys_binary = (*buf & 0x80) != 0;
+      }
+      if(pv->keys_binary) {
+        layer_process(pv, 0, buf, len);
+      }
+      else {
+        input_lines(pv, buf, len);
+      }
+      break;
+
+    default:
+      input_lines(pv, buf, len);
+      break;
+  }
+}
+
+
+/*
+ * Split armored input into lines.
+ */
+void input_lines(pgp_verify_t *pv, unsigned char *buf, size_t len)
+{
+  unsigned char *s;
+  size_t n;
+
+  while(len) {
+    s = memchr(buf, '\n', len);
+    n = s ? (size_t) (s - buf) + 1 : len;
+    membuf_add(&pv->line, (char *) buf, n);
+    buf += n;
+    len -= n;
+    if(s) {
+      line_handler(pv, pv->line.data, pv->line.len);
+      pv->line.len = 0;
+    }
+  }
+}
+
+
+void line_handler(pgp_verify_t *pv, char *line, size_t len)
+{
+  char *s, *t;
+  size_t n;
+
+  /* strip line end */
+  while(len && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+  line[len] = 0;
+
+  switch(pv->line_state) {
+    case A_START:
+      if(!strncmp(line, "-----BEGIN PGP SIGNED MESSAGE-----", 34)) {
+        pv->line_state = C_HEADERS;
+      }
+      else if(!strncmp(line, "-----BEGIN PGP ", 15)) {
+        pv->line_state = A_HEADERS;
+      }
+      break;
+
+    case C_HEADERS:
+      if(!*line) {
+        pv->line_state = C_TEXT;
+        pv->first_line = 1;
+        /* no 'Hash' header: md5 */
+        if(!pv->hash_started) start_hash(pv, PGP_HASH_MD5, 1);
+      }
+      else if(!strncmp(line, "Hash: ", 6)) {
+        /* if there are several, use the first one */
+        if((s = strchr(line + 6, ','))) *s = 0;
+        start_hash(pv, hash_by_name(line + 6), 1);
+      }
+      break;
+
+    case C_TEXT:
+      if(!strcmp(line, "-----BEGIN PGP SIGNATURE-----")) {
+        pv->line_state = A_HEADERS;
+        break;
+      }
+      s = line;
+      if(s[0] == '-' && s[1] == ' ') s += 2;
+      n = strlen(s);
+      if(pv->write) {
+        s[n] = '\n';
+        pv->write(pv->write_data, s, n + 1);
+        s[n] = 0;
+      }
+      /* trailing white space is not part of the signed text */
+      while(n && (s[n - 1] == ' ' || s[n - 1] == '\t')) n--;
+      if(!pv->first_line) hash_update(&pv->hash, "\r\n", 2);
+      hash_update(&pv->hash, s, n);
+      pv->first_line = 0;
+      break;
+
+    case A_HEADERS:
+      if(!*line) {
+        pv->line_state = A_BODY;
+        break;
+      }
+      /* no empty line after the headers */
+      if(!(t = strchr(line, ':')) || t[1] != ' ') {
+        pv->line_state = A_BODY;
+        b64_decode(pv, line);
+      }
+      break;
+
+    case A_BODY:
+      if(*line == '=') {
+        pv->line_state = A_TAIL;
+      }
+      else if(!strncmp(line, "-----END ", 9)) {
+        pv->line_state = pv->type == PV_KEYS ? A_START : A_DONE;
+      }
+      else {
+        b64_decode(pv, line);
+      }
+      break;
+
+    case A_TAIL:
+      if(!strncmp(line, "-----END ", 9)) {
+        pv->line_state = pv->type == PV_KEYS ? A_START : A_DONE;
+      }
+      break;
+  }
+}
+
+
+void b64_decode(pgp_verify_t *pv, char *line)
+{
+  static signed char b64[256];
+  static int b64_init;
+  unsigned char buf[128];
+  unsigned len = 0;
+  int i;
+
+  if(!b64_init) {
+    b64_init = 1;
+    memset(b64, -1, sizeof b64);
+    for(i = 0; i < 26; i++) {
+      b64['A' + i] = i;
+      b64['a' + i] = 26 + i;
+    }
+    for(i = 0; i < 10; i++) b64['0' + i] = 52 + i;
+    b64['+'] = 62;
+    b64['/'] = 63;
+  }
+
+  for(; *line && *line != '='; line++) {
+    if((i = b64[(unsigned char) *line]) < 0) continue;
+    pv->b64_val = (pv->b64_val << 6) + i;
+    pv->b64_bits += 6;
+    if(pv->b64_bits >= 8) {
+      pv->b64_bits -= 8;
+      buf[len++] = pv->b64_val >> pv->b64_bits;
+      if(len == sizeof buf) {
+        layer_process(pv, 0, buf, len);
+        len = 0;
+      }
+    }
+  }
+
+  /* padding: discard remaining bits */
+  if(*line == '=') pv->b64_bits = pv->b64_val = 0;
+
+  if(len) layer_process(pv, 0, buf, len);
+}
+
+
+/*
+ * Decode new format packet length.
+ *
+ * Return number of bytes used or -1 if more bytes are needed.
+ */
+int new_len(unsigned char *buf, unsigned len, uint64_t *pkt_len, unsigned *partial)
+{
+  *partial = 0;
+
+  if(!len) return -1;
+
+  if(buf[0] < 192) {
+    *pkt_len = buf[0];
+    return 1;
+  }
+
+  if(buf[0] < 224) {
+    if(len < 2) return -1;
+    *pkt_len = ((buf[0] - 192) << 8) + buf[1] + 192;
+    return 2;
+  }
+
+  if(buf[0] == 255) {
+    if(len < 5) return -1;
+    *pkt_len = get_be32(buf + 1);
+    return 5;
+  }
+
+  *pkt_len = 1 << (buf[0] & 0x1f);
+  *partial = 1;
+
+  return 1;
+}
+
+
+/*
+ * Parse OpenPGP packets.
+ *
+ * level 0: top level, level 1: inside compressed packet.
+ */
+void layer_process(pgp_verify_t *pv, int level, unsigned char *buf, size_t len)
+{
+  static const unsigned old_len[4] = { 1, 2, 4, 0 };
+  pgp_layer_t *l = pv->layer + level;
+  unsigned partial, u;
+  size_t n;
+
+  while(len && !pv->failed) {
+    if(l->state == PKT_BODY) {
+      n = l->indeterminate || l->left > len ? len : l->left;
+      packet_data(pv, level, buf, n);
+      buf += n;
+      len -= n;
+      if(l->indeterminate) continue;
+      l->left -= n;
+      if(l->left) continue;
+      l->hdr_len = 0;
+      if(l->partial) {
+        l->state = PKT_LEN;
+      }
+      else {
+        packet_end(pv, level);
+        l->state = PKT_HDR;
+      }
+      continue;
+    }
+
+    l->hdr[l->hdr_len++] = *buf++;
+    len--;
+
+    if(l->state == PKT_HDR) {
+      if(!(l->hdr[0] & 0x80)) {
+        log_debug("pgp: invalid packet\n");
+        pv->failed = 1;
+        break;
+      }
+      if(l->hdr[0] & 0x40) {
+        if(new_len(l->hdr + 1, l->hdr_len - 1, &l->left, &partial) < 0) continue;
+        l->tag = l->hdr[0] & 0x3f;
+        l->indeterminate = 0;
+      }
+      else {
+        u = old_len[l->hdr[0] & 3];
+        if(l->hdr_len < 1 + u) continue;
+        l->tag = (l->hdr[0] >> 2) & 0xf;
+        l->indeterminate = u == 0;
+        for(l->left = 0; u; u--) l->left = (l->left << 8) + l->hdr[l->hdr_len - u];
+        partial = 0;
+      }
+      l->partial = partial;
+      packet_start(pv, level);
+    }
+    else {
+      if(new_len(l->hdr, l->hdr_len, &l->left, &partial) < 0) continue;
+      l->partial = partial;
+    }
+
+    l->state = PKT_BODY;
+
+    if(!l->left && !l->indeterminate && !l->partial) {
+      packet_end(pv, level);
+      l->state = PKT_HDR;
+      l->hdr_len = 0;
+    }
+  }
+}
+
+
+/*
+ * End of input for packet parser.
+ */
+void layer_finish(pgp_verify_t *pv, int level)
+{
+  pgp_layer_t *l = pv->layer + level;
+
+  if(l->state == PKT_BODY && l->indeterminate) {
+    packet_end(pv, level);
+  }
+  else if(l->state != PKT_HDR || l->hdr_len) {
+    log_debug("pgp: truncated packet\n");
+    pv->failed = 1;
+  }
+
+  l->state = PKT_HDR;
+  l->hdr_len = 0;
+}
+
+
+void packet_start(pgp_verify_t *pv, int level)
+{
+  pgp_layer_t *l = pv->layer + level;
+
+  l->pos = 0;
+  l->body.len = 0;
+
+  switch(l->tag) {
+    case TAG_COMPRESSED:
+      if(level) {
+        log_debug("pgp: nested compressed packets\n");
+        pv->failed = 1;
+      }
+      pv->z_algo = -1;
+      memset(pv->layer + 1, 0, sizeof pv->layer[1]);
+      break;
+
+    case TAG_LITERAL:
+      /* format, file name length, ... */
+      pv->lit_hdr_len = 2;
+      break;
+  }
+}
+
+
+void packet_data(pgp_verify_t *pv, int level, unsigned char *buf, size_t len)
+{
+  pgp_layer_t *l = pv->layer + level;
+
+  switch(l->tag) {
+    case TAG_COMPRESSED:
+      if(!l->pos && len) {
+        pv->z_algo = *buf++;
+        len--;
+        l->pos++;
+        memset(&pv->z, 0, sizeof pv->z);
+        if(pv->z_algo == 1 || pv->z_algo == 2) {
+          if(inflateInit2(&pv->z, pv->z_algo == 1 ? -15 : 15) == Z_OK) {
+            pv->z_active = 1;
+          }
+          else {
+            pv->failed = 1;
+          }
+        }
+        else if(pv->z_algo) {
+          log_debug("pgp: unsupported compression algorithm %d\n", pv->z_algo);
+          pv->failed = 1;
+        }
+      }
+      l->pos += len;
+      if(pv->z_active) {
+        inflate_data(pv, buf, len, 0);
+      }
+      else if(!pv->failed) {
+        layer_process(pv, 1, buf, len);
+      }
+      break;
+
+    case TAG_LITERAL:
+      /* skip literal data header: format, name length, name, date */
+      while(len && l->pos < pv->lit_hdr_len) {
+        if(l->pos == 0) pv->lit_text = *buf == 't' || *buf == 'u';
+        if(l->pos == 1) pv->lit_hdr_len = 6 + *buf;
+        buf++;
+        len--;
+        l->pos++;
+      }
+      if(!len) break;
+      l->pos += len;
+      if(pv->hash_started) {
+        if(pv->text) {
+          hash_text(pv, buf, len);
+        }
+        else {
+          hash_update(&pv->hash, buf, len);
+        }
+      }
+      if(pv->write) {
+        if(pv->lit_text) {
+          write_text(pv, buf, len);
+        }
+        else {
+          pv->write(pv->write_data, buf, len);
+        }
+      }
+      break;
+
+    default:
+      l->pos += len;
+      if(l->pos > MAX_PACKET) {
+        log_debug("pgp: packet too large\n");
+        pv->failed = 1;
+        break;
+      }
+      if(l->tag == TAG_SIG || l->tag == TAG_ONEPASS || l->tag == TAG_KEY || l->tag == TAG_SUBKEY) {
+        membuf_add(&l->body, (char *) buf, len);
+      }
+      break;
+  }
+}
+
+
+void packet_end(pgp_verify_t *pv, int level)
+{
+  pgp_layer_t *l = pv->layer + level;
+  unsigned char *body = (unsigned char *) l->body.data;
+  pgp_sig_t sig;
+
+  switch(l->tag) {
+    case TAG_ONEPASS:
+      /* version 3, type, hash, pk, keyid[8], nested */
+      if(l->body.len >= 13 && body[0] == 3) {
+        start_hash(pv, body[2], body[1] == 1);
+      }
+      break;
+
+    case TAG_SIG:
+      if(pv->sig.len || pv->type == PV_KEYS) break;
+      membuf_add(&pv->sig, l->body.data, l->body.len);
+      /* signature before data (old style) */
+      if(!pv->hash_started && parse_sig(body, l->body.len, &sig)) {
+        start_hash(pv, sig.hash_algo, sig.type == 1);
+      }
+      break;
+
+    case TAG_KEY:
+    case TAG_SUBKEY:
+      if(pv->type == PV_KEYS) parse_key(body, l->body.len);
+      break;
+
+    case TAG_LITERAL:
+      if(pv->lit_cr && pv->write) pv->write(pv->write_data, "\r", 1);
+      pv->lit_cr = 0;
+      break;
+
+    case TAG_COMPRESSED:
+      if(pv->z_active) {
+        inflate_data(pv, NULL, 0, 1);
+        inflateEnd(&pv->z);
+        pv->z_active = 0;
+      }
+      layer_finish(pv, 1);
+      break;
+  }
+
+  l->body.len = 0;
+}
+
+
+/*
+ * Uncompress data and pass them on to the inner packet parser.
+ */
+void inflate_data(pgp_verify_t *pv, unsigned char *buf, size_t len, int flush)
+{
+  unsigned char out[16384];
+  int err;
+
+  pv->z.next_in = buf;
+  pv->z.avail_in = len;
+
+  do {
+    pv->z.next_out = out;
+    pv->z.avail_out = sizeof out;
+    err = inflate(&pv->z, flush ? Z_FINISH : Z_NO_FLUSH);
+    if(err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      log_debug("pgp: inflate error %d\n", err);
+      pv->failed = 1;
+      return;
+    }
+    if(sizeof out - pv->z.avail_out) layer_process(pv, 1, out, sizeof out - pv->z.avail_out);
+  } while(!pv->failed && err != Z_STREAM_END && (pv->z.avail_in || !pv->z.avail_out));
+}
+
+
+/*
+ * Process rpm package.
+ *
+ * Layout: lead, signature header, padding, header, payload.
+ */
+void rpm_process(pgp_verify_t *pv, unsigned char *buf, size_t len)
+{
+  size_t n;
+
+  if(pv->failed) return;
+
+  if(pv->rpm.state == R_LEAD && !pv->rpm.need && !pv->rpm.buf.len) {
+    pv->rpm.need = RPM_LEAD_SIZE;
+  }
+
+  while(len && !pv->failed) {
+    if(pv->rpm.state == R_PAYLOAD) {
+      hash_update(&pv->rpm.pkg_hash, buf, len);
+      hash_update(&pv->rpm.md5_hash, buf, len);
+      hash_update(&pv->rpm.payload_hash, buf, len);
+      break;
+    }
+
+    n = len < pv->rpm.need ? len : pv->rpm.need;
+    membuf_add(&pv->rpm.buf, (char *) buf, n);
+    if(pv->rpm.state == R_HDR || pv->rpm.state == R_HDRPRE) {
+      hash_update(&pv->rpm.hdr_hash, buf, n);
+      hash_update(&pv->rpm.pkg_hash, buf, n);
+      hash_update(&pv->rpm.md5_hash, buf, n);
+    }
+    buf += n;
+    len -= n;
+    pv->rpm.need -= n;
+
+    if(!pv->rpm.need) rpm_section_done(pv);
+  }
+}
+
+
+void rpm_section_done(pgp_verify_t *pv)
+{
+  static const unsigned char hdr_magic[4] = { 0x8e, 0xad, 0xe8, 0x01 };
+  unsigned char *buf = (unsigned char *) pv->rpm.buf.data, *p, digest[SHA512_DIGEST_SIZE];
+  unsigned il, dl, type, count, len, u;
+  pgp_sig_t sig;
+  pgp_hash_t hash;
+
+  switch(pv->rpm.state) {
+    case R_LEAD:
+      pv->rpm.state = R_SIGPRE;
+      pv->rpm.need = 16;
+      pv->rpm.buf.len = 0;
+      break;
+
+    case R_SIGPRE:
+    case R_HDRPRE:
+      il = get_be32(buf + 8);
+      dl = get_be32(buf + 12);
+      if(memcmp(buf, hdr_magic, 4) || il > 0x10000 || dl > (256 << 20)) {
+        log_debug("pgp: invalid rpm header\n");
+        pv->failed = 1;
+        break;
+      }
+      pv->rpm.need = 16 * il + dl;
+      if(pv->rpm.state == R_SIGPRE) {
+        /* signature header is padded to 8 bytes */
+        pv->rpm.need += (8 - dl % 8) % 8;
+        pv->rpm.state = R_SIG;
+      }
+      else {
+        pv->rpm.state = R_HDR;
+      }
+      break;
+
+    case R_SIG:
+      if((p = rpm_tag(&pv->rpm.buf, RPMSIGTAG_RSA, &type, &count, &len)) ||
+         (p = rpm_tag(&pv->rpm.buf, RPMSIGTAG_DSA, &type, &count, &len))) {
+        if(type == 7 && (p = sig_packet(p, &len)) && parse_sig(p, len, &sig)) {
+          membuf_add(&pv->rpm.hdr_sig, (char *) p, len);
+          hash_init(&pv->rpm.hdr_hash, sig.hash_algo);
+        }
+      }
+      if((p = rpm_tag(&pv->rpm.buf, RPMSIGTAG_PGP, &type, &count, &len)) ||
+         (p = rpm_tag(&pv->rpm.buf, RPMSIGTAG_GPG, &type, &count, &len))) {
+        if(type == 7 && (p = sig_packet(p, &len)) && parse_sig(p, len, &sig)) {
+          membuf_add(&pv->rpm.pkg_sig, (char *) p, len);
+          hash_init(&pv->rpm.pkg_hash, sig.hash_algo);
+        }
+      }
+      if((p = rpm_tag(&pv->rpm.buf, RPMSIGTAG_MD5, &type, &count, &len))) {
+        if(type == 7 && len == 16) {
+          memcpy(pv->rpm.md5, p, 16);
+          pv->rpm.has_md5 = 1;
+          hash_init(&pv->rpm.md5_hash, PGP_HASH_MD5);
+        }
+      }
+      pv->rpm.state = R_HDRPRE;
+      pv->rpm.need = 16;
+      pv->rpm.buf.len = 0;
+      break;
+
+    case R_HDR:
+      if(pv->rpm.hdr_sig.len) {
+        hash = pv->rpm.hdr_hash;
+        pv->rpm.hdr_ok = verify_sig(&hash, (unsigned char *) pv->rpm.hdr_sig.data, pv->rpm.hdr_sig.len) == PGP_SIG_OK;
+      }
+      if(
+        (p = rpm_tag(&pv->rpm.buf, RPMTAG_PAYLOADDIGEST, &type, &count, &len)) &&
+        type == 8 && count && memchr(p, 0, len)
+      ) {
+        str_copy(&pv->rpm.payload_digest, (char *) p);
+        u = PGP_HASH_MD5;
+        if((p = rpm_tag(&pv->rpm.buf, RPMTAG_PAYLOADDIGESTALGO, &type, &count, &len)) && type == 4 && count) {
+          u = get_be32(p);
+        }
+        if(!hash_init(&pv->rpm.payload_hash, u) || strlen(pv->rpm.payload_digest) != 2 * hash_finish(&pv->rpm.payload_hash, digest)) {
+          str_copy(&pv->rpm.payload_digest, NULL);
+        }
+        hash_init(&pv->rpm.payload_hash, u);
+      }
+      pv->rpm.state = R_PAYLOAD;
+      membuf_free(&pv->rpm.buf);
+      break;
+  }
+}
+
+
+/*
+ * Get body of signature packet.
+ *
+ * Return pointer to body or NULL; *len is updated.
+ */
+unsigned char *sig_packet(unsigned char *buf, unsigned *len)
+{
+  static const unsigned old_len[4] = { 1, 2, 4, 0 };
+  uint64_t pkt_len;
+  unsigned partial, u;
+  int tag, i;
+
+  if(*len < 2 || !(buf[0] & 0x80)) return NULL;
+
+  if(buf[0] & 0x40) {
+    tag = buf[0] & 0x3f;
+    if((i = new_len(buf + 1, *len - 1, &pkt_len, &partial)) < 0 || partial) return NULL;
+    i++;
+  }
+  else {
+    tag = (buf[0] >> 2) & 0xf;
+    u = old_len[buf[0] & 3];
+    if(!u || *len < 1 + u) return NULL;
+    for(pkt_len = 0, i = 1; i <= (int) u; i++) pkt_len = (pkt_len << 8) + buf[i];
+  }
+
+  if(tag != TAG_SIG || pkt_len > *len - i) return NULL;
+
+  *len = pkt_len;
+
+  return buf + i;
+}
+
+
+/*
+ * Find tag in rpm header (index + data, without the 16 byte preamble).
+ *
+ * Return pointer to data or NULL.
+ */
+unsigned char *rpm_tag(membuf_t *hdr, unsigned tag, unsigned *type, unsigned *count, unsigned *len)
+{
+  unsigned char *buf = (unsigned char *) hdr->data, *entry, *data;
+  unsigned il, dl, u, ofs, next_ofs, v;
+
+  if(hdr->len < 16) return NULL;
+
+  il = get_be32(buf + 8);
+  dl = get_be32(buf + 12);
+
+  if(hdr->len < 16 + 16 * il + dl) return NULL;
+
+  data = buf + 16 + 16 * il;
+
+  for(u = 0; u < il; u++) {
+    entry = buf + 16 + 16 * u;
+    if(get_be32(entry) != tag) continue;
+
+    *type = get_be32(entry + 4);
+    ofs = get_be32(entry + 8);
+    *count = get_be32(entry + 12);
+
+    if(ofs >= dl) return NULL;
+
+    /* data extend up to the next entry's data (or to the end) */
+    next_ofs = dl;
+    for(v = 0; v < il; v++) {
+      ofs = get_be32(buf + 16 + 16 * v + 8);
+      if(ofs > get_be32(entry + 8) && ofs < next_ofs) next_ofs = ofs;
+    }
+    ofs = get_be32(entry + 8);
+
+    *len = *type == 7 ? *count : next_ofs - ofs;
+    if(*len > dl - ofs) return NULL;
+
+    return data + ofs;
+  }
+
+  return NULL;
+}
+
+
+int rpm_result(pgp_verify_t *pv)
+{
+  unsigned char digest[SHA512_DIGEST_SIZE];
+  char hex[2 * SHA512_DIGEST_SIZE + 1];
+  unsigned u, len;
+  int ok = 1, payload_ok = 0;
+
+  if(pv->rpm.state != R_PAYLOAD) {
+    log_debug("pgp: truncated rpm\n");
+    return PGP_SIG_BAD;
+  }
+
+  if(!pv->rpm.hdr_sig.len && !pv->rpm.pkg_sig.len) return PGP_SIG_NONE;
+
+  if(pv->rpm.hdr_sig.len && !pv->rpm.hdr_ok) ok = 0;
+
+  if(pv->rpm.pkg_sig.len) {
+    if(verify_sig(&pv->rpm.pkg_hash, (unsigned char *) pv->rpm.pkg_sig.data, pv->rpm.pkg_sig.len) == PGP_SIG_OK) {
+      payload_ok = 1;
+    }
+    else {
+      ok = 0;
+    }
+  }
+
+  if(pv->rpm.payload_digest) {
+    len = hash_finish(&pv->rpm.payload_hash, digest);
+    for(u = 0; u < len; u++) sprintf(hex + 2 * u, "%02x", digest[u]);
+    if(!strcasecmp(hex, pv->rpm.payload_digest)) {
+      payload_ok = 1;
+    }
+    else {
+      log_debug("pgp: rpm payload digest wrong\n");
+      ok = 0;
+    }
+  }
+  else if(pv->rpm.has_md5) {
+    hash_finish(&pv->rpm.md5_hash, digest);
+    if(!memcmp(digest, pv->rpm.md5, 16)) {
+      payload_ok = 1;
+    }
+    else {
+      log_debug("pgp: rpm md5 wrong\n");
+      ok = 0;
+    }
+  }
+
+  return ok && payload_ok ? PGP_SIG_OK : PGP_SIG_BAD;
+}
+
+
+/*
+ * Finish processing.
+ *
+ * Return values:
+ *   PGP_SIG_OK:   signature ok
+ *   PGP_SIG_BAD:  signature wrong (or broken file)
+ *   PGP_SIG_NONE: not signed
+ */
+int pgp_verify_finish(pgp_verify_t *pv)
+{
+  if(pv->type == PV_UNKNOWN) {
+    detect_type(pv);
+    input_data(pv, (unsigned char *) pv->head.data, pv->head.len);
+    membuf_free(&pv->head);
+  }
+
+  if(pv->line.len) {
+    line_handler(pv, pv->line.data, pv->line.len);
+    pv->line.len = 0;
+  }
+
+  switch(pv->type) {
+    case PV_NONE:
+      pv->result = PGP_SIG_NONE;
+      break;
+
+    case PV_RPM:
+      pv->result = pv->failed ? PGP_SIG_BAD : rpm_result(pv);
+      break;
+
+    case PV_BINARY:
+    case PV_ARMOR:
+    case PV_CLEAR:
+      if(!pv->failed) layer_finish(pv, 0);
+      if(pv->type == PV_CLEAR && pv->line_state != A_DONE) pv->failed = 1;
+      /* fall through */
+
+    case PV_DETACHED:
+      if(!pv->sig.len && !pv->failed) {
+        pv->result = PGP_SIG_NONE;
+      }
+      else if(pv->failed || !pv->hash_started) {
+        pv->result = PGP_SIG_BAD;
+      }
+      else {
+        pv->result = verify_sig(&pv->hash, (unsigned char *) pv->sig.data, pv->sig.len);
+      }
+      break;
+  }
+
+  return pv->result;
+}
+
+
+/*
+ * Short description of data type (for logging).
+ */
+char *pgp_verify_type(pgp_verify_t *pv)
+{
+  switch(pv->type) {
+    case PV_RPM:
+      return "rpm";
+
+    case PV_BINARY:
+    case PV_ARMOR:
+    case PV_CLEAR:
+    case PV_DETACHED:
+      return "gpg";
+  }
+
+  return "unsigned";
+}
+
+
+/*
+ * Return 1 if the output differs from the input (signed data was unpacked).
+ */
+int pgp_verify_unpacked(pgp_verify_t *pv)
+{
+  return pv && (pv->type == PV_BINARY || pv->type == PV_ARMOR || pv->type == PV_CLEAR);
+}
+
+
+void pgp_verify_free(pgp_verify_t *pv)
+{
+  int i;
+
+  if(!pv) return;
+
+  if(pv->z_active) inflateEnd(&pv->z);
+
+  membuf_free(&pv->head);
+  membuf_free(&pv->line);
+  membuf_free(&pv->sig);
+  for(i = 0; i < 2; i++) membuf_free(&pv->layer[i].body);
+  membuf_free(&pv->rpm.buf);
+  membuf_free(&pv->rpm.hdr_sig);
+  membuf_free(&pv->rpm.pkg_sig);
+  free(pv->rpm.payload_digest);
+
+  free(pv);
+}
+
+
+static void write_fd(void *data, void *buf, size_t len)
+{
+  int *fd = data;
+  ssize_t i;
+
+  while(len && *fd >= 0) {
+    i = write(*fd, buf, len);
+    if(i < 0 && errno == EINTR) continue;
+    if(i <= 0) {
+      close(*fd);
+      *fd = -2;
+      break;
+    }
+    buf += i;
+    len -= i;
+  }
+}
+
+
+/*
+ * Verify file.
+ *
+ * If sig_file is set, it's the detached signature for file. Else check for
+ * a signed rpm or a signed message. In the latter case the signed content
+ * replaces 'file'.
+ *
+ * Return values:
+ *   -1: file not found
+ *   PGP_SIG_OK, PGP_SIG_BAD, PGP_SIG_NONE: see pgp_verify_finish()
+ */
+int pgp_verify_file(char *file, char *sig_file)
+{
+  pgp_verify_t *pv;
+  unsigned char buf[65536];
+  char *tmp = NULL;
+  membuf_t sig = {};
+  int fd, out_fd = -1, len, err;
+
+  if((fd = open(file, O_RDONLY)) == -1) return -1;
+
+  if(sig_file) {
+    pv = pgp_verify_new(NULL, NULL);
+    if((err = open(sig_file, O_RDONLY)) >= 0) {
+      while((len = read(err, buf, sizeof buf)) > 0) membuf_add(&sig, (char *) buf, len);
+      close(err);
+    }
+    pgp_verify_set_sig(pv, sig.data, sig.len);
+    membuf_free(&sig);
+  }
+  else {
+    strprintf(&tmp, "%s.unpacked", file);
+    out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    pv = pgp_verify_new(write_fd, &out_fd);
+  }
+
+  while((len = read(fd, buf, sizeof buf)) > 0) {
+    pgp_verify_process(pv, buf, len);
+    /* not a signed message: no need to copy it */
+    if(out_fd >= 0 && (pv->type == PV_NONE || pv->type == PV_RPM)) {
+      close(out_fd);
+      out_fd = -1;
+      pv->write = NULL;
+    }
+  }
+
+  close(fd);
+
+  err = pgp_verify_finish(pv);
+
+  if(tmp) {
+    if(out_fd >= 0) {
+      close(out_fd);
+      if(pv->type != PV_NONE && pv->type != PV_RPM && err != PGP_SIG_NONE) rename(tmp, file);
+    }
+    unlink(tmp);
+    str_copy(&tmp, NULL);
+  }
+
+  pgp_verify_free(pv);
+
+  return err;
+}
@@ -0,0 +1,41 @@
+typedef struct pgp_verify_s pgp_verify_t;
+
+/*
+ * Output function for unpacked data.
+ */
+typedef void (*pgp_write_func_t)(void *data, void *buf, size_t len);
+
+/*
+ * Result of a signature check (see pgp_verify_finish()).
+ */
+#define PGP_SIG_OK		0	/* signed, signature ok */
+#define PGP_SIG_BAD		1	/* signed, signature wrong */
+#define PGP_SIG_NONE		2	/* not signed */
+
+/*
+ * Hash algorithms.
+ */
+#define PGP_HASH_MD5		1
+#define PGP_HASH_SHA1		2
+#define PGP_HASH_SHA256		8
+#define PGP_HASH_SHA384		9
+#define PGP_HASH_SHA512		10
+#define PGP_HASH_SHA224		11
+
+#define PGP_KEYRING		"/installkey.gpg"
+#define PGP_KEYRING_DIR		"/pubkeys"
+
+int pgp_load_keys(void);
+
+pgp_verify_t *pgp_verify_new(pgp_write_func_t write_func, void *write_data);
+int pgp_verify_set_sig(pgp_verify_t *pv, void *buf, size_t len);
+void pgp_verify_process(pgp_verify_t *pv, void *buf, size_t len);
+int pgp_verify_finish(pgp_verify_t *pv);
+char *pgp_verify_type(pgp_verify_t *pv);
+int pgp_verify_unpacked(pgp_verify_t *pv);
+void pgp_verify_free(pgp_verify_t *pv);
+
+int pgp_sig_hash(void *sig, size_t len);
+int pgp_verify_hashed(void *sig, size_t len, void *ctx);
+
+int pgp_verify_file(char *file, char *sig_file);
@@ -4,9 +4,14 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <time.h>
 #include <fnmatch.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/utsname.h>
+#include <net/if.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -14,8 +19,34 @@
 #include "file.h"
 #include "dialog.h"
 #include "util.h"
+#include "netlink.h"
 #include "slp.h"
 
+#define SLP_MAX_IFS		16
+#define SLP_ROUND_MIN		400	/* wait at least this long (ms) for answers per round */
+#define SLP_ROUND_GAP		200	/* ...and until there was no answer for this long */
+#define SLP_ROUND_MAX		2000
+#define SLP_ROUNDS_MIN		2
+#define SLP_ROUNDS_MAX		5
+#define SLP_ATTR_TIMEOUT	2000	/* for all description lookups together */
+#define SLP_ATTR_BUFSIZE	8000
+#define SLP_TCP_TIMEOUT		500	/* connect, send and receive via tcp */
+
+/* an install url found and its description lookup state */
+typedef struct
+{
+  char *url;
+  char *descr;
+  unsigned char *origurl;
+  int origurllen;
+  struct sockaddr_in peer;
+  int fd;
+  int xid;
+  int sending;
+  unsigned char *buf;
+  int len, pos;
+} slp_url_t;
+
 static int nextxid = 1;
 
 static inline int slpgetw(unsigned char *p)
@@ -23,12 +54,44 @@ static inline int slpgetw(unsigned char *p)
   return p[0] << 8 | p[1];
 }
 
+static long slp_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* connect without blocking for longer than SLP_TCP_TIMEOUT; further
+   reads and writes on s time out as well */
+static int slp_connect(int s, struct sockaddr_in *peer)
+{
+  struct pollfd p = { .fd = s, .events = POLLOUT };
+  struct timeval tv = { .tv_sec = SLP_TCP_TIMEOUT / 1000, .tv_usec = (SLP_TCP_TIMEOUT % 1000) * 1000 };
+  int err = 0, flags;
+  socklen_t errlen = sizeof(err);
+
+  flags = fcntl(s, F_GETFL);
+  fcntl(s, F_SETFL, flags | O_NONBLOCK);
+  if (connect(s, (struct sockaddr *)peer, sizeof(*peer)))
+    {
+      if (errno != EINPROGRESS || poll(&p, 1, SLP_TCP_TIMEOUT) <= 0)
+	return -1;
+      if (getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &errlen) || err)
+	return -1;
+    }
+  fcntl(s, F_SETFL, flags);
+  setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return 0;
+}
+
 static int slpsend(int s,  unsigned char *buf, int buflen, struct sockaddr_in *peer, int tcp)
 {
   int l;
   if (tcp)
     {
-      if (connect(s, peer, sizeof(*peer)))
+      if (slp_connect(s, peer))
 	return -1;
       while (buflen)
 	{
@@ -52,7 +115,7 @@ static int slpsend(int s,  unsigned char *buf, int buflen, struct sockaddr_in *p
 
 /* returns: -2 on timeout, -1 on error, 0 for a bad msg,
    #bytes if a good msg was received */
-static int slprecv(int s, unsigned char *buf, int buflen, struct sockaddr_in *peer)
+static int slprecv(int s, unsigned char *buf, int buflen, struct sockaddr_in *peer, int timeout)
 {
   fd_set fdset;
   int l2, l3;
@@ -61,13 +124,13 @@ static int slprecv(int s, unsigned char *buf, int buflen, struct sockaddr_in *pe
 
   FD_ZERO(&fdset);
   FD_SET(s, &fdset);
-  tv.tv_sec = 0;
-  tv.tv_usec = 500000;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
   l2 = select(s + 1, &fdset, 0, 0, &tv);
   if (l2 < 0)
     {
+      /* s is closed by the caller */
       perror("select");
-      close(s);
       return -1;
     }
   if (l2 == 0)
@@ -106,19 +169,13 @@ static int slprecv(int s, unsigned char *buf, int buflen, struct sockaddr_in *pe
   return l2;
 }
 
-char *
-slp_get_descr(struct sockaddr_in *peer, unsigned char *url, int urllen)
+/* build AttrRqst for the description of url, returns length */
+static int
+slp_attr_request(unsigned char *sendbuf, int xid, unsigned char *url, int urllen)
 {
-  int s, l, l2, l3;
-  int xid, al;
-  char *d;
-  unsigned char sendbuf[8000];
-  unsigned char recvbuf[8000];
-  unsigned char *bp, *end;
+  unsigned char *bp;
+  int l;
 
-  xid = nextxid;
-  if (++nextxid == 65536)
-    nextxid = 1;
   memset(sendbuf, 0, 18);
   sendbuf[0] = 2;
   sendbuf[1] = 6;	/* AttrRqst */
@@ -142,18 +199,17 @@ slp_get_descr(struct sockaddr_in *peer, unsigned char *url, int urllen)
   l = bp - sendbuf;
   sendbuf[3] = l >> 8;
   sendbuf[4] = l & 255;
-  s = socket(PF_INET, SOCK_STREAM, 0);
-  if (s == -1)
-    return 0;
-  if (slpsend(s, sendbuf, l, peer, 1))
-    {
-      close(s);
-      return 0;
-    }
-  l2 = slprecv(s, recvbuf, sizeof(recvbuf), 0);
-  close(s);
-  if (l2 <= 0)
-    return 0;
+  return l;
+}
+
+/* parse AttrRply, returns description (malloced) or 0 */
+static char *
+slp_attr_reply(unsigned char *recvbuf, int l2, int xid)
+{
+  int l3, al;
+  char *d;
+  unsigned char *bp, *end;
+
   end = recvbuf + l2;
   if (recvbuf[0] != 2)
     return 0;
@@ -182,22 +238,196 @@ slp_get_descr(struct sockaddr_in *peer, unsigned char *url, int urllen)
   return d;
 }
 
+/* next step of a description lookup, returns 1 when done */
+static int
+slp_attr_io(slp_url_t *u)
+{
+  int l, err = 0;
+  socklen_t errlen = sizeof(err);
+
+  if (u->sending)
+    {
+      if (getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) || err)
+	return 1;
+      l = write(u->fd, u->buf + u->pos, u->len - u->pos);
+      if (l < 0 && errno == EAGAIN)
+	return 0;
+      if (l <= 0)
+	return 1;
+      u->pos += l;
+      if (u->pos < u->len)
+	return 0;
+      u->sending = 0;
+      u->pos = 0;
+      u->len = SLP_ATTR_BUFSIZE;
+      u->buf = realloc(u->buf, u->len);
+      return u->buf ? 0 : 1;
+    }
+  l = read(u->fd, u->buf + u->pos, u->len - u->pos);
+  if (l < 0 && errno == EAGAIN)
+    return 0;
+  if (l <= 0)
+    return 1;
+  u->pos += l;
+  if (u->pos < 5)
+    return 0;
+  l = u->buf[2] << 16 | u->buf[3] << 8 | u->buf[4];
+  if (l <= 16 || l > u->len)
+    return 1;
+  if (u->pos < l)
+    return 0;
+  u->descr = slp_attr_reply(u->buf, l, u->xid);
+  return 1;
+}
+
+static void
+slp_attr_done(slp_url_t *u)
+{
+  if (u->fd != -1)
+    close(u->fd);
+  u->fd = -1;
+  free(u->buf);
+  u->buf = 0;
+}
+
+/* get descriptions for all urls in parallel */
+static void
+slp_get_descrs(slp_url_t *urls, unsigned urlcnt)
+{
+  struct epoll_event ev, evs[32];
+  int efd, i, n, pending = 0;
+  unsigned j;
+  long end, wait;
+  slp_url_t *u;
+
+  efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd == -1)
+    {
+      perror("epoll_create1");
+      return;
+    }
+  for (j = 0; j < urlcnt; j++)
+    {
+      u = urls + j;
+      u->fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (u->fd == -1)
+	continue;
+      u->xid = nextxid;
+      if (++nextxid == 65536)
+	nextxid = 1;
+      u->buf = malloc(u->origurllen + 64);
+      if (!u->buf)
+	{
+	  slp_attr_done(u);
+	  continue;
+	}
+      u->len = slp_attr_request(u->buf, u->xid, u->origurl, u->origurllen);
+      u->pos = 0;
+      u->sending = 1;
+      if (connect(u->fd, (struct sockaddr *)&u->peer, sizeof(u->peer)) && errno != EINPROGRESS)
+	{
+	  slp_attr_done(u);
+	  continue;
+	}
+      ev.events = EPOLLOUT;
+      ev.data.ptr = u;
+      epoll_ctl(efd, EPOLL_CTL_ADD, u->fd, &ev);
+      pending++;
+    }
+  end = slp_ms() + SLP_ATTR_TIMEOUT;
+  while (pending && (wait = end - slp_ms()) > 0)
+    {
+      n = epoll_wait(efd, evs, sizeof(evs) / sizeof(*evs), wait);
+      if (n < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("epoll_wait");
+	  break;
+	}
+      for (i = 0; i < n; i++)
+	{
+	  u = evs[i].data.ptr;
+	  if (u->fd == -1)
+	    continue;
+	  if (slp_attr_io(u))
+	    {
+	      slp_attr_done(u);
+	      pending--;
+	    }
+	  else if (!u->sending && (evs[i].events & EPOLLOUT))
+	    {
+	      ev.events = EPOLLIN;
+	      ev.data.ptr = u;
+	      epoll_ctl(efd, EPOLL_CTL_MOD, u->fd, &ev);
+	    }
+	}
+    }
+  if (pending)
+    log_info("SLP: %d description lookups timed out\n", pending);
+  for (j = 0; j < urlcnt; j++)
+    slp_attr_done(urls + j);
+  close(efd);
+}
+
+/* sort by description, then url */
+static int
+slp_url_cmp(const void *p1, const void *p2)
+{
+  const slp_url_t *u1 = p1, *u2 = p2;
+  int i;
+
+  i = strcmp(u1->descr, u2->descr);
+  return i ? i : strcmp(u1->url, u2->url);
+}
+
+/* ipv4 addresses of all interfaces we can send multicasts on */
+static int
+slp_ifaddrs(struct in_addr *addrs, int max)
+{
+  nl_if_t *nif;
+  nl_addr_t *a;
+  int n = 0;
+
+  if (!nl_update())
+    {
+      for (nif = nl_if_list(); nif && n < max; nif = nif->next)
+	{
+	  if ((nif->flags & (IFF_UP | IFF_LOOPBACK | IFF_MULTICAST)) != (IFF_UP | IFF_MULTICAST))
+	    continue;
+	  for (a = nif->addr; a; a = a->next)
+	    if (a->family == AF_INET)
+	      {
+		memcpy(&addrs[n++], a->addr, 4);
+		break;	/* one per interface */
+	      }
+	}
+    }
+  if (n == 0)
+    addrs[n++] = config.net.hostname.ip;
+  return n;
+}
+
 char *slp_get_install(url_t *url)
 {
   unsigned char sendbuf[8000];
   unsigned char recvbuf[80000];
   unsigned char *bp, *end, *service, service_key[256];
-  int xid, l, s, l2, l3, ec, comma, ulen, i, acnt, service_key_len;
-  struct sockaddr_in mysa;
+  int xid, l, s, l2, l3, ec, comma, ulen, i, j, acnt, service_key_len;
   struct sockaddr_in mcsa;
   struct sockaddr_in pesa;
-  int tries;
+  struct in_addr ifaddrs[SLP_MAX_IFS];
+  struct epoll_event ev, evs[SLP_MAX_IFS];
+  int socks[SLP_MAX_IFS];
+  int nsocks = 0, nifs, efd, round, answers, n;
+  long start, last, now, wait;
   static char urlbuf[256];
   char *iaddr, *d;
   char **urls = 0;
   char **descs = 0;
   char **ambg = 0;
-  int urlcnt = 0;
+  slp_url_t *found = 0;
+  unsigned urlcnt = 0, u;
   int win_old;
   unsigned char *origurl;
   int origurllen;
@@ -205,10 +435,6 @@ char *slp_get_install(url_t *url)
   char *key = NULL;
   slist_t *sl;
 
-  mysa.sin_family = AF_INET;
-  mysa.sin_port = 0;
-  mysa.sin_addr.s_addr = config.net.hostname.ip.s_addr;
-
   mcsa.sin_family = AF_INET;
   mcsa.sin_port = htons(427);
   mcsa.sin_addr.s_addr = htonl(0xeffffffd);
@@ -264,195 +490,263 @@ char *slp_get_install(url_t *url)
   l = bp - sendbuf;
   sendbuf[3] = l >> 8;
   sendbuf[4] = l & 255;
-  s = socket(PF_INET, SOCK_DGRAM, 0);
-  if (s == -1)
+
+  /* query on all interfaces at once */
+  efd = epoll_create1(EPOLL_CLOEXEC);
+  if (efd == -1)
     {
-      perror("socket");
+      perror("epoll_create1");
       return NULL;
     }
-  if (fcntl(s, F_SETFL, O_NONBLOCK))
+  nifs = slp_ifaddrs(ifaddrs, SLP_MAX_IFS);
+  for (i = 0; i < nifs; i++)
     {
-      perror("fcntl O_NONBLOCK");
-      return NULL;
+      s = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (s == -1)
+	{
+	  perror("socket");
+	  continue;
+	}
+      if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, (char *)&ifaddrs[i], sizeof(ifaddrs[i])))
+	{
+	  perror("setsockopt IP_MULTICAST_IF");
+	  close(s);
+	  continue;
+	}
+      j = 8;	/* like openslp */
+      if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &j, sizeof(j)))
+	{
+	  perror("setsockopt IP_MULTICAST_TTL");
+	}
+      ev.events = EPOLLIN;
+      ev.data.fd = s;
+      epoll_ctl(efd, EPOLL_CTL_ADD, s, &ev);
+      socks[nsocks++] = s;
     }
-  if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_IF, (char *)&mysa.sin_addr, sizeof(mysa.sin_addr)))
+  if (nsocks == 0)
     {
-      perror("setsockopt IP_MULTICAST_IF");
-      close(s);
+      close(efd);
       return NULL;
     }
-  i = 8;	/* like openslp */
-  if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &i, sizeof(i)))
-    {
-      perror("setsockopt IP_MULTICAST_TTL");
-    }
-  for (tries = 0; tries < 3; tries++)
+  log_info("SLP: querying %d interface%s\n", nsocks, nsocks == 1 ? "" : "s");
+
+  /*
+   * Each round waits as long as answers keep coming in; another round is
+   * done (with the list of servers that already answered) only if the
+   * last one brought new answers.
+   */
+  for (round = 0; round < SLP_ROUNDS_MAX; round++)
     {
-      if (slpsend(s, sendbuf, l, &mcsa, 0))
-	{
-	  close(s);
-	  return NULL;
-	}
+      for (i = 0; i < nsocks; i++)
+	slpsend(socks[i], sendbuf, l, &mcsa, 0);
+      answers = 0;
+      start = last = slp_ms();
       for (;;)
 	{
-	  l2 = slprecv(s, recvbuf, sizeof(recvbuf), &pesa);
-	  if (l2 == -1)
-	    {
-	      close(s);
-	      return NULL;
-	    }
-	  if (l2 == -2)
+	  now = slp_ms();
+	  wait = start + SLP_ROUND_MIN - now;
+	  if (answers && last + SLP_ROUND_GAP - now > wait)
+	    wait = last + SLP_ROUND_GAP - now;
+	  if (start + SLP_ROUND_MAX - now < wait)
+	    wait = start + SLP_ROUND_MAX - now;
+	  if (wait <= 0)
 	    break;
-	  if (l2 == 0)
-	   continue;
-	  if (recvbuf[0] != 2)
-	    continue;
-	  if (recvbuf[1] != 2)	/* SrvRply */
-	    continue;
-	  if (slpgetw(recvbuf + 10) != xid)
-	    continue;
-
-	  iaddr = inet_ntoa(pesa.sin_addr);
-	  end = recvbuf + l2;
-
-	  /* check if we already saw that answer */
-	  l2 = slpgetw(sendbuf + 16);
-	  l3 = strlen(iaddr);
-	  bp = sendbuf + 18;
-	  while (l2)
+	  n = epoll_wait(efd, evs, SLP_MAX_IFS, wait);
+	  if (n < 0)
 	    {
-	      if (l2 >= l3 && strncmp(bp, iaddr, l3) == 0 && (l2 == l3 || bp[l3] == ','))
-		break;
-	      while (l2)
-		{
-		  l2--;
-		  if (*bp++ == ',')
-		    break;
-		}
-	    }
-	  if (l2)
-	    continue;	/* saw it, ignore answer as it is a dup */
-
-	  if (recvbuf[5] & 0x80)	/* OVERFLOW? */
-	    {
-	      /* redo request with tcp and unicast */
-	      int s2;
-	      s2 = socket(PF_INET, SOCK_STREAM, 0);
-	      if (s2 != 0 && slpsend(s2, sendbuf, l, &pesa, 1) == 0)
-		{
-		  l2 = slprecv(s2, recvbuf, sizeof(recvbuf), 0);
-		  close(s2);
-		  if (l2 <= 0)
-		    continue;
-		}
-	      if (recvbuf[0] != 2)
-		continue;
-	      if (recvbuf[1] != 2)	/* SrvRply */
+	      if (errno == EINTR)
 		continue;
-	      if (slpgetw(recvbuf + 10) != xid)
-		continue;
-	      end = recvbuf + l2;
-	    }
-
-	  l3 = strlen(iaddr);
-	  comma = sendbuf[16] != 0 || sendbuf[17] != 0;
-	  if (l + l3 + comma <= sizeof(sendbuf))
-	    {
-	      bp = sendbuf + 18;
-	      memmove(bp + l3 + comma, bp, l - 18);
-	      memmove(bp, iaddr, l3);
-	      if (comma)
-		bp[l3] = ',';
-	      l2 = slpgetw(sendbuf + 16) + l3 + comma;
-	      sendbuf[16] = l2 >> 8;
-	      sendbuf[17] = l2 & 255;
-	      l += l3 + comma;
-	      sendbuf[3] = l >> 8;
-	      sendbuf[4] = l & 255;
+	      perror("epoll_wait");
+	      break;
 	    }
-	  bp = recvbuf + 12;
-	  l3 = slpgetw(bp);
-	  bp += l3 + 2;
-	  if (bp + 4 > end)
-	    continue;
-	  if (slpgetw(bp))		/* error code */
-	    continue;
-	  ec = slpgetw(bp + 2);
-	  bp += 4;
-	  for (; ec > 0; ec--)
+	  for (j = 0; j < n; j++)
 	    {
-	      if (bp + 5 > end)
-		break;
-	      ulen =  slpgetw(bp + 3);
-	      bp += 5;
-	      if (bp + ulen + 1 > end)
-		break;
-	      origurl = bp;
-	      origurllen = ulen;
-	      if (ulen > service_key_len && !strncasecmp(bp, service_key, service_key_len))
+	      s = evs[j].data.fd;
+	      while ((l2 = slprecv(s, recvbuf, sizeof(recvbuf), &pesa, 0)) != -2)
 		{
-		  bp += service_key_len;
-		  ulen -= service_key_len;
-		}
-	      /* 8: room for install= */
-	      if (ulen > sizeof(urlbuf) - 1 - 8)
-		{
-		  bp += ulen;
-		  if (*bp++)
+		  if (l2 == -1)
 		    break;
-		  continue;
-		}
-	      memcpy(urlbuf, bp, ulen);
-	      urlbuf[ulen] = 0;
-	      bp += ulen;
-	      for (i = 0; i < urlcnt; i++)
-		if (!strcasecmp(urls[i], urlbuf))
-		  break;
-	      if (i == urlcnt)
-		{
-		  if ((urlcnt & 15) == 0)
+		  if (l2 == 0)
+		   continue;
+		  if (recvbuf[0] != 2)
+		    continue;
+		  if (recvbuf[1] != 2)	/* SrvRply */
+		    continue;
+		  if (slpgetw(recvbuf + 10) != xid)
+		    continue;
+
+		  iaddr = inet_ntoa(pesa.sin_addr);
+		  end = recvbuf + l2;
+
+		  /* check if we already saw that answer */
+		  l2 = slpgetw(sendbuf + 16);
+		  l3 = strlen(iaddr);
+		  bp = sendbuf + 18;
+		  while (l2)
+		    {
+		      if (l2 >= l3 && strncmp(bp, iaddr, l3) == 0 && (l2 == l3 || bp[l3] == ','))
+			break;
+		      while (l2)
+			{
+			  l2--;
+			  if (*bp++ == ',')
+			    break;
+			}
+		    }
+		  if (l2)
+		    continue;	/* saw it, ignore answer as it is a dup */
+
+		  answers++;
+		  last = slp_ms();
+
+		  if (recvbuf[5] & 0x80)	/* OVERFLOW? */
 		    {
-		      if (urls)
-			urls = realloc(urls, sizeof(char **) * (urlcnt + 16));
-		      else
-			urls = malloc(sizeof(char **) * (urlcnt + 16));
-		      if (descs)
-			descs = realloc(descs, sizeof(char **) * (urlcnt + 16));
-		      else
-			descs = malloc(sizeof(char **) * (urlcnt + 16));
+		      /* redo request with tcp and unicast */
+		      int s2;
+		      s2 = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		      if (s2 != -1 && slpsend(s2, sendbuf, l, &pesa, 1) == 0)
+			{
+			  l2 = slprecv(s2, recvbuf, sizeof(recvbuf), 0, SLP_TCP_TIMEOUT);
+			  close(s2);
+			  if (l2 <= 0)
+			    continue;
+			}
+		      else if (s2 != -1)
+			close(s2);
+		      if (recvbuf[0] != 2)
+			continue;
+		      if (recvbuf[1] != 2)	/* SrvRply */
+			continue;
+		      if (slpgetw(recvbuf + 10) != xid)
+			continue;
+		      end = recvbuf + l2;
 		    }
-		  if (!urls || !descs)
+
+		  l3 = strlen(iaddr);
+		  comma = sendbuf[16] != 0 || sendbuf[17] != 0;
+		  if (l + l3 + comma <= sizeof(sendbuf))
 		    {
-		      close(s);
-		      return NULL;
+		      bp = sendbuf + 18;
+		      memmove(bp + l3 + comma, bp, l - 18);
+		      memmove(bp, iaddr, l3);
+		      if (comma)
+			bp[l3] = ',';
+		      l2 = slpgetw(sendbuf + 16) + l3 + comma;
+		      sendbuf[16] = l2 >> 8;
+		      sendbuf[17] = l2 & 255;
+		      l += l3 + comma;
+		      sendbuf[3] = l >> 8;
+		      sendbuf[4] = l & 255;
 		    }
-		  d = slp_get_descr(&pesa, origurl, origurllen);
-		  if (!d)
-		    d = strdup(urlbuf);
-		  for (i = 0; i < urlcnt; i++)
-		    if (strcmp(d, descs[i]) < 0 || (strcmp(d, descs[i]) == 0 && strcmp(urlbuf, urls[i]) < 0))
-		      break;
-		  if (i < urlcnt)
+		  bp = recvbuf + 12;
+		  l3 = slpgetw(bp);
+		  bp += l3 + 2;
+		  if (bp + 4 > end)
+		    continue;
+		  if (slpgetw(bp))		/* error code */
+		    continue;
+		  ec = slpgetw(bp + 2);
+		  bp += 4;
+		  for (; ec > 0; ec--)
 		    {
-		      memmove(descs + i + 1, descs + i, sizeof(*descs) * (urlcnt - i));
-		      memmove(urls + i + 1, urls + i, sizeof(*urls) * (urlcnt - i));
+		      if (bp + 5 > end)
+			break;
+		      ulen =  slpgetw(bp + 3);
+		      bp += 5;
+		      if (bp + ulen + 1 > end)
+			break;
+		      origurl = bp;
+		      origurllen = ulen;
+		      if (ulen > service_key_len && !strncasecmp(bp, service_key, service_key_len))
+			{
+			  bp += service_key_len;
+			  ulen -= service_key_len;
+			}
+		      /* 8: room for install= */
+		      if (ulen > sizeof(urlbuf) - 1 - 8)
+			{
+			  bp += ulen;
+			  if (*bp++)
+			    break;
+			  continue;
+			}
+		      memcpy(urlbuf, bp, ulen);
+		      urlbuf[ulen] = 0;
+		      bp += ulen;
+		      for (u = 0; u < urlcnt; u++)
+			if (!strcasecmp(found[u].url, urlbuf))
+			  break;
+		      if (u == urlcnt)
+			{
+			  if ((urlcnt & 15) == 0)
+			    {
+			      found = realloc(found, sizeof(*found) * (urlcnt + 16));
+			      if (!found)
+				{
+				  urlcnt = 0;
+				  break;
+				}
+			    }
+			  memset(found + urlcnt, 0, sizeof(*found));
+			  found[urlcnt].url = strdup(urlbuf);
+			  found[urlcnt].origurl = malloc(origurllen);
+			  memcpy(found[urlcnt].origurl, origurl, origurllen);
+			  found[urlcnt].origurllen = origurllen;
+			  found[urlcnt].peer = pesa;
+			  found[urlcnt].fd = -1;
+			  urlcnt++;
+			}
+		      if (*bp++)
+			break;
 		    }
-		  descs[i] = d;
-		  urls[i] = strdup(urlbuf);;
-		  urlcnt++;
 		}
-	      if (*bp++)
-		break;
 	    }
 	}
+      if (round + 1 >= SLP_ROUNDS_MIN && !answers)
+	break;
+    }
+  for (i = 0; i < nsocks; i++)
+    close(socks[i]);
+  close(efd);
+
+  /* fetch all descriptions in parallel, then sort */
+  if (urlcnt)
+    {
+      slp_get_descrs(found, urlcnt);
+      for (u = 0; u < urlcnt; u++)
+	{
+	  if (!found[u].descr)
+	    found[u].descr = strdup(found[u].url);
+	  free(found[u].origurl);
+	}
+      qsort(found, urlcnt, sizeof(*found), slp_url_cmp);
+      urls = malloc(urlcnt * sizeof *urls);
+      descs = malloc(urlcnt * sizeof *descs);
+      if (!urls || !descs)
+	{
+	  free(urls);
+	  free(descs);
+	  for (u = 0; u < urlcnt; u++)
+	    {
+	      free(found[u].url);
+	      free(found[u].descr);
+	    }
+	  free(found);
+	  return NULL;
+	}
+      for (u = 0; u < urlcnt; u++)
+	{
+	  urls[u] = found[u].url;
+	  descs[u] = found[u].descr;
+	}
     }
-  close(s);
+  free(found);
   if (urlcnt == 0)
     {
       log_info("SLP: no installation source found\n");
       return NULL;
     }
-  ambg = malloc((urlcnt + 1) * sizeof(char **));
+  ambg = malloc((urlcnt + 1) * sizeof *ambg);
   if (!ambg)
     return NULL;
   win_old = config.win;
@@ -465,10 +759,10 @@ char *slp_get_install(url_t *url)
       str_copy(&key, sl ? sl->value : NULL);
 
       while(1) {
-        for(i = acnt = 0; i < urlcnt; i++) {
-          if(key && fnmatch(key, descs[i], FNM_CASEFOLD)) continue;
-          if(acnt == 0 || strcmp(descs[i], ambg[acnt - 1])) {
-            ambg[acnt++] = descs[i];
+        for(u = acnt = 0; u < urlcnt; u++) {
+          if(key && fnmatch(key, descs[u], FNM_CASEFOLD)) continue;
+          if(acnt == 0 || strcmp(descs[u], ambg[acnt - 1])) {
+            ambg[acnt++] = descs[u];
           }
         }
         ambg[acnt] = 0;
@@ -485,10 +779,10 @@ char *slp_get_install(url_t *url)
       str_copy(&key, sl ? sl->value : NULL);
 
       while(1) {
-        for(i = acnt = 0; i < urlcnt; i++) {
-          if(key && fnmatch(key, urls[i], FNM_CASEFOLD)) continue;
-          if(!strcmp(descs[i], d)) {
-            ambg[acnt++] = urls[i];
+        for(u = acnt = 0; u < urlcnt; u++) {
+          if(key && fnmatch(key, urls[u], FNM_CASEFOLD)) continue;
+          if(!strcmp(descs[u], d)) {
+            ambg[acnt++] = urls[u];
           }
         }
         ambg[acnt] = 0;
@@ -507,10 +801,10 @@ char *slp_get_install(url_t *url)
 	}
     }
   if(config.win && !win_old) util_disp_done();
-  for (i = 0; i < urlcnt; i++)
+  for (u = 0; u < urlcnt; u++)
     {
-      free(descs[i]);
-      free(urls[i]);
+      free(descs[u]);
+      free(urls[u]);
     }
   free(descs);
   free(urls);
@@ -33,6 +33,10 @@ known issues:
 #include "display.h"
 #include "auto2.h"
 #include "url.h"
+#include "dns.h"
+#include "netlink.h"
+#include "io.h"
+#include "console.h"
 
 #define CRAMFS_SUPER_MAGIC	0x28cd3d45
 #define CRAMFS_SUPER_MAGIC_BIG	0x453dcd28
@@ -50,13 +54,30 @@ struct cramfs_super_block {
   unsigned char name[16];
 };
 
+/*
+ * Prefetched file, see url_prefetch().
+ */
+typedef struct url_prefetch_s {
+  struct url_prefetch_s *next;
+  char *url;
+  char *data;
+  size_t len, max;
+  int err;			// curl error code
+  char *err_buf;
+  CURL *c_handle;		// while transfer is running
+  unsigned done:1;
+  unsigned missing:1;		// file does not exist
+} url_prefetch_t;
+
 static size_t url_write_cb(void *buffer, size_t size, size_t nmemb, void *userp);
+static void url_write_data(void *data, void *buffer, size_t len);
 static int url_progress_cb(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 
 static int url_read_file_nosig(url_t *url, char *dir, char *src, char *dst, char *label, unsigned flags);
 static int url_mount_really(url_t *url, char *device, char *dir);
 static int url_mount_disk(url_t *url, char *dir, int (*test_func)(url_t *));
 static int url_progress(url_data_t *url_data, int stage);
+static int url_progress_update(url_data_t *url_data);
 static int url_setup_device(url_t *url);
 static int url_setup_interface(url_t *url);
 static int url_setup_slp(url_t *url);
@@ -67,20 +88,76 @@ static char *url_config_get_path(char *entry);
 static slist_t *url_config_get_file_list(char *entry);
 static hd_t *sort_a_bit(hd_t *hd_list);
 static int link_detected(hd_t *hd);
+static int link_cmp(hd_t *hd1, hd_t *hd2);
 static char *url_print_zypp(url_t *url);
 static void digest_init(url_data_t *url_data);
 static void digest_process(url_data_t *url_data, void *buffer, size_t len);
 static void digest_finish(url_data_t *url_data);
 static int digest_verify(url_data_t *url_data, char *file_name);
+static int digest_match(url_data_t *url_data, char *digest);
+static unsigned digest_hash(char *file_name);
+static char *digest_lookup(char *file_name);
+static int digest_file_match(char *file_name, char *digest);
+static unsigned url_port(url_t *url);
+static int verify_detached(char *file, char *sig_file);
 static int warn_signature_failed(char *file_name);
-static int is_gpg_signed(char *file);
-static int is_rpm_signed(char *file);
-static int is_signed(char *file, int check);
 static unsigned url_scheme_attr(instmode_t scheme, char *attr_name);
+static void url_curl_init(void);
+static CURLSH *url_curl_share(void);
+static CURL *url_curl_get(void);
+static void url_curl_put(CURL *c_handle);
+static void url_curl_opts(CURL *c_handle);
+static url_t *url_add_path(url_t *url, char *file);
+static size_t url_prefetch_cb(void *buffer, size_t size, size_t nmemb, void *userp);
+static url_prefetch_t *url_prefetch_get(char *url);
+static void url_prefetch_serve(url_data_t *url_data, url_prefetch_t *pf);
+static void url_prefetch_free(url_prefetch_t *pf);
+static void url_prefetch_repo(url_t *url);
+static void url_read_local(url_data_t *url_data);
+
+/*
+ * Index for config.digests.list (hash table, by file name).
+ */
+typedef struct digest_entry_s {
+  struct digest_entry_s *next;
+  slist_t *sl;			// entry in config.digests.list
+  unsigned hash;		// digest_hash() of file name
+} digest_entry_t;
+
+static struct {
+  digest_entry_t **entry;
+  unsigned size, used;
+} digest_index;
+
+#define URL_CURL_HANDLES	8
+
+/*
+ * Curl state kept across transfers.
+ *
+ * Connections, DNS entries and TLS sessions are shared via 'share', so
+ * repeated requests to the same server reuse the connection. Easy handles
+ * are kept for reuse, see url_curl_get() and url_curl_put().
+ */
+static struct {
+  unsigned init:1;
+  CURLSH *share;
+  CURL *handle[URL_CURL_HANDLES];
+  unsigned handles;
+} url_curl;
+
+#define URL_PROGRESS_FPS	10
+
+#define URL_PREFETCH_MAX	(4 << 20)	/* max size of a prefetched file */
+#define URL_PREFETCH_TIMEOUT	30000		/* ms */
+
+static url_prefetch_t *url_prefetch_list;
+
 
 void url_read(url_data_t *url_data)
 {
   CURL *c_handle;
+  url_prefetch_t *pf;
+  struct curl_slist *resolve = NULL;
   int i;
   FILE *f;
   char *buf, *s, *proxy_url = NULL;
@@ -88,7 +165,7 @@ void url_read(url_data_t *url_data)
 
   digest_init(url_data);
 
-  c_handle = curl_easy_init();
+  c_handle = url_curl_get();
   // log_info("curl handle = %p\n", c_handle);
 
   // curl_easy_setopt(c_handle, CURLOPT_VERBOSE, 1);
@@ -96,25 +173,12 @@ void url_read(url_data_t *url_data)
   curl_easy_setopt(c_handle, CURLOPT_WRITEFUNCTION, url_write_cb);
   curl_easy_setopt(c_handle, CURLOPT_WRITEDATA, url_data);
   curl_easy_setopt(c_handle, CURLOPT_ERRORBUFFER, url_data->curl_err_buf);
-  curl_easy_setopt(c_handle, CURLOPT_FAILONERROR, 1);
-  curl_easy_setopt(c_handle, CURLOPT_FOLLOWLOCATION, 1);
-  curl_easy_setopt(c_handle, CURLOPT_MAXREDIRS, 10);
-  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYPEER, config.sslcerts ? 1 : 0);
-  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYHOST, config.sslcerts ? 2 : 0);
 
   curl_easy_setopt(c_handle, CURLOPT_PROGRESSFUNCTION, url_progress_cb);
   curl_easy_setopt(c_handle, CURLOPT_PROGRESSDATA, url_data);
   curl_easy_setopt(c_handle, CURLOPT_NOPROGRESS, 0);
 
-  if(config.net.ipv6 && !config.net.ipv4) {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
-  }
-  else if(config.net.ipv4 && !config.net.ipv6) {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
-  }
-  else {
-    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_WHATEVER);
-  }
+  url_curl_opts(c_handle);
 
   url_data->err = curl_easy_setopt(c_handle, CURLOPT_URL, url_data->url->str);
 
@@ -128,14 +192,36 @@ void url_read(url_data_t *url_data)
     if(config.debug >= 2) log_debug("proxy: %s\n", proxy_url);
   }
 
+  pf = url_data->err ? NULL : url_prefetch_get(url_data->url->str);
+
+  /* resolve names ourselves, so curl can use our dns cache; not needed for prefetched files */
+  if(!pf && url_data->url->scheme != inst_file) {
+    if(proxy_url) {
+      resolve = dns_curl_resolve(resolve, config.url.proxy->server, config.url.proxy->port ?: 1080);
+    }
+    else {
+      resolve = dns_curl_resolve(resolve, url_data->url->server, url_port(url_data->url));
+    }
+  }
+  if(resolve) curl_easy_setopt(c_handle, CURLOPT_RESOLVE, resolve);
+
   if(url_data->progress) url_data->progress(url_data, 0);
 
   if(!url_data->err) {
-    i = curl_easy_perform(c_handle);
-    if(!url_data->err) url_data->err = i;
+    if(pf) {
+      url_prefetch_serve(url_data, pf);
+    }
+    else if(url_data->url->scheme == inst_file) {
+      url_read_local(url_data);
+    }
+    else {
+      i = curl_easy_perform(c_handle);
+      if(!url_data->err) url_data->err = i;
+    }
   }
 
   if(!url_data->err) {
+    if(url_data->pgp) url_data->sig = pgp_verify_finish(url_data->pgp);
     url_data->flush = 1;
     url_write_cb(NULL, 0, 0, url_data);
   }
@@ -174,6 +260,7 @@ void url_read(url_data_t *url_data)
 
   /* to get progress bar at 100% when uncompressing */
   url_data->flush = 0;
+  url_data->p_time = 0;
   url_write_cb(NULL, 0, 0, url_data);
 
   if(url_data->pipe_fd >= 0) close(url_data->pipe_fd);
@@ -187,27 +274,103 @@ void url_read(url_data_t *url_data)
 
   if(url_data->progress) url_data->progress(url_data, 2);
 
-  curl_easy_cleanup(c_handle);
+  url_curl_put(c_handle);
+
+  curl_slist_free_all(resolve);
 
   str_copy(&proxy_url, NULL);
 
   signal(SIGPIPE, old_sigpipe);
 
-  if(!url_data->err) digest_finish(url_data);
+  if(!url_data->err) {
+    /* keep hash state for a detached signature */
+    if(url_data->pgp && url_data->sig == PGP_SIG_NONE) url_data->digest.sig_ctx = url_data->digest.ctx;
+    digest_finish(url_data);
+  }
+}
+
+
+/*
+ * Read local file.
+ *
+ * Local media are read directly (not via curl), with several reads in
+ * flight; see io_read_open().
+ */
+void url_read_local(url_data_t *url_data)
+{
+  io_reader_t *io;
+  unsigned char *buf;
+  struct stat sbuf;
+  char *name;
+  int fd, len;
+
+  name = url_data->url->path ?: "/";
+
+  fd = open(name, O_RDONLY | O_LARGEFILE);
+  if(fd == -1 || fstat(fd, &sbuf) || S_ISDIR(sbuf.st_mode)) {
+    url_data->err = CURLE_FILE_COULDNT_READ_FILE;
+    snprintf(url_data->curl_err_buf, CURL_ERROR_SIZE, "Couldn't open file %s", name);
+    if(fd != -1) close(fd);
+
+    return;
+  }
+
+  url_data->p_total = sbuf.st_size;
+
+  io = io_read_open(fd, 0, S_ISREG(sbuf.st_mode) ? sbuf.st_size : 0);
+
+  while((len = io_read_next(io, &buf)) > 0) {
+    if(url_write_cb(buf, 1, len, url_data) != len) {
+      if(!url_data->err) url_data->err = CURLE_WRITE_ERROR;
+      break;
+    }
+  }
+
+  if(len < 0 && !url_data->err) {
+    url_data->err = CURLE_READ_ERROR;
+    snprintf(url_data->curl_err_buf, CURL_ERROR_SIZE, "%s: %s", name, strerror(io_read_error(io)));
+  }
+
+  io_read_close(io);
+
+  close(fd);
 }
 
 
 size_t url_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
 {
   url_data_t *url_data = userp;
+  size_t len = size * nmemb;
+
+  digest_process(url_data, buffer, len);
+
+  /*
+   * If there's a signature check, data go through it; signed messages are
+   * unpacked on the fly.
+   */
+  if(url_data->pgp && len) {
+    pgp_verify_process(url_data->pgp, buffer, len);
+  }
+  else {
+    url_write_data(url_data, buffer, len);
+  }
+
+  return url_data->err ? 0 : len;
+}
+
+
+/*
+ * Write data to file, uncompressing them if necessary.
+ */
+void url_write_data(void *data, void *buffer, size_t len)
+{
+  url_data_t *url_data = data;
   size_t z1, z2;
   int i, fd, fd1, fd2, tmp;
   struct cramfs_super_block *cramfs_sb;
   off_t off;
 
-  z1 = size * nmemb;
-
-  digest_process(url_data, buffer, z1);
+  z1 = len;
 
   if(url_data->buf.len < url_data->buf.max && z1) {
     z2 = url_data->buf.max - url_data->buf.len;
@@ -322,12 +485,8 @@ size_t url_write_cb(void *buffer, size_t size, size_t nmemb, void *userp)
   }
 
   if(url_data->p_total || url_data->zp_total) {
-    if(url_data->progress) {
-      if(url_data->progress(url_data, 1) && !url_data->err) url_data->err = 102;
-    }
+    if(url_progress_update(url_data) && !url_data->err) url_data->err = 102;
   }
-
-  return url_data->err ? 0 : size * nmemb;
 }
 
 
@@ -337,7 +496,35 @@ int url_progress_cb(void *clientp, double dltotal, double dlnow, double ultotal,
 
   if(!url_data->p_total) url_data->p_total = dltotal;
 
-  return url_data->progress ? url_data->progress(url_data, 1) : 0;
+  return url_progress_update(url_data);
+}
+
+
+/*
+ * Update progress indicator.
+ *
+ * The data path just counts bytes; the indicator is redrawn at most
+ * URL_PROGRESS_FPS times per second (and once more at the end).
+ *
+ * return:
+ *   0: ok
+ *   1: abort download
+ */
+int url_progress_update(url_data_t *url_data)
+{
+  struct timespec ts;
+  long now;
+
+  if(!url_data->progress) return 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now = ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+
+  if(!url_data->flush && url_data->p_time && now - url_data->p_time < 1000 / URL_PROGRESS_FPS) return 0;
+
+  url_data->p_time = now;
+
+  return url_data->progress(url_data, 1);
 }
 
 
@@ -881,8 +1068,6 @@ url_t *url_free(url_t *url)
 
 url_data_t *url_data_new()
 {
-  static int curl_init = 0;
-  int err;
   url_data_t *url_data = calloc(1, sizeof *url_data);
 
   url_data->err_buf_len = CURL_ERROR_SIZE;
@@ -894,12 +1079,9 @@ url_data_t *url_data_new()
 
   url_data->pipe_fd = -1;
   url_data->percent = -1;
+  url_data->sig = PGP_SIG_NONE;
 
-  if(!curl_init) {
-    curl_init = 1;
-    err = curl_global_init(CURL_GLOBAL_ALL);
-    if(err) log_info("curl init = %d\n", err);
-  }
+  url_curl_init();
 
   return url_data;
 }
@@ -918,13 +1100,385 @@ void url_data_free(url_data_t *url_data)
   free(url_data->label);
   free(url_data->compressed);
 
+  pgp_verify_free(url_data->pgp);
+
   free(url_data);
 }
 
 
+/*
+ * Close all connections and free curl state.
+ *
+ * Call only once, at exit (curl_global_cleanup() is not thread-safe).
+ */
 void url_cleanup()
 {
+  if(!url_curl.init) return;
+
+  url_prefetch_clear();
+
+  while(url_curl.handles) curl_easy_cleanup(url_curl.handle[--url_curl.handles]);
+
+  if(url_curl.share) curl_share_cleanup(url_curl.share);
+  url_curl.share = NULL;
+
   curl_global_cleanup();
+
+  url_curl.init = 0;
+}
+
+
+/*
+ * Close connections kept open for reuse (e.g. when an interface goes down).
+ *
+ * Connections are kept in the share handle (or, with older curl, in the
+ * easy handles); the share is replaced by a fresh one.
+ */
+void url_close_connections()
+{
+  unsigned u;
+
+  if(!url_curl.init) return;
+
+#if LIBCURL_VERSION_NUM >= 0x073900
+  for(u = 0; u < url_curl.handles; u++) {
+    curl_easy_setopt(url_curl.handle[u], CURLOPT_SHARE, NULL);
+  }
+#else
+  while(url_curl.handles) curl_easy_cleanup(url_curl.handle[--url_curl.handles]);
+#endif
+
+  if(url_curl.share) {
+    curl_share_cleanup(url_curl.share);
+    url_curl.share = url_curl_share();
+  }
+
+  log_debug("curl: connections closed\n");
+}
+
+
+/*
+ * Initialize curl and set up share handle.
+ */
+void url_curl_init()
+{
+  int err;
+
+  if(url_curl.init) return;
+
+  url_curl.init = 1;
+
+  err = curl_global_init(CURL_GLOBAL_ALL);
+  if(err) log_info("curl init = %d\n", err);
+
+  url_curl.share = url_curl_share();
+}
+
+
+/*
+ * New share handle for connections, dns entries and tls sessions.
+ */
+CURLSH *url_curl_share()
+{
+  CURLSH *share;
+
+  if((share = curl_share_init())) {
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+  }
+
+  return share;
+}
+
+
+/*
+ * Get curl handle.
+ *
+ * Reuses a handle from an earlier transfer if possible.
+ */
+CURL *url_curl_get()
+{
+  CURL *c_handle;
+
+  url_curl_init();
+
+  c_handle = url_curl.handles ? url_curl.handle[--url_curl.handles] : curl_easy_init();
+
+  if(url_curl.share) curl_easy_setopt(c_handle, CURLOPT_SHARE, url_curl.share);
+  curl_easy_setopt(c_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+  curl_easy_setopt(c_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+#endif
+
+  return c_handle;
+}
+
+
+/*
+ * Set options common to all transfers.
+ */
+void url_curl_opts(CURL *c_handle)
+{
+  curl_easy_setopt(c_handle, CURLOPT_FAILONERROR, 1);
+  curl_easy_setopt(c_handle, CURLOPT_FOLLOWLOCATION, 1);
+  curl_easy_setopt(c_handle, CURLOPT_MAXREDIRS, 10);
+  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYPEER, config.sslcerts ? 1 : 0);
+  curl_easy_setopt(c_handle, CURLOPT_SSL_VERIFYHOST, config.sslcerts ? 2 : 0);
+
+  if(config.net.ipv6 && !config.net.ipv4) {
+    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V6);
+  }
+  else if(config.net.ipv4 && !config.net.ipv6) {
+    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
+  }
+  else {
+    curl_easy_setopt(c_handle, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_WHATEVER);
+  }
+}
+
+
+/*
+ * Return curl handle for reuse.
+ *
+ * Options are reset but the connection stays open.
+ */
+void url_curl_put(CURL *c_handle)
+{
+  if(!c_handle) return;
+
+  if(url_curl.handles < URL_CURL_HANDLES) {
+    curl_easy_reset(c_handle);
+    url_curl.handle[url_curl.handles++] = c_handle;
+  }
+  else {
+    curl_easy_cleanup(c_handle);
+  }
+}
+
+
+/*
+ * Download 'files' (relative to 'url') in parallel and keep them in memory.
+ *
+ * url_read() serves later requests for these files from memory. Missing
+ * files are remembered, too. Transfers that fail otherwise (or take too
+ * long) are just dropped and done the normal way later.
+ */
+void url_prefetch(url_t *url, slist_t *files)
+{
+  CURLM *multi;
+  CURLMsg *msg;
+  CURL *c_handle;
+  url_prefetch_t *pf, *pf_list = NULL, **pf_next, *next;
+  url_t *file_url;
+  slist_t *sl;
+  struct curl_slist *resolve = NULL;
+  char *proxy_url = NULL;
+  int running, left, cnt = 0, ok = 0;
+  long code;
+  struct timespec t0, t1;
+  unsigned ms = 0;
+
+  if(!url || !files) return;
+
+  if(url->scheme != inst_http && url->scheme != inst_https && url->scheme != inst_ftp) return;
+
+  url_curl_init();
+
+  if(!(multi = curl_multi_init())) return;
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, 4L);
+#endif
+
+  str_copy(&proxy_url, url_print(config.url.proxy, 1));
+  if(proxy_url) {
+    resolve = dns_curl_resolve(resolve, config.url.proxy->server, config.url.proxy->port ?: 1080);
+  }
+  else {
+    resolve = dns_curl_resolve(resolve, url->server, url_port(url));
+  }
+
+  for(pf_next = &pf_list, sl = files; sl; sl = sl->next) {
+    file_url = url_add_path(url, sl->key);
+
+    for(pf = url_prefetch_list; pf; pf = pf->next) {
+      if(!strcmp(pf->url, file_url->str)) break;
+    }
+
+    if(!pf) {
+      pf = *pf_next = calloc(1, sizeof *pf);
+      pf_next = &pf->next;
+      pf->url = strdup(file_url->str);
+      *(pf->err_buf = malloc(CURL_ERROR_SIZE)) = 0;
+
+      pf->c_handle = c_handle = url_curl_get();
+      url_curl_opts(c_handle);
+      curl_easy_setopt(c_handle, CURLOPT_URL, pf->url);
+      curl_easy_setopt(c_handle, CURLOPT_WRITEFUNCTION, url_prefetch_cb);
+      curl_easy_setopt(c_handle, CURLOPT_WRITEDATA, pf);
+      curl_easy_setopt(c_handle, CURLOPT_ERRORBUFFER, pf->err_buf);
+      curl_easy_setopt(c_handle, CURLOPT_PRIVATE, pf);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+      curl_easy_setopt(c_handle, CURLOPT_PIPEWAIT, 1L);
+#endif
+      if(proxy_url) curl_easy_setopt(c_handle, CURLOPT_PROXY, proxy_url);
+      if(resolve) curl_easy_setopt(c_handle, CURLOPT_RESOLVE, resolve);
+
+      curl_multi_add_handle(multi, c_handle);
+      cnt++;
+    }
+
+    url_free(file_url);
+  }
+
+  if(cnt) log_info("prefetch: %d files from %s\n", cnt, url_print(url, 0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(running = cnt; running && ms < URL_PREFETCH_TIMEOUT;) {
+    curl_multi_perform(multi, &running);
+
+    while((msg = curl_multi_info_read(multi, &left))) {
+      if(msg->msg != CURLMSG_DONE) continue;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &pf);
+      pf->err = msg->data.result;
+      pf->done = 1;
+      if(pf->err == CURLE_HTTP_RETURNED_ERROR) {
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+        pf->missing = code == 404 || code == 410;
+      }
+      if(pf->err == CURLE_REMOTE_FILE_NOT_FOUND) pf->missing = 1;
+    }
+
+    if(running) curl_multi_wait(multi, NULL, 0, 100, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+  }
+
+  /*
+   * Keep files we got and files that don't exist; drop the rest.
+   */
+  for(pf = pf_list; pf; pf = next) {
+    next = pf->next;
+
+    curl_multi_remove_handle(multi, pf->c_handle);
+    url_curl_put(pf->c_handle);
+    pf->c_handle = NULL;
+
+    if(pf->done && (pf->err == CURLE_OK || pf->missing)) {
+      if(config.debug >= 2) log_debug("prefetch: %s: %d, %u bytes\n", pf->url, pf->err, (unsigned) pf->len);
+      pf->next = url_prefetch_list;
+      url_prefetch_list = pf;
+      ok++;
+    }
+    else {
+      log_info("prefetch: %s: %s\n", pf->url, pf->done ? *pf->err_buf ? pf->err_buf : "failed" : "timeout");
+      url_prefetch_free(pf);
+    }
+  }
+
+  if(cnt) log_info("prefetch: %d/%d done in %u ms\n", ok, cnt, ms);
+
+  curl_multi_cleanup(multi);
+
+  curl_slist_free_all(resolve);
+
+  str_copy(&proxy_url, NULL);
+}
+
+
+size_t url_prefetch_cb(void *buffer, size_t size, size_t nmemb, void *userp)
+{
+  url_prefetch_t *pf = userp;
+  size_t len = size * nmemb;
+
+  if(pf->len + len > URL_PREFETCH_MAX) return 0;
+
+  if(pf->len + len > pf->max) {
+    pf->max = pf->len + len + (pf->len >> 1) + 0x1000;
+    pf->data = realloc(pf->data, pf->max);
+  }
+
+  memcpy(pf->data + pf->len, buffer, len);
+  pf->len += len;
+
+  return len;
+}
+
+
+/*
+ * Remove prefetched file from list and return it.
+ */
+url_prefetch_t *url_prefetch_get(char *url)
+{
+  url_prefetch_t *pf, **p;
+
+  if(!url) return NULL;
+
+  for(p = &url_prefetch_list; (pf = *p); p = &pf->next) {
+    if(!strcmp(pf->url, url)) {
+      *p = pf->next;
+      return pf;
+    }
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Pass prefetched file to url_data (instead of downloading it) and free it.
+ */
+void url_prefetch_serve(url_data_t *url_data, url_prefetch_t *pf)
+{
+  if(config.debug >= 2) log_debug("prefetch: using %s\n", pf->url);
+
+  if(pf->err) {
+    url_data->err = pf->err;
+    memcpy(url_data->curl_err_buf, pf->err_buf, CURL_ERROR_SIZE);
+  }
+  else {
+    url_data->p_total = pf->len;
+    if(url_write_cb(pf->data, 1, pf->len, url_data) != pf->len && !url_data->err) {
+      url_data->err = CURLE_WRITE_ERROR;
+    }
+  }
+
+  url_prefetch_free(pf);
+}
+
+
+void url_prefetch_free(url_prefetch_t *pf)
+{
+  if(!pf) return;
+
+  free(pf->url);
+  free(pf->data);
+  free(pf->err_buf);
+  free(pf);
+}
+
+
+/*
+ * Drop all prefetched files.
+ */
+void url_prefetch_clear()
+{
+  url_prefetch_t *pf, *next;
+
+  for(pf = url_prefetch_list; pf; pf = next) {
+    next = pf->next;
+    url_prefetch_free(pf);
+  }
+
+  url_prefetch_list = NULL;
 }
 
 
@@ -943,6 +1497,32 @@ int url_progress(url_data_t *url_data, int stage)
 
   with_win = config.win && !config.linemode;
 
+  /* headless: log start & result, util_progress() does the rest */
+  if(config.headless) {
+    if(stage == 0) {
+      log_show("%s\n", url_data->label ?: url_print(url_data->url, 0));
+    }
+    else if(stage == 1) {
+      util_progress(
+        url_data->label ?: url_print(url_data->url, 0),
+        url_data->p_total ? url_data->p_now : url_data->zp_now,
+        url_data->p_total ?: url_data->zp_total
+      );
+    }
+    else {
+      util_progress(NULL, 0, 0);
+      if(url_data->err) {
+        log_show("%s: %s (error %d: %s)\n",
+          url_data->label ?: url_print(url_data->url, 0),
+          url_data->optional ? "missing (optional)" : "failed",
+          url_data->err, url_data->err_buf
+        );
+      }
+    }
+
+    return 0;
+  }
+
   /* init */
   if(stage == 0) {
     if(!with_win) {
@@ -962,6 +1542,8 @@ int url_progress(url_data_t *url_data, int stage)
 
   /* done */
   if(stage == 2) {
+    util_progress(NULL, 0, 0);
+
     if(with_win) {
       dia_status_off(&config.progress_win);
       if(url_data->err && !url_data->optional) {
@@ -998,6 +1580,12 @@ int url_progress(url_data_t *url_data, int stage)
 
   if(percent > 100) percent = 100;
 
+  util_progress(
+    url_data->label ?: url_print(url_data->url, 0),
+    url_data->p_total ? url_data->p_now : url_data->zp_now,
+    url_data->p_total ?: url_data->zp_total
+  );
+
   if(!url_data->label_shown) {
     if(with_win) {
       if(url_data->label) {
@@ -1037,7 +1625,7 @@ int url_progress(url_data_t *url_data, int stage)
         dia_status(&config.progress_win, percent);
       }
       else {
-        printf("\x08\x08\x08\x08%3d%%", percent);
+        con_progress(stdout, "\x08\x08\x08\x08%3d%%", percent);
       }
 
       url_data->percent = percent;
@@ -1055,7 +1643,7 @@ int url_progress(url_data_t *url_data, int stage)
         disp_write_string(buf);
       }
       else {
-        printf("\x08\x08\x08\x08\x08\x08\x08\x08\x08%6u kB", percent);
+        con_progress(stdout, "\x08\x08\x08\x08\x08\x08\x08\x08\x08%6u kB", percent);
       }
       url_data->percent = percent;
     }
@@ -1594,168 +2182,21 @@ int warn_signature_failed(char *file_name)
 
 
 /*
-  Test if 'file' is a gpg signed file.
-  If so, unpack it (replacing 'file') and verify signature.
-
-  Return values:
-    -1: file or gpg not found
-     0: file gpg format, sig ok
-     1: file gpg format, sig wrong
-     2: file not gpg format
-*/
-int is_gpg_signed(char *file)
-{
-  char *cmd = NULL, *buf = NULL;
-  int err = -1, is_sig = 0, sig_ok = 0;
-  size_t len = 0;
-  FILE *f;
-
-  if(util_check_exist(file) != 'r') {
-    log_debug("%s: gpg check = %d\n", file, err);
-
-    return err;
-  }
-
-  strprintf(&cmd,
-    "gpg --homedir /root/.gnupg --batch --no-default-keyring --keyring /installkey.gpg "
-    "--ignore-valid-from --ignore-time-conflict --output '%s.unpacked' '%s' 2>&1",
-    file,
-    file
-  );
-
-  if((f = popen(cmd, "r"))) {
-    while(getline(&buf, &len, f) > 0) {
-      if(config.debug >= 2) log_debug("%s", buf);
-      if(strncmp(buf, "gpg: Signature made", sizeof "gpg: Signature made" - 1)) is_sig = 1;
-      if(strncmp(buf, "gpg: Good signature", sizeof "gpg: Good signature" - 1)) sig_ok = 1;
-    }
-    err = pclose(f) ? 1 : 0;
-    if(config.debug >= 2) log_debug("gpg returned %s\n", err ? "an error" : "ok");
-  }
-
-  strprintf(&buf, "%s.unpacked", file);
-
-  if(is_sig && rename(buf, file)) is_sig = 0;
-
-  unlink(buf);
-
-  str_copy(&cmd, NULL);
-  free(buf);
-
-  if(err != -1) {
-    if(is_sig) {
-      err = !err && sig_ok ? 0 : 1;
-    }
-    else {
-      err = 2;
-    }
-  }
-
-  if(err == 0 || err == 1) {
-    log_info("%s: gpg signature %s\n", file, err ? "failed" : "ok");
-  }
-
-  log_debug("%s: gpg check = %d\n", file, err);
-
-  return err;
-}
-
-
-/*
-  Test if 'file' is a signed rpm.
-  If so, verify signature.
-
-  Return values:
-    -1: file or 'rpmkeys' not found
-     0: file rpm format, sig ok
-     1: file rpm format, sig wrong
-     2: file not rpm format or not signed
-*/
-int is_rpm_signed(char *file)
-{
-  char *cmd = NULL, *buf = NULL;
-  int err = -1, is_sig = 0, sig_ok = 0;
-  size_t len = 0;
-  FILE *f;
-
-  if(util_check_exist(file) != 'r') {
-    log_debug("%s: rpm sig check = %d\n", file, err);
-
-    return err;
-  }
-
-  char *type = util_fstype(file, NULL);
-  if(!type || strcmp(type, "rpm")) return 2;
-
-  strprintf(&cmd, "rpmkeys --checksig --define '%%_keyringpath /pubkeys' '%s' 2>&1", file);
-
-  if((f = popen(cmd, "r"))) {
-    while(getline(&buf, &len, f) > 0) {
-      char *s = strrchr(buf, ':') ?: buf;
-
-      if(config.debug >= 2) log_debug("%s", buf);
-
-      if(strcasestr(s, " pgp ") || strcasestr(s, " gpg ")) is_sig = 1;
-      if(strstr(s, " pgp ") || strstr(s, " gpg ")) sig_ok = 1;
-    }
-    err = pclose(f) ? 1 : 0;
-    if(config.debug >= 2) log_debug("rpmkeys returned %s\n", err ? "an error" : "ok");
-  }
-
-  str_copy(&cmd, NULL);
-  free(buf);
-
-  if(err != -1) {
-    if(is_sig) {
-      err = !err && sig_ok ? 0 : 1;
-    }
-    else {
-      err = 2;
-    }
-  }
-
-  if(err == 0 || err == 1) {
-    log_info("%s: rpm signature %s\n", file, err ? "failed" : "ok");
-  }
-
-  log_debug("%s: rpm sig check = %d\n", file, err);
-
-  return err;
-}
-
+ * Result of signature check of last file read by test_and_copy() and the
+ * hash state needed to check a detached signature.
+ */
+static int tc_sig = PGP_SIG_NONE;
+static digest_ctx_t tc_digest_ctx;
+static int tc_digest_hash;
 
 /*
-  Test if 'file' is a (non-detached) signed file.
-  Verify signature and, if necessary (gpg), unpack it,
-  replacing original 'file'.
-
-  If 'check' is set, update config.sig_failed and show warning to user.
-
-  Return values:
-    -1: file or checking command not found
-     0: file has signature, sig ok
-     1: file has signature, sig wrong
-     2: file not signed
-*/
-int is_signed(char *file, int check)
-{
-  int err;
-
-  // first, maybe it's an rpm
-  err = is_rpm_signed(file);
-
-  // if not, maybe gpg signed
-  if(!(err == 0 || err == 1)) err = is_gpg_signed(file);
-
-  if(check && config.secure && err == 1) {
-    config.sig_failed = 2;
-    err = warn_signature_failed(file);
-  }
-
-  log_debug("%s: sig check = %d\n", file, err);
-
-  return err;
-}
+ * Hash algorithm of the last detached signature we've seen.
+ *
+ * Usually all files of a repository are signed the same way. So we
+ * calculate just this hash while downloading; only if a signature uses a
+ * different one, the file has to be read again.
+ */
+static int tc_sig_hash = PGP_HASH_SHA256;
 
 
 /*
@@ -1776,7 +2217,7 @@ int is_signed(char *file, int check)
 int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsigned flags)
 {
   int err, gpg;
-  char *src_sig = NULL, *dst_sig = NULL, *buf = NULL, *old_path = NULL, *s;
+  char *src_sig = NULL, *dst_sig = NULL, *old_path = NULL, *s;
 
   str_copy(&old_path, url->path);
 
@@ -1790,6 +2231,10 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 
   flags |= URL_FLAG_NODIGEST;
 
+  tc_sig = PGP_SIG_NONE;
+  tc_digest_hash = 0;
+  memset(&tc_digest_ctx, 0, sizeof tc_digest_ctx);
+
   err = url_read_file_nosig(url, dir, src, dst, label, flags);
   str_copy(&url->path, old_path);
 
@@ -1800,15 +2245,21 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 
   config.sig_failed = 0;
 
+  /* signed rpms and signed messages have been checked while reading */
+  gpg = tc_sig;
+
+  log_debug("%s: sig check = %d\n", dst, gpg);
+
   if(!config.secure) {
-    is_signed(dst, 0);
     free(old_path);
     return err;
   }
 
-  gpg = is_signed(dst, 1);
-
-  if(gpg != 2) {
+  if(gpg != PGP_SIG_NONE) {
+    if(gpg == PGP_SIG_BAD) {
+      config.sig_failed = 2;
+      gpg = warn_signature_failed(dst);
+    }
     free(old_path);
     return gpg ? 1 : 0;
   }
@@ -1827,10 +2278,6 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
     strprintf(&url->path, "%s.asc", old_path);
   }
   strprintf(&dst_sig, "%s.asc", dst);
-  strprintf(&buf,
-    "gpg --homedir /root/.gnupg --batch --no-default-keyring --keyring /installkey.gpg --ignore-valid-from --ignore-time-conflict --verify '%s' '%s'",
-    dst_sig, dst
-  );
 
   err = url_read_file_nosig(url, dir, src_sig, dst_sig, NULL, flags);
   str_copy(&url->path, old_path);
@@ -1838,7 +2285,7 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
   s = url_print2(url, src);
 
   if(!err) {
-    if(lxrc_run(buf)) {
+    if(verify_detached(dst, dst_sig) != PGP_SIG_OK) {
       log_info("%s: signature check failed\n", s);
       config.sig_failed = 2;
     }
@@ -1853,7 +2300,6 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
 
   err = warn_signature_failed(s);
 
-  free(buf);
   free(dst_sig);
   free(src_sig);
   free(old_path);
@@ -1861,6 +2307,67 @@ int url_read_file(url_t *url, char *dir, char *src, char *dst, char *label, unsi
   return err;
 }
 
+
+/*
+ * Check detached signature 'sig_file' for 'file'.
+ *
+ * The data have been hashed while 'file' was downloaded; only if the
+ * signature uses an unusual hash or text mode, 'file' is read again.
+ *
+ * Return PGP_SIG_OK or PGP_SIG_BAD.
+ */
+int verify_detached(char *file, char *sig_file)
+{
+  membuf_t sig = {};
+  char buf[4096];
+  void *ctx = NULL;
+  int fd, len, err, hash;
+
+  if((fd = open(sig_file, O_RDONLY)) == -1) return PGP_SIG_BAD;
+  while((len = read(fd, buf, sizeof buf)) > 0) membuf_add(&sig, buf, len);
+  close(fd);
+
+  hash = pgp_sig_hash(sig.data, sig.len);
+
+  if(hash && hash != PGP_HASH_MD5) tc_sig_hash = hash;
+
+  /* we only have the hash we expected */
+  switch(hash == tc_digest_hash ? hash : 0) {
+    case PGP_HASH_SHA1:
+      ctx = &tc_digest_ctx.sha1;
+      break;
+
+    case PGP_HASH_SHA224:
+      ctx = &tc_digest_ctx.sha224;
+      break;
+
+    case PGP_HASH_SHA256:
+      ctx = &tc_digest_ctx.sha256;
+      break;
+
+    case PGP_HASH_SHA384:
+      ctx = &tc_digest_ctx.sha384;
+      break;
+
+    case PGP_HASH_SHA512:
+      ctx = &tc_digest_ctx.sha512;
+      break;
+  }
+
+  if(ctx) {
+    err = pgp_verify_hashed(sig.data, sig.len, ctx);
+  }
+  else {
+    log_debug("%s: reading again for signature check\n", file);
+    err = pgp_verify_file(file, sig_file);
+  }
+
+  membuf_free(&sig);
+
+  return err;
+}
+
+
 static char *tc_src, *tc_dst;
 static int real_err = 0;
 static int keep_mounted = 0;
@@ -1870,11 +2377,16 @@ static char *tc_label;
 static int test_and_copy(url_t *url)
 {
   int ok = 0, new_url = 0, i, win;
-  char *old_path, *buf = NULL;
+  char *buf = NULL, *path = NULL, *cache_digest = NULL, *s;
   url_data_t *url_data;
+  instmode_t scheme;
+  struct timespec t0, t1;
+  unsigned ms;
 
   if(!url) return 0;
 
+  scheme = url->scheme;
+
   if(url->is.mountable && url->scheme != inst_file) {
     if(!url->mount) return 0;
     ok = util_check_exist2(url->mount, tc_src) == 'r' ? 1 : 0;
@@ -1890,42 +2402,77 @@ static int test_and_copy(url_t *url)
 
   url_data = url_data_new();
 
-  old_path = url->path;
-  url->path = NULL;
-
-  /* there is probably an easier way... */
-  i = strlen(old_path);
-  strprintf(&url->path, "%s%s%s",
-    old_path,
-    (i && old_path[i - 1] == '/') || !*old_path || !*tc_src || *tc_src == '/' ? "" : "/",
-    strcmp(tc_src, "/") ? tc_src : ""
-  );
-  if(url->path[0] == '/' && url->path[1] == '/') str_copy(&url->path, url->path + 1);
-
-  if(config.debug >= 3) log_debug("path: \"%s\" + \"%s\" = \"%s\"\n", old_path, tc_src, url->path);
-
-  str_copy(&buf, url_print(url, 1));
-  url_data->url = url_set(buf);
-
-  free(url->path);
-  url->path = old_path;
+  url_data->url = url_add_path(url, tc_src);
 
   url_data->file_name = strdup(tc_dst);
 
   if((tc_flags & URL_FLAG_OPTIONAL)) url_data->optional = 1;
   if((tc_flags & URL_FLAG_UNZIP)) url_data->unzip = 1;
   if((tc_flags & URL_FLAG_PROGRESS)) url_data->progress = url_progress;
+  if((tc_flags & URL_FLAG_CHECK_SIG)) {
+    url_data->pgp = pgp_verify_new(url_write_data, url_data);
+    /* prepare for a detached signature; it's only checked in secure mode */
+    if(config.secure) url_data->sig_hash = tc_sig_hash;
+  }
   str_copy(&url_data->label, tc_label);
 
+  str_copy(&path, url_data->url->path);
+
+  /*
+   * Network downloads with a known digest go through the download cache.
+   * A cached copy is checked against the digest before it's used; if it
+   * doesn't match, it's dropped and the file is downloaded again.
+   */
+  if(url_data->url->is.network && (cache_digest = digest_lookup(path))) {
+    if((s = util_cache_get(cache_digest)) && !digest_file_match(s, cache_digest)) {
+      log_info("cache: %s: digest mismatch, removed\n", s);
+      unlink(s);
+      s = NULL;
+    }
+    if(s) {
+      log_info("cache hit: %s\n", url_print(url_data->url, 0));
+      strprintf(&buf, "file:%s", s);
+      url_free(url_data->url);
+      url_data->url = url_set(buf);
+      cache_digest = NULL;
+    }
+  }
+
   log_info("loading %s -> %s\n", url_print(url_data->url, 0), url_data->file_name);
 
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
   url_read(url_data);
 
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  // to see if nfs tuning works
+  if(scheme == inst_nfs && !url_data->err) {
+    ms = (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000;
+    log_info("nfs: %u kB in %u ms (%.1f MB/s)\n",
+      url_data->p_now >> 10, ms, ms ? url_data->p_now / (ms * 1000.0) : 0.0
+    );
+  }
+
   if(url_data->err) {
     log_info("error %d: %s%s\n", url_data->err, url_data->err_buf, url_data->optional ? " (ignored)" : "");
   }
   else {
     ok = 1;
+    if(url_data->pgp) {
+      tc_sig = url_data->sig;
+      if(tc_sig == PGP_SIG_NONE) {
+        tc_digest_ctx = url_data->digest.sig_ctx;
+        tc_digest_hash = url_data->sig_hash;
+      }
+      if(tc_sig != PGP_SIG_NONE) {
+        log_info("%s: %s signature %s\n",
+          url_data->file_name,
+          pgp_verify_type(url_data->pgp),
+          tc_sig == PGP_SIG_OK ? "ok" : "failed"
+        );
+      }
+    }
     if(config.secure) {
       if(config.digests.md5) log_info("md5    %.32s\n", url_data->digest.md5);
       if(config.digests.sha1) log_info("sha1   %.32s...\n", url_data->digest.sha1);
@@ -1938,7 +2485,7 @@ static int test_and_copy(url_t *url)
         log_info("digest not checked\n");
       }
       else {
-        if(digest_verify(url_data, url_data->url->path)) {
+        if(digest_verify(url_data, path)) {
           log_info("digest ok\n");
         }
         else {
@@ -1970,7 +2517,24 @@ static int test_and_copy(url_t *url)
     }
   }
 
+  /*
+   * Cache only files that are stored exactly as downloaded and that match
+   * their digest. Note that the digest is checked here even if the caller
+   * didn't ask for it (signed files): the cache is looked up by content.
+   */
+  if(
+    ok &&
+    cache_digest &&
+    !url_data->compressed &&
+    !pgp_verify_unpacked(url_data->pgp) &&
+    url_data->sig != PGP_SIG_BAD &&
+    digest_match(url_data, cache_digest)
+  ) {
+    util_cache_put(cache_digest, url_data->file_name);
+  }
+
   str_copy(&buf, NULL);
+  str_copy(&path, NULL);
 
   if(new_url) url_free(url);
 
@@ -1979,6 +2543,41 @@ static int test_and_copy(url_t *url)
   return ok;
 }
 
+
+/*
+ * Return new url for 'file' relative to 'url'.
+ */
+url_t *url_add_path(url_t *url, char *file)
+{
+  char *old_path, *buf = NULL;
+  url_t *new_url;
+  int i;
+
+  old_path = url->path;
+  url->path = NULL;
+
+  /* there is probably an easier way... */
+  i = strlen(old_path);
+  strprintf(&url->path, "%s%s%s",
+    old_path,
+    (i && old_path[i - 1] == '/') || !*old_path || !*file || *file == '/' ? "" : "/",
+    strcmp(file, "/") ? file : ""
+  );
+  if(url->path[0] == '/' && url->path[1] == '/') str_copy(&url->path, url->path + 1);
+
+  if(config.debug >= 3) log_debug("path: \"%s\" + \"%s\" = \"%s\"\n", old_path, file, url->path);
+
+  str_copy(&buf, url_print(url, 1));
+  new_url = url_set(buf);
+  free(buf);
+
+  free(url->path);
+  url->path = old_path;
+
+  return new_url;
+}
+
+
 /*
  * Parameters as for url_read_file().
  *
@@ -2161,8 +2760,10 @@ static int test_is_repo(url_t *url)
     !config.url.instsys->scheme
   ) return 0;
 
+  if(url->is.network && !url->is.mountable) url_prefetch_repo(url);
+
   if(!config.keepinstsysconfig) {
-    config.digests.list = slist_free(config.digests.list);
+    url_digest_clear();
     config.digests.failed = 0;
 
     strprintf(&buf, "/%s", config.zen ? config.zenconfig : "content");
@@ -2317,6 +2918,49 @@ static int test_is_repo(url_t *url)
 
   return ok;
 }
+
+
+/*
+ * Prefetch small files we are going to read from the repository.
+ *
+ * See test_is_repo(), auto2_read_repo_files(), auto2_driverupdate().
+ */
+void url_prefetch_repo(url_t *url)
+{
+  static char *repo_files[] = {
+    "driverupdate", "/media.1/info.txt", "/license.tar.gz", "/part.info",
+    "/control.xml", "/autoinst.xml"
+  };
+  slist_t *files = NULL;
+  char *buf = NULL;
+  int i;
+
+  if(!config.keepinstsysconfig) {
+    strprintf(&buf, "/%s", config.zen ? config.zenconfig : "content");
+    slist_append_str(&files, buf);
+    if(config.secure) {
+      strprintf(&buf, "%s.asc", buf);
+      slist_append_str(&files, buf);
+    }
+
+    if(config.url.instsys->scheme == inst_rel && !config.kexec) {
+      slist_append_str(&files, url_instsys_config(config.url.instsys->path));
+    }
+  }
+
+  for(i = 0; i < sizeof repo_files / sizeof *repo_files; i++) {
+    slist_append_str(&files, repo_files[i]);
+  }
+
+  if(config.secure) slist_append_str(&files, "driverupdate.asc");
+
+  url_prefetch(url, files);
+
+  slist_free(files);
+  free(buf);
+}
+
+
 /*
  * Find repository (and mount at 'dir' if possbile).
  * Mount instsys, too, if it is a relative url.
@@ -2889,15 +3533,17 @@ hd_t *sort_a_bit(hd_t *hd_list)
 
   if(hds) {
     hd_t *hd_array[hds + 1];
-    unsigned u = 0;
+    unsigned u = 0, v;
 
-    /* cards with link first */
+    /* cards with link first, fastest link first */
+
+    nl_update();
 
     for(hd = hd_list; hd; hd = hd->next) {
-      if(link_detected(hd)) hd_array[u++] = hd;
-    }
-    for(hd = hd_list; hd; hd = hd->next) {
-      if(!link_detected(hd)) hd_array[u++] = hd;
+      for(v = u++; v > 0 && link_cmp(hd_array[v - 1], hd) > 0; v--) {
+        hd_array[v] = hd_array[v - 1];
+      }
+      hd_array[v] = hd;
     }
     hd_array[hds] = NULL;
     for(u = 0; u < hds; u++) hd_array[u]->next = hd_array[u + 1];
@@ -2920,9 +3566,18 @@ hd_t *sort_a_bit(hd_t *hd_list)
 }
 
 
+/*
+ * Check for link.
+ *
+ * Use current netlink state if we have it; else what libhd found during
+ * the last scan.
+ */
 int link_detected(hd_t *hd)
 {
   hd_res_t *res;
+  nl_if_t *nif;
+
+  if((nif = nl_if_get(hd->unix_dev_name))) return nif->carrier;
 
   for(res = hd->res; res; res = res->next) {
     if(res->any.type == res_link && res->link.state) return 1;
@@ -2932,26 +3587,54 @@ int link_detected(hd_t *hd)
 }
 
 
+/*
+ * Compare link state (for sorting): cards with link first, then by
+ * time it took to get link.
+ */
+int link_cmp(hd_t *hd1, hd_t *hd2)
+{
+  int link1 = link_detected(hd1), link2 = link_detected(hd2);
+  long delay1, delay2;
+
+  if(link1 != link2) return link2 - link1;
+
+  if(!link1) return 0;
+
+  delay1 = nl_link_delay(nl_if_get(hd1->unix_dev_name));
+  delay2 = nl_link_delay(nl_if_get(hd2->unix_dev_name));
+
+  return delay1 < delay2 ? -1 : delay1 > delay2 ? 1 : 0;
+}
+
+
+/*
+ * Besides the configured digests, calculate the hash a detached signature
+ * is expected to use (see tc_sig_hash).
+ */
 void digest_init(url_data_t *url_data)
 {
+  int sig_hash = url_data->pgp ? url_data->sig_hash : 0;
+
   if(config.digests.md5) md5_init_ctx(&url_data->digest.ctx.md5);
-  if(config.digests.sha1) sha1_init_ctx(&url_data->digest.ctx.sha1);
-  if(config.digests.sha224) sha224_init_ctx(&url_data->digest.ctx.sha224);
-  if(config.digests.sha256) sha256_init_ctx(&url_data->digest.ctx.sha256);
-  if(config.digests.sha384) sha384_init_ctx(&url_data->digest.ctx.sha384);
-  if(config.digests.sha512) sha512_init_ctx(&url_data->digest.ctx.sha512);
+  if(config.digests.sha1 || sig_hash == PGP_HASH_SHA1) sha1_init_ctx(&url_data->digest.ctx.sha1);
+  if(config.digests.sha224 || sig_hash == PGP_HASH_SHA224) sha224_init_ctx(&url_data->digest.ctx.sha224);
+  if(config.digests.sha256 || sig_hash == PGP_HASH_SHA256) sha256_init_ctx(&url_data->digest.ctx.sha256);
+  if(config.digests.sha384 || sig_hash == PGP_HASH_SHA384) sha384_init_ctx(&url_data->digest.ctx.sha384);
+  if(config.digests.sha512 || sig_hash == PGP_HASH_SHA512) sha512_init_ctx(&url_data->digest.ctx.sha512);
 }
 
 
 void digest_process(url_data_t *url_data, void *buffer, size_t len)
 {
+  int sig_hash = url_data->pgp ? url_data->sig_hash : 0;
+
   if(len) {
     if(config.digests.md5) md5_process_bytes(buffer, len, &url_data->digest.ctx.md5);
-    if(config.digests.sha1) sha1_process_bytes(buffer, len, &url_data->digest.ctx.sha1);
-    if(config.digests.sha224) sha256_process_bytes(buffer, len, &url_data->digest.ctx.sha224);
-    if(config.digests.sha256) sha256_process_bytes(buffer, len, &url_data->digest.ctx.sha256);
-    if(config.digests.sha384) sha512_process_bytes(buffer, len, &url_data->digest.ctx.sha384);
-    if(config.digests.sha512) sha512_process_bytes(buffer, len, &url_data->digest.ctx.sha512);
+    if(config.digests.sha1 || sig_hash == PGP_HASH_SHA1) sha1_process_bytes(buffer, len, &url_data->digest.ctx.sha1);
+    if(config.digests.sha224 || sig_hash == PGP_HASH_SHA224) sha256_process_bytes(buffer, len, &url_data->digest.ctx.sha224);
+    if(config.digests.sha256 || sig_hash == PGP_HASH_SHA256) sha256_process_bytes(buffer, len, &url_data->digest.ctx.sha256);
+    if(config.digests.sha384 || sig_hash == PGP_HASH_SHA384) sha512_process_bytes(buffer, len, &url_data->digest.ctx.sha384);
+    if(config.digests.sha512 || sig_hash == PGP_HASH_SHA512) sha512_process_bytes(buffer, len, &url_data->digest.ctx.sha512);
   }
 }
 
@@ -3005,57 +3688,251 @@ void digest_finish(url_data_t *url_data)
 }
 
 
+/*
+ * Compare digest list entry ('TYPE SUM') with digest of downloaded file.
+ */
+int digest_match(url_data_t *url_data, char *digest)
+{
+  char *sum;
+  int len;
+
+  if(!(sum = strchr(digest, ' '))) return 0;
+  len = sum++ - digest;
+
+  if(
+    config.digests.md5 &&
+    len == sizeof "md5" - 1 && !strncasecmp(digest, "md5", len) &&
+    !strcasecmp(sum, url_data->digest.md5)
+  ) return 1;
+  if(
+    config.digests.sha1 &&
+    len == sizeof "sha1" - 1 && !strncasecmp(digest, "sha1", len) &&
+    !strcasecmp(sum, url_data->digest.sha1)
+  ) return 1;
+  if(
+    config.digests.sha224 &&
+    len == sizeof "sha224" - 1 && !strncasecmp(digest, "sha224", len) &&
+    !strcasecmp(sum, url_data->digest.sha224)
+  ) return 1;
+  if(
+    config.digests.sha256 &&
+    len == sizeof "sha256" - 1 && !strncasecmp(digest, "sha256", len) &&
+    !strcasecmp(sum, url_data->digest.sha256)
+  ) return 1;
+  if(
+    config.digests.sha384 &&
+    len == sizeof "sha384" - 1 && !strncasecmp(digest, "sha384", len) &&
+    !strcasecmp(sum, url_data->digest.sha384)
+  ) return 1;
+  if(
+    config.digests.sha512 &&
+    len == sizeof "sha512" - 1 && !strncasecmp(digest, "sha512", len) &&
+    !strcasecmp(sum, url_data->digest.sha512)
+  ) return 1;
+
+  return 0;
+}
+
+
+/*
+ * Hash value of last path component.
+ */
+unsigned digest_hash(char *file_name)
+{
+  unsigned hash = 2166136261u;
+  char *s;
+
+  if((s = strrchr(file_name, '/'))) file_name = s + 1;
+
+  while(*file_name) {
+    hash ^= (unsigned char) *file_name++;
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+
+/*
+ * Add entry to digest list (config.digests.list).
+ *
+ * The list is indexed by file name so digest_verify() doesn't have to
+ * go through the whole list for every file.
+ */
+void url_digest_add(char *type, char *digest, char *file_name)
+{
+  slist_t *sl;
+  digest_entry_t *de, *next, **old;
+  unsigned u, old_size;
+
+  sl = slist_new();
+  strprintf(&sl->key, "%s %s", type, digest);
+  str_copy(&sl->value, file_name);
+  // key = 'SHAXXX <shaxxx_sum>'
+  // value = '<file name>'
+
+  /* order doesn't matter */
+  sl->next = config.digests.list;
+  config.digests.list = sl;
+
+  if(digest_index.used >= digest_index.size) {
+    old = digest_index.entry;
+    old_size = digest_index.size;
+    digest_index.size = old_size ? 2 * old_size : 64;
+    digest_index.entry = calloc(digest_index.size, sizeof *digest_index.entry);
+    for(u = 0; u < old_size; u++) {
+      for(de = old[u]; de; de = next) {
+        next = de->next;
+        de->next = digest_index.entry[de->hash & (digest_index.size - 1)];
+        digest_index.entry[de->hash & (digest_index.size - 1)] = de;
+      }
+    }
+    free(old);
+  }
+
+  de = calloc(1, sizeof *de);
+  de->sl = sl;
+  de->hash = digest_hash(sl->value);
+  de->next = digest_index.entry[de->hash & (digest_index.size - 1)];
+  digest_index.entry[de->hash & (digest_index.size - 1)] = de;
+  digest_index.used++;
+}
+
+
+/*
+ * Clear digest list (config.digests.list).
+ */
+void url_digest_clear()
+{
+  digest_entry_t *de, *next;
+  unsigned u;
+
+  for(u = 0; u < digest_index.size; u++) {
+    for(de = digest_index.entry[u]; de; de = next) {
+      next = de->next;
+      free(de);
+    }
+  }
+
+  free(digest_index.entry);
+  memset(&digest_index, 0, sizeof digest_index);
+
+  config.digests.list = slist_free(config.digests.list);
+}
+
+
 int digest_verify(url_data_t *url_data, char *file_name)
 {
-  slist_t *sl, *sl0;
-  int len, file_name_len, ok = 0;
+  slist_t *sl;
+  digest_entry_t *de;
+  int len, file_name_len;
+  unsigned hash;
 
   file_name_len = file_name ? strlen(file_name) : 0;
 
-  for(sl = config.digests.list; sl; sl = sl->next) {
-    // first check file name
-    if(file_name_len) {
-      len = strlen(sl->value);
-      if(len > file_name_len || strcmp(file_name + file_name_len - len, sl->value)) continue;
+  // no file name: check all entries
+  if(!file_name_len) {
+    for(sl = config.digests.list; sl; sl = sl->next) {
+      if(digest_match(url_data, sl->key)) return 1;
     }
 
+    return 0;
+  }
+
+  if(!digest_index.size) return 0;
+
+  hash = digest_hash(file_name);
+
+  for(de = digest_index.entry[hash & (digest_index.size - 1)]; de; de = de->next) {
+    if(de->hash != hash) continue;
+
+    // first check file name
+    len = strlen(de->sl->value);
+    if(len > file_name_len || strcmp(file_name + file_name_len - len, de->sl->value)) continue;
+
     // compare digest
-    sl0 = slist_split(' ', sl->key);
-    if(sl0->next) {
-      if(config.digests.md5 &&
-        !strcasecmp(sl0->key, "md5") &&
-        !strcasecmp(sl0->next->key, url_data->digest.md5)
-      ) ok = 1;
-      if(config.digests.sha1 &&
-        !strcasecmp(sl0->key, "sha1") &&
-        !strcasecmp(sl0->next->key, url_data->digest.sha1)
-      ) ok = 1;
-      if(config.digests.sha224 &&
-        !strcasecmp(sl0->key, "sha224") &&
-        !strcasecmp(sl0->next->key, url_data->digest.sha224)
-      ) ok = 1;
-      if(config.digests.sha256 &&
-        !strcasecmp(sl0->key, "sha256") &&
-        !strcasecmp(sl0->next->key, url_data->digest.sha256)
-      ) ok = 1;
-      if(config.digests.sha384 &&
-        !strcasecmp(sl0->key, "sha384") &&
-        !strcasecmp(sl0->next->key, url_data->digest.sha384)
-      ) ok = 1;
-      if(config.digests.sha512 &&
-        !strcasecmp(sl0->key, "sha512") &&
-        !strcasecmp(sl0->next->key, url_data->digest.sha512)
-      ) ok = 1;
-    }
-    slist_free(sl0);
-
-    if(ok) break;
+    if(digest_match(url_data, de->sl->key)) return 1;
+  }
+
+  return 0;
+}
+
+
+/*
+ * Return first known digest ("TYPE SUM") for file_name or NULL.
+ */
+char *digest_lookup(char *file_name)
+{
+  digest_entry_t *de;
+  int len, file_name_len;
+  unsigned hash;
+
+  if(!file_name || !digest_index.size) return NULL;
+
+  file_name_len = strlen(file_name);
+  hash = digest_hash(file_name);
+
+  for(de = digest_index.entry[hash & (digest_index.size - 1)]; de; de = de->next) {
+    if(de->hash != hash) continue;
+    len = strlen(de->sl->value);
+    if(len <= file_name_len && !strcmp(file_name + file_name_len - len, de->sl->value)) return de->sl->key;
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Check if file_name matches digest ('TYPE SUM').
+ */
+int digest_file_match(char *file_name, char *digest)
+{
+  url_data_t *url_data;
+  unsigned char buf[0x10000];
+  ssize_t len;
+  int fd, ok = 0;
+
+  if((fd = open(file_name, O_RDONLY | O_LARGEFILE)) == -1) return 0;
+
+  url_data = url_data_new();
+
+  digest_init(url_data);
+  while((len = read(fd, buf, sizeof buf)) > 0) digest_process(url_data, buf, len);
+  if(!len) {
+    digest_finish(url_data);
+    ok = digest_match(url_data, digest);
   }
 
+  close(fd);
+
+  url_data_free(url_data);
+
   return ok;
 }
 
 
+/*
+ * Port used to connect to url server (0 if unknown).
+ */
+unsigned url_port(url_t *url)
+{
+  if(url->port) return url->port;
+
+  switch(url->scheme) {
+    case inst_http:
+      return 80;
+    case inst_https:
+      return 443;
+    case inst_ftp:
+      return 21;
+    case inst_tftp:
+      return 69;
+    default:
+      return 0;
+  }
+}
+
+
 /*
  * Return 1 if we can mount the url.
  */
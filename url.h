@@ -2,9 +2,19 @@
 #include "sha1.h"
 #include "sha256.h"
 #include "sha512.h"
+#include "pgp.h"
 
 #define MAX_DIGEST_SIZE SHA512_DIGEST_SIZE
 
+typedef struct {
+  struct md5_ctx md5;
+  struct sha1_ctx sha1;
+  struct sha256_ctx sha224;
+  struct sha256_ctx sha256;
+  struct sha512_ctx sha384;
+  struct sha512_ctx sha512;
+} digest_ctx_t;
+
 typedef struct url_data_s {
   url_t *url;
   char *file_name;
@@ -15,6 +25,7 @@ typedef struct url_data_s {
   unsigned err_buf_len;
   unsigned p_now, p_total;
   unsigned zp_now, zp_total;
+  long p_time;			// last progress update (ms), see url_progress_update()
   unsigned z_progress:1;
   unsigned flush:1;
   unsigned cramfs:1;
@@ -34,15 +45,12 @@ typedef struct url_data_s {
     unsigned char *data;
   } buf;
   int (*progress)(struct url_data_s *, int);
+  pgp_verify_t *pgp;		// signature check while downloading
+  int sig;			// signature check result (PGP_SIG_*)
+  int sig_hash;			// hash (PGP_HASH_*) to calculate for a detached signature; 0: none
   struct {
-    struct {
-      struct md5_ctx md5;
-      struct sha1_ctx sha1;
-      struct sha256_ctx sha224;
-      struct sha256_ctx sha256;
-      struct sha512_ctx sha384;
-      struct sha512_ctx sha512;
-    } ctx;
+    digest_ctx_t ctx;
+    digest_ctx_t sig_ctx;	// hash state before digest_finish() (for signature check)
     char md5[MD5_DIGEST_SIZE * 2 + 1];
     char sha1[SHA1_DIGEST_SIZE * 2 + 1];
     char sha224[SHA224_DIGEST_SIZE * 2 + 1];
@@ -64,6 +72,9 @@ void url_read(url_data_t *url_data);
 url_t *url_set(char *str);
 url_t *url_free(url_t *url);
 void url_cleanup(void);
+void url_close_connections(void);
+void url_prefetch(url_t *url, slist_t *files);
+void url_prefetch_clear(void);
 url_data_t *url_data_new(void);
 void url_data_free(url_data_t *url_data);
 void url_umount(url_t *url);
@@ -76,6 +87,8 @@ char *url_print(url_t *url, int format);
 char *url_print2(url_t *url, char *file);
 char *url_instsys_base(char *path);
 void url_build_instsys_list(char *instsys, int read_list);
+void url_digest_add(char *type, char *digest, char *file_name);
+void url_digest_clear(void);
 
 unsigned url_is_mountable(instmode_t scheme);
 unsigned url_is_network(instmode_t scheme);
@@ -1,9 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "utf8.h"
 
+/*
+ * Width of BMP chars, looked up per 256 char block: 0 = all narrow,
+ * 1 = all wide, else use bitmap map[n - 2].
+ */
+#define UTF8_WIDE_MAPS	16
+
+static struct {
+  unsigned init:1;
+  unsigned char block[0x100];
+  uint32_t map[UTF8_WIDE_MAPS][8];
+} utf8_wide;
+
+static int utf32_char_width_calc(int c);
+static void utf8_wide_init(void);
+static unsigned utf8_ascii_span(unsigned char *str) __attribute__ ((no_sanitize_address));
+
 /*
  * Return length of utf8 sequence or 0 if it's not the first byte of an
  * utf8 sequence.
@@ -119,6 +136,93 @@ int utf32_len(int *str)
  * Return char width (0, 1, or 2).
  */
 int utf32_char_width(int c)
+{
+  unsigned u;
+
+  if(c < 0x1100) return c ? 1 : 0;
+
+  if(c > 0xffff) return c >= 0x20000 && c <= 0x2ffff ? 2 : 1;
+
+  if(!utf8_wide.init) utf8_wide_init();
+
+  u = utf8_wide.block[c >> 8];
+
+  if(u < 2) return u + 1;
+
+  return (utf8_wide.map[u - 2][(c >> 5) & 7] >> (c & 31)) & 1 ? 2 : 1;
+}
+
+
+/*
+ * Return string width, taking line breaks into account.
+ */
+int utf8_strwidth(unsigned char *str)
+{
+  int c, len, i = 0, width = 0;
+  unsigned u;
+
+  for(;;) {
+    u = utf8_ascii_span(str);
+    str += u;
+    i += u;
+    if(i > width) width = i;
+
+    if(!*str) break;
+
+    if(*str == '\n') {
+      i = 0;
+      str++;
+      continue;
+    }
+
+    if(!(len = utf8_enc_len(*str)) || !(c = utf8_decode(str))) break;
+
+    str += len;
+    i += utf32_char_width(c);
+    if(i > width) width = i;
+  }
+
+  return width;
+}
+
+
+/*
+ * Copy as long as dst doesn't exceed width. '\0' is always added.
+ */
+void utf8_strwcpy(unsigned char *dst, unsigned char *src, int width)
+{
+  int w = 0, c, l = 0;
+  unsigned u;
+
+//  log_info("[wcpy %d: <%s>", width, src);
+
+  if(width < 0) width = 0;
+
+  for(;;) {
+    u = utf8_ascii_span(src + l);
+    if((int) u > width - w) u = width - w;
+    w += u;
+    l += u;
+
+    if(
+      !(c = utf8_decode(src + l)) ||
+      (w += utf32_char_width(c)) > width
+    ) break;
+
+    l += utf8_enc_len(src[l]);
+  }
+
+  memcpy(dst, src, l);
+  dst[l] = 0;
+
+//  log_info(" <%s>]\n", dst);
+}
+
+
+/*
+ * Width as defined by the range list; used to build the lookup table.
+ */
+int utf32_char_width_calc(int c)
 {
   if(c == 0) return 0;
 
@@ -143,55 +247,62 @@ int utf32_char_width(int c)
 }
 
 
-/*
- * Return string width, taking line breaks into account.
- */
-int utf8_strwidth(unsigned char *str)
+void utf8_wide_init()
 {
-  int i, width = 0;
-  int *buf, *p, buf_len;
-
-  buf_len = strlen(str) + 1;
-  buf = malloc(buf_len * sizeof *buf);
-
-  utf8_to_utf32(buf, buf_len, str);
+  unsigned b, u, wide, maps = 0;
+  uint32_t map[8];
+
+  for(b = 0; b < 0x100; b++) {
+    memset(map, 0, sizeof map);
+    for(wide = u = 0; u < 0x100; u++) {
+      if(utf32_char_width_calc((b << 8) + u) == 2) {
+        map[u >> 5] |= 1u << (u & 31);
+        wide++;
+      }
+    }
 
-  for(p = buf, i = 0; *p; p++) {
-    if(*p == '\n') {
-      i = 0;
+    if(!wide) {
+      utf8_wide.block[b] = 0;
     }
-    else {
-      i += utf32_char_width(*p);
-      if(i > width) width = i;
+    else if(wide == 0x100) {
+      utf8_wide.block[b] = 1;
+    }
+    else if(maps < UTF8_WIDE_MAPS) {
+      memcpy(utf8_wide.map[maps], map, sizeof map);
+      utf8_wide.block[b] = maps++ + 2;
     }
   }
 
-  free(buf);
-
-  return width;
+  utf8_wide.init = 1;
 }
 
 
 /*
- * Copy as long as dst doesn't exceed width. '\0' is always added.
+ * Number of leading printable ASCII chars (everything below 0x80 except
+ * '\0' and '\n').
+ *
+ * Checks a word at a time once str is aligned. Like strlen() this may read
+ * past the terminating '\0', but never beyond the aligned word holding it.
  */
-void utf8_strwcpy(unsigned char *dst, unsigned char *src, int width)
+unsigned utf8_ascii_span(unsigned char *str)
 {
-  int w = 0, c, l = 0;
+  unsigned char *s = str;
+  const uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+  uint64_t v, nl;
 
-//  log_info("[wcpy %d: <%s>", width, src);
+  while(((uintptr_t) s & 7)) {
+    if(!*s || *s == '\n' || *s >= 0x80) return s - str;
+    s++;
+  }
 
-  while(
-    (c = utf8_decode(src + l)) &&
-    (w += utf32_char_width(c)) <= width
-  ) {
-    l += utf8_enc_len(src[l]);
+  for(;; s += 8) {
+    memcpy(&v, s, sizeof v);
+    nl = v ^ (ones * '\n');
+    /* any byte >= 0x80, 0, or '\n' */
+    if(((v | ((v - ones) & ~v) | ((nl - ones) & ~nl)) & highs)) break;
   }
 
-  memcpy(dst, src, l);
-  dst[l] = 0;
+  while(*s && *s != '\n' && *s < 0x80) s++;
 
-//  log_info(" <%s>]\n", dst);
+  return s - str;
 }
-
-
@@ -25,6 +25,7 @@
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <sys/klog.h>
+#include <sys/reboot.h>
 #include <fcntl.h>
 #include <time.h>
 #include <syscall.h>
@@ -41,6 +42,8 @@
 #include <linux/major.h>
 #include <linux/raid/md_u.h>
 #include <execinfo.h>
+#include <spawn.h>
+#include <poll.h>
 
 #define CDROMEJECT	0x5309	/* Ejects the cdrom media */
 
@@ -65,6 +68,8 @@
 #include "utf8.h"
 #include "url.h"
 #include "linuxrc.h"
+#include "io.h"
+#include "console.h"
 
 extern char **environ;
 
@@ -91,10 +96,35 @@ static struct hlink_s {
 static char *exclude = NULL;
 static int rec_level = 0;
 static int extend_ready = 0;
+static unsigned long long kmsg_next_seq = 0;	/* next /dev/kmsg record to log */
+
+#define PROGRESS_FILE	"/run/linuxrc.progress"
+#define SPLASH_STEP	10	/* splash progress we may add while downloading (in %) */
+#define BOOT_PROBE_JOBS	8	/* partitions probed in parallel by util_boot_system() */
+#define PROGRESS_LOG	10	/* headless mode: log progress every 10 seconds */
+#define CACHE_MEM_SHARE	10	/* in-memory download cache: max. 1/10 of memory */
+
+static struct {
+  unsigned num;		/* last value set via util_splash_bar() */
+  unsigned shown;	/* currently shown value */
+  time_t time;		/* last update */
+} splash_state;
+
+/* one partition probed by util_boot_system() */
+typedef struct {
+  char *name;		/* partition */
+  char *dev;		/* long device name */
+  char *type;		/* fs type */
+  char *dir;		/* private mountpoint */
+  pid_t pid;		/* probing process */
+  int fd;		/* pipe from probing process */
+  membuf_t result;	/* output of boot_probe() */
+} boot_probe_t;
 
 static void add_flag(slist_t **sl, char *buf, int value, char *name);
 
 static int do_cp(char *src, char *dst);
+static void splash_set(unsigned num, char *trigger);
 static char *walk_hlink_list(ino_t ino, dev_t dev, char *dst);
 static void free_hlink_list(void);
 
@@ -117,7 +147,16 @@ static int util_extend(char *extension, char task, int verbose);
 
 static int cmp_alpha(slist_t *sl0, slist_t *sl1);
 static int cmp_alpha_s(const void *p0, const void *p1);
-static slist_t *get_kernel_list(char *dev);
+static slist_t *get_kernel_list(char *dev, char *dir);
+static void boot_probe_all(boot_probe_t *probes, unsigned count);
+static void boot_probe(boot_probe_t *probe, int fd);
+static int boot_mount(char *dev, char *dir, char *type);
+
+static int run_needs_shell(char *cmd);
+static int cache_setup(void);
+static int run_reap(run_t *run, int flags);
+static void run_read(run_t *run);
+static void run_done(run_t *run, int status);
 
 
 void util_redirect_kmsg()
@@ -379,65 +418,95 @@ int util_fileinfo(char *file_name, int *size, int *compressed)
 }
 
 
-void util_update_kernellog (void)
-    {
-    FILE  *outfile_pri;
-    FILE  *lastfile_pri;
-    FILE  *bootmsg_pri;
-    char   buffer_ti [1 << 19];
-    char   line_ti [MAX_X - 30];
-    int    i_ii = 1;
-    int    pos_ii;
-    int    size_ii;
-
-
-    outfile_pri = fopen (kernellog_tg, "a");
-    if (!outfile_pri)
-        return;
-
-    lastfile_pri = fopen (lastlog_tg, "w");
-    if (!lastfile_pri)
-        {
-        fclose (outfile_pri);
-        return;
-        }
+/*
+ * Append new kernel messages to the kernel log files.
+ *
+ * Reads /dev/kmsg incrementally: the device stays open between calls, so
+ * each call only sees records logged since the previous one. The kernel
+ * ring buffer itself is left alone.
+ *
+ * kernellog_tg and bootmsg_tg accumulate all messages, lastlog_tg holds only
+ * those added by the last call. bootmsg_tg also gets the record metadata
+ * (priority, timestamp, device properties).
+ *
+ * The next sequence number is passed on in 'kmsg_seq' when linuxrc restarts
+ * itself (see util_restart()), so records already logged are skipped.
+ */
+void util_update_kernellog(void)
+{
+  static int kmsg_fd = -1;
+  membuf_t log = {}, boot = {};
+  char buf[8192 + 1], *msg, *s, *t;
+  unsigned pri;
+  unsigned long long seq, usec;
+  ssize_t len;
+  int fd;
 
-    bootmsg_pri = fopen (bootmsg_tg, "a");
+  if(kmsg_fd == -1) {
+    kmsg_fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(kmsg_fd == -1) return;
+    if((s = getenv("kmsg_seq"))) {
+      kmsg_next_seq = strtoull(s, NULL, 10);
+      unsetenv("kmsg_seq");
+    }
+  }
 
-    size_ii = klogctl (3, buffer_ti, sizeof (buffer_ti));
+  for(;;) {
+    len = read(kmsg_fd, buf, sizeof buf - 1);
+    if(len < 0) {
+      /* records got overwritten before we could read them: just go on */
+      if(errno == EPIPE) continue;
+      if(errno == EINTR) continue;
+      break;
+    }
+    if(len == 0) break;
+    buf[len] = 0;
 
-    if (size_ii > 0 && bootmsg_pri)
-        fwrite (buffer_ti, 1, size_ii, bootmsg_pri);
+    /* record format: "pri,seq,usec,flags[,...];message\n[ KEY=value\n]..." */
+    if(
+      !(msg = strchr(buf, ';')) ||
+      sscanf(buf, "%u,%llu,%llu", &pri, &seq, &usec) != 3
+    ) continue;
+    msg++;
 
-    if (bootmsg_pri) fclose (bootmsg_pri);
+    if(seq < kmsg_next_seq) continue;
+    kmsg_next_seq = seq + 1;
 
-    for (pos_ii = 0; pos_ii < size_ii; pos_ii++)
-        {
-        line_ti [i_ii] = buffer_ti [pos_ii];
-        if (line_ti [i_ii] == '\n' || i_ii >= (int) sizeof (line_ti) - 2)
-            {
-            line_ti [i_ii + 1] = 0;
-            if (line_ti [1] == '<')
-                {
-                fputs (line_ti + 4, outfile_pri);
-                fputs (line_ti + 4, lastfile_pri);
-                }
-            else
-                {
-                fputs (line_ti + 1, outfile_pri);
-                fputs (line_ti + 1, lastfile_pri);
-                }
-            i_ii = 0;
-            }
+    /* message ends at first newline, the rest are ' KEY=value' lines */
+    if((s = strchr(msg, '\n'))) *s++ = 0;
 
-        ++i_ii;
-        }
+    membuf_printf(&boot, "<%u>[%5llu.%06llu] ", pri & 7, usec / 1000000, usec % 1000000);
 
-    klogctl (5, 0, 0);
+    /* non-printable chars are escaped as '\xNN' by the kernel; keep it that way */
+    membuf_add(&log, msg, strlen(msg));
+    membuf_add(&log, "\n", 1);
+    membuf_add(&boot, msg, strlen(msg));
+    membuf_add(&boot, "\n", 1);
 
-    fclose (outfile_pri);
-    fclose (lastfile_pri);
+    for(; s && *s == ' '; s = t) {
+      if((t = strchr(s, '\n'))) t++;
+      membuf_add(&boot, s, t ? t - s : strlen(s));
     }
+  }
+
+  if((fd = open(kernellog_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+    membuf_write(&log, fd);
+    close(fd);
+  }
+
+  if((fd = open(lastlog_tg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+    membuf_write(&log, fd);
+    close(fd);
+  }
+
+  if((fd = open(bootmsg_tg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) >= 0) {
+    membuf_write(&boot, fd);
+    close(fd);
+  }
+
+  membuf_free(&log);
+  membuf_free(&boot);
+}
 
 
 void util_print_banner (void)
@@ -594,6 +663,8 @@ void util_disp_init()
 {
   int i_ii;
 
+  if(config.headless) return;
+
   log_debug("win on\n");
 
   config.win = 1;
@@ -611,6 +682,8 @@ void util_disp_init()
 
 void util_disp_done()
 {
+  if(config.headless) return;
+
   log_debug("win off\n");
 
   if (config.linemode) {
@@ -667,6 +740,17 @@ int util_umount(char *dir)
 }
 
 
+/*
+ * Write out queued console output, then reboot (see reboot(2) for 'how').
+ */
+void util_reboot(int how)
+{
+  con_sync();
+
+  reboot(how);
+}
+
+
 void util_umount_all()
 {
   int i;
@@ -1641,13 +1725,24 @@ void util_get_splash_status()
  */
 void util_splash_bar(unsigned num, char *trigger)
 {
-  static unsigned old = 0;
-  char buf[256], buf2[256];
-
   if(!config.splash) return;
 
   if(num > 100) num = 100;
 
+  splash_state.num = num;
+
+  splash_set(num, trigger);
+}
+
+
+void splash_set(unsigned num, char *trigger)
+{
+  static unsigned old = 0;
+  char buf[256], buf2[256];
+
+  splash_state.shown = num;
+  splash_state.time = time(NULL);
+
   num = (num * 65535) / 100;
 
   if(num < old) old = num;
@@ -1662,6 +1757,57 @@ void util_splash_bar(unsigned num, char *trigger)
 }
 
 
+/*
+ * Publish download progress.
+ *
+ * Progress is written to PROGRESS_FILE and advances the splash bar (at most
+ * once a second). In headless mode a short status line is logged every
+ * PROGRESS_LOG seconds instead. label = NULL: done.
+ */
+void util_progress(char *label, uint64_t now, uint64_t total)
+{
+  static time_t log_time;
+  FILE *f;
+  unsigned percent, num;
+  time_t t;
+
+  if(!label) {
+    log_time = 0;
+    unlink(PROGRESS_FILE);
+    if(config.splash && splash_state.shown != splash_state.num) splash_set(splash_state.num, NULL);
+
+    return;
+  }
+
+  percent = total ? (100 * now) / total : 0;
+  if(percent > 100) percent = 100;
+
+  if((f = fopen(PROGRESS_FILE ".tmp", "w"))) {
+    fprintf(f, "%s\t%"PRIu64"\t%"PRIu64"\t%u\n", label, now, total, percent);
+    fclose(f);
+    rename(PROGRESS_FILE ".tmp", PROGRESS_FILE);
+  }
+
+  if(config.headless && (t = time(NULL)) >= log_time + PROGRESS_LOG) {
+    if(log_time) {
+      if(total) {
+        log_show("progress: %s %u%% (%"PRIu64"/%"PRIu64" kB)\n", label, percent, now >> 10, total >> 10);
+      }
+      else {
+        log_show("progress: %s %"PRIu64" kB\n", label, now >> 10);
+      }
+    }
+    log_time = t;
+  }
+
+  if(config.splash && total) {
+    num = splash_state.num + (SPLASH_STEP * percent) / 100;
+    if(num > 100) num = 100;
+    if(num != splash_state.shown && time(NULL) != splash_state.time) splash_set(num, NULL);
+  }
+}
+
+
 char *read_symlink(char *file)
 {
   static char buf[256];
@@ -1725,7 +1871,7 @@ int do_cp(char *src, char *dst)
   char src2[0x100];
   char dst2[0x100];
   char *s;
-  int i, j;
+  int i;
   int err = 0;
   unsigned char buf[0x1000];
   int fd1, fd2;
@@ -1798,19 +1944,12 @@ int do_cp(char *src, char *dst)
             close(fd1);
             break;
           }
-          do {
-            i = read(fd1, buf, sizeof buf);
-            j = 0;
-            if(i > 0) {
-              j = write(fd2, buf, i);
-            }
-          }
-          while(i > 0 && j > 0);
-          if(i < 0) {
+          i = io_copy(fd1, fd2, sbuf.st_size);
+          if(i == 1) {
             perror_info(src2);
             err = 7;
           }
-          if(j < 0) {
+          if(i == 2) {
             perror_info(dst2);
             err = 8;
           }
@@ -2547,6 +2686,69 @@ void strprintf(char **buf, char *format, ...)
 }
 
 
+/*
+ * Append len bytes to buffer.
+ */
+void membuf_add(membuf_t *buf, char *data, size_t len)
+{
+  if(buf->len + len + 1 > buf->size) {
+    buf->size = (buf->len + len + 1) * 2 + 1024;
+    buf->data = realloc(buf->data, buf->size);
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+
+  /* keep it 0-terminated, so text can be used as string */
+  buf->data[buf->len] = 0;
+}
+
+
+/*
+ * printf() to buffer.
+ */
+void membuf_printf(membuf_t *buf, char *format, ...)
+{
+  char *s = NULL;
+  va_list args;
+  int len;
+
+  va_start(args, format);
+  len = vasprintf(&s, format, args);
+  va_end(args);
+
+  if(len > 0) membuf_add(buf, s, len);
+
+  free(s);
+}
+
+
+/*
+ * Write buffer to fd, with as few write() calls as possible.
+ */
+int membuf_write(membuf_t *buf, int fd)
+{
+  size_t pos = 0;
+  ssize_t len;
+
+  while(pos < buf->len) {
+    len = write(fd, buf->data + pos, buf->len - pos);
+    if(len < 0 && errno == EINTR) continue;
+    if(len <= 0) return -1;
+    pos += len;
+  }
+
+  return 0;
+}
+
+
+void membuf_free(membuf_t *buf)
+{
+  free(buf->data);
+  memset(buf, 0, sizeof *buf);
+}
+
+
 int util_fstype_main(int argc, char **argv)
 {
   char *s, buf[64], *compr, *archive;
@@ -3216,7 +3418,7 @@ static int is_there(char *name);
 static int is_dir(char *name);
 static int is_link(char *name);
 static char *read_symlink(char *name);
-static int make_links(char *src, char *dst);
+static int make_links(char *src, char *dst, slist_t *skip);
 
 
 int util_lndir_main(int argc, char **argv)
@@ -3225,7 +3427,17 @@ int util_lndir_main(int argc, char **argv)
 
   if(argc != 2) return 1;
 
-  return make_links(argv[0], argv[1]);
+  return make_links(argv[0], argv[1], NULL);
+}
+
+
+/*
+ * Link directory tree src to dst (like 'lndir'), leaving out the top-level
+ * entries listed in skip.
+ */
+int util_lndir(char *src, char *dst, slist_t *skip)
+{
+  return make_links(src, dst, skip);
 }
 
 
@@ -3265,8 +3477,10 @@ int is_link(char *name)
 
 /*
  * Link directory tree src to dst. Keep existing files in dst.
+ *
+ * Entries in src listed in skip are ignored (not recursively).
  */
-int make_links(char *src, char *dst)
+int make_links(char *src, char *dst, slist_t *skip)
 {
   DIR *dir;
   struct dirent *de;
@@ -3281,6 +3495,7 @@ int make_links(char *src, char *dst)
   if((dir = opendir(src))) {
     while((de = readdir(dir))) {
       if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+      if(skip && slist_getentry(skip, de->d_name)) continue;
       sprintf(src2, "%s/%s", src, de->d_name);
       sprintf(dst2, "%s/%s", dst, de->d_name);
 
@@ -3346,7 +3561,7 @@ int make_links(char *src, char *dst)
               // sprintf(tmp_link, "%s/%s", dst2, s);
               s = tmp_link;
             }
-            if((err = make_links(s, tmp_dir))) continue;
+            if((err = make_links(s, tmp_dir, NULL))) continue;
             if(unlink(dst2)) {
               perror_info(dst2);
               err = 4;
@@ -3365,7 +3580,7 @@ int make_links(char *src, char *dst)
               lchown(dst2, sbuf.st_uid, sbuf.st_gid);
             }
           }
-          if((err = make_links(src2, dst2))) continue;
+          if((err = make_links(src2, dst2, NULL))) continue;
         }
         else if(!is_there(dst2)) {
           unlink(dst2);
@@ -3990,6 +4205,209 @@ void util_clear_downloads()
 }
 
 
+/*
+ * Download cache.
+ *
+ * Downloaded files are kept in config.download.cache, named after a hash of
+ * their digest (so only files with a known digest can be cached). Cached
+ * files are read-only copies of the downloaded files: a hard link would
+ * change with the download. They are checked against the digest again
+ * before they are used (see test_and_copy()).
+ *
+ * The least recently used entries are removed if memory (or, for a cache on
+ * disk, space) gets low. A cache in memory is also limited to
+ * 1/CACHE_MEM_SHARE of the total memory.
+ */
+
+/*
+ * Prepare download cache.
+ *
+ * If the cache is on a block device, mount it first.
+ *
+ * Return 1 if the cache can be used.
+ */
+int cache_setup()
+{
+  char *dev = NULL, *mp;
+
+  if(!config.download.cache) return 0;
+
+  if(config.download.cache_ready) return 1;
+
+  config.download.cache_ready = 1;
+
+  if(util_check_exist(config.download.cache) == 'b') {
+    str_copy(&dev, config.download.cache);
+    mp = new_mountpoint();
+    if(util_mount_rw(dev, mp, NULL)) {
+      log_info("cache: %s: mount failed\n", dev);
+      strprintf(&config.download.cache, "%s/cache", config.download.base);
+      config.download.cache_on_disk = 0;
+    }
+    else {
+      strprintf(&config.download.cache, "%s/linuxrc-cache", mp);
+    }
+    str_copy(&dev, NULL);
+  }
+
+  mkdir(config.download.cache, 0755);
+
+  log_info("download cache: %s\n", config.download.cache);
+
+  return 1;
+}
+
+
+/*
+ * Return cache file name for digest ('TYPE SUM').
+ */
+char *util_cache_name(char *digest)
+{
+  static char *buf = NULL;
+  struct sha256_ctx ctx;
+  unsigned char hash[SHA256_DIGEST_SIZE];
+  char hex[33];
+  int i;
+
+  sha256_init_ctx(&ctx);
+  sha256_process_bytes(digest, strlen(digest), &ctx);
+  sha256_finish_ctx(&ctx, hash);
+
+  for(i = 0; i < 16; i++) sprintf(hex + 2 * i, "%02x", hash[i]);
+
+  strprintf(&buf, "%s/%s", config.download.cache, hex);
+
+  return buf;
+}
+
+
+/*
+ * Look up file with digest ('TYPE SUM') in download cache.
+ *
+ * Return cache file name or NULL.
+ */
+char *util_cache_get(char *digest)
+{
+  char *name;
+
+  if(!cache_setup() || !digest) return NULL;
+
+  name = util_cache_name(digest);
+
+  if(util_check_exist(name) != 'r') return NULL;
+
+  /* mark as recently used */
+  utimensat(AT_FDCWD, name, NULL, 0);
+
+  log_debug("cache: %s = %s\n", digest, name);
+
+  return name;
+}
+
+
+/*
+ * Add 'file' to download cache; digest ('TYPE SUM') must have been verified.
+ */
+void util_cache_put(char *digest, char *file)
+{
+  char *name, *tmp = NULL;
+  int err;
+
+  if(!cache_setup() || !digest || !file) return;
+
+  name = util_cache_name(digest);
+  strprintf(&tmp, "%s.tmp", name);
+
+  err = util_copy_file("", file, tmp) || chmod(tmp, 0444);
+
+  if(err || rename(tmp, name)) {
+    log_debug("cache: %s: failed to add %s\n", digest, file);
+    unlink(tmp);
+  }
+  else {
+    log_debug("cache: %s -> %s\n", file, name);
+  }
+
+  str_copy(&tmp, NULL);
+
+  util_cache_trim();
+}
+
+
+/*
+ * Remove least recently used cache entries until there's enough space.
+ *
+ * For a cache in memory, keep what YaST needs and don't let the cache grow
+ * beyond 1/CACHE_MEM_SHARE of the memory; for a cache on disk keep 10% of
+ * the file system free.
+ */
+void util_cache_trim()
+{
+  struct {
+    char *name;
+    time_t mtime;
+    int64_t size;
+  } *entry = NULL, e;
+  struct dirent *de;
+  struct stat sbuf;
+  struct statfs fs;
+  char *buf = NULL;
+  unsigned u, v, entries = 0, removed = 0;
+  int64_t avail = 0, min_avail = 0, size = 0, max_size = 0;
+  DIR *dir;
+
+  if(!cache_setup() || !(dir = opendir(config.download.cache))) return;
+
+  while((de = readdir(dir))) {
+    if(*de->d_name == '.') continue;
+    strprintf(&buf, "%s/%s", config.download.cache, de->d_name);
+    if(stat(buf, &sbuf) || !S_ISREG(sbuf.st_mode)) continue;
+    entry = realloc(entry, (entries + 1) * sizeof *entry);
+    entry[entries].name = strdup(buf);
+    entry[entries].mtime = sbuf.st_mtime;
+    entry[entries].size = sbuf.st_size;
+    size += sbuf.st_size;
+    entries++;
+  }
+
+  closedir(dir);
+
+  /* oldest first */
+  for(u = 1; u < entries; u++) {
+    e = entry[u];
+    for(v = u; v > 0 && entry[v - 1].mtime > e.mtime; v--) entry[v] = entry[v - 1];
+    entry[v] = e;
+  }
+
+  if(config.download.cache_on_disk) {
+    if(!statfs(config.download.cache, &fs)) {
+      avail = (int64_t) fs.f_bavail * fs.f_bsize;
+      min_avail = (int64_t) fs.f_blocks * fs.f_bsize / 10;
+    }
+  }
+  else {
+    util_free_mem();
+    avail = config.memoryXXX.current - config.memoryXXX.free_swap;
+    min_avail = config.memoryXXX.min_yast;
+    max_size = config.memoryXXX.total / CACHE_MEM_SHARE;
+  }
+
+  for(u = 0; u < entries; u++) {
+    if((avail < min_avail || (max_size && size > max_size)) && !unlink(entry[u].name)) {
+      avail += entry[u].size;
+      size -= entry[u].size;
+      removed++;
+    }
+    free(entry[u].name);
+  }
+
+  if(removed) log_info("cache: %u entries removed\n", removed);
+
+  free(entry);
+  str_copy(&buf, NULL);
+}
+
+
 /*
  * Stop and allow to start a shell.
  *
@@ -4036,6 +4454,7 @@ void util_wait(const char *file, int line, const char *func)
           fflush(stdout);
         }
 
+        con_sync();
         system("PS1='\\w # ' /bin/bash 2>&1");
 
         kbd_init(0);
@@ -4799,11 +5218,20 @@ int util_choose_disk_device(char **dev, int type, char *list_title, char *input_
 
 void util_restart()
 {
+  char seq[32];
+
   if(config.restarting || config.restarted) return;
 
   config.restarting = 1;
   lxrc_end();
   setenv("restarted", "42", 1);
+
+  /* don't log kernel messages twice */
+  util_update_kernellog();
+  if(kmsg_next_seq) {
+    snprintf(seq, sizeof seq, "%llu", kmsg_next_seq);
+    setenv("kmsg_seq", seq, 1);
+  }
   execve(*config.argv, config.argv, environ);
 }
 
@@ -4903,9 +5331,9 @@ int cmp_alpha_s(const void *p0, const void *p1)
 
 
 /*
- * Scan parition mounted at /mnt for kernel & initrd.
+ * Scan parition dev mounted at dir for kernel & initrd.
  */
-slist_t *get_kernel_list(char *dev)
+slist_t *get_kernel_list(char *dev, char *dir)
 {
 #if defined(__s390__) || defined(__s390x__)
   char *kernel_pattern = "image-*";
@@ -4914,35 +5342,36 @@ slist_t *get_kernel_list(char *dev)
 #else
   char *kernel_pattern = "vmlinux-*";
 #endif
-  char *dirs[] = { "/mnt", "/mnt/boot", "/mnt/efi/boot", "/mnt/efi/SuSE" };
+  char *dirs[] = { "", "/boot", "/efi/boot", "/efi/SuSE" };
 
   int i;
   DIR *d;
   struct dirent *de;
-  char *buf = NULL;
+  char *buf = NULL, *path = NULL;
   slist_t *sl, *kernel_list = NULL;
 
   for(i = 0; i < sizeof dirs/sizeof *dirs; i++) {
     char link_name[2];
 
+    strprintf(&path, "%s%s", dir, dirs[i]);
+
     // skip boot -> . symlink and absolute symlinks
     if(
-      readlink(dirs[i], link_name, sizeof link_name) == 1 &&
+      readlink(path, link_name, sizeof link_name) == 1 &&
       (*link_name == '.' || *link_name == '/')
     ) continue;
 
-    if((d = opendir(dirs[i]))) {
+    if((d = opendir(path))) {
       while((de = readdir(d))) {
         if(!fnmatch(kernel_pattern, de->d_name, FNM_PATHNAME)) {
           char *t = strchr(de->d_name, '-');
           if(t) {
-            strprintf(&buf, "%s/initrd%s", dirs[i], t);
+            strprintf(&buf, "%s/initrd%s", path, t);
             log_info("%s matched, initrd? %s\n", de->d_name, buf);
             if(util_check_exist(buf) == 'r') {
-              char *t2 = dirs[i] + sizeof "/mnt" - 1;
               sl = slist_append(&kernel_list, slist_new());
-              strprintf(&sl->key, "%s:%s/%s", dev, t2, de->d_name);
-              strprintf(&sl->value, "%s:%s/initrd%s", dev, t2, t);
+              strprintf(&sl->key, "%s:%s/%s", dev, dirs[i], de->d_name);
+              strprintf(&sl->value, "%s:%s/initrd%s", dev, dirs[i], t);
               log_info("kernel: %s / %s\n", sl->key, sl->value);
             }
             str_copy(&buf, NULL);
@@ -4954,6 +5383,8 @@ slist_t *get_kernel_list(char *dev)
     }
   }
 
+  free(path);
+
   return kernel_list;
 }
 
@@ -4961,7 +5392,7 @@ slist_t *get_kernel_list(char *dev)
 /*
  * Boot installed system.
  *
- *   1. analyze disks: mount every partition and
+ *   1. analyze disks: mount every partition (read-only, several at a time) and
  *       - look for /etc/{os,SuSE}-release; every such partition is considered
  *         to be a root file system
  *       - look for <kernel>-XXX and matching initrd-XXX files; every such pair
@@ -4985,6 +5416,8 @@ void util_boot_system()
   char *kernel_options = NULL;
   int i, items;
   char **item_list;
+  boot_probe_t *probes, *probe;
+  unsigned u, count;
 
   strprintf(&buf, "Analysing disks...");
   log_info("%s\n", buf);
@@ -4999,47 +5432,75 @@ void util_boot_system()
 
   util_update_disk_list(NULL, 1);
 
-  for(sl = config.partitions; sl; sl = sl->next) {
-    char *type = util_fstype(long_dev(sl->key), NULL);
-    char *blk_id = blk_ident(long_dev(sl->key));
-    if(type && strcmp(type, "swap")) {
-      if(!util_mount_ro(long_dev(sl->key), "/mnt", NULL)) {
-        char *os_name = NULL;
+  for(count = 0, sl = config.partitions; sl; sl = sl->next) count++;
 
-        if(util_check_exist("/mnt/etc/os-release")) {
-          char *s = util_get_attr("/mnt/etc/os-release");
-          char *t = strstr(s, "PRETTY_NAME=\"");
-          if(t) {
-            t += sizeof "PRETTY_NAME=\"" - 1;
-            char *t2 = strchr(t, '"');
-            if(t2) {
-              *t2 = 0;
-              os_name = t;
-            }
-          }
-        }
-        else if(util_check_exist("/mnt/etc/SuSE-release")) {
-          char *s = util_get_attr("/mnt/etc/SuSE-release");
-          char *t = strchr(s, '\n');
-          if(t) *t = 0;
-          if(*s) os_name = s;
-        }
+  probes = calloc(count + 1, sizeof *probes);
 
-        strprintf(&buf, "%s (%s) -- %s", sl->key, blk_id, os_name ?: "");
-        log_info("%s\n", buf);
-        if(os_name) {
-          slist_t *sl2 = slist_append_str(&root_list, long_dev(sl->key));
-          str_copy(&sl2->value, buf);
-        }
-        str_copy(&buf, NULL);
+  for(count = 0, sl = config.partitions; sl; sl = sl->next) {
+    char *module = NULL;
+    char *type = util_fstype(long_dev(sl->key), &module);
 
-        slist_append(&kernel_list, get_kernel_list(sl->key));
+    if(!type || !strcmp(type, "swap")) continue;
+
+    // load fs modules here, not in the probing processes
+    if(module) mod_modprobe(module, NULL);
+
+    probe = probes + count;
+    str_copy(&probe->type, type);
+    str_copy(&probe->name, sl->key);
+    str_copy(&probe->dev, long_dev(sl->key));
+    strprintf(&probe->dir, "%sboot_%04u", config.mountpoint.base, count);
+    mkdir(probe->dir, 0755);
+    count++;
+  }
 
-        util_umount("/mnt");
+  boot_probe_all(probes, count);
+
+  // evaluate in partition order, regardless of which probe finished first
+  for(u = 0; u < count; u++) {
+    char *s, *t, *val, *blk_id = NULL, *os_name = NULL;
+
+    probe = probes + u;
+
+    for(s = probe->result.data; s && *s; s = t) {
+      if((t = strchr(s, '\n'))) *t++ = 0; else t = s + strlen(s);
+      if(!(val = strchr(s, '\t'))) continue;
+      *val++ = 0;
+      if(!strcmp(s, "id")) {
+        blk_id = val;
+      }
+      else if(!strcmp(s, "root")) {
+        os_name = val;
       }
+      else if(!strcmp(s, "kernel") && (s = strchr(val, '\t'))) {
+        *s++ = 0;
+        sl = slist_append_str(&kernel_list, val);
+        str_copy(&sl->value, s);
+      }
+    }
+
+    // not mounted
+    if(!blk_id) continue;
+
+    strprintf(&buf, "%s (%s) -- %s", probe->name, blk_id, os_name ?: "");
+    log_info("%s\n", buf);
+    if(os_name) {
+      slist_t *sl2 = slist_append_str(&root_list, probe->dev);
+      str_copy(&sl2->value, buf);
     }
+    str_copy(&buf, NULL);
   }
 
+  for(probe = probes; probe < probes + count; probe++) {
+    rmdir(probe->dir);
+    free(probe->name);
+    free(probe->dev);
+    free(probe->type);
+    free(probe->dir);
+    membuf_free(&probe->result);
+  }
+  free(probes);
+
   if(config.win) win_close(&win);
 
   if(!root_list || !kernel_list) {
@@ -5225,6 +5686,171 @@ void util_boot_system()
 }
 
 
+/*
+ * Run boot_probe() for all partitions, BOOT_PROBE_JOBS at a time.
+ *
+ * Every partition is probed in a separate process; the results are
+ * collected in probe->result.
+ */
+void boot_probe_all(boot_probe_t *probes, unsigned count)
+{
+  struct pollfd pfd[BOOT_PROBE_JOBS];
+  boot_probe_t *running[BOOT_PROBE_JOBS], *probe;
+  unsigned next = 0, n = 0, u;
+  char buf[1024];
+  int fds[2], len;
+
+  for(;;) {
+    while(n < BOOT_PROBE_JOBS && next < count) {
+      probe = probes + next++;
+
+      if(pipe2(fds, O_CLOEXEC)) {
+        perror_info("pipe");
+        continue;
+      }
+
+      if(!(probe->pid = fork())) {
+        close(fds[0]);
+        boot_probe(probe, fds[1]);
+        _exit(0);
+      }
+
+      close(fds[1]);
+
+      if(probe->pid < 0) {
+        perror_info("fork");
+        close(fds[0]);
+        continue;
+      }
+
+      probe->fd = fds[0];
+      running[n++] = probe;
+    }
+
+    if(!n) break;
+
+    for(u = 0; u < n; u++) {
+      pfd[u].fd = running[u]->fd;
+      pfd[u].events = POLLIN;
+      pfd[u].revents = 0;
+    }
+
+    if(poll(pfd, n, -1) < 0) {
+      if(errno == EINTR) continue;
+      perror_info("poll");
+      break;
+    }
+
+    // backwards, so finished entries can be replaced by the last one
+    for(u = n; u-- > 0;) {
+      if(!pfd[u].revents) continue;
+      probe = running[u];
+      len = read(probe->fd, buf, sizeof buf);
+      if(len > 0) {
+        membuf_add(&probe->result, buf, len);
+      }
+      else if(!(len < 0 && errno == EINTR)) {
+        close(probe->fd);
+        waitpid(probe->pid, NULL, 0);
+        running[u] = running[--n];
+      }
+    }
+  }
+}
+
+
+/*
+ * Probe partition; runs in its own process.
+ *
+ * If the partition can be mounted, write to fd:
+ *   id <tab> blk_ident() result
+ *   root <tab> os name (if it's a root file system)
+ *   kernel <tab> kernel <tab> initrd (for every kernel found)
+ */
+void boot_probe(boot_probe_t *probe, int fd)
+{
+  FILE *f;
+  char *buf = NULL, *os_name = NULL, *s, *t;
+  slist_t *sl, *kernel_list;
+
+  if(!(f = fdopen(fd, "w"))) return;
+
+  if(!boot_mount(probe->dev, probe->dir, probe->type)) {
+    fprintf(f, "id\t%s\n", blk_ident(probe->dev) ?: "");
+
+    strprintf(&buf, "%s/etc/os-release", probe->dir);
+    if(util_check_exist(buf)) {
+      s = util_get_attr(buf);
+      if((t = strstr(s, "PRETTY_NAME=\""))) {
+        t += sizeof "PRETTY_NAME=\"" - 1;
+        if((s = strchr(t, '"'))) {
+          *s = 0;
+          os_name = t;
+        }
+      }
+    }
+    else {
+      strprintf(&buf, "%s/etc/SuSE-release", probe->dir);
+      if(util_check_exist(buf)) {
+        s = util_get_attr(buf);
+        if((t = strchr(s, '\n'))) *t = 0;
+        if(*s) os_name = s;
+      }
+    }
+
+    if(os_name) {
+      for(s = os_name; *s; s++) if(*s == '\t') *s = ' ';
+      fprintf(f, "root\t%s\n", os_name);
+    }
+
+    kernel_list = get_kernel_list(probe->name, probe->dir);
+    for(sl = kernel_list; sl; sl = sl->next) {
+      fprintf(f, "kernel\t%s\t%s\n", sl->key, sl->value);
+    }
+    slist_free(kernel_list);
+
+    util_umount(probe->dir);
+  }
+
+  fclose(f);
+  free(buf);
+}
+
+
+/*
+ * Mount partition read-only for probing.
+ *
+ * Journals are not replayed if the file system supports it - we only look
+ * and don't want to spend time on (or risk) recovery.
+ */
+int boot_mount(char *dev, char *dir, char *type)
+{
+  static struct {
+    char *type;
+    char *options;
+  } no_replay[] = {
+    { "ext3",  "noload"             },
+    { "ext4",  "noload"             },
+    { "xfs",   "norecovery"         },
+    { "btrfs", "rescue=nologreplay" },
+    { "btrfs", "nologreplay"        },	/* older kernels */
+  };
+  unsigned u;
+
+  for(u = 0; u < sizeof no_replay / sizeof *no_replay; u++) {
+    if(
+      !strcmp(type, no_replay[u].type) &&
+      !mount(dev, dir, type, MS_MGC_VAL | MS_RDONLY, no_replay[u].options)
+    ) {
+      log_info("mount: %s: %s, %s\n", dev, type, no_replay[u].options);
+      return 0;
+    }
+  }
+
+  return util_mount_ro(dev, dir, NULL);
+}
+
+
 /*
  * Remember that device is a wlan interface.
  */
@@ -5270,7 +5896,7 @@ void util_log(unsigned level, char *format, ...)
   for(lf = config.log.dest; lf < config.log.dest + sizeof config.log.dest / sizeof *config.log.dest; lf++) {
     if((level & lf->level)) {
       if(!lf->f && lf->name) {
-        lf->f = fopen(lf->name, "a");
+        lf->f = con_fopen(lf->name);
       }
       if(lf->f) {
         if((lf->level & LOG_TIMESTAMP)) {
@@ -5303,48 +5929,331 @@ void util_log(unsigned level, char *format, ...)
 
 
 /*
- * Run command and redirect and log stderr to linuxrc log file.
+ * Run command and log its exit code and output.
  *
- * If log_stdout is != 0, redirect and log also stdout.
+ * stderr (and stdout if log_stdout is set) go to the log file.
+ *
+ * Return exit code.
  */
 int util_run(char *cmd, unsigned log_stdout)
 {
-  char buf[1024], *buf2 = NULL, *cmd2 = NULL;
-  int fd, i, err = -1;
+  run_t run = { .cmd = cmd, .log_stdout = log_stdout };
 
-  if(!cmd) return err;
+  if(!cmd) return -1;
 
-  fd = open("/tmp", O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+  util_run_start(&run);
 
-  if(fd == -1) {
-    perror_debug("failed to create tmp file");
+  return util_run_wait(&run, 1);
+}
 
-    return err;
+
+/*
+ * Like util_run() but with explicit argument list and optional timeout (in ms).
+ */
+int util_run_argv(char **argv, unsigned log_stdout, unsigned timeout)
+{
+  run_t run = { .argv = argv, .log_stdout = log_stdout, .timeout = timeout };
+
+  util_run_start(&run);
+
+  return util_run_wait(&run, 1);
+}
+
+
+/*
+ * Check if we need a shell to run cmd.
+ *
+ * That's the case if it contains anything besides plain words or starts
+ * with a variable assignment.
+ */
+int run_needs_shell(char *cmd)
+{
+  char *s;
+
+  if(strpbrk(cmd, "|&;<>()$`\\\"'*?[]#~{}!\n")) return 1;
+
+  s = cmd + strspn(cmd, " \t");
+  if(!*s) return 1;
+
+  s = strpbrk(s, " \t=");
+
+  return s && *s == '=';
+}
+
+
+/*
+ * Start external command.
+ *
+ * The command is run directly (no shell) unless run->shell is set or it
+ * uses shell syntax. If the program can't be started this way, /bin/sh is
+ * tried as a last resort (think of shell builtins).
+ *
+ * Output is captured through a pipe; use util_run_wait() to collect it.
+ * Several commands may be started before waiting for them.
+ *
+ * Return 0 if command is running.
+ */
+int util_run_start(run_t *run)
+{
+  static char *sh_argv[] = { "/bin/sh", "-c", NULL, NULL };
+  posix_spawn_file_actions_t actions;
+  char **argv;
+  slist_t *sl;
+  int i, err, fds[2];
+
+  run->pid = 0;
+  run->fd = run->pid_fd = -1;
+  run->status = -1;
+  run->status_unknown = 0;
+  run->args = NULL;
+  run->arg_list = NULL;
+  memset(&run->output, 0, sizeof run->output);
+  clock_gettime(CLOCK_MONOTONIC, &run->start);
+
+  if(!(argv = run->argv)) {
+    if(!run->cmd) return -1;
+    if(!run->shell && !run_needs_shell(run->cmd)) {
+      run->args = slist_split(' ', run->cmd);
+      for(i = 0, sl = run->args; sl; sl = sl->next) i++;
+      argv = run->arg_list = calloc(i + 1, sizeof *argv);
+      for(i = 0, sl = run->args; sl; sl = sl->next) argv[i++] = sl->key;
+    }
   }
 
-  strprintf(&cmd2, "%s 2>&%d%s", cmd, fd, log_stdout ? " >&2" : "");
+  if(pipe2(fds, O_CLOEXEC)) {
+    perror_debug("pipe");
+    return -1;
+  }
 
-  err = WEXITSTATUS(system(cmd2));
+  /* child writes to the console directly, so let our output go first */
+  if(!run->log_stdout) con_sync();
 
-  log_info_maybe(config.debug, "exec: %s = %d\n", cmd, err);
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+  if(run->log_stdout) posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
 
-  lseek(fd, 0, SEEK_SET);
+  err = argv ? posix_spawnp(&run->pid, argv[0], &actions, NULL, argv, environ) : ENOENT;
 
-  while((i = read(fd, buf, sizeof buf - 1)) > 0) {
-    buf[i] = 0;
-    strprintf(&buf2, "%s%s", buf2 ?: "", buf);
+  if(err == ENOENT && run->cmd) {
+    sh_argv[2] = run->cmd;
+    err = posix_spawn(&run->pid, sh_argv[0], &actions, NULL, sh_argv, environ);
   }
 
-  close(fd);
+  posix_spawn_file_actions_destroy(&actions);
+  close(fds[1]);
 
-  if(buf2) {
-    log_debug("%sstderr:\n%s", log_stdout ? "stdout + " : "", buf2);
+  if(err) {
+    errno = err;
+    perror_debug(run->cmd ?: run->argv[0]);
+    close(fds[0]);
+    run->pid = 0;
+    run_done(run, 127);
+
+    return -1;
   }
 
-  str_copy(&buf2, NULL);
-  str_copy(&cmd2, NULL);
+  run->fd = fds[0];
+  fcntl(run->fd, F_SETFL, O_NONBLOCK);
 
-  return err;
+#ifdef SYS_pidfd_open
+  run->pid_fd = syscall(SYS_pidfd_open, run->pid, 0);
+#endif
+
+  return 0;
+}
+
+
+/*
+ * Wait for commands started with util_run_start() to finish.
+ *
+ * Output of all commands is collected in parallel. Commands exceeding their
+ * timeout are killed.
+ *
+ * Return 0 if all commands succeeded, else exit code of first failed one.
+ * Commands with unknown exit code (see run_reap()) don't count as failed.
+ */
+int util_run_wait(run_t *runs, unsigned count)
+{
+  struct pollfd pfds[2 * count];
+  struct timespec now;
+  run_t *run;
+  unsigned u, n;
+  int i, wait_ms, elapsed;
+
+  for(;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    wait_ms = -1;
+
+    for(n = u = 0; u < count; u++) {
+      run = runs + u;
+      if(!run->pid) continue;
+
+      if(run_reap(run, WNOHANG)) continue;
+
+      if(run->timeout) {
+        elapsed = (now.tv_sec - run->start.tv_sec) * 1000 + (now.tv_nsec - run->start.tv_nsec) / 1000000;
+        if(elapsed >= (int) run->timeout) {
+          log_info("%s: timeout after %u ms\n", run->cmd ?: run->argv[0], run->timeout);
+          kill(run->pid, SIGKILL);
+          run_reap(run, 0);
+          continue;
+        }
+        if(wait_ms < 0 || (int) run->timeout - elapsed < wait_ms) wait_ms = run->timeout - elapsed;
+      }
+
+      /* no pidfd: we have to check for the process ourselves */
+      if(run->pid_fd == -1 && (wait_ms < 0 || wait_ms > 100)) wait_ms = 100;
+
+      if(run->fd != -1) {
+        pfds[n].fd = run->fd;
+        pfds[n++].events = POLLIN;
+      }
+      if(run->pid_fd != -1) {
+        pfds[n].fd = run->pid_fd;
+        pfds[n++].events = POLLIN;
+      }
+    }
+
+    for(u = 0; u < count; u++) if(runs[u].pid) break;
+    if(u == count) break;
+
+    if(poll(pfds, n, wait_ms) < 0 && errno != EINTR) break;
+
+    for(u = 0; u < count; u++) {
+      if(runs[u].fd != -1) run_read(runs + u);
+    }
+  }
+
+  for(i = u = 0; u < count; u++) {
+    if(runs[u].status && !i) i = runs[u].status;
+  }
+
+  return i;
+}
+
+
+/*
+ * Check if a command started with util_run_start() has finished; doesn't
+ * wait.
+ *
+ * Return 1 if it has (run->status is valid, unless run->status_unknown is set).
+ */
+int util_run_poll(run_t *run)
+{
+  if(!run->pid) return 1;
+
+  if(run->fd != -1) run_read(run);
+
+  return run_reap(run, WNOHANG);
+}
+
+
+/*
+ * Check if command has finished and clean up if so; flags are passed to
+ * waitpid().
+ *
+ * Note: there are still some waitpid(-1) loops around. If one of them has
+ * reaped our child, waitpid() fails with ECHILD and we would never see the
+ * command finish (the pidfd stays readable, so we'd even busy-loop). So the
+ * command is gone; as we can't know how it went, set run->status_unknown
+ * (and don't report a failure). Any other waitpid() error gives exit
+ * code -1.
+ *
+ * Return 1 if command has finished (run->status is valid).
+ */
+int run_reap(run_t *run, int flags)
+{
+  int status;
+  pid_t pid;
+
+  while((pid = waitpid(run->pid, &status, flags)) == -1 && errno == EINTR);
+
+  if(!pid) return 0;
+
+  if(pid == -1) {
+    log_info("%s: waitpid: %s\n", run->cmd ?: run->argv[0], strerror(errno));
+    run->pid = 0;
+    run->status_unknown = errno == ECHILD;
+    status = run->status_unknown ? 0 : -1;
+  }
+
+  run_done(run, status);
+
+  return 1;
+}
+
+
+/*
+ * Read available command output.
+ */
+void run_read(run_t *run)
+{
+  char buf[4096];
+  ssize_t len;
+
+  while((len = read(run->fd, buf, sizeof buf)) != 0) {
+    if(len < 0) {
+      if(errno == EINTR) continue;
+      if(errno == EAGAIN) return;
+      break;
+    }
+    membuf_add(&run->output, buf, len);
+  }
+
+  close(run->fd);
+  run->fd = -1;
+}
+
+
+/*
+ * Command has finished: collect remaining output, log result, and clean up.
+ *
+ * Note: if the command left some background process running that still
+ * holds the pipe, its further output is lost.
+ */
+void run_done(run_t *run, int status)
+{
+  char *cmd = run->cmd ?: run->argv[0];
+
+  if(run->pid) {
+    run->status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+  }
+  else {
+    run->status = status;
+  }
+  run->pid = 0;
+
+  if(run->fd != -1) {
+    run_read(run);
+    if(run->fd != -1) {
+      close(run->fd);
+      run->fd = -1;
+    }
+  }
+
+  if(run->pid_fd != -1) {
+    close(run->pid_fd);
+    run->pid_fd = -1;
+  }
+
+  if(run->status_unknown) {
+    log_info_maybe(config.debug, "exec: %s = unknown\n", cmd);
+  }
+  else {
+    log_info_maybe(config.debug, "exec: %s = %d\n", cmd, run->status);
+  }
+
+  if(run->output.len) {
+    log_debug("%sstderr:\n%s", run->log_stdout ? "stdout + " : "", run->output.data);
+  }
+
+  membuf_free(&run->output);
+
+  slist_free(run->args);
+  run->args = NULL;
+  free(run->arg_list);
+  run->arg_list = NULL;
 }
 
 
@@ -5440,11 +6349,12 @@ void util_run_debugshell()
 
   char *cmd = NULL;
   strprintf(&cmd, "exec %s 2>&1", config.debugshell ?: "/bin/sh");
+  con_sync();
   system(cmd);
   free(cmd);
 
   freopen(config.console, "r", stdin);
-  freopen(config.console, "a", stdout);
+  con_reopen(config.console);
   freopen(config.console, "a", stderr);
 
   kbd_init(0);
@@ -26,6 +26,7 @@ extern void util_disp_init         (void);
 extern void util_disp_done         (void);
 extern int  util_umount            (char *mountpoint);
 void util_umount_all(void);
+void util_reboot(int how);
 extern int  util_eject_cdrom       (char *dev);
 int util_chk_driver_update(char *dir, char *loc);
 extern void util_do_driver_updates (void);
@@ -33,6 +34,7 @@ extern int show_driver_updates(void);
 extern void util_status_info       (int log_it);
 extern void util_get_splash_status (void);
 void   util_splash_bar(unsigned num, char *trigger);
+void util_progress(char *label, uint64_t now, uint64_t total);
 extern int  util_cp_main           (int argc, char **argv);
 extern int  util_do_cp             (char *src, char *dst);
 extern int  util_swapon_main       (int argc, char **argv);
@@ -66,6 +68,11 @@ char *inet2print(inet_t *inet);
 void str_copy(char **dst, const char *src);
 void strprintf(char **buf, char *format, ...) __attribute__ ((format (printf, 2, 3)));
 
+void membuf_add(membuf_t *buf, char *data, size_t len);
+void membuf_printf(membuf_t *buf, char *format, ...) __attribute__ ((format (printf, 2, 3)));
+int membuf_write(membuf_t *buf, int fd);
+void membuf_free(membuf_t *buf);
+
 void util_free_mem(void);
 void util_update_meminfo(void);
 
@@ -91,6 +98,7 @@ char *long_dev(char *dev);
 void util_mkdevs(void);
 
 int util_lndir_main(int argc, char **argv);
+int util_lndir(char *src, char *dst, slist_t *skip);
 
 void util_notty(void);
 void util_killall(char *name, int sig);
@@ -122,6 +130,10 @@ char *new_mountpoint(void);
 int util_copy_file(char *src_dir, char *src_file, char *dst);
 char *new_download(void);
 void util_clear_downloads(void);
+char *util_cache_name(char *digest);
+char *util_cache_get(char *digest);
+void util_cache_put(char *digest, char *file);
+void util_cache_trim(void);
 void util_wait(const char *file, int line, const char *func);
 void run_braille(void);
 void util_setup_udevrules(void);
@@ -153,6 +165,10 @@ int util_is_wlan(char *device);
 
 void util_log(unsigned level, char *format, ...);
 int util_run(char *cmd, unsigned log_stdout);
+int util_run_argv(char **argv, unsigned log_stdout, unsigned timeout);
+int util_run_start(run_t *run);
+int util_run_wait(run_t *runs, unsigned count);
+int util_run_poll(run_t *run);
 void util_perror(unsigned level, char *msg);
 char *util_get_caller(int skip);
 void util_set_hostname(char *hostname);